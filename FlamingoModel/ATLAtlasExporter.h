@@ -0,0 +1,41 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLAtlasExporter.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import "ATLImportMetrics.h"
+
+/**
+ ATLAtlasExporter writes the atlas as one XML document in the format read by ATLFileImporter.
+ Entries are fetched in batches and streamed to the output one at a time, unchanged entries are turned
+ back into faults after they have been written, so memory does not grow with the size of the atlas.
+ */
+@interface ATLAtlasExporter : NSObject
+
+- (BOOL)exportContentsOfManagedObjectContext:(NSManagedObjectContext *)managedObjectContext
+                                       toURL:(NSURL *)url
+                                       error:(NSError **)error;
+
+/**
+ Throughput measurements of the export, rows are counted as entries.
+ */
+@property (nonatomic, strong) ATLImportMetrics *metrics;
+
+@end
@@ -0,0 +1,94 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLAtlasExporter.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLAtlasExporter.h"
+#import "ATLXMLWriter.h"
+
+#import "ATLOrganization.h"
+#import "ATLStation.h"
+#import "ATLJunction.h"
+#import "ATLRoute.h"
+#import "ATLSeries.h"
+#import "ATLService.h"
+
+#import "NSManagedObjectContext+FFEUtilities.h"
+
+#define EXPORT_BATCH_SIZE 100
+
+@implementation ATLAtlasExporter
+
+- (BOOL)exportContentsOfManagedObjectContext:(NSManagedObjectContext *)managedObjectContext
+                                       toURL:(NSURL *)url
+                                       error:(NSError **)error
+{
+    ATLXMLWriter *writer = [[ATLXMLWriter alloc] initWithURL:url];
+    [self.metrics beginStep:[url lastPathComponent] managedObjectContext:managedObjectContext];
+    [writer writeCString:"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<atlas>\n"];
+
+    // Referenced entries come first, so that the file can be imported in a single pass
+    NSArray *classes = @[[ATLOrganization class], [ATLStation class], [ATLJunction class],
+                         [ATLRoute class], [ATLSeries class], [ATLService class]];
+    NSUInteger nrOfEntries = 0;
+    for (Class entryClass in classes) {
+        NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:NSStringFromClass(entryClass)];
+        request.includesSubentities = NO;
+        request.fetchBatchSize = EXPORT_BATCH_SIZE;
+        request.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"id_" ascending:YES]];
+        NSError *fetchError = nil;
+        NSArray *entries = [managedObjectContext fetchObjectsWithRequest:request error:&fetchError];
+        if (!entries) {
+            NSLog(@"Export of %@ failed: %@", NSStringFromClass(entryClass), fetchError);
+            if (error) {
+                *error = fetchError;
+            }
+            [writer close];
+            [self.metrics endStep];
+            return NO;
+        }
+        for (ATLEntry *entry in entries) {
+            @autoreleasepool {
+                [entry writeXMLWithWriter:writer];
+                if (!entry.hasChanges) {
+                    [managedObjectContext refreshObject:entry mergeChanges:NO];
+                }
+            }
+            [self.metrics updateRows:++nrOfEntries bytes:writer.totalBytesWritten];
+        }
+    }
+
+    [writer writeCString:"</atlas>\n"];
+    BOOL success = [writer close];
+    if (!success && error) {
+        *error = writer.error;
+    }
+    [self.metrics updateRows:nrOfEntries bytes:writer.totalBytesWritten];
+    [self.metrics endStep];
+    return success;
+}
+
+- (ATLImportMetrics *)metrics
+{
+    if (!_metrics) {
+        _metrics = [ATLImportMetrics new];
+    }
+    return _metrics;
+}
+
+@end
@@ -0,0 +1,144 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLAtlasSnapshot.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+extern NSString * const ATLAtlasSnapshotErrorDomain;
+
+typedef NS_ENUM(NSInteger, ATLAtlasSnapshotError) {
+    invalidSnapshotError = 1,
+    incompatibleSnapshotError
+};
+
+typedef NS_ENUM(uint32_t, ATLSnapshotLocationKind) {
+    snapshotStation,
+    snapshotJunction,
+    snapshotOtherLocation
+};
+
+/**
+ A string inside the string heap of the snapshot, not zero terminated.
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} ATLSnapshotString;
+
+typedef struct {
+    ATLSnapshotString identifier;
+    ATLSnapshotString name;
+    double latitude, longitude;
+    ATLSnapshotLocationKind kind;
+    int32_t importance;
+} ATLSnapshotLocation;
+
+typedef struct {
+    ATLSnapshotString identifier;
+    ATLSnapshotString name;
+    uint32_t firstNode, nrOfNodes;
+    uint32_t firstPosition, nrOfPositions;
+} ATLSnapshotRoute;
+
+typedef struct {
+    double latitude, longitude;
+    float km_a, km_b;
+    int32_t radius;
+    uint32_t reserved;
+} ATLSnapshotNode;
+
+typedef struct {
+    double latitude, longitude;
+    float km;
+    uint32_t location;          // index of the location
+} ATLSnapshotPosition;
+
+typedef struct {
+    ATLSnapshotString identifier;
+    ATLSnapshotString shortName;
+    ATLSnapshotString longName;
+    uint32_t firstServicePoint, nrOfServicePoints;
+} ATLSnapshotService;
+
+typedef struct {
+    float km;
+    uint32_t location;          // index of the location
+    int16_t upArrival, upDeparture, downArrival, downDeparture;
+    ATLSnapshotString upPlatform, downPlatform;
+    int16_t options;
+    int16_t reserved[3];
+} ATLSnapshotServicePoint;
+
+/**
+ ATLAtlasSnapshot is a read only binary image of the infrastructure and services of the atlas.
+ Locations, routes and services are stored as packed arrays sorted by identifier, with their heartline nodes,
+ route positions and service points in contiguous ranges and all strings in one heap.
+ The snapshot is memory mapped, so that geometry and timetable queries can start without faulting in managed objects.
+ ATLDataController writes it next to its store after every save that changes the atlas and builds its station index
+ from it while the context has no unsaved changes. Heartlines are still read from ATLRoute, as they are edited in place.
+ Every range, string and index is checked when the file is opened.
+ */
+@interface ATLAtlasSnapshot : NSObject
+
++ (BOOL)writeSnapshotOfManagedObjectContext:(NSManagedObjectContext *)managedObjectContext
+                                      toURL:(NSURL *)url
+                                      error:(NSError **)error;
+
++ (instancetype)snapshotWithContentsOfURL:(NSURL *)url error:(NSError **)error;
+
+@property (nonatomic, readonly) NSUInteger nrOfLocations, nrOfRoutes, nrOfServices;
+@property (nonatomic, readonly) const ATLSnapshotLocation *locations;
+@property (nonatomic, readonly) const ATLSnapshotRoute *routes;
+@property (nonatomic, readonly) const ATLSnapshotService *services;
+
+- (NSString *)stringForReference:(ATLSnapshotString)reference;
+
+#pragma mark - Finding entries
+
+/**
+ Binary searches on identifier, returning NSNotFound for unknown identifiers.
+ */
+- (NSUInteger)indexOfLocationWithID:(NSString *)identifier;
+- (NSUInteger)indexOfRouteWithID:(NSString *)identifier;
+- (NSUInteger)indexOfServiceWithID:(NSString *)identifier;
+
+#pragma mark - Geometry
+
+- (const ATLSnapshotNode *)nodesOfRoute:(NSUInteger)route count:(NSUInteger *)count;
+
+/**
+ The positions of locations on a route, sorted by km.
+ */
+- (const ATLSnapshotPosition *)positionsOfRoute:(NSUInteger)route count:(NSUInteger *)count;
+- (double)kmOfLocation:(NSUInteger)location onRoute:(NSUInteger)route;
+
+/**
+ The heartline as ATLNode objects, for the geometry of ATLRoute.
+ */
+- (NSArray *)heartLineOfRoute:(NSUInteger)route;
+
+#pragma mark - Timetable
+
+/**
+ The service points of a service in their arranged order.
+ */
+- (const ATLSnapshotServicePoint *)servicePointsOfService:(NSUInteger)service count:(NSUInteger *)count;
+
+@end
@@ -0,0 +1,450 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLAtlasSnapshot.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLAtlasSnapshot.h"
+#import "ATLError.h"
+
+#import "ATLLocation.h"
+#import "ATLStation.h"
+#import "ATLJunction.h"
+#import "ATLRoute.h"
+#import "ATLRoutePosition.h"
+#import "ATLNode.h"
+#import "ATLService.h"
+#import "ATLServicePoint.h"
+
+#import "NSManagedObjectContext+FFEUtilities.h"
+
+#define SNAPSHOT_MAGIC      "ATLS"
+#define SNAPSHOT_VERSION    1
+
+NSString * const ATLAtlasSnapshotErrorDomain = @"nl.firstflamingo.atlassnapshot";
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t nrOfLocations, nrOfRoutes, nrOfNodes, nrOfPositions, nrOfServices, nrOfServicePoints;
+    uint32_t heapLength;
+    uint32_t reserved;
+} ATLSnapshotHeader;
+
+// Every section starts 8 byte aligned, because all records are a multiple of 8 bytes
+_Static_assert(sizeof(ATLSnapshotHeader) % 8 == 0, "snapshot header must be 8 byte aligned");
+_Static_assert(sizeof(ATLSnapshotLocation) % 8 == 0, "snapshot locations must be 8 byte aligned");
+_Static_assert(sizeof(ATLSnapshotRoute) % 8 == 0, "snapshot routes must be 8 byte aligned");
+_Static_assert(sizeof(ATLSnapshotNode) % 8 == 0, "snapshot nodes must be 8 byte aligned");
+_Static_assert(sizeof(ATLSnapshotPosition) % 8 == 0, "snapshot positions must be 8 byte aligned");
+_Static_assert(sizeof(ATLSnapshotService) % 8 == 0, "snapshot services must be 8 byte aligned");
+_Static_assert(sizeof(ATLSnapshotServicePoint) % 8 == 0, "snapshot service points must be 8 byte aligned");
+
+static int compareBytes(const char *bytes1, NSUInteger length1, const char *bytes2, NSUInteger length2)
+{
+    int result = memcmp(bytes1, bytes2, MIN(length1, length2));
+    if (result == 0 && length1 != length2) {
+        result = length1 < length2 ? -1 : 1;
+    }
+    return result;
+}
+
+static BOOL isValidString(ATLSnapshotString reference, uint32_t heapLength)
+{
+    return (uint64_t)reference.offset + reference.length <= heapLength;
+}
+
+static NSArray *entriesSortedByID(NSArray *entries)
+{
+    NSPredicate *hasID = [NSPredicate predicateWithFormat:@"id_ != nil"];
+    return [[entries filteredArrayUsingPredicate:hasID] sortedArrayUsingComparator:^NSComparisonResult(ATLEntry *entry1, ATLEntry *entry2) {
+        int comparison = strcmp([entry1.id_ UTF8String], [entry2.id_ UTF8String]);
+        return comparison < 0 ? NSOrderedAscending : (comparison > 0 ? NSOrderedDescending : NSOrderedSame);
+    }];
+}
+
+#pragma mark - Building the string heap
+
+@interface ATLSnapshotHeap : NSObject
+
+@property (nonatomic, readonly) NSMutableData *data;
+- (ATLSnapshotString)referenceForString:(NSString *)string;
+
+@end
+
+@implementation ATLSnapshotHeap {
+    NSMutableDictionary *_references;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _data = [NSMutableData dataWithCapacity:1 << 20];
+        _references = [NSMutableDictionary dictionaryWithCapacity:10000];
+    }
+    return self;
+}
+
+- (ATLSnapshotString)referenceForString:(NSString *)string
+{
+    ATLSnapshotString reference = {0, 0};
+    if ([string length] == 0) {
+        return reference;
+    }
+    // Identical strings, like platform numbers, are stored once
+    NSValue *stored = _references[string];
+    if (stored) {
+        [stored getValue:&reference];
+        return reference;
+    }
+    NSData *bytes = [string dataUsingEncoding:NSUTF8StringEncoding];
+    reference.offset = (uint32_t)[_data length];
+    reference.length = (uint32_t)[bytes length];
+    [_data appendData:bytes];
+    _references[string] = [NSValue valueWithBytes:&reference objCType:@encode(ATLSnapshotString)];
+    return reference;
+}
+
+@end
+
+@implementation ATLAtlasSnapshot {
+    NSData *_data;
+    const ATLSnapshotHeader *_header;
+    const ATLSnapshotNode *_nodes;
+    const ATLSnapshotPosition *_positions;
+    const ATLSnapshotServicePoint *_servicePoints;
+    const char *_heap;
+}
+
+#pragma mark - Writing a snapshot
+
++ (BOOL)writeSnapshotOfManagedObjectContext:(NSManagedObjectContext *)managedObjectContext
+                                      toURL:(NSURL *)url
+                                      error:(NSError **)error
+{
+    ATLSnapshotHeap *heap = [ATLSnapshotHeap new];
+    ATLSnapshotHeader header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION};
+
+    // Locations
+    NSArray *locations = entriesSortedByID([managedObjectContext allObjectsOfClass:[ATLLocation class]]);
+    NSMutableDictionary *locationIndexes = [NSMutableDictionary dictionaryWithCapacity:[locations count]];
+    NSMutableData *locationData = [NSMutableData dataWithCapacity:[locations count] * sizeof(ATLSnapshotLocation)];
+    for (ATLLocation *location in locations) {
+        ATLSnapshotLocation record = {{0, 0}};
+        record.identifier = [heap referenceForString:location.id_];
+        CLLocationCoordinate2D coordinate = location.averagedCoordinate;
+        record.latitude = coordinate.latitude;
+        record.longitude = coordinate.longitude;
+        if ([location isKindOfClass:[ATLStation class]]) {
+            ATLStation *station = (ATLStation *)location;
+            record.kind = snapshotStation;
+            record.name = [heap referenceForString:station.name];
+            record.importance = station.importance;
+        } else if ([location isKindOfClass:[ATLJunction class]]) {
+            record.kind = snapshotJunction;
+        } else {
+            record.kind = snapshotOtherLocation;
+        }
+        locationIndexes[location.id_] = @([locationIndexes count]);
+        [locationData appendBytes:&record length:sizeof(record)];
+    }
+    header.nrOfLocations = (uint32_t)[locations count];
+
+    // Routes with their heartlines and positions
+    NSArray *routes = entriesSortedByID([managedObjectContext allObjectsOfClass:[ATLRoute class]]);
+    NSMutableData *routeData = [NSMutableData dataWithCapacity:[routes count] * sizeof(ATLSnapshotRoute)];
+    NSMutableData *nodeData = [NSMutableData dataWithCapacity:[routes count] * 50 * sizeof(ATLSnapshotNode)];
+    NSMutableData *positionData = [NSMutableData dataWithCapacity:[routes count] * 20 * sizeof(ATLSnapshotPosition)];
+    for (ATLRoute *route in routes) {
+        ATLSnapshotRoute record = {{0, 0}};
+        record.identifier = [heap referenceForString:route.id_];
+        record.name = [heap referenceForString:route.name];
+        record.firstNode = header.nrOfNodes;
+        for (ATLNode *node in route.heartLine) {
+            ATLSnapshotNode nodeRecord = {node.coordinate.latitude, node.coordinate.longitude, node.km_a, node.km_b, node.radius, 0};
+            [nodeData appendBytes:&nodeRecord length:sizeof(nodeRecord)];
+            header.nrOfNodes++;
+        }
+        record.nrOfNodes = header.nrOfNodes - record.firstNode;
+
+        record.firstPosition = header.nrOfPositions;
+        NSArray *positions = [route.positions sortedArrayUsingComparator:^NSComparisonResult(ATLRoutePosition *position1, ATLRoutePosition *position2) {
+            float km1 = position1.km, km2 = position2.km;
+            return km1 < km2 ? NSOrderedAscending : (km1 > km2 ? NSOrderedDescending : NSOrderedSame);
+        }];
+        for (ATLRoutePosition *position in positions) {
+            NSNumber *locationIndex = position.location.id_ ? locationIndexes[position.location.id_] : nil;
+            if (locationIndex) {
+                ATLSnapshotPosition positionRecord = {position.latitude, position.longitude, position.km, [locationIndex unsignedIntValue]};
+                [positionData appendBytes:&positionRecord length:sizeof(positionRecord)];
+                header.nrOfPositions++;
+            }
+        }
+        record.nrOfPositions = header.nrOfPositions - record.firstPosition;
+        [routeData appendBytes:&record length:sizeof(record)];
+    }
+    header.nrOfRoutes = (uint32_t)[routes count];
+
+    // Services with their service points
+    NSArray *services = entriesSortedByID([managedObjectContext allObjectsOfClass:[ATLService class]]);
+    NSMutableData *serviceData = [NSMutableData dataWithCapacity:[services count] * sizeof(ATLSnapshotService)];
+    NSMutableData *servicePointData = [NSMutableData dataWithCapacity:[services count] * 20 * sizeof(ATLSnapshotServicePoint)];
+    for (ATLService *service in services) {
+        ATLSnapshotService record = {{0, 0}};
+        record.identifier = [heap referenceForString:service.id_];
+        record.shortName = [heap referenceForString:service.shortName];
+        record.longName = [heap referenceForString:service.longName];
+        record.firstServicePoint = header.nrOfServicePoints;
+        for (ATLServicePoint *servicePoint in service.arrangedServicePoints) {
+            NSNumber *locationIndex = servicePoint.location.id_ ? locationIndexes[servicePoint.location.id_] : nil;
+            if (!locationIndex) {
+                continue;
+            }
+            ATLSnapshotServicePoint pointRecord = {0};
+            pointRecord.km = servicePoint.km;
+            pointRecord.location = [locationIndex unsignedIntValue];
+            pointRecord.upArrival = servicePoint.upArrival;
+            pointRecord.upDeparture = servicePoint.upDeparture;
+            pointRecord.downArrival = servicePoint.downArrival;
+            pointRecord.downDeparture = servicePoint.downDeparture;
+            pointRecord.upPlatform = [heap referenceForString:servicePoint.upPlatform];
+            pointRecord.downPlatform = [heap referenceForString:servicePoint.downPlatform];
+            pointRecord.options = servicePoint.options;
+            [servicePointData appendBytes:&pointRecord length:sizeof(pointRecord)];
+            header.nrOfServicePoints++;
+        }
+        record.nrOfServicePoints = header.nrOfServicePoints - record.firstServicePoint;
+        [serviceData appendBytes:&record length:sizeof(record)];
+    }
+    header.nrOfServices = (uint32_t)[services count];
+    header.heapLength = (uint32_t)[heap.data length];
+
+    NSMutableData *output = [NSMutableData dataWithBytes:&header length:sizeof(header)];
+    for (NSData *section in @[locationData, routeData, nodeData, positionData, serviceData, servicePointData, heap.data]) {
+        [output appendData:section];
+    }
+    return [output writeToURL:url options:NSDataWritingAtomic error:error];
+}
+
+#pragma mark - Reading a snapshot
+
++ (instancetype)snapshotWithContentsOfURL:(NSURL *)url error:(NSError **)error
+{
+    NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedAlways error:error];
+    if (!data) {
+        return nil;
+    }
+    if ([data length] < sizeof(ATLSnapshotHeader)) {
+        failWithError(error, ATLAtlasSnapshotErrorDomain, invalidSnapshotError, @"File is too small to be an atlas snapshot");
+        return nil;
+    }
+    const ATLSnapshotHeader *header = [data bytes];
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, 4) != 0) {
+        failWithError(error, ATLAtlasSnapshotErrorDomain, invalidSnapshotError, @"File is not an atlas snapshot");
+        return nil;
+    }
+    if (header->version != SNAPSHOT_VERSION) {
+        failWithError(error, ATLAtlasSnapshotErrorDomain, incompatibleSnapshotError, @"Atlas snapshot has an unsupported version");
+        return nil;
+    }
+    uint64_t expectedLength = sizeof(ATLSnapshotHeader) +
+        (uint64_t)header->nrOfLocations * sizeof(ATLSnapshotLocation) +
+        (uint64_t)header->nrOfRoutes * sizeof(ATLSnapshotRoute) +
+        (uint64_t)header->nrOfNodes * sizeof(ATLSnapshotNode) +
+        (uint64_t)header->nrOfPositions * sizeof(ATLSnapshotPosition) +
+        (uint64_t)header->nrOfServices * sizeof(ATLSnapshotService) +
+        (uint64_t)header->nrOfServicePoints * sizeof(ATLSnapshotServicePoint) +
+        header->heapLength;
+    if ([data length] < expectedLength) {
+        failWithError(error, ATLAtlasSnapshotErrorDomain, invalidSnapshotError, @"Atlas snapshot is truncated");
+        return nil;
+    }
+
+    ATLAtlasSnapshot *snapshot = [[self alloc] init];
+    snapshot->_data = data;
+    snapshot->_header = header;
+    snapshot->_locations = (const ATLSnapshotLocation *)(header + 1);
+    snapshot->_routes = (const ATLSnapshotRoute *)(snapshot->_locations + header->nrOfLocations);
+    snapshot->_nodes = (const ATLSnapshotNode *)(snapshot->_routes + header->nrOfRoutes);
+    snapshot->_positions = (const ATLSnapshotPosition *)(snapshot->_nodes + header->nrOfNodes);
+    snapshot->_services = (const ATLSnapshotService *)(snapshot->_positions + header->nrOfPositions);
+    snapshot->_servicePoints = (const ATLSnapshotServicePoint *)(snapshot->_services + header->nrOfServices);
+    snapshot->_heap = (const char *)(snapshot->_servicePoints + header->nrOfServicePoints);
+    if (![snapshot hasValidRanges]) {
+        failWithError(error, ATLAtlasSnapshotErrorDomain, invalidSnapshotError, @"Atlas snapshot contains invalid ranges");
+        return nil;
+    }
+    return snapshot;
+}
+
+/**
+ Checks every range, string reference and location index, so that lookups never read outside the mapped file.
+ */
+- (BOOL)hasValidRanges
+{
+    uint32_t heapLength = _header->heapLength;
+    for (NSUInteger i = 0; i < _header->nrOfLocations; i++) {
+        if (!isValidString(_locations[i].identifier, heapLength) || !isValidString(_locations[i].name, heapLength) ||
+            _locations[i].kind > snapshotOtherLocation) {
+            return NO;
+        }
+    }
+    for (NSUInteger i = 0; i < _header->nrOfRoutes; i++) {
+        if (!isValidString(_routes[i].identifier, heapLength) || !isValidString(_routes[i].name, heapLength) ||
+            (uint64_t)_routes[i].firstNode + _routes[i].nrOfNodes > _header->nrOfNodes ||
+            (uint64_t)_routes[i].firstPosition + _routes[i].nrOfPositions > _header->nrOfPositions) {
+            return NO;
+        }
+    }
+    for (NSUInteger i = 0; i < _header->nrOfPositions; i++) {
+        if (_positions[i].location >= _header->nrOfLocations) {
+            return NO;
+        }
+    }
+    for (NSUInteger i = 0; i < _header->nrOfServices; i++) {
+        if (!isValidString(_services[i].identifier, heapLength) || !isValidString(_services[i].shortName, heapLength) ||
+            !isValidString(_services[i].longName, heapLength) ||
+            (uint64_t)_services[i].firstServicePoint + _services[i].nrOfServicePoints > _header->nrOfServicePoints) {
+            return NO;
+        }
+    }
+    for (NSUInteger i = 0; i < _header->nrOfServicePoints; i++) {
+        if (_servicePoints[i].location >= _header->nrOfLocations ||
+            !isValidString(_servicePoints[i].upPlatform, heapLength) || !isValidString(_servicePoints[i].downPlatform, heapLength)) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (NSUInteger)nrOfLocations
+{
+    return _header->nrOfLocations;
+}
+
+- (NSUInteger)nrOfRoutes
+{
+    return _header->nrOfRoutes;
+}
+
+- (NSUInteger)nrOfServices
+{
+    return _header->nrOfServices;
+}
+
+- (NSString *)stringForReference:(ATLSnapshotString)reference
+{
+    if (!isValidString(reference, _header->heapLength)) {
+        return nil;
+    }
+    return [[NSString alloc] initWithBytes:_heap + reference.offset length:reference.length encoding:NSUTF8StringEncoding];
+}
+
+#pragma mark - Finding entries
+
+/**
+ Binary search in an array of records that start with their identifier and are sorted on it.
+ */
+- (NSUInteger)indexOfIdentifier:(NSString *)identifier inRecords:(const void *)records count:(NSUInteger)count size:(size_t)size
+{
+    const char *key = [identifier UTF8String];
+    if (!key) {
+        return NSNotFound;
+    }
+    NSUInteger keyLength = strlen(key);
+    NSUInteger low = 0, high = count;
+    while (low < high) {
+        NSUInteger middle = (low + high) / 2;
+        const ATLSnapshotString *reference = (const ATLSnapshotString *)((const char *)records + middle * size);
+        int comparison = compareBytes(_heap + reference->offset, reference->length, key, keyLength);
+        if (comparison == 0) {
+            return middle;
+        } else if (comparison < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NSNotFound;
+}
+
+- (NSUInteger)indexOfLocationWithID:(NSString *)identifier
+{
+    return [self indexOfIdentifier:identifier inRecords:_locations count:_header->nrOfLocations size:sizeof(ATLSnapshotLocation)];
+}
+
+- (NSUInteger)indexOfRouteWithID:(NSString *)identifier
+{
+    return [self indexOfIdentifier:identifier inRecords:_routes count:_header->nrOfRoutes size:sizeof(ATLSnapshotRoute)];
+}
+
+- (NSUInteger)indexOfServiceWithID:(NSString *)identifier
+{
+    return [self indexOfIdentifier:identifier inRecords:_services count:_header->nrOfServices size:sizeof(ATLSnapshotService)];
+}
+
+#pragma mark - Geometry
+
+- (const ATLSnapshotNode *)nodesOfRoute:(NSUInteger)route count:(NSUInteger *)count
+{
+    NSAssert(route < _header->nrOfRoutes, @"Route index out of range");
+    *count = _routes[route].nrOfNodes;
+    return _nodes + _routes[route].firstNode;
+}
+
+- (const ATLSnapshotPosition *)positionsOfRoute:(NSUInteger)route count:(NSUInteger *)count
+{
+    NSAssert(route < _header->nrOfRoutes, @"Route index out of range");
+    *count = _routes[route].nrOfPositions;
+    return _positions + _routes[route].firstPosition;
+}
+
+- (double)kmOfLocation:(NSUInteger)location onRoute:(NSUInteger)route
+{
+    NSUInteger count = 0;
+    const ATLSnapshotPosition *positions = [self positionsOfRoute:route count:&count];
+    for (NSUInteger i = 0; i < count; i++) {
+        if (positions[i].location == location) {
+            return positions[i].km;
+        }
+    }
+    return NAN;
+}
+
+- (NSArray *)heartLineOfRoute:(NSUInteger)route
+{
+    NSUInteger count = 0;
+    const ATLSnapshotNode *nodes = [self nodesOfRoute:route count:&count];
+    NSMutableArray *heartLine = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [heartLine addObject:[[ATLNode alloc] initWithLatitude:nodes[i].latitude longitude:nodes[i].longitude
+                                                        radius:nodes[i].radius km_a:nodes[i].km_a km_b:nodes[i].km_b]];
+    }
+    return heartLine;
+}
+
+#pragma mark - Timetable
+
+- (const ATLSnapshotServicePoint *)servicePointsOfService:(NSUInteger)service count:(NSUInteger *)count
+{
+    NSAssert(service < _header->nrOfServices, @"Service index out of range");
+    *count = _services[service].nrOfServicePoints;
+    return _servicePoints + _services[service].firstServicePoint;
+}
+
+@end
@@ -0,0 +1,40 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLBoundsTree.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+#import "ATLRoute.h"
+
+/**
+ ATLBoundsTree is a packed R-tree over a fixed array of bounds, bulk loaded with Sort-Tile-Recursive.
+ Items are identified by their index in the array that the tree was built from.
+ The tree is read only, rebuilding it is cheap enough to do whenever the bounds change.
+ */
+@interface ATLBoundsTree : NSObject
+
+- (instancetype)initWithBounds:(const ATLBounds *)bounds count:(NSUInteger)count;
+
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+ Adds the indexes of all items whose bounds overlap the given bounds, touching edges do not count as overlap.
+ */
+- (void)addItemsIntersectingBounds:(ATLBounds)bounds toIndexSet:(NSMutableIndexSet *)items;
+
+@end
@@ -0,0 +1,162 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLBoundsTree.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLBoundsTree.h"
+
+#define NODE_CAPACITY   16
+
+/*
+ All levels of the tree are stored in one array, leaves first and the root last.
+ Entries of the leaf level refer to an item, entries of higher levels to a range of entries in the level below.
+ */
+typedef struct {
+    ATLBounds bounds;
+    uint32_t first;
+    uint32_t count;             // 0 for leaf entries, first is then the item index
+} ATLBoundsTreeEntry;
+
+static int compareLongitude(const void *entry1, const void *entry2)
+{
+    const ATLBounds *bounds1 = &((const ATLBoundsTreeEntry *)entry1)->bounds;
+    const ATLBounds *bounds2 = &((const ATLBoundsTreeEntry *)entry2)->bounds;
+    double center1 = bounds1->minLon + bounds1->maxLon;
+    double center2 = bounds2->minLon + bounds2->maxLon;
+    return center1 < center2 ? -1 : (center1 > center2 ? 1 : 0);
+}
+
+static int compareLatitude(const void *entry1, const void *entry2)
+{
+    const ATLBounds *bounds1 = &((const ATLBoundsTreeEntry *)entry1)->bounds;
+    const ATLBounds *bounds2 = &((const ATLBoundsTreeEntry *)entry2)->bounds;
+    double center1 = bounds1->minLat + bounds1->maxLat;
+    double center2 = bounds2->minLat + bounds2->maxLat;
+    return center1 < center2 ? -1 : (center1 > center2 ? 1 : 0);
+}
+
+static inline BOOL boundsOverlap(const ATLBounds *bounds1, const ATLBounds *bounds2)
+{
+    return bounds1->minLon < bounds2->maxLon && bounds1->maxLon > bounds2->minLon &&
+           bounds1->minLat < bounds2->maxLat && bounds1->maxLat > bounds2->minLat;
+}
+
+@implementation ATLBoundsTree {
+    NSMutableData *_entryData;
+    const ATLBoundsTreeEntry *_entries;
+    NSUInteger _root;
+    NSUInteger _height;         // number of levels above the leaves
+}
+
+- (instancetype)initWithBounds:(const ATLBounds *)bounds count:(NSUInteger)count
+{
+    self = [super init];
+    if (self) {
+        _count = count;
+        // A tree with n leaves has less than n / (NODE_CAPACITY - 1) + levels nodes above them
+        NSUInteger capacity = count + count / (NODE_CAPACITY - 1) + 16;
+        _entryData = [NSMutableData dataWithLength:capacity * sizeof(ATLBoundsTreeEntry)];
+        ATLBoundsTreeEntry *entries = [_entryData mutableBytes];
+        for (NSUInteger i = 0; i < count; i++) {
+            entries[i].bounds = bounds[i];
+            entries[i].first = (uint32_t)i;
+            entries[i].count = 0;
+        }
+        NSUInteger levelStart = 0, levelCount = count;
+        while (levelCount > 1) {
+            NSUInteger nrOfParents = [self packLevelAt:levelStart count:levelCount intoEntries:entries];
+            levelStart += levelCount;
+            levelCount = nrOfParents;
+            _height++;
+        }
+        _entries = entries;
+        _root = levelStart;
+    }
+    return self;
+}
+
+/**
+ Sort-Tile-Recursive packing: the level is cut in vertical slices by longitude,
+ every slice is sorted by latitude and cut in nodes of NODE_CAPACITY entries.
+ The parents are appended directly after the level.
+ */
+- (NSUInteger)packLevelAt:(NSUInteger)levelStart count:(NSUInteger)levelCount intoEntries:(ATLBoundsTreeEntry *)entries
+{
+    ATLBoundsTreeEntry *level = entries + levelStart;
+    NSUInteger nrOfParents = (levelCount + NODE_CAPACITY - 1) / NODE_CAPACITY;
+    NSUInteger nrOfSlices = (NSUInteger)ceil(sqrt((double)nrOfParents));
+    NSUInteger sliceSize = nrOfSlices * NODE_CAPACITY;
+
+    qsort(level, levelCount, sizeof(ATLBoundsTreeEntry), compareLongitude);
+    for (NSUInteger sliceStart = 0; sliceStart < levelCount; sliceStart += sliceSize) {
+        qsort(level + sliceStart, MIN(sliceSize, levelCount - sliceStart), sizeof(ATLBoundsTreeEntry), compareLatitude);
+    }
+
+    // Nodes never straddle two slices, so a level can have a few more parents than the minimum
+    ATLBoundsTreeEntry *parent = level + levelCount;
+    NSUInteger parentCount = 0;
+    for (NSUInteger sliceStart = 0; sliceStart < levelCount; sliceStart += sliceSize) {
+        NSUInteger sliceEnd = MIN(sliceStart + sliceSize, levelCount);
+        for (NSUInteger first = sliceStart; first < sliceEnd; first += NODE_CAPACITY) {
+            NSUInteger count = MIN(NODE_CAPACITY, sliceEnd - first);
+            ATLBounds bounds = level[first].bounds;
+            for (NSUInteger i = first + 1; i < first + count; i++) {
+                bounds.minLon = MIN(bounds.minLon, level[i].bounds.minLon);
+                bounds.minLat = MIN(bounds.minLat, level[i].bounds.minLat);
+                bounds.maxLon = MAX(bounds.maxLon, level[i].bounds.maxLon);
+                bounds.maxLat = MAX(bounds.maxLat, level[i].bounds.maxLat);
+            }
+            parent->bounds = bounds;
+            parent->first = (uint32_t)(levelStart + first);
+            parent->count = (uint32_t)count;
+            parent++;
+            parentCount++;
+        }
+    }
+    return parentCount;
+}
+
+#pragma mark - Querying the tree
+
+- (void)addItemsIntersectingBounds:(ATLBounds)bounds toIndexSet:(NSMutableIndexSet *)items
+{
+    if (_count == 0) {
+        return;
+    }
+    // Depth first, every level leaves at most NODE_CAPACITY - 1 siblings on the stack
+    NSUInteger stackSize = _height * (NODE_CAPACITY - 1) + 1;
+    NSUInteger stack[stackSize];
+    NSUInteger depth = 0;
+    stack[depth++] = _root;
+    while (depth > 0) {
+        const ATLBoundsTreeEntry *entry = &_entries[stack[--depth]];
+        if (!boundsOverlap(&entry->bounds, &bounds)) {
+            continue;
+        }
+        if (entry->count == 0) {
+            [items addIndex:entry->first];
+        } else {
+            NSAssert(depth + entry->count <= stackSize, @"Bounds tree stack overflow");
+            for (NSUInteger i = 0; i < entry->count; i++) {
+                stack[depth++] = entry->first + i;
+            }
+        }
+    }
+}
+
+@end
@@ -0,0 +1,113 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLCSVReader.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+
+extern NSString * const ATLCSVReaderErrorDomain;
+
+/**
+ A field of the current line, expressed as a range of bytes inside the mapped file.
+ The bytes are only valid during reader:didEndLine:
+ */
+typedef struct {
+    const char *bytes;
+    NSUInteger length;
+    BOOL escaped;           // field contains doubled quotes that must be unescaped
+} ATLCSVField;
+
+int intValueOfField(ATLCSVField field);
+BOOL fieldEqualsCString(ATLCSVField field, const char *string);
+BOOL fieldEqualsBytes(ATLCSVField field, const char *bytes, NSUInteger length);
+
+@class ATLCSVReader;
+
+@protocol ATLCSVReaderDelegate <NSObject>
+
+@optional
+- (void)readerDidBeginDocument:(ATLCSVReader *)reader;
+- (void)readerDidEndDocument:(ATLCSVReader *)reader;
+- (void)reader:(ATLCSVReader *)reader didEndLine:(NSUInteger)recordNumber;
+- (void)reader:(ATLCSVReader *)reader didEndBatch:(NSUInteger)recordNumber;
+- (void)reader:(ATLCSVReader *)reader didFailWithError:(NSError *)error;
+
+@end
+
+/**
+ ATLCSVReader is a lightweight alternative to CHCSVParser, dedicated to large GTFS files.
+ The file is memory mapped and tokenized in place, for every line the delegate receives reader:didEndLine:
+ and can inspect the fields of that line without any objects being allocated.
+ Only UTF-8 (or ASCII) input with comma delimiters is supported.
+ */
+@interface ATLCSVReader : NSObject
+
+- (instancetype)initWithContentsOfCSVFile:(NSString *)csvFilePath;
+- (instancetype)initWithData:(NSData *)data;
+- (instancetype)initWithData:(NSData *)data range:(NSRange)range;
+
+@property (nonatomic, weak) id <ATLCSVReaderDelegate> delegate;
+@property (nonatomic, readonly) NSUInteger totalBytesRead;
+@property (nonatomic, readonly) NSUInteger nrOfRecords;
+
+/**
+ When batchSize is non-zero, lines are read within an autorelease pool that is drained every batchSize lines.
+ The delegate receives reader:didEndBatch: before each pool is drained.
+ */
+@property (nonatomic, assign) NSUInteger batchSize;
+
+- (void)parse;
+- (void)cancelParsing;
+
+/**
+ Tokenizes the whole document without calling the delegate, so that this can be done on a background queue.
+ A following parse replays the stored lines to the delegate instead of scanning the document again.
+ */
+- (void)tokenize;
+
+/**
+ Reads every page of the mapped document once, so that it is resident in memory before it is parsed.
+ */
+- (void)prefetch;
+
+#pragma mark - Streaming input
+
+/**
+ Creates a reader that receives its document in chunks, e.g. while it is being inflated, instead of calling parse.
+ Lines are tokenized as soon as they are complete, the incomplete tail of a chunk is kept until the next one arrives.
+ */
+- (instancetype)initForStreaming;
+- (void)appendBytes:(const void *)bytes length:(NSUInteger)length;
+- (void)finishStreaming;
+
+#pragma mark - Fields of the current line
+
+@property (nonatomic, readonly) NSUInteger fieldCount;
+
+/**
+ The whole current line including its line terminator, not available while replaying a tokenized document.
+ */
+@property (nonatomic, readonly) ATLCSVField currentLine;
+
+- (ATLCSVField)field:(NSUInteger)index;
+- (NSString *)stringForField:(NSUInteger)index;
+- (int)intValueForField:(NSUInteger)index;
+- (BOOL)field:(NSUInteger)index isEqualToCString:(const char *)string;
+- (BOOL)field:(NSUInteger)index isEqualToString:(NSString *)string;
+
+@end
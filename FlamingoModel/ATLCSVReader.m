@@ -0,0 +1,500 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLCSVReader.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLCSVReader.h"
+
+NSString * const ATLCSVReaderErrorDomain = @"nl.firstflamingo.csvreader";
+
+#define INITIAL_FIELD_CAPACITY  16
+#define DOUBLE_QUOTE            '"'
+#define COMMA                   ','
+#define CARRIAGE_RETURN         '\r'
+#define LINE_FEED               '\n'
+#define ESCAPED_FLAG            0x80000000
+
+/**
+ A field of a tokenized line, the offset is relative to the start of the data
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;        // ESCAPED_FLAG is set for fields with doubled quotes
+} ATLCSVFieldRecord;
+
+@implementation ATLCSVReader {
+    NSData *_data;
+    NSRange _range;
+    NSError *_error;
+    BOOL _cancelled;
+    BOOL _delegateHandlesLines;
+    BOOL _delegateHandlesBatches;
+    BOOL _recording;
+    NSMutableData *_lines;
+    BOOL _streaming;
+    NSMutableData *_pending;                // incomplete last line of the previous chunk
+
+    NSUInteger _currentRecord;
+    ATLCSVField *_fields;
+    NSUInteger _fieldCapacity;
+}
+
+#pragma mark - Object lifecycle
+
+- (instancetype)initWithContentsOfCSVFile:(NSString *)csvFilePath
+{
+    NSError *error = nil;
+    NSData *data = [NSData dataWithContentsOfFile:csvFilePath options:NSDataReadingMappedAlways error:&error];
+    self = [self initWithData:data];
+    if (self) {
+        _error = error;
+    }
+    return self;
+}
+
+- (instancetype)initWithData:(NSData *)data
+{
+    return [self initWithData:data range:NSMakeRange(0, [data length])];
+}
+
+- (instancetype)initWithData:(NSData *)data range:(NSRange)range
+{
+    self = [super init];
+    if (self) {
+        _data = data;
+        _range = range;
+        _fieldCapacity = INITIAL_FIELD_CAPACITY;
+        _fields = malloc(_fieldCapacity * sizeof(ATLCSVField));
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_fields);
+}
+
+- (instancetype)initForStreaming
+{
+    self = [self initWithData:nil range:NSMakeRange(0, 0)];
+    if (self) {
+        _streaming = YES;
+    }
+    return self;
+}
+
+#pragma mark - Parsing
+
+- (BOOL)beginDocument
+{
+    _delegateHandlesLines = [self.delegate respondsToSelector:@selector(reader:didEndLine:)];
+    _delegateHandlesBatches = [self.delegate respondsToSelector:@selector(reader:didEndBatch:)];
+    if (_error) {
+        [self failWithError:_error];
+        return NO;
+    }
+    if ([self.delegate respondsToSelector:@selector(readerDidBeginDocument:)]) {
+        [self.delegate readerDidBeginDocument:self];
+    }
+    return YES;
+}
+
+- (void)parse
+{
+    NSAssert(!_streaming, @"A streaming reader receives its document through appendBytes:length:");
+    if (![self beginDocument]) {
+        return;
+    }
+
+    if (_lines) {
+        [self replayLines];
+    } else {
+        [self scanDocument];
+    }
+
+    if (_cancelled || _error) {
+        return;
+    }
+    if ([self.delegate respondsToSelector:@selector(readerDidEndDocument:)]) {
+        [self.delegate readerDidEndDocument:self];
+    }
+}
+
+- (void)scanDocument
+{
+    const char *bytes = (const char *)[_data bytes] + _range.location;
+    NSUInteger length = _range.length;
+    NSUInteger start = 0;
+    if (_range.location == 0 && length >= 3 &&
+        (uint8_t)bytes[0] == 0xEF && (uint8_t)bytes[1] == 0xBB && (uint8_t)bytes[2] == 0xBF) {
+        start = 3;
+    }
+    [self scanBuffer:bytes + start length:length - start final:YES];
+}
+
+/**
+ Scans the buffer in batches, returns the number of bytes consumed.
+ */
+- (NSUInteger)scanBuffer:(const char *)bytes length:(NSUInteger)length final:(BOOL)final
+{
+    const char *p = bytes;
+    const char *end = bytes + length;
+    while (p < end && !_cancelled && !_error) {
+        @autoreleasepool {
+            NSUInteger consumed = [self scanBytes:p length:end - p final:final];
+            p += consumed;
+            if (_batchSize > 0 && _delegateHandlesBatches && p < end && consumed > 0) {
+                [self.delegate reader:self didEndBatch:_currentRecord];
+            }
+            if (consumed == 0) {
+                break;
+            }
+        }
+    }
+    return p - bytes;
+}
+
+#pragma mark - Streaming input
+
+- (void)appendBytes:(const void *)bytes length:(NSUInteger)length
+{
+    NSAssert(_streaming, @"Only a reader created with initForStreaming accepts chunks");
+    if (!_pending) {
+        if (![self beginDocument]) {
+            _cancelled = YES;
+        }
+        _pending = [NSMutableData dataWithCapacity:1024];
+        const uint8_t *start = bytes;
+        if (length >= 3 && start[0] == 0xEF && start[1] == 0xBB && start[2] == 0xBF) {
+            bytes = start + 3;
+            length -= 3;
+        }
+    }
+    if (_cancelled || _error || length == 0) {
+        return;
+    }
+
+    // Only incomplete lines are copied, complete lines are tokenized inside the chunk itself
+    const char *chunk = bytes;
+    const char *end = chunk + length;
+    if ([_pending length] > 0) {
+        const char *lineEnd = memchr(chunk, LINE_FEED, length);
+        const char *head = lineEnd ? lineEnd + 1 : end;
+        [_pending appendBytes:chunk length:head - chunk];
+        NSUInteger consumed = [self scanBuffer:[_pending bytes] length:[_pending length] final:NO];
+        [_pending replaceBytesInRange:NSMakeRange(0, consumed) withBytes:NULL length:0];
+        chunk = head;
+        if ([_pending length] > 0) {
+            // The line continues, e.g. in a quoted field containing a line break
+            [_pending appendBytes:chunk length:end - chunk];
+            consumed = [self scanBuffer:[_pending bytes] length:[_pending length] final:NO];
+            [_pending replaceBytesInRange:NSMakeRange(0, consumed) withBytes:NULL length:0];
+            return;
+        }
+    }
+    NSUInteger consumed = [self scanBuffer:chunk length:end - chunk final:NO];
+    [_pending appendBytes:chunk + consumed length:end - chunk - consumed];
+}
+
+- (void)finishStreaming
+{
+    if (!_pending) {
+        [self appendBytes:NULL length:0];
+    }
+    if (_cancelled || _error) {
+        return;
+    }
+    [self scanBuffer:[_pending bytes] length:[_pending length] final:YES];
+    _pending = nil;
+    if (_cancelled || _error) {
+        return;
+    }
+    if ([self.delegate respondsToSelector:@selector(readerDidEndDocument:)]) {
+        [self.delegate readerDidEndDocument:self];
+    }
+}
+
+- (void)tokenize
+{
+    if (_error || _lines || _streaming) {
+        return;
+    }
+    NSAssert(NSMaxRange(_range) <= UINT32_MAX, @"Documents larger than 4 GB can't be tokenized in advance");
+    _lines = [NSMutableData dataWithCapacity:_range.length];
+    _recording = YES;
+    [self scanDocument];
+    _recording = NO;
+    _currentRecord = 0;
+}
+
+- (void)prefetch
+{
+    const volatile char *bytes = (const char *)[_data bytes] + _range.location;
+    NSUInteger pageSize = NSPageSize();
+    char sum = 0;
+    for (NSUInteger offset = 0; offset < _range.length; offset += pageSize) {
+        sum += bytes[offset];
+    }
+    (void)sum;
+}
+
+- (void)recordLine
+{
+    uint32_t fieldCount = (uint32_t)_fieldCount;
+    [_lines appendBytes:&fieldCount length:sizeof(fieldCount)];
+    const char *base = [_data bytes];
+    for (NSUInteger i = 0; i < _fieldCount; i++) {
+        ATLCSVFieldRecord record;
+        record.offset = (uint32_t)(_fields[i].bytes - base);
+        record.length = (uint32_t)_fields[i].length | (_fields[i].escaped ? ESCAPED_FLAG : 0);
+        [_lines appendBytes:&record length:sizeof(record)];
+    }
+}
+
+/**
+ Calls the delegate for every line stored by tokenize, in batches like scanDocument.
+ */
+- (void)replayLines
+{
+    const char *base = [_data bytes];
+    const char *p = [_lines bytes];
+    const char *end = p + [_lines length];
+    while (p < end && !_cancelled && !_error) {
+        @autoreleasepool {
+            NSUInteger lastRecord = _batchSize > 0 ? _currentRecord + _batchSize : NSUIntegerMax;
+            while (p < end && !_cancelled && _currentRecord < lastRecord) {
+                uint32_t fieldCount = *(const uint32_t *)p;
+                p += sizeof(uint32_t);
+                while (fieldCount > _fieldCapacity) {
+                    _fieldCapacity *= 2;
+                    _fields = realloc(_fields, _fieldCapacity * sizeof(ATLCSVField));
+                }
+                const ATLCSVFieldRecord *records = (const ATLCSVFieldRecord *)p;
+                for (NSUInteger i = 0; i < fieldCount; i++) {
+                    _fields[i].bytes = base + records[i].offset;
+                    _fields[i].length = records[i].length & ~ESCAPED_FLAG;
+                    _fields[i].escaped = (records[i].length & ESCAPED_FLAG) != 0;
+                }
+                p += fieldCount * sizeof(ATLCSVFieldRecord);
+                _fieldCount = fieldCount;
+                _currentRecord++;
+                if (_delegateHandlesLines) {
+                    [self.delegate reader:self didEndLine:_currentRecord];
+                }
+            }
+            _fieldCount = 0;
+            if (_batchSize > 0 && _delegateHandlesBatches && p < end) {
+                [self.delegate reader:self didEndBatch:_currentRecord];
+            }
+        }
+    }
+    _lines = nil;
+}
+
+- (void)cancelParsing
+{
+    _cancelled = YES;
+}
+
+- (void)failWithError:(NSError *)error
+{
+    _error = error;
+    if ([self.delegate respondsToSelector:@selector(reader:didFailWithError:)]) {
+        [self.delegate reader:self didFailWithError:error];
+    }
+}
+
+/**
+ Tokenizes complete lines within the buffer, calling the delegate once for each line.
+ Stops after batchSize lines, if batchSize is set.
+ @returns the number of bytes consumed, when final is NO an incomplete last line is left unconsumed.
+ */
+- (NSUInteger)scanBytes:(const char *)bytes length:(NSUInteger)length final:(BOOL)final
+{
+    const char *end = bytes + length;
+    const char *lineStart = bytes;
+    const char *p = bytes;
+
+    NSUInteger lastRecord = _batchSize > 0 ? _currentRecord + _batchSize : NSUIntegerMax;
+
+    while (p < end && !_cancelled && _currentRecord < lastRecord) {
+        _fieldCount = 0;
+        BOOL endOfLine = NO;
+
+        while (!endOfLine) {
+            ATLCSVField field = {p, 0, NO};
+            if (p < end && *p == DOUBLE_QUOTE) {
+                const char *q = ++p;
+                while (YES) {
+                    q = memchr(q, DOUBLE_QUOTE, end - q);
+                    if (!q) {
+                        break;
+                    }
+                    if (q + 1 < end && q[1] == DOUBLE_QUOTE) {
+                        field.escaped = YES;
+                        q += 2;
+                    } else {
+                        break;
+                    }
+                }
+                if (!q) {
+                    if (!final) {
+                        return lineStart - bytes;
+                    }
+                    [self failWithError:[NSError errorWithDomain:ATLCSVReaderErrorDomain code:1
+                                                        userInfo:@{NSLocalizedDescriptionKey: @"Unterminated quoted field"}]];
+                    return lineStart - bytes;
+                }
+                field.bytes = p;
+                field.length = q - p;
+                p = q + 1;
+                while (p < end && *p != COMMA && *p != LINE_FEED && *p != CARRIAGE_RETURN) {
+                    p++;
+                }
+            } else {
+                while (p < end && *p != COMMA && *p != LINE_FEED && *p != CARRIAGE_RETURN) {
+                    p++;
+                }
+                field.length = p - field.bytes;
+            }
+
+            if (p == end && !final) {
+                return lineStart - bytes;
+            }
+            if (_fieldCount == _fieldCapacity) {
+                _fieldCapacity *= 2;
+                _fields = realloc(_fields, _fieldCapacity * sizeof(ATLCSVField));
+            }
+            _fields[_fieldCount++] = field;
+
+            if (p < end && *p == COMMA) {
+                p++;
+            } else {
+                endOfLine = YES;
+                if (p < end && *p == CARRIAGE_RETURN) {
+                    p++;
+                }
+                if (p < end && *p == LINE_FEED) {
+                    p++;
+                }
+            }
+        }
+
+        BOOL blankLine = (_fieldCount == 1 && _fields[0].length == 0);
+        if (!blankLine) {
+            _currentRecord++;
+            if (_recording) {
+                [self recordLine];
+            } else if (_delegateHandlesLines) {
+                _currentLine.bytes = lineStart;
+                _currentLine.length = p - lineStart;
+                [self.delegate reader:self didEndLine:_currentRecord];
+            }
+        }
+        _totalBytesRead += p - lineStart;
+        lineStart = p;
+    }
+    _fieldCount = 0;
+    _currentLine.bytes = NULL;
+    _currentLine.length = 0;
+    return lineStart - bytes;
+}
+
+- (NSUInteger)nrOfRecords
+{
+    return _currentRecord;
+}
+
+#pragma mark - Fields of the current line
+
+- (ATLCSVField)field:(NSUInteger)index
+{
+    if (index < _fieldCount) {
+        return _fields[index];
+    }
+    ATLCSVField emptyField = {NULL, 0, NO};
+    return emptyField;
+}
+
+- (NSString *)stringForField:(NSUInteger)index
+{
+    ATLCSVField field = [self field:index];
+    if (!field.bytes) {
+        return nil;
+    }
+    NSString *string = [[NSString alloc] initWithBytes:field.bytes length:field.length encoding:NSUTF8StringEncoding];
+    if (field.escaped) {
+        string = [string stringByReplacingOccurrencesOfString:@"\"\"" withString:@"\""];
+    }
+    return string;
+}
+
+- (int)intValueForField:(NSUInteger)index
+{
+    return intValueOfField([self field:index]);
+}
+
+- (BOOL)field:(NSUInteger)index isEqualToCString:(const char *)string
+{
+    return fieldEqualsCString([self field:index], string);
+}
+
+- (BOOL)field:(NSUInteger)index isEqualToString:(NSString *)string
+{
+    if (!string) {
+        return NO;
+    }
+    const char *cString = [string UTF8String];
+    return fieldEqualsBytes([self field:index], cString, strlen(cString));
+}
+
+@end
+
+#pragma mark - Field functions
+
+int intValueOfField(ATLCSVField field)
+{
+    const char *p = field.bytes;
+    const char *end = p + field.length;
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    int sign = 1;
+    if (p < end && (*p == '-' || *p == '+')) {
+        if (*p == '-') {
+            sign = -1;
+        }
+        p++;
+    }
+    int value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = 10 * value + (*p - '0');
+        p++;
+    }
+    return sign * value;
+}
+
+BOOL fieldEqualsCString(ATLCSVField field, const char *string)
+{
+    return fieldEqualsBytes(field, string, strlen(string));
+}
+
+BOOL fieldEqualsBytes(ATLCSVField field, const char *bytes, NSUInteger length)
+{
+    return field.bytes && field.length == length && memcmp(field.bytes, bytes, length) == 0;
+}
@@ -20,12 +20,25 @@
 
 #import <Foundation/Foundation.h>
 #import "ATLMissionRule.h"
+#import "ATLFeedCalendar.h"
 
 @interface ATLCalendarRule : NSObject
 
+/**
+ Derives the calendar rule for a service from the days it runs.
+ A weekday is regular when the service runs on more than half of those weekdays in the feed period,
+ the other days are recorded as exceptions.
+ */
+- (instancetype)initWithCalendar:(ATLFeedCalendar *)calendar runningDays:(const ATLDayWord *)days;
+
 @property (nonatomic, assign) ATLWeekdays weekdays;
 @property (nonatomic, readonly) NSString *weekdaysString;
-@property (nonatomic, strong) NSSet *runningDates;
-@property (nonatomic, strong) NSSet *notRunningDates;
+@property (nonatomic, readonly) NSSet *runningDates;
+@property (nonatomic, readonly) NSSet *notRunningDates;
+
+/**
+ Hash of the weekdays and the dates of the exceptions, to detect changes between imports.
+ */
+@property (nonatomic, readonly) uint64_t fingerprint;
 
 @end
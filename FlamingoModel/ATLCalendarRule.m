@@ -19,8 +19,75 @@
 //
 
 #import "ATLCalendarRule.h"
+#import "ATLFingerprint.h"
 
-@implementation ATLCalendarRule
+@implementation ATLCalendarRule {
+    ATLFeedCalendar *_calendar;
+    NSData *_runningDays, *_notRunningDays;
+    NSSet *_runningDates, *_notRunningDates;
+}
+
+- (instancetype)initWithCalendar:(ATLFeedCalendar *)calendar runningDays:(const ATLDayWord *)days
+{
+    self = [super init];
+    if (self) {
+        _calendar = calendar;
+        NSUInteger nrOfWords = calendar.nrOfWords;
+        NSUInteger criterium = (calendar.nrOfWeeks / 2) + 1;
+        NSMutableData *runningDays = [NSMutableData dataWithLength:nrOfWords * sizeof(ATLDayWord)];
+        NSMutableData *notRunningDays = [NSMutableData dataWithLength:nrOfWords * sizeof(ATLDayWord)];
+        ATLDayWord *running = [runningDays mutableBytes];
+        ATLDayWord *notRunning = [notRunningDays mutableBytes];
+        ATLDayWord *daysOnWeekday = calloc(MAX(nrOfWords, 1), sizeof(ATLDayWord));
+
+        for (int weekday = 0; weekday < 7; weekday++) {
+            const ATLDayWord *mask = [calendar daysOnWeekday:weekday];
+            for (NSUInteger i = 0; i < nrOfWords; i++) {
+                daysOnWeekday[i] = days[i] & mask[i];
+            }
+            if (numberOfDays(daysOnWeekday, nrOfWords) >= criterium) {
+                _weekdays |= 1 << weekday;
+                for (NSUInteger i = 0; i < nrOfWords; i++) {
+                    notRunning[i] |= mask[i] & ~days[i];
+                }
+            } else {
+                for (NSUInteger i = 0; i < nrOfWords; i++) {
+                    running[i] |= daysOnWeekday[i];
+                }
+            }
+        }
+        free(daysOnWeekday);
+        _runningDays = runningDays;
+        _notRunningDays = notRunningDays;
+    }
+    return self;
+}
+
+- (uint64_t)fingerprint
+{
+    uint64_t startDay = (uint64_t)([_calendar.startDate timeIntervalSince1970] / 86400.0);
+    uint64_t result = fingerprintBytes(FINGERPRINT_SEED, &startDay, sizeof(startDay));
+    ATLWeekdays weekdays = self.weekdays;
+    result = fingerprintBytes(result, &weekdays, sizeof(weekdays));
+    result = fingerprintBytes(result, [_runningDays bytes], [_runningDays length]);
+    return fingerprintBytes(result, [_notRunningDays bytes], [_notRunningDays length]);
+}
+
+- (NSSet *)runningDates
+{
+    if (!_runningDates) {
+        _runningDates = _runningDays ? [_calendar datesForDays:[_runningDays bytes]] : [NSSet set];
+    }
+    return _runningDates;
+}
+
+- (NSSet *)notRunningDates
+{
+    if (!_notRunningDates) {
+        _notRunningDates = _notRunningDays ? [_calendar datesForDays:[_notRunningDays bytes]] : [NSSet set];
+    }
+    return _notRunningDates;
+}
 
 - (NSString *)weekdaysString
 {
@@ -26,7 +26,7 @@
 
 #define TESTING_ENVIRONMENT
 
-@class ATLEntry, ATLRoute, ATLLocation, ATLMission, ATLStation, ATLJunction, ATLSeries, ATLService, ATLJourney;
+@class ATLEntry, ATLRoute, ATLLocation, ATLMission, ATLStation, ATLJunction, ATLSeries, ATLService, ATLJourney, ATLStationIndex, ATLAtlasSnapshot;
 
 @interface ATLDataController : FFEDataController
 
@@ -37,6 +37,11 @@
 #pragma mark - Inserting new objects
 
 - (void)searchAndAddRoutesForItem:(ATLLocation*)item;
+
+/**
+ Connects many items at once, each route that is near any of the items projects its candidates in one batch.
+ */
+- (void)searchAndAddRoutesForItems:(NSArray *)items;
 - (void)addJunctionsToRoute:(ATLRoute*)route;
 
 #pragma mark - Accessing existing objects
@@ -47,6 +52,18 @@
 - (ATLStation *)stationClosestToCoordinate:(CLLocationCoordinate2D)coordinate;
 - (NSSet *)stationsWithinRange:(double)distanceInMeters ofCoordinate:(CLLocationCoordinate2D)coordinate;
 
+/**
+ Grid of all stations for many proximity queries, e.g. the nearest station for a batch of positions.
+ The index is built on first use and rebuilt after stations or their route positions have changed.
+ */
+@property (nonatomic, readonly) ATLStationIndex *stationIndex;
+
+/**
+ Snapshot of the atlas as it was last saved, stored next to the data store and rewritten after every save that
+ changed locations, routes or services. Nil for a testing instance or when no snapshot could be written.
+ */
+@property (nonatomic, readonly) ATLAtlasSnapshot *atlasSnapshot;
+
 /**
  Provides a journey that is occuring, or will occur within an hour of the given date
  @param date the moment in time at which the journey should
@@ -67,6 +84,7 @@
 
 - (void)repositionRouteItems;
 - (void)removeAllMissionRules;
+- (void)migrateTimePaths;
 
 #pragma mark - Finding shortest path
 
@@ -35,6 +35,10 @@
 #import "ATLJourney.h"
 #import "ATLVisit.h"
 #import "ATLTransfer.h"
+#import "ATLTimePath.h"
+#import "ATLBoundsTree.h"
+#import "ATLStationIndex.h"
+#import "ATLAtlasSnapshot.h"
 
 #import "NSManagedObjectContext+FFEUtilities.h"
 #import "NSDate+Formatters.h"
@@ -42,7 +46,26 @@
 #define SEARCH_MARGIN 1000
 #define ONE_HOUR 3600.0
 
-@implementation ATLDataController
+@implementation ATLDataController {
+    // Spatial index of the routes, built on first use and discarded when subroutes change
+    ATLBoundsTree *_routeTree;
+    NSArray *_routeTreeSubroutes;
+    // Spatial index of the stations, discarded when stations or their positions change
+    ATLStationIndex *_stationIndex;
+    BOOL _observingChanges;
+    // Snapshot of the saved atlas, rewritten after every save that changed the atlas
+    ATLAtlasSnapshot *_atlasSnapshot;
+    BOOL _atlasSnapshotOutdated;
+}
+
+- (void)dealloc
+{
+    if (_observingChanges) {
+        [[NSNotificationCenter defaultCenter] removeObserver:self
+                                                        name:NSManagedObjectContextObjectsDidChangeNotification
+                                                      object:nil];
+    }
+}
 
 #pragma mark - Configuration
 
@@ -88,16 +111,47 @@
 
 - (void)searchAndAddRoutesForItem:(ATLLocation *)item
 {
-    for (ATLRoute *route in [self routesAtCoordinate:item.coordinate]) {
-        if (![item isConnectedToRoute:route]) {
-            RoutePosition routePosition = [route projectionOfCoordinate:item.coordinate withAccuracy:100];
-            if (validPosition(routePosition)) {
+    [self searchAndAddRoutesForItems:@[item]];
+}
+
+- (void)searchAndAddRoutesForItems:(NSArray *)items
+{
+    // Collect the candidate items per route, so that every route projects all its candidates at once
+    NSMutableDictionary *routes = [NSMutableDictionary dictionaryWithCapacity:100];
+    NSMutableDictionary *itemsByRoute = [NSMutableDictionary dictionaryWithCapacity:100];
+    for (ATLLocation *item in items) {
+        for (ATLRoute *route in [self routesAtCoordinate:item.coordinate]) {
+            if (![item isConnectedToRoute:route]) {
+                NSMutableArray *routeItems = itemsByRoute[route.objectID];
+                if (!routeItems) {
+                    routeItems = [NSMutableArray arrayWithCapacity:10];
+                    itemsByRoute[route.objectID] = routeItems;
+                    routes[route.objectID] = route;
+                }
+                [routeItems addObject:item];
+            }
+        }
+    }
+    for (NSManagedObjectID *routeID in itemsByRoute) {
+        ATLRoute *route = routes[routeID];
+        NSArray *routeItems = itemsByRoute[routeID];
+        NSUInteger count = [routeItems count];
+        CLLocationCoordinate2D *coordinates = malloc(count * sizeof(CLLocationCoordinate2D));
+        RoutePosition *projections = malloc(count * sizeof(RoutePosition));
+        for (NSUInteger i = 0; i < count; i++) {
+            coordinates[i] = [routeItems[i] coordinate];
+        }
+        [route getProjections:projections ofCoordinates:coordinates count:count withAccuracy:100];
+        for (NSUInteger i = 0; i < count; i++) {
+            if (validPosition(projections[i])) {
                 ATLRoutePosition *atlasPosition = (ATLRoutePosition*)[self.managedObjectContext createManagedObjectOfType:@"ATLRoutePosition"];
-                atlasPosition.km = routePosition.km;
-                atlasPosition.location = item;
+                atlasPosition.km = projections[i].km;
+                atlasPosition.location = routeItems[i];
                 atlasPosition.route = route;
             }
         }
+        free(coordinates);
+        free(projections);
     }
 }
 
@@ -145,62 +199,138 @@
 - (NSSet *)routesAtCoordinate:(CLLocationCoordinate2D)coordinate
 {
     // Search routes within reach of the coordinate
+    double deltaLon = SEARCH_MARGIN / horScaleForLatitude(coordinate.latitude);
+    double deltaLat = SEARCH_MARGIN / VER_SCALE;
+    ATLBounds searchBounds = {coordinate.longitude - deltaLon, coordinate.latitude - deltaLat,
+                              coordinate.longitude + deltaLon, coordinate.latitude + deltaLat};
+    NSMutableIndexSet *indexes = [NSMutableIndexSet indexSet];
+    [self.routeTree addItemsIntersectingBounds:searchBounds toIndexSet:indexes];
+
     NSMutableSet *routes = [NSMutableSet setWithCapacity:10];
-    NSPredicate *predicate = [self searchPredicateForArea:YES withinRange:SEARCH_MARGIN fromCoordinate:coordinate];
-    
-    for (ATLSubRoute *subroute in [self.managedObjectContext fetchInstancesOfType:@"ATLSubRoute" withPredicate:predicate]) {
-        [routes addObject:subroute.route];
-    }
+    [indexes enumerateIndexesUsingBlock:^(NSUInteger index, BOOL *stop) {
+        ATLRoute *route = [_routeTreeSubroutes[index] route];
+        if (route) {
+            [routes addObject:route];
+        }
+    }];
     return routes;
 }
 
-- (ATLStation *)stationClosestToCoordinate:(CLLocationCoordinate2D)coordinate
+#pragma mark Spatial index of routes
+
+- (void)observeChangesForIndex:(id)index
+{
+    if (!_observingChanges) {
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(objectsDidChange:)
+                                                     name:NSManagedObjectContextObjectsDidChangeNotification
+                                                   object:self.managedObjectContext];
+        _observingChanges = YES;
+    }
+    // Changes that are still pending would not have been notified yet, they can only outdate an index that was built,
+    // and only a context with unsaved changes can have pending changes. A new index is fetched including them.
+    if (index && [self.managedObjectContext hasChanges]) {
+        [self.managedObjectContext processPendingChanges];
+    }
+}
+
+- (ATLBoundsTree *)routeTree
 {
-    ATLStation *closestStation = nil;
-    double closestDistance = 1E308;
-    for (ATLStation *station in [self stationsWithinRange:5000 ofCoordinate:coordinate]) {
-        CoordinateSize coordSize = coordinateSizeFromLine(coordinate, station.coordinate);
-        CGSize meterSize = CGSizeMake(coordSize.deltaLon * horScaleForLatitude(coordinate.latitude), coordSize.deltaLat * VER_SCALE);
-        double distance = pythagoras(meterSize);
-        if (distance < closestDistance) {
-            closestStation = station;
-            closestDistance = distance;
+    [self observeChangesForIndex:_routeTree];
+    if (!_routeTree) {
+        NSArray *subroutes = [self.managedObjectContext allObjectsOfClass:[ATLSubRoute class]];
+        NSUInteger count = [subroutes count];
+        ATLBounds *bounds = malloc(MAX(count, 1) * sizeof(ATLBounds));
+        for (NSUInteger i = 0; i < count; i++) {
+            ATLSubRoute *subroute = subroutes[i];
+            bounds[i] = (ATLBounds){subroute.minLon, subroute.minLat, subroute.maxLon, subroute.maxLat};
         }
+        _routeTree = [[ATLBoundsTree alloc] initWithBounds:bounds count:count];
+        _routeTreeSubroutes = subroutes;
+        free(bounds);
     }
-    return closestStation;
+    return _routeTree;
 }
 
-- (NSSet *)stationsWithinRange:(double)distanceInMeters ofCoordinate:(CLLocationCoordinate2D)coordinate
+- (void)objectsDidChange:(NSNotification *)notification
 {
-    NSPredicate *predicate = [self searchPredicateForArea:NO withinRange:distanceInMeters fromCoordinate:coordinate];
-    NSArray *closePositions = [self.managedObjectContext fetchInstancesOfType:@"ATLRoutePosition" withPredicate:predicate];
-    NSMutableSet *foundStations = [NSMutableSet setWithCapacity:5];
-    for (ATLRoutePosition *position in closePositions) {
-        ATLLocation *location = position.location;
-        if ([location isKindOfClass:[ATLStation class]]) {
-            [foundStations addObject:location];
+    if (!_routeTree && !_stationIndex) {
+        return;
+    }
+    NSDictionary *userInfo = notification.userInfo;
+    if (userInfo[NSInvalidatedAllObjectsKey]) {
+        [self resetRouteTree];
+        [self resetStationIndex];
+        return;
+    }
+    for (NSString *key in @[NSInsertedObjectsKey, NSUpdatedObjectsKey, NSDeletedObjectsKey, NSRefreshedObjectsKey, NSInvalidatedObjectsKey]) {
+        for (NSManagedObject *object in userInfo[key]) {
+            if ([object isKindOfClass:[ATLSubRoute class]]) {
+                [self resetRouteTree];
+            } else if ([object isKindOfClass:[ATLStation class]] || [object isKindOfClass:[ATLRoutePosition class]]) {
+                [self resetStationIndex];
+            }
+            if (!_routeTree && !_stationIndex) {
+                return;
+            }
         }
     }
-    return foundStations;
-}
-
-- (NSPredicate *)searchPredicateForArea:(BOOL)isArea
-                            withinRange:(double)distanceInMeters
-                         fromCoordinate:(CLLocationCoordinate2D)coordinate
-{
-    double deltaLon = distanceInMeters / horScaleForLatitude(coordinate.latitude);
-    double deltaLat = distanceInMeters / VER_SCALE;
-    NSNumber *minLon = @(coordinate.longitude - deltaLon);
-    NSNumber *maxLon = @(coordinate.longitude + deltaLon);
-    NSNumber *minLat = @(coordinate.latitude - deltaLat);
-    NSNumber *maxLat = @(coordinate.latitude + deltaLat);
-    if (isArea) {
-        return [NSPredicate predicateWithFormat:
-                @"(minLon < %@) AND (maxLon > %@) AND (minLat < %@) AND (maxLat > %@)", maxLon, minLon, maxLat, minLat];
-    } else {
-        return [NSPredicate predicateWithFormat:
-                @"(longitude < %@) AND (longitude > %@) AND (latitude < %@) AND (latitude > %@)", maxLon, minLon, maxLat, minLat];
+}
+
+- (void)resetRouteTree
+{
+    _routeTree = nil;
+    _routeTreeSubroutes = nil;
+}
+
+#pragma mark Spatial index of stations
+
+- (ATLStationIndex *)stationIndex
+{
+    [self observeChangesForIndex:_stationIndex];
+    if (!_stationIndex) {
+        NSArray *stations = [self.managedObjectContext allObjectsOfClass:[ATLStation class]];
+        ATLAtlasSnapshot *snapshot = [self.managedObjectContext hasChanges] ? nil : self.atlasSnapshot;
+        if (snapshot) {
+            _stationIndex = [self stationIndexOfStations:stations fromSnapshot:snapshot];
+        }
+        if (!_stationIndex) {
+            _stationIndex = [[ATLStationIndex alloc] initWithStations:stations];
+        }
     }
+    return _stationIndex;
+}
+
+- (ATLStationIndex *)stationIndexOfStations:(NSArray *)stations fromSnapshot:(ATLAtlasSnapshot *)snapshot
+{
+    NSUInteger count = [stations count];
+    CLLocationCoordinate2D *coordinates = malloc(MAX(count, 1) * sizeof(CLLocationCoordinate2D));
+    for (NSUInteger i = 0; i < count; i++) {
+        NSUInteger index = [snapshot indexOfLocationWithID:[stations[i] id_]];
+        if (index == NSNotFound) {
+            free(coordinates);
+            return nil;
+        }
+        coordinates[i] = CLLocationCoordinate2DMake(snapshot.locations[index].latitude, snapshot.locations[index].longitude);
+    }
+    ATLStationIndex *stationIndex = [[ATLStationIndex alloc] initWithStations:stations coordinates:coordinates];
+    free(coordinates);
+    return stationIndex;
+}
+
+- (void)resetStationIndex
+{
+    _stationIndex = nil;
+}
+
+- (ATLStation *)stationClosestToCoordinate:(CLLocationCoordinate2D)coordinate
+{
+    return [[self.stationIndex nearestStations:1 toCoordinate:coordinate withinRange:5000] firstObject];
+}
+
+- (NSSet *)stationsWithinRange:(double)distanceInMeters ofCoordinate:(CLLocationCoordinate2D)coordinate
+{
+    return [NSSet setWithArray:[self.stationIndex stationsWithinRange:distanceInMeters ofCoordinate:coordinate]];
 }
 
 - (ATLJourney *)journeyAtDate:(NSDate *)date
@@ -212,7 +342,7 @@
     NSSortDescriptor *sort = [NSSortDescriptor sortDescriptorWithKey:@"timeOfDeparture" ascending:YES];
     [request setSortDescriptors:@[sort]];
     
-    NSArray *result = [self.managedObjectContext executeFetchRequest:request error:NULL];
+    NSArray *result = [self.managedObjectContext fetchObjectsWithRequest:request];
     if ([result count] > 0) {
         return result[0];
     } else {
@@ -270,37 +400,143 @@
     return junction;
 }
 
+#pragma mark Snapshot of the atlas
+
+- (NSURL *)atlasSnapshotURL
+{
+    return [[self.storeURL URLByDeletingPathExtension] URLByAppendingPathExtension:@"atls"];
+}
+
+- (ATLAtlasSnapshot *)atlasSnapshot
+{
+    if (!_atlasSnapshot && self.atlasSnapshotURL) {
+        if ([[NSFileManager defaultManager] fileExistsAtPath:self.atlasSnapshotURL.path]) {
+            NSError *error = nil;
+            _atlasSnapshot = [ATLAtlasSnapshot snapshotWithContentsOfURL:self.atlasSnapshotURL error:&error];
+            if (!_atlasSnapshot) {
+                NSLog(@"Ignoring atlas snapshot: %@", error);
+            }
+        }
+    }
+    return _atlasSnapshot;
+}
+
+- (BOOL)writeAtlasSnapshot:(NSError **)error
+{
+    if (!self.atlasSnapshotURL) {
+        return YES;
+    }
+    _atlasSnapshot = nil;
+    return [ATLAtlasSnapshot writeSnapshotOfManagedObjectContext:self.managedObjectContext toURL:self.atlasSnapshotURL error:error];
+}
+
+- (void)contextWillSave:(NSNotification *)notification
+{
+    [super contextWillSave:notification];
+    NSManagedObjectContext *context = self.managedObjectContext;
+    for (NSSet *objects in @[context.insertedObjects, context.updatedObjects, context.deletedObjects]) {
+        for (NSManagedObject *object in objects) {
+            if ([object isKindOfClass:[ATLLocation class]] || [object isKindOfClass:[ATLRoute class]] ||
+                [object isKindOfClass:[ATLRoutePosition class]] || [object isKindOfClass:[ATLService class]] ||
+                [object isKindOfClass:[ATLServicePoint class]]) {
+                _atlasSnapshotOutdated = YES;
+                break;
+            }
+        }
+    }
+    if (_atlasSnapshotOutdated && self.atlasSnapshotURL) {
+        // Remove the snapshot before the store changes, so that a failed save never leaves an outdated one behind
+        _atlasSnapshot = nil;
+        [[NSFileManager defaultManager] removeItemAtURL:self.atlasSnapshotURL error:NULL];
+    }
+}
+
+- (void)contextDidSave:(NSNotification *)notification
+{
+    [super contextDidSave:notification];
+    if (_atlasSnapshotOutdated) {
+        _atlasSnapshotOutdated = NO;
+        NSError *error = nil;
+        if (![self writeAtlasSnapshot:&error]) {
+            NSLog(@"Atlas snapshot not written: %@", error);
+            [[NSFileManager defaultManager] removeItemAtURL:self.atlasSnapshotURL error:NULL];
+        }
+    }
+}
+
 #pragma mark - Changing exitsing objects
 
 - (void)repositionRouteItems
 {
+    // Positions are geo referenced per route in order of km, so that each route is swept once
+    NSMutableDictionary *positionsByRoute = [NSMutableDictionary dictionary];
     for (ATLLocation *item in [self routeItemsWithConnections:1]) {
         ATLRoutePosition *position = [item.routePositions anyObject];
-        ATLGeoReference reference = [position.route geoReferenceForPosition:position.km];
-        if (CLLocationCoordinate2DIsValid(reference.coordinate)) {
-            NSLog(@"position %@ (%.6f, %.6f) >>> (%.6f, %.6f)",
-                  item.id_, item.coordinate.latitude, item.coordinate.longitude, reference.coordinate.latitude, reference.coordinate.longitude);
-            position.coordinate = reference.coordinate;
+        if (!position.route) {
+            continue;
+        }
+        NSMutableArray *positions = positionsByRoute[position.route.objectID];
+        if (!positions) {
+            positions = [NSMutableArray arrayWithCapacity:20];
+            positionsByRoute[position.route.objectID] = positions;
+        }
+        [positions addObject:position];
+    }
+    for (NSMutableArray *positions in [positionsByRoute allValues]) {
+        [positions sortUsingComparator:^NSComparisonResult(ATLRoutePosition *position1, ATLRoutePosition *position2) {
+            float km1 = position1.km, km2 = position2.km;
+            return km1 < km2 ? NSOrderedAscending : (km1 > km2 ? NSOrderedDescending : NSOrderedSame);
+        }];
+        NSUInteger count = [positions count];
+        double *kms = malloc(count * sizeof(double));
+        ATLGeoReference *references = malloc(count * sizeof(ATLGeoReference));
+        for (NSUInteger i = 0; i < count; i++) {
+            kms[i] = [positions[i] km];
+        }
+        [[positions[0] route] getGeoReferences:references forPositions:kms count:count];
+        for (NSUInteger i = 0; i < count; i++) {
+            ATLRoutePosition *position = positions[i];
+            ATLLocation *item = position.location;
+            if (CLLocationCoordinate2DIsValid(references[i].coordinate)) {
+                NSLog(@"position %@ (%.6f, %.6f) >>> (%.6f, %.6f)", item.id_, item.coordinate.latitude, item.coordinate.longitude,
+                      references[i].coordinate.latitude, references[i].coordinate.longitude);
+                position.coordinate = references[i].coordinate;
+            }
         }
+        free(kms);
+        free(references);
     }
 }
 
 - (void)removeAllMissionRules
 {
     NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"ATLMissionRule"];
-	NSArray *expiredObjects = [self.managedObjectContext executeFetchRequest:request error:NULL];
+	NSArray *expiredObjects = [self.managedObjectContext fetchObjectsWithRequest:request];
     NSLog(@"Remove %d mission rules", (int)[expiredObjects count]);
     for (NSManagedObject *expiredObject in expiredObjects) {
         [self.managedObjectContext deleteObject:expiredObject];
     }
     request = [NSFetchRequest fetchRequestWithEntityName:@"ATLTimePath"];
-	expiredObjects = [self.managedObjectContext executeFetchRequest:request error:NULL];
+	expiredObjects = [self.managedObjectContext fetchObjectsWithRequest:request];
     NSLog(@"Remove %d time paths", (int)[expiredObjects count]);
     for (NSManagedObject *expiredObject in expiredObjects) {
         [self.managedObjectContext deleteObject:expiredObject];
     }
 }
 
+- (void)migrateTimePaths
+{
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"ATLTimePath"];
+    NSArray *timePaths = [self.managedObjectContext fetchObjectsWithRequest:request];
+    int nrOfMigrations = 0;
+    for (ATLTimePath *timePath in timePaths) {
+        if ([timePath migrateTimePointsData]) {
+            nrOfMigrations++;
+        }
+    }
+    NSLog(@"Migrated %d of %d time paths", nrOfMigrations, (int)[timePaths count]);
+}
+
 #pragma mark - Finding shortest path
 
 -(NSArray *)shortestDistancePathFrom:(ATLLocation *)origin to:(ATLLocation *)destination
@@ -21,6 +21,7 @@
 #import <Foundation/Foundation.h>
 #import <CoreData/CoreData.h>
 #import "FFESyncing.h"
+#import "ATLXMLWriter.h"
 
 typedef enum {
     groupIntercityNoord,
@@ -69,9 +70,11 @@ typedef enum {
 // XML representation
 - (NSString*)xmlString;
 - (NSString*)xmlReferenceString;
-- (void)appendAttributesToXMLString:(NSMutableString*)output;
+- (void)writeXMLWithWriter:(ATLXMLWriter*)writer;
+- (void)writeXMLReferenceWithWriter:(ATLXMLWriter*)writer;
+- (void)writeXMLAttributesWithWriter:(ATLXMLWriter*)writer;
 @property (nonatomic, readonly) BOOL hasXMLData;
-- (void)appendDataToXMLString:(NSMutableString*)output;
+- (void)writeXMLDataWithWriter:(ATLXMLWriter*)writer;
 
 @end
 
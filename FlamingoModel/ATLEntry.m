@@ -19,6 +19,7 @@
 //
 
 #import "ATLEntry.h"
+#import <objc/runtime.h>
 
 @implementation ATLEntry
 
@@ -195,29 +196,45 @@
 
 - (NSString*)xmlString
 {
-    NSString *name = [[NSStringFromClass([self class]) substringFromIndex:3] lowercaseString];
-    NSMutableString *theString = [[NSMutableString alloc] initWithCapacity:50];
-    [theString appendFormat:@"<%@", name];
-    [self appendAttributesToXMLString:theString];
+    ATLXMLWriter *writer = [ATLXMLWriter memoryWriter];
+    [self writeXMLWithWriter:writer];
+    return writer.string;
+}
+
+- (NSString *)xmlReferenceString
+{
+    ATLXMLWriter *writer = [ATLXMLWriter memoryWriter];
+    [self writeXMLReferenceWithWriter:writer];
+    return writer.string;
+}
+
+- (void)writeXMLWithWriter:(ATLXMLWriter *)writer
+{
+    [writer writeCString:"<"];
+    [writer writeElementNameOfClass:[self class]];
+    [self writeXMLAttributesWithWriter:writer];
     if (self.hasXMLData) {
-        [theString appendString:@">\n"];
-        [self appendDataToXMLString:theString];
-        [theString appendFormat:@"</%@>\n", name];
+        [writer writeCString:">\n"];
+        [self writeXMLDataWithWriter:writer];
+        [writer writeCString:"</"];
+        [writer writeElementNameOfClass:[self class]];
+        [writer writeCString:">\n"];
     } else {
-        [theString appendString:@"/>\n"];
+        [writer writeCString:"/>\n"];
     }
-    return theString;
 }
 
-- (NSString *)xmlReferenceString
+- (void)writeXMLReferenceWithWriter:(ATLXMLWriter *)writer
 {
-    return [NSString stringWithFormat:@"<%@ id=\"%@\"/>\n",
-            NSStringFromClass([self class]), self.id_];
+    [writer writeCString:"<"];
+    [writer writeCString:class_getName([self class])];
+    [writer writeAttribute:"id" string:self.id_];
+    [writer writeCString:"/>\n"];
 }
 
-- (void)appendAttributesToXMLString:(NSMutableString *)output
+- (void)writeXMLAttributesWithWriter:(ATLXMLWriter *)writer
 {
-    [output appendFormat:@" id=\"%@\"", self.id_];
+    [writer writeAttribute:"id" string:self.id_];
 }
 
 - (BOOL)hasXMLData
@@ -225,7 +242,7 @@
     return YES;
 }
 
-- (void)appendDataToXMLString:(NSMutableString *)output
+- (void)writeXMLDataWithWriter:(ATLXMLWriter *)writer
 {
     // To be overwritten by subclasses
 }
@@ -0,0 +1,60 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLFeedCalendar.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef uint64_t ATLDayWord;
+
+#define DAYS_PER_WORD       64
+#define INVALID_DAY         -1
+
+/**
+ ATLFeedCalendar describes the period covered by a GTFS feed.
+ Days are numbered from the first day of the feed (day 0), sets of days are represented
+ as bitsets of nrOfWords ATLDayWords, so that they can be combined with word-wide bit operations.
+ Weekdays are indexed from monday (0) to sunday (6).
+ */
+@interface ATLFeedCalendar : NSObject
+
+- (instancetype)initWithStartIdentifier:(NSString *)startIdentifier endIdentifier:(NSString *)endIdentifier;
+
+@property (nonatomic, readonly) int nrOfDays;
+@property (nonatomic, readonly) int nrOfWeeks;
+@property (nonatomic, readonly) NSUInteger nrOfWords;
+@property (nonatomic, readonly) NSDate *startDate;
+@property (nonatomic, readonly) NSDate *endDate;
+
+// Converting days
+- (int)dayForIdentifier:(NSString *)identifier;
+- (int)dayForIdentifierBytes:(const char *)bytes length:(NSUInteger)length;
+- (int)weekdayForDay:(int)day;
+- (NSDate *)dateForDay:(int)day;
+
+// Sets of days
+- (const ATLDayWord *)daysOnWeekday:(int)weekday;
+- (NSSet *)datesForDays:(const ATLDayWord *)days;
+
+@end
+
+NSUInteger numberOfDays(const ATLDayWord *days, NSUInteger nrOfWords);
+static inline void addDay(ATLDayWord *days, int day)
+{
+    days[day / DAYS_PER_WORD] |= (ATLDayWord)1 << (day % DAYS_PER_WORD);
+}
@@ -0,0 +1,164 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLFeedCalendar.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLFeedCalendar.h"
+
+#define TWELVE_HOURS        43200.0
+#define TWENTYFOUR_HOURS    86400.0
+
+int daysFromCivil(int year, int month, int day);
+
+@implementation ATLFeedCalendar {
+    int _firstCivilDay;
+    ATLDayWord *_weekdayMasks;
+}
+
+#pragma mark - Object lifecycle
+
+- (instancetype)initWithStartIdentifier:(NSString *)startIdentifier endIdentifier:(NSString *)endIdentifier
+{
+    self = [super init];
+    if (self) {
+        const char *start = [startIdentifier UTF8String];
+        const char *end = [endIdentifier UTF8String];
+        _firstCivilDay = [self civilDayForIdentifierBytes:start length:strlen(start)];
+        _nrOfDays = MAX([self civilDayForIdentifierBytes:end length:strlen(end)] - _firstCivilDay + 1, 0);
+        _nrOfWeeks = _nrOfDays / 7;
+        _nrOfWords = (_nrOfDays + DAYS_PER_WORD - 1) / DAYS_PER_WORD;
+
+        _weekdayMasks = calloc(7 * MAX(_nrOfWords, 1), sizeof(ATLDayWord));
+        for (int day = 0; day < _nrOfDays; day++) {
+            addDay(_weekdayMasks + [self weekdayForDay:day] * _nrOfWords, day);
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_weekdayMasks);
+}
+
+- (NSDate *)startDate
+{
+    return [self dateForDay:0];
+}
+
+- (NSDate *)endDate
+{
+    return [self dateForDay:_nrOfDays - 1];
+}
+
+#pragma mark - Converting days
+
+- (int)civilDayForIdentifierBytes:(const char *)bytes length:(NSUInteger)length
+{
+    // identifier has format yyyyMMdd
+    if (length != 8) {
+        return INT_MIN;
+    }
+    int value[8];
+    for (int i = 0; i < 8; i++) {
+        value[i] = bytes[i] - '0';
+        if (value[i] < 0 || value[i] > 9) {
+            return INT_MIN;
+        }
+    }
+    int year = 1000 * value[0] + 100 * value[1] + 10 * value[2] + value[3];
+    int month = 10 * value[4] + value[5];
+    int day = 10 * value[6] + value[7];
+    return daysFromCivil(year, month, day);
+}
+
+- (int)dayForIdentifier:(NSString *)identifier
+{
+    const char *bytes = [identifier UTF8String];
+    if (!bytes) {
+        return INVALID_DAY;
+    }
+    return [self dayForIdentifierBytes:bytes length:strlen(bytes)];
+}
+
+- (int)dayForIdentifierBytes:(const char *)bytes length:(NSUInteger)length
+{
+    int civilDay = [self civilDayForIdentifierBytes:bytes length:length];
+    if (civilDay == INT_MIN || civilDay < _firstCivilDay || civilDay - _firstCivilDay >= _nrOfDays) {
+        return INVALID_DAY;
+    }
+    return civilDay - _firstCivilDay;
+}
+
+- (int)weekdayForDay:(int)day
+{
+    // 1 january 1970 (civil day 0) was a thursday
+    int weekday = (_firstCivilDay + day + 3) % 7;
+    return weekday < 0 ? weekday + 7 : weekday;
+}
+
+- (NSDate *)dateForDay:(int)day
+{
+    if (day < 0 || day >= _nrOfDays) {
+        return nil;
+    }
+    return [NSDate dateWithTimeIntervalSince1970:(_firstCivilDay + day) * TWENTYFOUR_HOURS + TWELVE_HOURS];
+}
+
+#pragma mark - Sets of days
+
+- (const ATLDayWord *)daysOnWeekday:(int)weekday
+{
+    return _weekdayMasks + weekday * _nrOfWords;
+}
+
+- (NSSet *)datesForDays:(const ATLDayWord *)days
+{
+    NSMutableSet *dates = [NSMutableSet setWithCapacity:numberOfDays(days, _nrOfWords)];
+    for (NSUInteger i = 0; i < _nrOfWords; i++) {
+        ATLDayWord word = days[i];
+        while (word) {
+            int bit = __builtin_ctzll(word);
+            [dates addObject:[self dateForDay:(int)(i * DAYS_PER_WORD) + bit]];
+            word &= word - 1;
+        }
+    }
+    return dates;
+}
+
+@end
+
+NSUInteger numberOfDays(const ATLDayWord *days, NSUInteger nrOfWords)
+{
+    NSUInteger count = 0;
+    for (NSUInteger i = 0; i < nrOfWords; i++) {
+        count += __builtin_popcountll(days[i]);
+    }
+    return count;
+}
+
+int daysFromCivil(int year, int month, int day)
+{
+    // Days since 1 january 1970 ~ http://howardhinnant.github.io/date_algorithms.html
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
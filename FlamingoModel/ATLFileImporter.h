@@ -20,9 +20,23 @@
 
 #import <Foundation/Foundation.h>
 #import <CoreData/CoreData.h>
+#import "ATLImportMetrics.h"
 
 @interface ATLFileImporter : NSObject
 
 - (void)importContentsOfURL:(NSURL*)url intoManagedObjectContext:(NSManagedObjectContext*)managedObjectContext;
 
+/**
+ When set, the document is split into chunks of top level entries that are parsed concurrently,
+ each chunk is applied to the managed object context as soon as the chunks before it are applied.
+ Only parsing runs concurrently, inserting the objects into the context stays serial.
+ Parallel import expects UTF-8 documents without a DTD, like the ones written by ATLAtlasExporter.
+ */
+@property (nonatomic, assign) BOOL parallelImport;
+
+/**
+ Throughput measurements of every imported file, rows are counted as XML elements.
+ */
+@property (nonatomic, strong) ATLImportMetrics *metrics;
+
 @end
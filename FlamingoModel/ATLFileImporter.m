@@ -54,18 +54,464 @@
 @property (nonatomic, strong) NSMutableArray *currentHeartline;
 @property (nonatomic, strong) NSMutableDictionary *currentLocations;
 @property (nonatomic, assign) BOOL previousServices, nextServices;
+@property (nonatomic, assign) NSUInteger nrOfElements;
 
 @end
 
+#define PREFETCH_BATCH_SIZE     500
+#define CHUNKS_PER_PROCESSOR    4
 
-@implementation ATLFileImporter
+/**
+ Collects the identifiers of all entries that a document declares or refers to.
+ */
+@interface ATLXMLIdentifierScanner : NSObject <NSXMLParserDelegate>
+
+@property (nonatomic, readonly) NSMutableSet *identifiers;
+
+@end
+
+@implementation ATLXMLIdentifierScanner
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _identifiers = [NSMutableSet setWithCapacity:1000];
+    }
+    return self;
+}
+
+- (void)parser:(NSXMLParser *)parser didStartElement:(NSString *)elementName
+  namespaceURI:(NSString *)namespaceURI qualifiedName:(NSString *)qName attributes:(NSDictionary *)attributeDict
+{
+    for (NSString *key in @[@"id", @"location", @"series", @"service"]) {
+        NSString *identifier = attributeDict[key];
+        if (identifier) {
+            [_identifiers addObject:identifier];
+        }
+    }
+}
+
+@end
+
+#pragma mark - Parallel parsing
+
+typedef NS_ENUM(NSInteger, ATLXMLEventType) {
+    startElementEvent,
+    endElementEvent,
+    charactersEvent
+};
+
+@interface ATLXMLEvent : NSObject
+
+@property (nonatomic, assign) ATLXMLEventType type;
+@property (nonatomic, strong) NSString *elementName;
+@property (nonatomic, strong) NSDictionary *attributes;
+@property (nonatomic, strong) NSMutableString *characters;
+
+@end
+
+@implementation ATLXMLEvent
+
+@end
+
+/**
+ Parses a range of top level elements of a document into events that can be replayed on another thread.
+ A chunk only creates Foundation objects, so it can be parsed on any thread.
+ The identifiers of the chunk are collected on the way, so no separate scanning pass is needed.
+ The range is only copied while it is parsed, the events are released when they have been replayed.
+ */
+@interface ATLXMLChunk : ATLXMLIdentifierScanner
+
+- (instancetype)initWithData:(NSData *)data range:(NSRange)range;
+- (BOOL)parse;
+- (void)replayToDelegate:(id <NSXMLParserDelegate>)delegate;
+
+@property (nonatomic, readonly) NSError *error;
+
+@end
+
+@implementation ATLXMLChunk {
+    NSData *_data;
+    NSRange _range;
+    NSMutableArray *_events;
+    NSUInteger _depth;
+}
+
+- (instancetype)initWithData:(NSData *)data range:(NSRange)range
+{
+    self = [super init];
+    if (self) {
+        _data = data;
+        _range = range;
+        _events = [NSMutableArray arrayWithCapacity:range.length / 40];
+    }
+    return self;
+}
+
+- (BOOL)parse
+{
+    // The elements of the chunk are wrapped in a root element of their own
+    NSMutableData *chunkData = [NSMutableData dataWithCapacity:_range.length + 20];
+    [chunkData appendBytes:"<chunk>" length:7];
+    [chunkData appendBytes:(const char *)[_data bytes] + _range.location length:_range.length];
+    [chunkData appendBytes:"</chunk>" length:8];
+    _data = nil;
+
+    NSXMLParser *parser = [[NSXMLParser alloc] initWithData:chunkData];
+    parser.delegate = self;
+    BOOL success = [parser parse];
+    _error = parser.parserError;
+    return success;
+}
+
+- (void)replayToDelegate:(id <NSXMLParserDelegate>)delegate
+{
+    for (ATLXMLEvent *event in _events) {
+        switch (event.type) {
+            case startElementEvent:
+                [delegate parser:nil didStartElement:event.elementName namespaceURI:nil qualifiedName:nil attributes:event.attributes];
+                break;
+            case endElementEvent:
+                [delegate parser:nil didEndElement:event.elementName namespaceURI:nil qualifiedName:nil];
+                break;
+            case charactersEvent:
+                [delegate parser:nil foundCharacters:event.characters];
+                break;
+        }
+    }
+    _events = nil;
+}
+
+- (void)parser:(NSXMLParser *)parser didStartElement:(NSString *)elementName
+  namespaceURI:(NSString *)namespaceURI qualifiedName:(NSString *)qName attributes:(NSDictionary *)attributeDict
+{
+    if (_depth++ == 0) {
+        return;
+    }
+    [super parser:parser didStartElement:elementName namespaceURI:namespaceURI qualifiedName:qName attributes:attributeDict];
+    ATLXMLEvent *event = [ATLXMLEvent new];
+    event.type = startElementEvent;
+    event.elementName = elementName;
+    event.attributes = attributeDict;
+    [_events addObject:event];
+}
+
+- (void)parser:(NSXMLParser *)parser didEndElement:(NSString *)elementName
+  namespaceURI:(NSString *)namespaceURI qualifiedName:(NSString *)qName
+{
+    if (--_depth == 0) {
+        return;
+    }
+    ATLXMLEvent *event = [ATLXMLEvent new];
+    event.type = endElementEvent;
+    event.elementName = elementName;
+    [_events addObject:event];
+}
+
+- (void)parser:(NSXMLParser *)parser foundCharacters:(NSString *)string
+{
+    // The parser may report the characters of one text in several parts
+    ATLXMLEvent *event = [_events lastObject];
+    if (event.type != charactersEvent || !event.characters) {
+        event = [ATLXMLEvent new];
+        event.type = charactersEvent;
+        event.characters = [NSMutableString stringWithCapacity:[string length]];
+        [_events addObject:event];
+    }
+    [event.characters appendString:string];
+}
+
+@end
+
+static NSUInteger indexPastString(const char *bytes, NSUInteger length, NSUInteger index, const char *string)
+{
+    NSUInteger stringLength = strlen(string);
+    while (index + stringLength <= length) {
+        if (memcmp(bytes + index, string, stringLength) == 0) {
+            return index + stringLength;
+        }
+        index++;
+    }
+    return length;
+}
+
+/**
+ Splits the contents of the root element into at most count ranges that start and end between top level elements.
+ Returns no ranges when the root element is not closed.
+ */
+static NSArray *chunkRangesOfDocument(NSData *data, NSUInteger count)
+{
+    const char *bytes = [data bytes];
+    NSUInteger length = [data length];
+    NSUInteger chunkSize = length / MAX(count, 1) + 1;
+    NSMutableArray *ranges = [NSMutableArray arrayWithCapacity:count];
+    NSUInteger chunkStart = NSNotFound;
+    NSInteger depth = 0;
+    NSUInteger index = 0;
+    while (index < length) {
+        if (bytes[index] != '<') {
+            index++;
+            continue;
+        }
+        NSUInteger tagStart = index;
+        if (index + 1 < length && bytes[index + 1] == '?') {
+            index = indexPastString(bytes, length, index, "?>");
+        } else if (index + 3 < length && memcmp(bytes + index, "<!--", 4) == 0) {
+            index = indexPastString(bytes, length, index, "-->");
+        } else if (index + 8 < length && memcmp(bytes + index, "<![CDATA[", 9) == 0) {
+            index = indexPastString(bytes, length, index, "]]>");
+        } else if (index + 1 < length && bytes[index + 1] == '!') {
+            index = indexPastString(bytes, length, index, ">");
+        } else {
+            BOOL closingTag = index + 1 < length && bytes[index + 1] == '/';
+            char quote = 0;
+            for (index++; index < length; index++) {
+                char c = bytes[index];
+                if (quote) {
+                    if (c == quote) {
+                        quote = 0;
+                    }
+                } else if (c == '"' || c == '\'') {
+                    quote = c;
+                } else if (c == '>') {
+                    break;
+                }
+            }
+            BOOL emptyElement = !closingTag && bytes[index - 1] == '/';
+            index++;
+            if (closingTag) {
+                depth--;
+            } else if (!emptyElement) {
+                depth++;
+            }
+            if (depth == 1 && !closingTag && !emptyElement && chunkStart == NSNotFound) {
+                chunkStart = index;         // just after the start tag of the root element
+            } else if (depth == 0 && closingTag && chunkStart != NSNotFound) {
+                [ranges addObject:[NSValue valueWithRange:NSMakeRange(chunkStart, tagStart - chunkStart)]];
+                return ranges;
+            } else if (depth == 1 && (closingTag || emptyElement) && index - chunkStart >= chunkSize) {
+                [ranges addObject:[NSValue valueWithRange:NSMakeRange(chunkStart, index - chunkStart)]];
+                chunkStart = index;
+            }
+        }
+    }
+    // The root element is not closed, the serial import reports the error
+    return @[];
+}
+
+
+@implementation ATLFileImporter {
+    NSMutableDictionary *_entries;
+    NSMutableSet *_prefetchedIdentifiers;
+
+    // Progress through the document, for the import metrics
+    NSData *_documentData;
+    NSUInteger _bytePosition;
+    NSInteger _lineOfBytePosition;
+}
 
 - (void)importContentsOfURL:(NSURL *)url intoManagedObjectContext:(NSManagedObjectContext *)managedObjectContext
 {
     self.managedObjectContext = managedObjectContext;
-    NSXMLParser *parser = [[NSXMLParser alloc] initWithContentsOfURL:url];
+    self.nrOfElements = 0;
+    [self.metrics beginStep:[url lastPathComponent] managedObjectContext:managedObjectContext];
+    NSError *error = nil;
+    NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:&error];
+    if (!data) {
+        NSLog(@"Could not read %@: %@", url, error);
+        [self.metrics endStep];
+        return;
+    }
+
+    if (self.parallelImport && [self importDataInParallel:data]) {
+        [self finishImportOfURL:url];
+        return;
+    }
+
+    // First pass: resolve all identifiers in the document, so that the elements need no fetch requests
+    ATLXMLIdentifierScanner *scanner = [ATLXMLIdentifierScanner new];
+    NSXMLParser *parser = [[NSXMLParser alloc] initWithData:data];
+    parser.delegate = scanner;
+    [parser parse];
+    [self resetEntries];
+    [self prefetchEntriesWithIdentifiers:scanner.identifiers];
+
+    // Second pass: import the elements
+    parser = [[NSXMLParser alloc] initWithData:data];
     parser.delegate = self;
+    _documentData = data;
+    _bytePosition = 0;
+    _lineOfBytePosition = 1;
     [parser parse];
+    _documentData = nil;
+    [self finishImportOfURL:url];
+}
+
+- (void)finishImportOfURL:(NSURL *)url
+{
+    NSNumber *fileSize = nil;
+    [url getResourceValue:&fileSize forKey:NSURLFileSizeKey error:NULL];
+    [self.metrics updateRows:self.nrOfElements bytes:[fileSize unsignedIntegerValue]];
+    [self.metrics endStep];
+}
+
+/**
+ Offset of the start of the line the parser is at, found by scanning forward from the previous position.
+ While chunks are replayed there is no parser, the position is then set per chunk.
+ */
+- (NSUInteger)bytePositionOfParser:(NSXMLParser *)parser
+{
+    if (parser && _documentData) {
+        const char *bytes = [_documentData bytes];
+        NSUInteger length = [_documentData length];
+        while (_lineOfBytePosition < parser.lineNumber && _bytePosition < length) {
+            const char *lineFeed = memchr(bytes + _bytePosition, '\n', length - _bytePosition);
+            _bytePosition = lineFeed ? lineFeed - bytes + 1 : length;
+            _lineOfBytePosition++;
+        }
+    }
+    return _bytePosition;
+}
+
+- (ATLImportMetrics *)metrics
+{
+    if (!_metrics) {
+        _metrics = [ATLImportMetrics new];
+    }
+    return _metrics;
+}
+
+#pragma mark - Parallel import
+
+/**
+ Parses chunks of the document concurrently and applies them in document order,
+ so that references between entries resolve exactly as in a serial import.
+ Only parsing runs concurrently, the chunks are applied to the context one after the other on the calling thread.
+ A chunk is applied as soon as it and all chunks before it are parsed, after its identifiers are prefetched.
+ Only a window of chunks is parsed ahead of the one being applied, which bounds the copies and events in memory.
+ When a chunk fails to parse, the context is rolled back before the serial import, so that the children
+ of the chunks that were already applied are not added twice. A context with unsaved changes of its own
+ can not be rolled back, all chunks are then parsed before the first is applied.
+ Returns NO without changes to the context when the document can not be chunked or parsed.
+ */
+- (BOOL)importDataInParallel:(NSData *)data
+{
+    NSUInteger nrOfProcessors = [[NSProcessInfo processInfo] activeProcessorCount];
+    NSArray *ranges = chunkRangesOfDocument(data, nrOfProcessors * CHUNKS_PER_PROCESSOR);
+    if ([ranges count] == 0) {
+        return NO;
+    }
+    BOOL canRollBack = ![self.managedObjectContext hasChanges];
+    NSMutableArray *chunks = [NSMutableArray arrayWithCapacity:[ranges count]];
+    NSMutableArray *parsedChunks = [NSMutableArray arrayWithCapacity:[ranges count]];
+    for (NSValue *range in ranges) {
+        [chunks addObject:[[ATLXMLChunk alloc] initWithData:data range:[range rangeValue]]];
+        [parsedChunks addObject:dispatch_semaphore_create(0)];
+    }
+    void (^parseChunk)(NSUInteger) = ^(NSUInteger chunkIndex) {
+        ATLXMLChunk *chunk = chunks[chunkIndex];
+        dispatch_semaphore_t parsed = parsedChunks[chunkIndex];
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [chunk parse];
+            dispatch_semaphore_signal(parsed);
+        });
+    };
+    NSUInteger window = canRollBack ? 2 * nrOfProcessors : [chunks count];
+    for (NSUInteger chunkIndex = 0; chunkIndex < MIN(window, [chunks count]); chunkIndex++) {
+        parseChunk(chunkIndex);
+    }
+    if (!canRollBack) {
+        for (NSUInteger chunkIndex = 0; chunkIndex < [chunks count]; chunkIndex++) {
+            dispatch_semaphore_wait(parsedChunks[chunkIndex], DISPATCH_TIME_FOREVER);
+            dispatch_semaphore_signal(parsedChunks[chunkIndex]);
+            ATLXMLChunk *chunk = chunks[chunkIndex];
+            if (chunk.error) {
+                NSLog(@"Parallel import failed at chunk %lu, importing serially: %@", (unsigned long)chunkIndex, chunk.error);
+                return NO;
+            }
+        }
+    }
+
+    [self resetEntries];
+    for (NSUInteger chunkIndex = 0; chunkIndex < [chunks count]; chunkIndex++) {
+        dispatch_semaphore_wait(parsedChunks[chunkIndex], DISPATCH_TIME_FOREVER);
+        ATLXMLChunk *chunk = chunks[chunkIndex];
+        if (chunk.error) {
+            NSLog(@"Parallel import failed at chunk %lu, importing serially: %@", (unsigned long)chunkIndex, chunk.error);
+            [self.managedObjectContext rollback];
+            [self resetEntries];
+            return NO;
+        }
+        if (chunkIndex + window < [chunks count]) {
+            parseChunk(chunkIndex + window);
+        }
+        [self prefetchEntriesWithIdentifiers:chunk.identifiers];
+        _bytePosition = [ranges[chunkIndex] rangeValue].location;
+        @autoreleasepool {
+            [chunk replayToDelegate:self];
+        }
+        chunks[chunkIndex] = [NSNull null];
+    }
+    [self parserDidEndDocument:nil];
+    return YES;
+}
+
+#pragma mark - Resolving identifiers
+
+- (void)resetEntries
+{
+    _entries = [NSMutableDictionary dictionaryWithCapacity:1000];
+    _prefetchedIdentifiers = [NSMutableSet setWithCapacity:1000];
+}
+
+/**
+ Fetches the entries of the identifiers that were not prefetched before, in batches.
+ */
+- (void)prefetchEntriesWithIdentifiers:(NSSet *)identifiers
+{
+    NSMutableSet *newIdentifiers = [identifiers mutableCopy];
+    [newIdentifiers minusSet:_prefetchedIdentifiers];
+    [_prefetchedIdentifiers unionSet:newIdentifiers];
+    NSArray *allIdentifiers = [newIdentifiers allObjects];
+    for (NSUInteger start = 0; start < [allIdentifiers count]; start += PREFETCH_BATCH_SIZE) {
+        NSRange range = NSMakeRange(start, MIN(PREFETCH_BATCH_SIZE, [allIdentifiers count] - start));
+        NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"ATLEntry"];
+        request.predicate = [NSPredicate predicateWithFormat:@"id_ IN %@", [allIdentifiers subarrayWithRange:range]];
+        request.returnsObjectsAsFaults = NO;
+        for (ATLEntry *entry in [self.managedObjectContext fetchObjectsWithRequest:request]) {
+            [self addEntry:entry];
+        }
+    }
+}
+
+- (void)addEntry:(ATLEntry *)entry
+{
+    // Entries of different classes may share an identifier
+    NSMutableArray *entries = _entries[entry.id_];
+    if (!entries) {
+        entries = [NSMutableArray arrayWithCapacity:1];
+        _entries[entry.id_] = entries;
+    }
+    [entries addObject:entry];
+}
+
+- (id)entryOfClass:(Class)entryClass withID:(NSString *)identifier create:(BOOL)create
+{
+    for (ATLEntry *entry in _entries[identifier]) {
+        if ([entry isKindOfClass:entryClass]) {
+            return entry;
+        }
+    }
+    if (!create) {
+        return nil;
+    }
+    ATLEntry *entry = [self.managedObjectContext createManagedObjectOfClass:entryClass];
+    entry.modelID = identifier;
+    if (identifier) {
+        [self addEntry:entry];
+    }
+    return entry;
 }
 
 #pragma mark - Current Entry
@@ -155,29 +601,25 @@
 - (void)parser:(NSXMLParser *)parser didStartElement:(NSString *)elementName
   namespaceURI:(NSString *)namespaceURI qualifiedName:(NSString *)qName attributes:(NSDictionary *)attributeDict
 {
+    self.nrOfElements++;
+    [_metrics updateRows:self.nrOfElements bytes:[self bytePositionOfParser:parser]];
     if (!self.currentEntry)
     {
         if ([elementName isEqualToString:@"route"])
         {
-            self.currentEntry = [self.managedObjectContext objectOfClass:[ATLRoute class]
-                                                             withModelID:attributeDict[@"id"]
-                                                                  create:YES];
+            self.currentEntry = [self entryOfClass:[ATLRoute class] withID:attributeDict[@"id"] create:YES];
             self.currentRoute.name = attributeDict[@"name"];
             NSLog(@"Import route %@", self.currentRoute.name);
         }
         else if ([elementName isEqualToString:@"junction"])
         {
-            self.currentEntry = [self.managedObjectContext objectOfClass:[ATLJunction class]
-                                                             withModelID:attributeDict[@"id"]
-                                                                  create:YES];
+            self.currentEntry = [self entryOfClass:[ATLJunction class] withID:attributeDict[@"id"] create:YES];
             self.currentJunction.sameDirection = [attributeDict[@"sameDirection"] isEqualToString:@"yes"];
             NSLog(@"Import junction %@", self.currentJunction.id_);
         }
         else if ([elementName isEqualToString:@"station"])
         {
-            self.currentEntry = [self.managedObjectContext objectOfClass:[ATLStation class]
-                                                             withModelID:attributeDict[@"id"]
-                                                                  create:YES];
+            self.currentEntry = [self entryOfClass:[ATLStation class] withID:attributeDict[@"id"] create:YES];
             self.currentStation.name = attributeDict[@"name"];
             self.currentStation.importance = [attributeDict[@"importance"] integerValue];
             self.currentStation.icGroup = [attributeDict[@"corridor"] integerValue];
@@ -186,16 +628,12 @@
         }
         else if ([elementName isEqualToString:@"organization"])
         {
-            self.currentEntry = [self.managedObjectContext objectOfClass:[ATLOrganization class]
-                                                             withModelID:attributeDict[@"id"]
-                                                                  create:YES];
+            self.currentEntry = [self entryOfClass:[ATLOrganization class] withID:attributeDict[@"id"] create:YES];
             self.currentOrganization.name = attributeDict[@"name"];
         }
         else if ([elementName isEqualToString:@"service"])
         {
-            self.currentEntry = [self.managedObjectContext objectOfClass:[ATLService class]
-                                                             withModelID:attributeDict[@"id"]
-                                                                  create:YES];
+            self.currentEntry = [self entryOfClass:[ATLService class] withID:attributeDict[@"id"] create:YES];
             self.currentService.expressService = [attributeDict[@"express"] isEqualToString:@"yes"];
             self.currentService.group = [attributeDict[@"group"] intValue];
             self.currentService.shortName = attributeDict[@"short"];
@@ -205,9 +643,7 @@
         }
         else if ([elementName isEqualToString:@"series"])
         {
-            self.currentEntry = [self.managedObjectContext objectOfClass:[ATLSeries class]
-                                                             withModelID:attributeDict[@"id"]
-                                                                  create:YES];
+            self.currentEntry = [self entryOfClass:[ATLSeries class] withID:attributeDict[@"id"] create:YES];
         }
     }
     else if ([elementName isEqualToString:@"name"] ||
@@ -261,9 +697,7 @@
         }
         else if ([elementName isEqualToString:@"ATLRoutePosition"])
         {
-            ATLLocation *item = (ATLLocation*)[self.managedObjectContext objectOfClass:[ATLLocation class]
-                                                                           withModelID:attributeDict[@"location"]
-                                                                                create:NO];
+            ATLLocation *item = (ATLLocation*)[self entryOfClass:[ATLLocation class] withID:attributeDict[@"location"] create:NO];
             if (item) {
                 [self.currentRoute insertLocation:item atPosition:[attributeDict[@"km"] floatValue]];
             }
@@ -292,9 +726,7 @@
         }
         else if ([elementName isEqualToString:@"ATLOrganization"])
         {
-            self.currentReference = [self.managedObjectContext objectOfClass:[ATLOrganization class]
-                                                                 withModelID:attributeDict[@"id"]
-                                                                      create:NO];
+            self.currentReference = [self entryOfClass:[ATLOrganization class] withID:attributeDict[@"id"] create:NO];
         }
         else if ([elementName isEqualToString:@"previousServices"])
         {
@@ -306,7 +738,7 @@
         }
         else if ([elementName isEqualToString:@"ATLService"])
         {
-            ATLService *service = [self.managedObjectContext objectOfClass:[ATLService class] withModelID:attributeDict[@"id"] create:NO];
+            ATLService *service = [self entryOfClass:[ATLService class] withID:attributeDict[@"id"] create:NO];
             if (service) {
                 if (self.previousServices) {
                     ATLServiceRef *ref = [self.managedObjectContext createManagedObjectOfClass:[ATLServiceRef class]];
@@ -326,17 +758,13 @@
         else if ([elementName isEqualToString:@"junction"])
         {
             NSString *identifier = attributeDict[@"id"];
-            ATLJunction *junction = (ATLJunction*)[self.managedObjectContext objectOfClass:[ATLJunction class]
-                                                                               withModelID:identifier
-                                                                                    create:NO];
+            ATLJunction *junction = (ATLJunction*)[self entryOfClass:[ATLJunction class] withID:identifier create:NO];
             self.currentLocations[identifier] = [self.currentService insertLocation:junction atKM:[attributeDict[@"km"] floatValue]];
         }
         else if ([elementName isEqualToString:@"station"])
         {
             NSString *identifier = attributeDict[@"id"];
-            ATLStation *station = (ATLStation*)[self.managedObjectContext objectOfClass:[ATLStation class]
-                                                                            withModelID:identifier
-                                                                                 create:NO];
+            ATLStation *station = (ATLStation*)[self entryOfClass:[ATLStation class] withID:identifier create:NO];
             self.currentLocations[identifier] = [self.currentService insertLocation:station atKM:[attributeDict[@"km"] floatValue]];
             
         }
@@ -364,7 +792,7 @@
         }
         else if ([elementName isEqualToString:@"ref"])
         {
-            ATLSeries *series = [self.managedObjectContext objectOfClass:[ATLSeries class] withModelID:attributeDict[@"series"] create:NO];
+            ATLSeries *series = [self entryOfClass:[ATLSeries class] withID:attributeDict[@"series"] create:NO];
             if (series) {
                 ATLSeriesRef *ref = (ATLSeriesRef*)[self.managedObjectContext createManagedObjectOfType:@"ATLSeriesRef"];
                 ref.service = self.currentService;
@@ -386,9 +814,7 @@
     else if (self.currentSeries)
     {
         if ([elementName isEqualToString:@"ref"]) {
-            ATLService *service = [self.managedObjectContext objectOfClass:[ATLService class]
-                                                               withModelID:attributeDict[@"service"]
-                                                                    create:NO];
+            ATLService *service = [self entryOfClass:[ATLService class] withID:attributeDict[@"service"] create:NO];
             if (service) {
                 ATLSeriesRef *ref = [self.managedObjectContext createManagedObjectOfClass:[ATLSeriesRef class]];
                 ref.series = self.currentSeries;
@@ -509,6 +935,8 @@
     self.currentHeartline = nil;
     self.currentLocations = nil;
     self.currentReference = nil;
+    _entries = nil;
+    _prefetchedIdentifiers = nil;
 }
 
 @end
@@ -0,0 +1,29 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLFingerprint.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+
+#define FINGERPRINT_SEED    14695981039346656037ULL
+
+/**
+ 64 bit FNV-1a hash of a range of bytes. Fingerprints of several ranges are chained
+ by passing the result of one range as seed for the next, starting with FINGERPRINT_SEED.
+ */
+uint64_t fingerprintBytes(uint64_t seed, const void *bytes, NSUInteger length);
@@ -0,0 +1,33 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLFingerprint.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLFingerprint.h"
+
+uint64_t fingerprintBytes(uint64_t seed, const void *bytes, NSUInteger length)
+{
+    // 64 bit FNV-1a ~ http://www.isthe.com/chongo/tech/comp/fnv/
+    const uint8_t *p = bytes;
+    uint64_t result = seed;
+    for (NSUInteger i = 0; i < length; i++) {
+        result ^= p[i];
+        result *= 1099511628211ULL;
+    }
+    return result;
+}
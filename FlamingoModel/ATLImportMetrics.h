@@ -0,0 +1,86 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLImportMetrics.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+@class ATLImportMetrics, ATLImportStepMetrics;
+
+@protocol ATLImportMetricsDelegate <NSObject>
+
+@optional
+- (void)importMetrics:(ATLImportMetrics *)metrics didUpdateStep:(ATLImportStepMetrics *)step;
+- (void)importMetrics:(ATLImportMetrics *)metrics didFinishStep:(ATLImportStepMetrics *)step;
+
+@end
+
+/**
+ Measurements of one import step, usually the import of one file
+ */
+@interface ATLImportStepMetrics : NSObject
+
+@property (nonatomic, readonly) NSString *name;
+@property (nonatomic, readonly) NSUInteger nrOfRows;
+@property (nonatomic, readonly) NSUInteger nrOfBytes;
+@property (nonatomic, readonly) NSUInteger nrOfObjectsCreated;
+@property (nonatomic, readonly) NSUInteger nrOfFetches;
+@property (nonatomic, readonly) NSUInteger nrOfSaves;
+@property (nonatomic, readonly) NSTimeInterval saveDuration;
+@property (nonatomic, readonly) NSTimeInterval duration;
+@property (nonatomic, readonly) uint64_t peakMemory;
+
+@property (nonatomic, readonly) double rowsPerSecond;
+@property (nonatomic, readonly) double bytesPerSecond;
+
+@property (nonatomic, readonly) NSDictionary *dictionaryRepresentation;
+
+@end
+
+/**
+ ATLImportMetrics collects throughput measurements of the importers.
+ Progress is reported to the delegate every progressInterval rows (or logged, without a delegate),
+ the measurements of all steps are available as a summary at the end.
+ */
+@interface ATLImportMetrics : NSObject
+
+@property (nonatomic, weak) id <ATLImportMetricsDelegate> delegate;
+
+/**
+ Number of rows between progress updates, 5000 by default.
+ */
+@property (nonatomic, assign) NSUInteger progressInterval;
+
+@property (nonatomic, readonly) NSArray *steps;
+@property (nonatomic, readonly) ATLImportStepMetrics *currentStep;
+
+- (void)beginStep:(NSString *)name managedObjectContext:(NSManagedObjectContext *)context;
+- (void)updateRows:(NSUInteger)nrOfRows bytes:(NSUInteger)nrOfBytes;
+- (BOOL)saveContext:(NSError **)error;
+- (void)endStep;
+
+/**
+ Property list with the measurements of every step, suitable for comparing imports across releases.
+ */
+@property (nonatomic, readonly) NSDictionary *summary;
+- (NSData *)JSONSummary;
+
+@end
+
+uint64_t currentResidentMemory(void);
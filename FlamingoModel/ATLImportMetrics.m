@@ -0,0 +1,211 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLImportMetrics.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLImportMetrics.h"
+#import "NSManagedObjectContext+FFEUtilities.h"
+#import <mach/mach.h>
+
+#define DEFAULT_PROGRESS_INTERVAL   5000
+
+@interface ATLImportStepMetrics ()
+
+@property (nonatomic, strong) NSString *name;
+@property (nonatomic, assign) NSUInteger nrOfRows;
+@property (nonatomic, assign) NSUInteger nrOfBytes;
+@property (nonatomic, assign) NSUInteger nrOfObjectsCreated;
+@property (nonatomic, assign) NSUInteger nrOfFetches;
+@property (nonatomic, assign) NSUInteger nrOfSaves;
+@property (nonatomic, assign) NSTimeInterval saveDuration;
+@property (nonatomic, assign) NSTimeInterval duration;
+@property (nonatomic, assign) uint64_t peakMemory;
+
+@end
+
+@implementation ATLImportStepMetrics
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@ %@: %lu rows, %.0f rows/s, %.0f bytes/s, %lu objects, %lu fetches, %lu saves in %.3fs, peak %.1f MB>",
+            NSStringFromClass([self class]), self.name, (unsigned long)self.nrOfRows, self.rowsPerSecond, self.bytesPerSecond,
+            (unsigned long)self.nrOfObjectsCreated, (unsigned long)self.nrOfFetches, (unsigned long)self.nrOfSaves,
+            self.saveDuration, self.peakMemory / 1048576.0];
+}
+
+- (double)rowsPerSecond
+{
+    return self.duration > 0 ? self.nrOfRows / self.duration : 0;
+}
+
+- (double)bytesPerSecond
+{
+    return self.duration > 0 ? self.nrOfBytes / self.duration : 0;
+}
+
+- (NSDictionary *)dictionaryRepresentation
+{
+    return @{@"name": self.name,
+             @"rows": @(self.nrOfRows),
+             @"bytes": @(self.nrOfBytes),
+             @"rowsPerSecond": @(self.rowsPerSecond),
+             @"bytesPerSecond": @(self.bytesPerSecond),
+             @"objectsCreated": @(self.nrOfObjectsCreated),
+             @"fetches": @(self.nrOfFetches),
+             @"saves": @(self.nrOfSaves),
+             @"saveDuration": @(self.saveDuration),
+             @"duration": @(self.duration),
+             @"peakMemory": @(self.peakMemory)};
+}
+
+@end
+
+@implementation ATLImportMetrics {
+    NSMutableArray *_steps;
+    NSManagedObjectContext *_context;
+    NSDate *_startDate;
+    NSUInteger _fetchCountAtStart;
+    NSUInteger _pendingInsertsAtStart;
+    NSUInteger _nextProgressRow;
+}
+
+#pragma mark - Object lifecycle
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _steps = [NSMutableArray arrayWithCapacity:8];
+        _progressInterval = DEFAULT_PROGRESS_INTERVAL;
+    }
+    return self;
+}
+
+#pragma mark - Measuring
+
+- (NSArray *)steps
+{
+    return _steps;
+}
+
+- (void)beginStep:(NSString *)name managedObjectContext:(NSManagedObjectContext *)context
+{
+    if (_currentStep) {
+        [self endStep];
+    }
+    _currentStep = [ATLImportStepMetrics new];
+    _currentStep.name = name;
+    _currentStep.peakMemory = currentResidentMemory();
+    _context = context;
+    _startDate = [NSDate date];
+    _fetchCountAtStart = context.numberOfFetchRequests;
+    _pendingInsertsAtStart = [[context insertedObjects] count];
+    _nextProgressRow = self.progressInterval;
+}
+
+- (void)updateRows:(NSUInteger)nrOfRows bytes:(NSUInteger)nrOfBytes
+{
+    _currentStep.nrOfRows = nrOfRows;
+    _currentStep.nrOfBytes = nrOfBytes;
+    if (self.progressInterval > 0 && nrOfRows >= _nextProgressRow) {
+        _nextProgressRow = nrOfRows + self.progressInterval;
+        [self measure];
+        if ([self.delegate respondsToSelector:@selector(importMetrics:didUpdateStep:)]) {
+            [self.delegate importMetrics:self didUpdateStep:_currentStep];
+        } else if (!self.delegate) {
+            NSLog(@"Import %@ at line %lu", _currentStep.name, (unsigned long)nrOfRows);
+        }
+    }
+}
+
+- (BOOL)saveContext:(NSError **)error
+{
+    [self countInsertedObjects];
+    NSDate *saveStart = [NSDate date];
+    BOOL success = [_context save:error];
+    _currentStep.saveDuration += -[saveStart timeIntervalSinceNow];
+    _currentStep.nrOfSaves++;
+    [self measure];
+    return success;
+}
+
+- (void)endStep
+{
+    if (!_currentStep) {
+        return;
+    }
+    [self countInsertedObjects];
+    [self measure];
+    [_steps addObject:_currentStep];
+    ATLImportStepMetrics *step = _currentStep;
+    _currentStep = nil;
+    _context = nil;
+    if ([self.delegate respondsToSelector:@selector(importMetrics:didFinishStep:)]) {
+        [self.delegate importMetrics:self didFinishStep:step];
+    } else if (!self.delegate) {
+        NSLog(@"%@", step);
+    }
+}
+
+- (void)countInsertedObjects
+{
+    NSUInteger pendingInserts = [[_context insertedObjects] count];
+    if (pendingInserts > _pendingInsertsAtStart) {
+        _currentStep.nrOfObjectsCreated += pendingInserts - _pendingInsertsAtStart;
+    }
+    _pendingInsertsAtStart = 0;
+}
+
+- (void)measure
+{
+    _currentStep.duration = -[_startDate timeIntervalSinceNow];
+    _currentStep.nrOfFetches = _context.numberOfFetchRequests - _fetchCountAtStart;
+    _currentStep.peakMemory = MAX(_currentStep.peakMemory, currentResidentMemory());
+}
+
+#pragma mark - Summary
+
+- (NSDictionary *)summary
+{
+    NSMutableArray *steps = [NSMutableArray arrayWithCapacity:[_steps count]];
+    NSTimeInterval totalDuration = 0;
+    uint64_t peakMemory = 0;
+    for (ATLImportStepMetrics *step in _steps) {
+        [steps addObject:step.dictionaryRepresentation];
+        totalDuration += step.duration;
+        peakMemory = MAX(peakMemory, step.peakMemory);
+    }
+    return @{@"steps": steps, @"duration": @(totalDuration), @"peakMemory": @(peakMemory)};
+}
+
+- (NSData *)JSONSummary
+{
+    return [NSJSONSerialization dataWithJSONObject:self.summary options:NSJSONWritingPrettyPrinted error:NULL];
+}
+
+@end
+
+uint64_t currentResidentMemory(void)
+{
+    struct mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.resident_size;
+}
@@ -68,10 +68,10 @@
 
 #pragma mark - XML representation
 
-- (void)appendAttributesToXMLString:(NSMutableString *)output
+- (void)writeXMLAttributesWithWriter:(ATLXMLWriter *)writer
 {
-    [super appendAttributesToXMLString:output];
-    [output appendFormat:@" sameDirection=\"%@\"", self.sameDirection ? @"yes" : @"no"];
+    [super writeXMLAttributesWithWriter:writer];
+    [writer writeCString:self.sameDirection ? " sameDirection=\"yes\"" : " sameDirection=\"no\""];
 }
 
 @end
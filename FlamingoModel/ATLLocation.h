@@ -50,6 +50,12 @@
 @property (nonatomic, readonly) CLLocationCoordinate2D coordinate;
 @property (nonatomic, readonly) double latitude, longitude;
 
+/**
+ The average of the current route positions, kCLLocationCoordinate2DInvalid without positions.
+ coordinate caches this value on first use and does not follow later changes of the positions.
+ */
+@property (nonatomic, readonly) CLLocationCoordinate2D averagedCoordinate;
+
 // Path finding
 @property (weak) ATLPathNode *pathNode;
 
@@ -74,19 +74,38 @@
 - (CLLocationCoordinate2D)coordinate
 {
     if (_coordinate.latitude == 0.0 && _coordinate.longitude == 0.0) {
-        double lat_sum = 0;
-        double lon_sum = 0;
-        int counter = 0;
-        for (ATLRoutePosition *position in self.routePositions) {
-            lat_sum += position.latitude;
-            lon_sum += position.longitude;
-            counter ++;
+        CLLocationCoordinate2D coordinate = self.averagedCoordinate;
+        // Without positions there is nothing to cache yet
+        if (!CLLocationCoordinate2DIsValid(coordinate)) {
+            return coordinate;
         }
-        _coordinate = CLLocationCoordinate2DMake(lat_sum/counter, lon_sum/counter);
+        _coordinate = coordinate;
     }
     return _coordinate;
 }
 
+- (CLLocationCoordinate2D)averagedCoordinate
+{
+    double lat_sum = 0;
+    double lon_sum = 0;
+    int counter = 0;
+    for (ATLRoutePosition *position in self.routePositions) {
+        lat_sum += position.latitude;
+        lon_sum += position.longitude;
+        counter ++;
+    }
+    if (counter == 0) {
+        return kCLLocationCoordinate2DInvalid;
+    }
+    return CLLocationCoordinate2DMake(lat_sum/counter, lon_sum/counter);
+}
+
+- (void)didTurnIntoFault
+{
+    [super didTurnIntoFault];
+    _coordinate = CLLocationCoordinate2DMake(0.0, 0.0);
+}
+
 - (double)latitude
 {
     return self.coordinate.latitude;
@@ -254,15 +273,15 @@
 
 #pragma mark - XML representation
 
-- (void)appendDataToXMLString:(NSMutableString *)output
+- (void)writeXMLDataWithWriter:(ATLXMLWriter *)writer
 {
-    [super appendDataToXMLString:output];
+    [super writeXMLDataWithWriter:writer];
     if ([self.routePositions count] > 0) {
-        [output appendString:@"<positions>\n"];
+        [writer writeCString:"<positions>\n"];
         for (ATLRoutePosition *position in self.routePositions) {
-            [output appendString:[position xmlRouteRef]];
+            [position writeXMLRouteRefWithWriter:writer];
         }
-        [output appendString:@"</positions>\n"];
+        [writer writeCString:"</positions>\n"];
     }
 }
 
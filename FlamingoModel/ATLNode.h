@@ -22,7 +22,7 @@
 #import <CoreLocation/CoreLocation.h>
 #import "GeoMetricFunctions.h"
 
-@class ATLRoute;
+@class ATLRoute, ATLXMLWriter;
 
 @interface ATLNode : NSObject <NSCoding>
 
@@ -40,6 +40,6 @@
 - (PolarSize)polarSizeBetween:(CLLocationCoordinate2D)coord1 and:(CLLocationCoordinate2D)coord2;
 
 // XML representation
-- (NSString*)xmlString;
+- (void)writeXMLWithWriter:(ATLXMLWriter*)writer;
 
 @end
@@ -19,6 +19,7 @@
 //
 
 #import "ATLNode.h"
+#import "ATLXMLWriter.h"
 
 @implementation ATLNode
 
@@ -79,10 +80,15 @@
 
 #pragma mark - XML representation
 
-- (NSString *)xmlString
+- (void)writeXMLWithWriter:(ATLXMLWriter *)writer
 {
-    NSString *format = @"\t<node lat=\"%.7f\" lon=\"%.7f\" radius=\"%0d\" km_a=\"%.3f\" km_b=\"%.3f\"/>\n";
-    return [NSString stringWithFormat:format, self.coordinate.latitude, self.coordinate.longitude, self.radius, self.km_a, self.km_b];
+    [writer writeCString:"\t<node"];
+    [writer writeAttribute:"lat" doubleValue:self.coordinate.latitude decimals:7];
+    [writer writeAttribute:"lon" doubleValue:self.coordinate.longitude decimals:7];
+    [writer writeAttribute:"radius" intValue:self.radius];
+    [writer writeAttribute:"km_a" doubleValue:self.km_a decimals:3];
+    [writer writeAttribute:"km_b" doubleValue:self.km_b decimals:3];
+    [writer writeCString:"/>\n"];
 }
 
 @end
@@ -61,16 +61,16 @@
 
 #pragma mark - XML representation
 
-- (void)appendAttributesToXMLString:(NSMutableString *)output
+- (void)writeXMLAttributesWithWriter:(ATLXMLWriter *)writer
 {
-    [super appendAttributesToXMLString:output];
-    [output appendFormat:@" name=\"%@\"", self.name];
+    [super writeXMLAttributesWithWriter:writer];
+    [writer writeAttribute:"name" string:self.name];
 }
 
-- (void)appendDataToXMLString:(NSMutableString *)output
+- (void)writeXMLDataWithWriter:(ATLXMLWriter *)writer
 {
-    [super appendDataToXMLString:output];
-    [output appendFormat:@"<icon>%@</icon>\n", self.iconName];
+    [super writeXMLDataWithWriter:writer];
+    [writer writeElement:"icon" text:self.iconName];
 }
 
 @end
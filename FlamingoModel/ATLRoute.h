@@ -59,7 +59,12 @@ void ATLBoundsExtend(ATLBounds *bounds, CLLocationCoordinate2D coordinate);
 @property (nonatomic, readonly) ATLNode *firstNode, *lastNode;
 - (ATLNode *)nodeAtIndex:(NSUInteger)index;
 
-// Derived points
+/**
+ Derived geometry is cached until the heartline is replaced, call this after changing its nodes in place.
+ */
+- (void)resetGeometry;
+
+// Derived points, zero for an index outside the heartline
 - (CLLocationCoordinate2D)coordinateAAtIndex:(NSUInteger)index;
 - (CLLocationCoordinate2D)coordinateBAtIndex:(NSUInteger)index;
 - (CLLocationCoordinate2D)coordinateCAtIndex:(NSUInteger)index;
@@ -77,8 +82,19 @@ void ATLBoundsExtend(ATLBounds *bounds, CLLocationCoordinate2D coordinate);
 
 // Querying the route
 - (RoutePosition)projectionOfCoordinate:(CLLocationCoordinate2D)coordinate withAccuracy:(double)accuracy;
+
+/**
+ Projections of count coordinates at once, coordinates that are not within accuracy of the route get INVALID_POSITION.
+ */
+- (void)getProjections:(RoutePosition *)projections ofCoordinates:(const CLLocationCoordinate2D *)coordinates
+                 count:(NSUInteger)count withAccuracy:(double)accuracy;
 - (ATLGeoReference)geoReferenceForPosition:(double)km;
 
+/**
+ Geo references for count positions in one forward sweep along the heartline, positions should be in ascending order.
+ */
+- (void)getGeoReferences:(ATLGeoReference *)references forPositions:(const double *)positions count:(NSUInteger)count;
+
 // Managing subroutes
 - (ATLRouteOverlay*)overlayBetweenKM:(float)startKM andKM:(float)endKM;
 - (ATLSubRoute*)subRouteNamed:(NSString *)name;
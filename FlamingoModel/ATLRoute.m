@@ -22,9 +22,159 @@
 #import "ATLSubRoute.h"
 #import "ATLRouteOverlay.h"
 
-typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
+#import "NSManagedObjectContext+FFEUtilities.h"
+
+/**
+ Geometry derived from the heartline, cached per node because every route query needs it for the same nodes.
+ Segments run from b of the previous node to a, arcs run around c from a to b; all are measured at the node.
+ */
+typedef struct {
+    CLLocationCoordinate2D a, b, c;
+    double km_a, km_b;
+    double radius;
+    double angle;               // change of direction at the node
+    PolarSize inSegment;        // from b of the previous node to a
+    PolarSize outSegment;       // from b to a of the next node
+    PolarSize arcStart;         // from c to a
+    double arcAngle;            // from c, between a and b
+    double horScale;            // meters per degree of longitude at the node
+    double outX, outY;          // direction of the outgoing segment
+    double capX, capY;          // direction from c towards the start of the arc
+} ATLNodeGeometry;
+
+/*
+ Projection handles four coordinates at once in clang vector types, which compile to SSE or NEON instructions.
+ */
+#define PROJECTION_LANES    4
+
+typedef double ATLDouble4 __attribute__((ext_vector_type(PROJECTION_LANES)));
+typedef __typeof__((ATLDouble4){0} < (ATLDouble4){0}) ATLMask4;      // the type of lane wise comparisons
+
+static inline ATLDouble4 selectLanes(ATLMask4 mask, ATLDouble4 a, ATLDouble4 b)
+{
+    return (ATLDouble4)(((ATLMask4)a & mask) | ((ATLMask4)b & ~mask));
+}
+
+static inline BOOL anyLane(ATLMask4 mask)
+{
+    return (mask.x | mask.y | mask.z | mask.w) != 0;
+}
+
+static inline BOOL allLanes(ATLMask4 mask)
+{
+    return (mask.x & mask.y & mask.z & mask.w) != 0;
+}
+
+/**
+ Finds the first segment on which each coordinate lies within accuracy,
+ the coordinate is rotated into the direction of the segment instead of comparing polar angles.
+ */
+static void projectOntoSegments(const ATLNodeGeometry *geometry, NSUInteger nrOfNodes, ATLDouble4 latitude, ATLDouble4 longitude,
+                                double accuracy, ATLDouble4 *km, ATLDouble4 *transversal, ATLMask4 *found)
+{
+    for (NSUInteger index = 0; index + 1 < nrOfNodes; index++) {
+        const ATLNodeGeometry *node = &geometry[index];
+        double length = node->outSegment.length;
+        ATLDouble4 x = (longitude - node->b.longitude) * node->horScale;
+        ATLDouble4 y = (latitude - node->b.latitude) * VER_SCALE;
+        ATLDouble4 along = x * node->outX + y * node->outY;
+        ATLDouble4 across = y * node->outX - x * node->outY;
+        ATLMask4 hit = ~*found & (x * x + y * y < length * length) & (across > -accuracy) & (across < accuracy) & (along > 0);
+        if (anyLane(hit)) {
+            *km = selectLanes(hit, node->km_b + along / 1000, *km);
+            *transversal = selectLanes(hit, across, *transversal);
+            *found |= hit;
+            if (allLanes(*found)) {
+                return;
+            }
+        }
+    }
+}
+
+/**
+ Finds the first curve around which each coordinate lies within accuracy. Only coordinates within the ring
+ around the center of a curve need their angle, which is rare enough to calculate per coordinate.
+ */
+static void projectOntoCurves(const ATLNodeGeometry *geometry, NSUInteger nrOfNodes, ATLDouble4 latitude, ATLDouble4 longitude,
+                              double accuracy, ATLDouble4 *km, ATLDouble4 *transversal, ATLMask4 *found)
+{
+    for (NSUInteger index = 1; index + 1 < nrOfNodes; index++) {
+        const ATLNodeGeometry *node = &geometry[index];
+        double radius = node->radius;
+        if (radius <= 0) {
+            continue;
+        }
+        double innerRadius = MAX(radius - accuracy, 0);
+        double outerRadius = radius + accuracy;
+        ATLDouble4 x = (longitude - node->c.longitude) * node->horScale;
+        ATLDouble4 y = (latitude - node->c.latitude) * VER_SCALE;
+        ATLDouble4 distance2 = x * x + y * y;
+        ATLMask4 ring = ~*found & (distance2 > innerRadius * innerRadius) & (distance2 < outerRadius * outerRadius);
+        if (!anyLane(ring)) {
+            continue;
+        }
+        for (NSUInteger lane = 0; lane < PROJECTION_LANES; lane++) {
+            if (!ring[lane]) {
+                continue;
+            }
+            double angleDif = atan2(node->capX * y[lane] - node->capY * x[lane], node->capX * x[lane] + node->capY * y[lane]);
+            double curveAngle = node->angle;
+            if ((curveAngle > 0 && angleDif > 0 && angleDif < curveAngle) ||
+                (curveAngle < 0 && angleDif < 0 && angleDif > curveAngle)) {
+                (*km)[lane] = node->km_a + fabs(angleDif) * radius / 1000;
+                (*transversal)[lane] = sqrt(distance2[lane]) - radius;
+                (*found)[lane] = -1;
+            }
+        }
+        if (allLanes(*found)) {
+            return;
+        }
+    }
+}
+
+static CLLocationCoordinate2D derivedCoordinate(ATLNode *node, PolarSize previousPolar, PolarSize nextPolar, PointType type)
+{
+    CLLocationCoordinate2D coord = node.coordinate;
+    if (node.radius == 0) return coord;
+    
+    PolarSize linePolar = (type == pointA) ? previousPolar : nextPolar;
+    
+    double angle = rangeMinusPiPlusPi(M_PI + nextPolar.angle - previousPolar.angle);
+    double complementaryAngle;
+    if (angle < 0) {
+        complementaryAngle = -(M_PI + angle);
+        angle = -angle;
+    } else {
+        complementaryAngle = (M_PI - angle);
+    }
+    
+    switch (type) {
+        case pointA:
+        case pointB:
+            linePolar.length = node.radius * tan(angle / 2);
+            break;
+            
+        case pointC:
+            linePolar.length = node.radius / cos(angle / 2);
+            linePolar.angle += complementaryAngle / 2;
+            break;
+            
+        default:
+            NSLog(@"derivedCoordinate received unknown type: %d", type);
+            break;
+    }
 
-@implementation ATLRoute
+    CoordinateSize delta = [node coordinateSizeFromMeterSize:cartesianSizeFromPolar(linePolar)];
+    coord.latitude += delta.deltaLat;
+    coord.longitude += delta.deltaLon;
+    return coord;
+}
+
+@implementation ATLRoute {
+    NSData *_geometryData;
+    const ATLNodeGeometry *_geometry;
+    NSUInteger _nrOfGeometryNodes;
+}
 
 #pragma mark - Core Data properties
 
@@ -60,6 +210,20 @@ typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
 
 #pragma mark - Accessing the heartline
 
+- (void)setHeartLine:(NSArray *)heartLine
+{
+    [self willChangeValueForKey:@"heartLine"];
+    [self setPrimitiveValue:heartLine forKey:@"heartLine"];
+    [self didChangeValueForKey:@"heartLine"];
+    [self resetGeometry];
+}
+
+- (void)didTurnIntoFault
+{
+    [super didTurnIntoFault];
+    [self resetGeometry];
+}
+
 - (ATLNode *)firstNode
 {
     [self willAccessValueForKey:@"firstNode"];
@@ -93,67 +257,92 @@ typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
 
 - (double)angleAtIndex:(NSInteger)index
 {
-    PolarSize next = [self polarSizeBetweenIndex:index andIndex:index + 1];
-    PolarSize previous = [self polarSizeBetweenIndex:index andIndex:index - 1];
-    return rangeMinusPiPlusPi(M_PI + next.angle - previous.angle);
+    return [self geometryAtIndex:index]->angle;
 }
 
 - (CLLocationCoordinate2D)coordinateAAtIndex:(NSUInteger)index
 {
-    return [self derivedCoordinateAtIndex:index ofType:pointA];
+    return [self geometryAtIndex:index]->a;
 }
 
 - (CLLocationCoordinate2D)coordinateBAtIndex:(NSUInteger)index
 {
-    return [self derivedCoordinateAtIndex:index ofType:pointB];
+    return [self geometryAtIndex:index]->b;
 }
 
 - (CLLocationCoordinate2D)coordinateCAtIndex:(NSUInteger)index
 {
-    return [self derivedCoordinateAtIndex:index ofType:pointC];
+    return [self geometryAtIndex:index]->c;
 }
 
-#pragma mark Utility methods
+#pragma mark Geometry cache
 
-- (CLLocationCoordinate2D)derivedCoordinateAtIndex:(NSInteger)index ofType:(PointType)type
+- (void)resetGeometry
 {
-    ATLNode *node = [self nodeAtIndex:index];
-    CLLocationCoordinate2D coord = node.coordinate;
-    if (node.radius == 0) return coord;
-    
-    PolarSize previousPolar = [self polarSizeBetweenIndex:index andIndex:index - 1];
-    PolarSize nextPolar = [self polarSizeBetweenIndex:index andIndex:index + 1];
-    PolarSize linePolar = (type == pointA) ? previousPolar : nextPolar;
-    
-    double angle = rangeMinusPiPlusPi(M_PI + nextPolar.angle - previousPolar.angle);
-    double complementaryAngle;
-    if (angle < 0) {
-        complementaryAngle = -(M_PI + angle);
-        angle = -angle;
-    } else {
-        complementaryAngle = (M_PI - angle);
+    _geometryData = nil;
+    _geometry = NULL;
+    _nrOfGeometryNodes = 0;
+}
+
+- (const ATLNodeGeometry *)geometryAtIndex:(NSUInteger)index
+{
+    if (!_geometry) {
+        [self buildGeometry];
     }
-    
-    switch (type) {
-        case pointA:
-        case pointB:
-            linePolar.length = node.radius * tan(angle / 2);
-            break;
-            
-        case pointC:
-            linePolar.length = node.radius / cos(angle / 2);
-            linePolar.angle += complementaryAngle / 2;
-            break;
-            
-        default:
-            NSLog(@"derivedPointInDirection:type: received unknown type: %d", type);
-            break;
+    // Like the polar sizes, an index outside the heartline gives zeroes
+    static const ATLNodeGeometry noGeometry;
+    if (index >= _nrOfGeometryNodes) {
+        return &noGeometry;
     }
-
-    CoordinateSize delta = [node coordinateSizeFromMeterSize:cartesianSizeFromPolar(linePolar)];
-    coord.latitude += delta.deltaLat;
-    coord.longitude += delta.deltaLon;
-    return coord;
+    return &_geometry[index];
+}
+
+/**
+ Derives the curve points, segments and arcs of all nodes at once,
+ every node only needs the polar sizes towards its neighbours.
+ */
+- (void)buildGeometry
+{
+    NSArray *heartLine = self.heartLine;
+    NSUInteger count = [heartLine count];
+    NSMutableData *data = [NSMutableData dataWithLength:MAX(count, 1) * sizeof(ATLNodeGeometry)];
+    ATLNodeGeometry *geometry = [data mutableBytes];
+
+    for (NSUInteger index = 0; index < count; index++) {
+        ATLNode *node = heartLine[index];
+        PolarSize previousPolar = index > 0 ? [node polarSizeBetween:node.coordinate and:[heartLine[index - 1] coordinate]] : polarSizeMake(0, 0);
+        PolarSize nextPolar = index + 1 < count ? [node polarSizeBetween:node.coordinate and:[heartLine[index + 1] coordinate]] : polarSizeMake(0, 0);
+        ATLNodeGeometry *nodeGeometry = &geometry[index];
+        nodeGeometry->km_a = node.km_a;
+        nodeGeometry->km_b = node.km_b;
+        nodeGeometry->radius = node.radius;
+        nodeGeometry->angle = rangeMinusPiPlusPi(M_PI + nextPolar.angle - previousPolar.angle);
+        nodeGeometry->a = derivedCoordinate(node, previousPolar, nextPolar, pointA);
+        nodeGeometry->b = derivedCoordinate(node, previousPolar, nextPolar, pointB);
+        nodeGeometry->c = derivedCoordinate(node, previousPolar, nextPolar, pointC);
+    }
+    for (NSUInteger index = 0; index < count; index++) {
+        ATLNode *node = heartLine[index];
+        ATLNodeGeometry *nodeGeometry = &geometry[index];
+        if (index > 0) {
+            nodeGeometry->inSegment = [node polarSizeBetween:geometry[index - 1].b and:nodeGeometry->a];
+        }
+        if (index + 1 < count) {
+            nodeGeometry->outSegment = [node polarSizeBetween:nodeGeometry->b and:geometry[index + 1].a];
+        }
+        nodeGeometry->arcStart = [node polarSizeBetween:nodeGeometry->c and:nodeGeometry->a];
+        PolarSize arcEnd = [node polarSizeBetween:nodeGeometry->c and:nodeGeometry->b];
+        nodeGeometry->arcAngle = rangeMinusPiPlusPi(arcEnd.angle - nodeGeometry->arcStart.angle);
+        nodeGeometry->horScale = horScaleForLatitude(node.coordinate.latitude);
+        nodeGeometry->outX = cos(nodeGeometry->outSegment.angle);
+        nodeGeometry->outY = sin(nodeGeometry->outSegment.angle);
+        double capAngle = rangeMinusPiPlusPi(nodeGeometry->inSegment.angle - capInCurveDirection(nodeGeometry->angle));
+        nodeGeometry->capX = cos(capAngle);
+        nodeGeometry->capY = sin(capAngle);
+    }
+    _geometryData = data;
+    _geometry = geometry;
+    _nrOfGeometryNodes = count;
 }
 
 #pragma mark - Calculating route length
@@ -200,16 +389,14 @@ typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
 - (double)lengthOfSegmentAtIndex:(NSUInteger)index
 {
     if (index < 1 || index >= self.nrOfNodes) return 0;
-    ATLNode *node = [self nodeAtIndex:index];
-    PolarSize polar = [node polarSizeBetween:[self coordinateBAtIndex:index - 1] and:[self coordinateAAtIndex:index]];
-    return polar.length;
+    return [self geometryAtIndex:index]->inSegment.length;
 }
 
 - (double)lengthOfCurveAtIndex:(NSUInteger)index
 {
     if (index < 1 || index >= self.nrOfNodes) return 0;
-    ATLNode *node = [self nodeAtIndex:index];
-    return node.radius * fabs([self angleAtIndex:index]);
+    const ATLNodeGeometry *geometry = [self geometryAtIndex:index];
+    return geometry->radius * fabs(geometry->angle);
 }
 
 - (void)updateRoutePositioning
@@ -224,45 +411,67 @@ typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
         routeLength += [self lengthOfCurveAtIndex:i] / 1000;
         node.km_b = routeLength;
     }
+    // The nodes changed in place, so the cached positions are outdated
+    [self resetGeometry];
 }
 
 - (void)updateItemPositioning
 {
-    for (ATLRoutePosition *atlasPosition in self.positions) {
-        RoutePosition routePosition = [self projectionOfCoordinate:atlasPosition.location.coordinate withAccuracy:100];
-        if (validPosition(routePosition)) {
-            NSLog(@"item %@: %.3f >>> %.3f", atlasPosition.location.id_, atlasPosition.km, routePosition.km);
-            atlasPosition.km = routePosition.km;
+    NSArray *positions = [self.positions allObjects];
+    NSUInteger count = [positions count];
+    CLLocationCoordinate2D *coordinates = malloc(MAX(count, 1) * sizeof(CLLocationCoordinate2D));
+    RoutePosition *projections = malloc(MAX(count, 1) * sizeof(RoutePosition));
+    for (NSUInteger i = 0; i < count; i++) {
+        coordinates[i] = [[positions[i] location] coordinate];
+    }
+    [self getProjections:projections ofCoordinates:coordinates count:count withAccuracy:100];
+    for (NSUInteger i = 0; i < count; i++) {
+        ATLRoutePosition *atlasPosition = positions[i];
+        if (validPosition(projections[i])) {
+            NSLog(@"item %@: %.3f >>> %.3f", atlasPosition.location.id_, atlasPosition.km, projections[i].km);
+            atlasPosition.km = projections[i].km;
         }
     }
+    free(coordinates);
+    free(projections);
 }
 
 #pragma mark - Querying the route
 
 - (RoutePosition)projectionOfCoordinate:(CLLocationCoordinate2D)coordinate withAccuracy:(double)accuracy
 {
-    __block RoutePosition result = INVALID_POSITION;
-    __block BOOL hit = NO;
-    
-    [self onSegmentWithinRange:accuracy
-                  ofCoordinate:(CLLocationCoordinate2D)coordinate
-                       perform:^(ATLNode *start, CGSize delta){
-        hit = YES;
-        result.km = start.km_b + (delta.width / 1000);
-        result.transversal = delta.height;
-    }];
-    if (hit) return result;
-    
-    [self onCurveWithinRange:accuracy
-                ofCoordinate:(CLLocationCoordinate2D)coordinate
-                     perform:^(ATLNode *end, CGSize delta){
-        hit = YES;
-        result.km = end.km_a + (delta.width / 1000);
-        result.transversal = delta.height;
-    }];
+    RoutePosition result;
+    [self getProjections:&result ofCoordinates:&coordinate count:1 withAccuracy:accuracy];
     return result;
 }
 
+- (void)getProjections:(RoutePosition *)projections ofCoordinates:(const CLLocationCoordinate2D *)coordinates
+                 count:(NSUInteger)count withAccuracy:(double)accuracy
+{
+    NSUInteger nrOfNodes = self.nrOfNodes;
+    const ATLNodeGeometry *geometry = nrOfNodes > 0 ? [self geometryAtIndex:0] : NULL;
+    for (NSUInteger first = 0; first < count; first += PROJECTION_LANES) {
+        NSUInteger nrOfLanes = MIN(PROJECTION_LANES, count - first);
+        ATLDouble4 latitude, longitude;
+        for (NSUInteger lane = 0; lane < PROJECTION_LANES; lane++) {
+            // Unused lanes repeat the last coordinate
+            CLLocationCoordinate2D coordinate = coordinates[first + MIN(lane, nrOfLanes - 1)];
+            latitude[lane] = coordinate.latitude;
+            longitude[lane] = coordinate.longitude;
+        }
+        ATLDouble4 km = INVALID_KM;
+        ATLDouble4 transversal = 0;
+        ATLMask4 found = 0;
+        projectOntoSegments(geometry, nrOfNodes, latitude, longitude, accuracy, &km, &transversal, &found);
+        if (!allLanes(found)) {
+            projectOntoCurves(geometry, nrOfNodes, latitude, longitude, accuracy, &km, &transversal, &found);
+        }
+        for (NSUInteger lane = 0; lane < nrOfLanes; lane++) {
+            projections[first + lane] = routePositionMake(km[lane], transversal[lane]);
+        }
+    }
+}
+
 - (ATLGeoReference)geoReferenceForPosition:(double)km
 {
     BOOL curve = NO;
@@ -270,43 +479,75 @@ typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
     return [self geoReferenceForPosition:km index:&index inCurve:&curve];
 }
 
+- (void)getGeoReferences:(ATLGeoReference *)references forPositions:(const double *)positions count:(NSUInteger)count
+{
+    NSUInteger nrOfNodes = self.nrOfNodes;
+    NSUInteger index = 1;
+    for (NSUInteger i = 0; i < count; i++) {
+        double km = positions[i];
+        if (i > 0 && km < positions[i - 1]) {
+            // Out of order, search again instead of sweeping
+            BOOL curve = NO;
+            index = [self indexForPosition:km inCurve:&curve];
+        }
+        while (index < nrOfNodes && !(km < [self geometryAtIndex:index]->km_b)) {
+            index++;
+        }
+        if (index < nrOfNodes) {
+            references[i] = [self geoReferenceForPosition:km atIndex:index inCurve:!(km < [self geometryAtIndex:index]->km_a)];
+        } else {
+            references[i] = [self geoReferenceForPosition:km atIndex:nrOfNodes > 0 ? nrOfNodes - 1 : 0 inCurve:NO];
+        }
+    }
+}
+
 #pragma mark utility methods
 
+/**
+ Binary search for the first node that ends after km, the positions of the nodes increase along the heartline.
+ */
 - (NSUInteger)indexForPosition:(double)km inCurve:(BOOL *)curve
 {
-    for (NSUInteger i = 1; i < self.nrOfNodes; i++) {
-        ATLNode *node = [self nodeAtIndex:i];
-        if (km < node.km_a) {
-            *curve = NO;
-            return i;
-        }
-        if (km < node.km_b) {
-            *curve = YES;
-            return i;
+    NSUInteger count = self.nrOfNodes;
+    NSUInteger low = 1, high = count;
+    while (low < high) {
+        NSUInteger middle = (low + high) / 2;
+        if (km < [self geometryAtIndex:middle]->km_b) {
+            high = middle;
+        } else {
+            low = middle + 1;
         }
     }
-    *curve = NO;
-    return self.nrOfNodes - 1;
+    if (low >= count) {
+        *curve = NO;
+        return count - 1;
+    }
+    *curve = !(km < [self geometryAtIndex:low]->km_a);
+    return low;
 }
 
 - (ATLGeoReference)geoReferenceForPosition:(double)km index:(NSUInteger *)index inCurve:(BOOL *)curve
+{
+    *index = [self indexForPosition:km inCurve:curve];
+    return [self geoReferenceForPosition:km atIndex:*index inCurve:*curve];
+}
+
+- (ATLGeoReference)geoReferenceForPosition:(double)km atIndex:(NSUInteger)index inCurve:(BOOL)curve
 {
     ATLGeoReference reference;
     reference.coordinate = CLLocationCoordinate2DMake(999, 999);
     reference.heading = 0;
     
-    *index = [self indexForPosition:km inCurve:curve];
-    if (*index > 0) {
-        ATLNode *node = [self nodeAtIndex:*index];
+    if (index > 0) {
+        ATLNode *node = [self nodeAtIndex:index];
+        const ATLNodeGeometry *geometry = [self geometryAtIndex:index];
         PolarSize linePolar;
         
-        if (*curve) {
-            double positionAngle = 1000 * (km - node.km_a) / node.radius;
-            reference.coordinate = [self coordinateCAtIndex:*index];
-            linePolar = [node polarSizeBetween:reference.coordinate and:[self coordinateAAtIndex:*index]];
-            PolarSize endPolar = [node polarSizeBetween:reference.coordinate and:[self coordinateBAtIndex:*index]];
-            double curveAngle = rangeMinusPiPlusPi(endPolar.angle - linePolar.angle);
-            if (curveAngle < 0) {
+        if (curve) {
+            double positionAngle = 1000 * (km - geometry->km_a) / geometry->radius;
+            reference.coordinate = geometry->c;
+            linePolar = geometry->arcStart;
+            if (geometry->arcAngle < 0) {
                 linePolar.angle -= positionAngle;
                 reference.heading = rangeMinusPiPlusPi(linePolar.angle - M_PI_2);
             } else {
@@ -314,9 +555,9 @@ typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
                 reference.heading = rangeMinusPiPlusPi(linePolar.angle + M_PI_2);
             }
         } else {
-            reference.coordinate = [self coordinateBAtIndex:*index - 1];
-            linePolar = [node polarSizeBetween:reference.coordinate and:[self coordinateAAtIndex:*index]];
-            linePolar.length -= 1000 * (node.km_a - km);
+            reference.coordinate = [self geometryAtIndex:index - 1]->b;
+            linePolar = geometry->inSegment;
+            linePolar.length -= 1000 * (geometry->km_a - km);
             reference.heading = linePolar.angle;
         }
         CoordinateSize delta = [node coordinateSizeFromMeterSize:cartesianSizeFromPolar(linePolar)];
@@ -326,50 +567,6 @@ typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
     return reference;
 }
 
-- (void)onSegmentWithinRange:(double)range ofCoordinate:(CLLocationCoordinate2D)hitCoord perform:(ATLRangeInstructions)instructions
-{
-    for (NSUInteger index = 0; index < self.nrOfNodes - 1; index++) {
-        ATLNode *node = [self nodeAtIndex:index];
-        CLLocationCoordinate2D startCoord = [self coordinateBAtIndex:index];
-        PolarSize linePolar = [node polarSizeBetween:startCoord and:[self coordinateAAtIndex:index + 1]];
-        PolarSize hitPolar = [node polarSizeBetween:startCoord and:hitCoord];
-        
-        if (hitPolar.length < linePolar.length) {
-            hitPolar.angle -= linePolar.angle;
-            CGSize delta = cartesianSizeFromPolar(hitPolar);
-            if (delta.height > -range && delta.height < range && delta.width > 0) {
-                instructions(node, delta);
-                break;
-            }
-        }
-    }
-}
-
-- (void)onCurveWithinRange:(double)range ofCoordinate:(CLLocationCoordinate2D)coordinate perform:(ATLRangeInstructions)instructions
-{
-    for (NSUInteger index = 1; index < self.nrOfNodes - 1; index++) {
-        ATLNode *node = [self nodeAtIndex:index];
-        int radius = node.radius;
-        if (radius > 0) {
-            PolarSize hitPolar = [node polarSizeBetween:[self coordinateCAtIndex:index] and:coordinate];
-            if (hitPolar.length > radius - range && hitPolar.length < radius + range) {
-                PolarSize linePolar = [node polarSizeBetween:[self coordinateBAtIndex:index - 1] and:[self coordinateAAtIndex:index]];
-                double curveAngle = [self angleAtIndex:index];
-                double capAngle = rangeMinusPiPlusPi( linePolar.angle - capInCurveDirection(curveAngle) );
-                double angleDif = rangeMinusPiPlusPi( hitPolar.angle - capAngle );
-                if ( (curveAngle > 0 && angleDif > 0 && angleDif < curveAngle) ||
-                    (curveAngle < 0 && angleDif < 0 && angleDif > curveAngle)) {
-                    CGSize delta;
-                    delta.height = hitPolar.length - radius;
-                    delta.width = fabs(angleDif) * radius;
-                    instructions(node, delta);
-                    break;
-                }
-            }
-        }
-    }
-}
-
 #pragma mark - Managing subroutes
 
 - (ATLRouteOverlay *)overlayBetweenKM:(float)start andKM:(float)end
@@ -392,7 +589,7 @@ typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
     NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"ATLSubRoute"];
     NSPredicate *predicate = [NSPredicate predicateWithFormat:@"route = %@ and name = %@", self, name];
     [request setPredicate:predicate];
-    NSArray *result = [self.managedObjectContext executeFetchRequest:request error:NULL];
+    NSArray *result = [self.managedObjectContext fetchObjectsWithRequest:request];
     NSAssert([result count] <= 1, @"Subroutes must not have the same name");
     
     if ([result count] == 1) {
@@ -495,7 +692,7 @@ typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
     NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"ATLRoutePosition"];
     NSPredicate *predicate = [NSPredicate predicateWithFormat:@"route = %@ and km = %@", self, @(km)];
     [request setPredicate:predicate];
-    NSArray *result = [self.managedObjectContext executeFetchRequest:request error:NULL];
+    NSArray *result = [self.managedObjectContext fetchObjectsWithRequest:request];
     if ([result count] == 1) {
         ATLRoutePosition *position = result[0];
         return position.location;
@@ -518,41 +715,46 @@ typedef void (^ATLRangeInstructions)(ATLNode *node, CGSize delta);
 
 #pragma mark - XML representation
 
-- (void)appendAttributesToXMLString:(NSMutableString *)output
+- (void)writeXMLAttributesWithWriter:(ATLXMLWriter *)writer
 {
-    [super appendAttributesToXMLString:output];
-    [output appendFormat:@" name=\"%@\"", self.name];
+    [super writeXMLAttributesWithWriter:writer];
+    [writer writeAttribute:"name" string:self.name];
 }
 
-- (void)appendDataToXMLString:(NSMutableString *)output
+- (void)writeXMLDataWithWriter:(ATLXMLWriter *)writer
 {
-    [super appendDataToXMLString:output];
-    [output appendFormat:@"<origin>%@</origin>\n", self.origin];
-    [output appendFormat:@"<destination>%@</destination>\n", self.destination];
+    [super writeXMLDataWithWriter:writer];
+    [writer writeElement:"origin" text:self.origin];
+    [writer writeElement:"destination" text:self.destination];
     if (self.heartLine) {
-        [output appendString:@"<heartLine>\n"];
+        [writer writeCString:"<heartLine>\n"];
         for (ATLNode *node in self.heartLine) {
-            [output appendString:[node xmlString]];
+            [node writeXMLWithWriter:writer];
         }
-        [output appendString:@"</heartLine>\n"];
+        [writer writeCString:"</heartLine>\n"];
     }
+    // Sorting on the scalar accessors avoids the key value coding of NSSortDescriptor
     if ([self.subRoutes count] > 0) {
-        [output appendString:@"<subRoutes>\n"];
-        NSSortDescriptor *sort = [NSSortDescriptor sortDescriptorWithKey:@"start" ascending:YES];
-        NSArray *sortedSubRoutes = [self.subRoutes sortedArrayUsingDescriptors:@[sort]];
+        [writer writeCString:"<subRoutes>\n"];
+        NSArray *sortedSubRoutes = [self.subRoutes sortedArrayUsingComparator:^NSComparisonResult(ATLSubRoute *subRoute1, ATLSubRoute *subRoute2) {
+            float start1 = subRoute1.start, start2 = subRoute2.start;
+            return start1 < start2 ? NSOrderedAscending : (start1 > start2 ? NSOrderedDescending : NSOrderedSame);
+        }];
         for (ATLSubRoute *subRoute in sortedSubRoutes) {
-            [output appendString:[subRoute xmlString]];
+            [subRoute writeXMLWithWriter:writer];
         }
-        [output appendString:@"</subRoutes>\n"];
+        [writer writeCString:"</subRoutes>\n"];
     }
     if ([self.positions count] > 0) {
-        [output appendString:@"<positions>\n"];
-        NSSortDescriptor *sort = [NSSortDescriptor sortDescriptorWithKey:@"km" ascending:YES];
-        NSArray *sortedPositions = [self.positions sortedArrayUsingDescriptors:@[sort]];
+        [writer writeCString:"<positions>\n"];
+        NSArray *sortedPositions = [self.positions sortedArrayUsingComparator:^NSComparisonResult(ATLRoutePosition *position1, ATLRoutePosition *position2) {
+            float km1 = position1.km, km2 = position2.km;
+            return km1 < km2 ? NSOrderedAscending : (km1 > km2 ? NSOrderedDescending : NSOrderedSame);
+        }];
         for (ATLRoutePosition *position in sortedPositions) {
-            [output appendString:[position xmlItemRef]];
+            [position writeXMLItemRefWithWriter:writer];
         }
-        [output appendString:@"</positions>\n"];
+        [writer writeCString:"</positions>\n"];
     }
 }
 
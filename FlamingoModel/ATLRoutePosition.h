@@ -22,7 +22,7 @@
 #import <CoreData/CoreData.h>
 #import <CoreLocation/CoreLocation.h>
 
-@class ATLRoute, ATLLocation;
+@class ATLRoute, ATLLocation, ATLXMLWriter;
 
 @interface ATLRoutePosition : NSManagedObject
 
@@ -36,7 +36,7 @@
 
 
 // XML reperesentation
-- (NSString*)xmlRouteRef;
-- (NSString*)xmlItemRef;
+- (void)writeXMLRouteRefWithWriter:(ATLXMLWriter*)writer;
+- (void)writeXMLItemRefWithWriter:(ATLXMLWriter*)writer;
 
 @end
@@ -21,6 +21,7 @@
 #import "ATLRoutePosition.h"
 #import "ATLRoute.h"
 #import "ATLLocation.h"
+#import "ATLXMLWriter.h"
 
 @implementation ATLRoutePosition
 
@@ -44,16 +45,26 @@
 
 #pragma mark - XML representation
 
-- (NSString *)xmlItemRef
+- (void)writeXMLPositionWithWriter:(ATLXMLWriter *)writer
 {
-    return [NSString stringWithFormat:@"\t<ATLRoutePosition km=\"%.3f\" lat=\"%.7f\" lon=\"%.7f\" location=\"%@\"/>\n",
-            self.km, self.coordinate.latitude, self.coordinate.longitude, self.location.id_];
+    [writer writeCString:"\t<ATLRoutePosition"];
+    [writer writeAttribute:"km" doubleValue:self.km decimals:3];
+    [writer writeAttribute:"lat" doubleValue:self.coordinate.latitude decimals:7];
+    [writer writeAttribute:"lon" doubleValue:self.coordinate.longitude decimals:7];
 }
 
-- (NSString *)xmlRouteRef
+- (void)writeXMLItemRefWithWriter:(ATLXMLWriter *)writer
 {
-    return [NSString stringWithFormat:@"\t<ATLRoutePosition km=\"%.3f\" lat=\"%.7f\" lon=\"%.7f\" route=\"%@\"/>\n",
-            self.km, self.coordinate.latitude, self.coordinate.longitude, self.route.id_];
+    [self writeXMLPositionWithWriter:writer];
+    [writer writeAttribute:"location" string:self.location.id_];
+    [writer writeCString:"/>\n"];
+}
+
+- (void)writeXMLRouteRefWithWriter:(ATLXMLWriter *)writer
+{
+    [self writeXMLPositionWithWriter:writer];
+    [writer writeAttribute:"route" string:self.route.id_];
+    [writer writeCString:"/>\n"];
 }
 
 @end
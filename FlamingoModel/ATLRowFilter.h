@@ -0,0 +1,58 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLRowFilter.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+#import "ATLCSVReader.h"
+
+// Rule keys
+extern NSString * const ATLRowFilterExcludedAgenciesKey;    // NSArray of NSNumber, agency codes in route_id
+extern NSString * const ATLRowFilterCategoriesKey;          // NSArray of NSString, train categories in route_id
+extern NSString * const ATLRowFilterCategoryPrefixesKey;    // NSArray of NSString, prefixes of train categories
+extern NSString * const ATLRowFilterAllowedServicesKey;     // NSArray of NSString, service_ids, all are allowed when absent
+extern NSString * const ATLRowFilterDeniedServicesKey;      // NSArray of NSString, service_ids
+
+/**
+ ATLRowFilter decides which GTFS trips are imported, using rules on route_id (formatted like "100-IC",
+ the category ends at a following '-') and service_id. The rules are compiled into lookup tables
+ when the filter is created, so rows are tested on the raw bytes of their fields without creating strings.
+ Accepted trips are registered, so that their stop_times can be selected with the same kind of test.
+ */
+@interface ATLRowFilter : NSObject
+
+/**
+ The rules used for the NS feed: Dutch domestic trains, excluding international operators.
+ */
++ (instancetype)defaultFilter;
+
+- (instancetype)initWithRules:(NSDictionary *)rules;
+
+- (BOOL)acceptsRoute:(ATLCSVField)route service:(ATLCSVField)service;
+- (BOOL)acceptsRouteID:(NSString *)routeID;
+
+/**
+ Trips registered with addTrip: are accepted, when no trip has been registered all trips are accepted.
+ addTrip: must not be called while other threads use acceptsTrip:
+ */
+- (void)addTrip:(ATLCSVField)trip;
+- (BOOL)acceptsTrip:(ATLCSVField)trip;
+- (void)removeAllTrips;
+@property (nonatomic, readonly) NSUInteger nrOfTrips;
+
+@end
@@ -0,0 +1,283 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLRowFilter.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLRowFilter.h"
+#import "ATLFingerprint.h"
+
+NSString * const ATLRowFilterExcludedAgenciesKey = @"excludedAgencies";
+NSString * const ATLRowFilterCategoriesKey = @"categories";
+NSString * const ATLRowFilterCategoryPrefixesKey = @"categoryPrefixes";
+NSString * const ATLRowFilterAllowedServicesKey = @"allowedServices";
+NSString * const ATLRowFilterDeniedServicesKey = @"deniedServices";
+
+#define ROUTE_SEPARATOR     '-'
+#define MIN_SET_CAPACITY    16
+
+typedef struct {
+    uint64_t hash;
+    uint32_t offset;
+    uint32_t length;
+} ATLByteSetSlot;
+
+/**
+ Set of byte strings in an open addressing table, membership is tested by hash and confirmed with memcmp
+ */
+@interface ATLByteSet : NSObject
+
+@property (nonatomic, readonly) NSUInteger count;
+
+- (void)addBytes:(const char *)bytes length:(NSUInteger)length;
+- (BOOL)containsBytes:(const char *)bytes length:(NSUInteger)length;
+
+@end
+
+@implementation ATLByteSet {
+    ATLByteSetSlot *_slots;
+    NSUInteger _capacity;
+    NSMutableData *_heap;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _capacity = MIN_SET_CAPACITY;
+        _slots = calloc(_capacity, sizeof(ATLByteSetSlot));
+        _heap = [NSMutableData dataWithCapacity:256];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_slots);
+}
+
+static uint64_t hashOfBytes(const char *bytes, NSUInteger length)
+{
+    uint64_t hash = fingerprintBytes(FINGERPRINT_SEED, bytes, length);
+    return hash != 0 ? hash : 1;     // zero marks an empty slot
+}
+
+- (void)addBytes:(const char *)bytes length:(NSUInteger)length
+{
+    if ([self containsBytes:bytes length:length]) {
+        return;
+    }
+    if (2 * (_count + 1) > _capacity) {
+        [self grow];
+    }
+    ATLByteSetSlot slot = {hashOfBytes(bytes, length), (uint32_t)[_heap length], (uint32_t)length};
+    [_heap appendBytes:bytes length:length];
+    [self insertSlot:slot];
+    _count++;
+}
+
+- (BOOL)containsBytes:(const char *)bytes length:(NSUInteger)length
+{
+    uint64_t hash = hashOfBytes(bytes, length);
+    const char *heap = [_heap bytes];
+    NSUInteger mask = _capacity - 1;
+    for (NSUInteger i = hash & mask; _slots[i].hash != 0; i = (i + 1) & mask) {
+        if (_slots[i].hash == hash && _slots[i].length == length && memcmp(heap + _slots[i].offset, bytes, length) == 0) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (void)insertSlot:(ATLByteSetSlot)slot
+{
+    NSUInteger mask = _capacity - 1;
+    NSUInteger i = slot.hash & mask;
+    while (_slots[i].hash != 0) {
+        i = (i + 1) & mask;
+    }
+    _slots[i] = slot;
+}
+
+- (void)grow
+{
+    ATLByteSetSlot *oldSlots = _slots;
+    NSUInteger oldCapacity = _capacity;
+    _capacity *= 2;
+    _slots = calloc(_capacity, sizeof(ATLByteSetSlot));
+    for (NSUInteger i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i].hash != 0) {
+            [self insertSlot:oldSlots[i]];
+        }
+    }
+    free(oldSlots);
+}
+
+@end
+
+@implementation ATLRowFilter {
+    NSMutableData *_excludedAgencies;       // bitmap indexed by agency code
+    ATLByteSet *_categories;
+    NSArray *_categoryPrefixes;
+    BOOL _prefixStart[256];                 // first bytes of the category prefixes
+    ATLByteSet *_allowedServices;
+    ATLByteSet *_deniedServices;
+    ATLByteSet *_trips;
+}
+
+#pragma mark - Object lifecycle
+
++ (instancetype)defaultFilter
+{
+    NSDictionary *rules = @{ATLRowFilterExcludedAgenciesKey: @[@300,     // Thalys
+                                                              @310,     // EETC
+                                                              @910,     // DB
+                                                              @911,     // Keolis
+                                                              @920],    // NMBS
+                            ATLRowFilterCategoriesKey: @[@"IC",         // Intercity
+                                                         @"HSN"],       // Intercity direct
+                            ATLRowFilterCategoryPrefixesKey: @[@"S"]};  // Stoptrein, Sneltrein, Sprinter
+    return [[self alloc] initWithRules:rules];
+}
+
+- (instancetype)initWithRules:(NSDictionary *)rules
+{
+    self = [super init];
+    if (self) {
+        NSArray *agencies = rules[ATLRowFilterExcludedAgenciesKey];
+        NSUInteger maxAgency = 0;
+        for (NSNumber *agency in agencies) {
+            maxAgency = MAX(maxAgency, [agency unsignedIntegerValue]);
+        }
+        _excludedAgencies = [NSMutableData dataWithLength:maxAgency / 8 + 1];
+        uint8_t *bitmap = [_excludedAgencies mutableBytes];
+        for (NSNumber *agency in agencies) {
+            NSUInteger code = [agency unsignedIntegerValue];
+            bitmap[code / 8] |= 1 << (code % 8);
+        }
+
+        _categories = [self byteSetWithStrings:rules[ATLRowFilterCategoriesKey]];
+        NSMutableArray *prefixes = [NSMutableArray arrayWithCapacity:4];
+        for (NSString *prefix in rules[ATLRowFilterCategoryPrefixesKey]) {
+            NSData *bytes = [prefix dataUsingEncoding:NSUTF8StringEncoding];
+            if ([bytes length] > 0) {
+                [prefixes addObject:bytes];
+                _prefixStart[((const uint8_t *)[bytes bytes])[0]] = YES;
+            }
+        }
+        _categoryPrefixes = prefixes;
+
+        if (rules[ATLRowFilterAllowedServicesKey]) {
+            _allowedServices = [self byteSetWithStrings:rules[ATLRowFilterAllowedServicesKey]];
+        }
+        _deniedServices = [self byteSetWithStrings:rules[ATLRowFilterDeniedServicesKey]];
+        _trips = [ATLByteSet new];
+    }
+    return self;
+}
+
+- (ATLByteSet *)byteSetWithStrings:(NSArray *)strings
+{
+    ATLByteSet *set = [ATLByteSet new];
+    for (NSString *string in strings) {
+        const char *bytes = [string UTF8String];
+        [set addBytes:bytes length:strlen(bytes)];
+    }
+    return set;
+}
+
+#pragma mark - Filtering rows
+
+- (BOOL)acceptsRoute:(ATLCSVField)route service:(ATLCSVField)service
+{
+    if (!route.bytes) {
+        return NO;
+    }
+    const char *separator = memchr(route.bytes, ROUTE_SEPARATOR, route.length);
+    if (!separator) {
+        return NO;
+    }
+
+    // Agency code before the separator
+    NSUInteger agency = 0;
+    for (const char *p = route.bytes; p < separator && *p >= '0' && *p <= '9'; p++) {
+        agency = 10 * agency + (*p - '0');
+    }
+    if (agency / 8 < [_excludedAgencies length] && (((const uint8_t *)[_excludedAgencies bytes])[agency / 8] & (1 << (agency % 8)))) {
+        return NO;
+    }
+
+    // Train category after the separator, up to a next separator
+    const char *category = separator + 1;
+    const char *routeEnd = route.bytes + route.length;
+    const char *categoryEnd = memchr(category, ROUTE_SEPARATOR, routeEnd - category);
+    NSUInteger categoryLength = (categoryEnd ? categoryEnd : routeEnd) - category;
+    BOOL acceptedCategory = [_categories containsBytes:category length:categoryLength];
+    if (!acceptedCategory && categoryLength > 0 && _prefixStart[(uint8_t)category[0]]) {
+        for (NSData *prefix in _categoryPrefixes) {
+            if ([prefix length] <= categoryLength && memcmp([prefix bytes], category, [prefix length]) == 0) {
+                acceptedCategory = YES;
+                break;
+            }
+        }
+    }
+    if (!acceptedCategory) {
+        return NO;
+    }
+
+    if (service.bytes) {
+        if (_allowedServices && ![_allowedServices containsBytes:service.bytes length:service.length]) {
+            return NO;
+        }
+        if ([_deniedServices containsBytes:service.bytes length:service.length]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (BOOL)acceptsRouteID:(NSString *)routeID
+{
+    const char *bytes = [routeID UTF8String];
+    ATLCSVField route = {bytes, bytes ? strlen(bytes) : 0, NO};
+    ATLCSVField noService = {NULL, 0, NO};
+    return [self acceptsRoute:route service:noService];
+}
+
+#pragma mark - Filtering trips
+
+- (void)addTrip:(ATLCSVField)trip
+{
+    [_trips addBytes:trip.bytes length:trip.length];
+}
+
+- (BOOL)acceptsTrip:(ATLCSVField)trip
+{
+    return _trips.count == 0 || [_trips containsBytes:trip.bytes length:trip.length];
+}
+
+- (void)removeAllTrips
+{
+    _trips = [ATLByteSet new];
+}
+
+- (NSUInteger)nrOfTrips
+{
+    return _trips.count;
+}
+
+@end
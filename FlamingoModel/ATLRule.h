@@ -37,6 +37,8 @@ typedef NS_OPTIONS(uint16_t, ATLWeekdays) {
 
 @property (nonatomic) int32_t block;
 @property (nonatomic, retain) NSString * headsign;
+@property (nonatomic) int16_t headway;
+@property (nonatomic) int16_t lastOffset;
 @property (nonatomic) int32_t number;
 @property (nonatomic) int16_t offset;
 @property (nonatomic) BOOL upDirection;
@@ -50,6 +52,12 @@ typedef NS_OPTIONS(uint16_t, ATLWeekdays) {
 @property (nonatomic, readonly) NSString *offsetString;
 @property (nonatomic, readonly) NSString *weekdaysString;
 
+// Periodic rules stand for a departure every headway minutes, from offset up to and including lastOffset
+@property (nonatomic, readonly) BOOL isPeriodic;
+@property (nonatomic, readonly) NSUInteger nrOfInstances;
+- (void)setPeriodWithStart:(int16_t)start end:(int16_t)end headway:(int16_t)headway;
+- (void)enumerateOffsetsFrom:(int16_t)start to:(int16_t)end usingBlock:(void (^)(int16_t offset))block;
+
 + (NSArray*)arrangeRules:(NSSet*)rules inUpDirection:(BOOL)upDirection;
 
 @end
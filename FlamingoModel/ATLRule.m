@@ -25,6 +25,8 @@
 
 @dynamic block;
 @dynamic headsign;
+@dynamic headway;
+@dynamic lastOffset;
 @dynamic number;
 @dynamic offset;
 @dynamic upDirection;
@@ -76,6 +78,48 @@
     return numberOfSetBits(self.weekdays);
 }
 
+#pragma mark - Periodic rules
+
+- (BOOL)isPeriodic
+{
+    return self.headway > 0;
+}
+
+- (NSUInteger)nrOfInstances
+{
+    if (self.headway <= 0 || self.lastOffset < self.offset) {
+        return 1;
+    }
+    return (self.lastOffset - self.offset) / self.headway + 1;
+}
+
+/**
+ Follows frequencies.txt: departures from start every headway minutes, the last one before end
+ */
+- (void)setPeriodWithStart:(int16_t)start end:(int16_t)end headway:(int16_t)headway
+{
+    self.offset = start;
+    self.headway = MAX(headway, 1);
+    self.lastOffset = end > start ? start + ((end - start - 1) / self.headway) * self.headway : start;
+}
+
+- (void)enumerateOffsetsFrom:(int16_t)start to:(int16_t)end usingBlock:(void (^)(int16_t offset))block
+{
+    int16_t offset = self.offset;
+    if (!self.isPeriodic) {
+        if (offset >= start && offset <= end) {
+            block(offset);
+        }
+        return;
+    }
+    if (offset < start) {
+        offset += ((start - offset + self.headway - 1) / self.headway) * self.headway;
+    }
+    for (; offset <= MIN(end, self.lastOffset); offset += self.headway) {
+        block(offset);
+    }
+}
+
 + (NSArray *)arrangeRules:(NSSet *)rules inUpDirection:(BOOL)upDirection
 {
     NSPredicate *filter = [NSPredicate predicateWithFormat:@"upDirection == %@", @(upDirection)];
@@ -96,16 +140,27 @@
     self.upDirection = [dictionary[@"d"] isEqualToString:@"up"];
     self.weekdays = [dictionary[@"w"] intValue];
     self.headsign = dictionary[@"headsign"];
+    if (dictionary[@"hw"]) {
+        self.headway = [dictionary[@"hw"] intValue];
+        self.lastOffset = minutesFromString(dictionary[@"lo"]);
+    }
 }
 
 #pragma mark - Writing methods
 
-- (void)appendAttributesToXMLString:(NSMutableString *)output
+- (void)writeXMLAttributesWithWriter:(ATLXMLWriter *)writer
 {
-    [super appendAttributesToXMLString:output];
-    NSString *direction = self.upDirection ? @"up" : @"down";
-    [output appendFormat:@" nr=\"%d\" b=\"%d\" o=\"%@\" d=\"%@\" w=\"%d\" headsign=\"%@\"",
-     self.number, self.block, self.offsetString, direction, self.weekdays, self.headsign];
+    [super writeXMLAttributesWithWriter:writer];
+    [writer writeAttribute:"nr" intValue:self.number];
+    [writer writeAttribute:"b" intValue:self.block];
+    [writer writeAttribute:"o" minutes:self.offset];
+    [writer writeCString:self.upDirection ? " d=\"up\"" : " d=\"down\""];
+    [writer writeAttribute:"w" intValue:self.weekdays];
+    [writer writeAttribute:"headsign" string:self.headsign];
+    if (self.isPeriodic) {
+        [writer writeAttribute:"hw" intValue:self.headway];
+        [writer writeAttribute:"lo" minutes:self.lastOffset];
+    }
 }
 
 @end
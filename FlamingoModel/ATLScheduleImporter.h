@@ -20,10 +20,16 @@
 
 #import <Foundation/Foundation.h>
 #import <CoreData/CoreData.h>
+#import "ATLImportMetrics.h"
+#import "ATLRowFilter.h"
 
 typedef NS_OPTIONS(uint16_t, ATLScheduleImportOptions) {
     noImportOptions = 0,
-    includeCalendarExceptions = 1 << 0
+    includeCalendarExceptions = 1 << 0,
+    parallelStopTimes = 1 << 1,
+    incrementalImport = 1 << 2,
+    pipelinedImport = 1 << 3,
+    sortStopTimes = 1 << 4
 };
 
 typedef NS_ENUM(uint16_t, ATLScheduleImportStep) {
@@ -31,9 +37,33 @@ typedef NS_ENUM(uint16_t, ATLScheduleImportStep) {
     readCalendar,
     readTrips,
     readStopTimes,
+    readFrequencies,
     nrOfImportSteps
 };
 
+extern NSString * const ATLScheduleImporterErrorDomain;
+
+typedef NS_ENUM(NSInteger, ATLScheduleImporterError) {
+    missingFeedPeriodError = 1
+};
+
+/**
+ Summary of the changes made by an incremental import
+ */
+@interface ATLScheduleImportChanges : NSObject
+
+@property (nonatomic, readonly) NSSet *insertedTripIDs;
+@property (nonatomic, readonly) NSSet *updatedTripIDs;
+@property (nonatomic, readonly) NSSet *deletedTripIDs;
+@property (nonatomic, readonly) NSUInteger nrOfUnchangedTrips;
+
+/**
+ Series whose mission rules were inserted, updated or deleted, only services of these series need a new fillSchedule.
+ */
+@property (nonatomic, readonly) NSSet *changedSeriesIDs;
+
+@end
+
 @interface ATLScheduleImporter : NSObject
 
 
@@ -41,6 +71,8 @@ typedef NS_ENUM(uint16_t, ATLScheduleImportStep) {
 
 /**
  Instructs schedule importer to execute the import
+ When options include pipelinedImport, the files are tokenized on a background queue while
+ the objects of the preceding files are created. Objects are still created in step order on the calling thread.
  @param directory The directory where the GTFS files to be imported, are located
  @param managedObjectContext The managedObjectContext which is destination for the import
  @param options The options for the import
@@ -49,17 +81,67 @@ typedef NS_ENUM(uint16_t, ATLScheduleImportStep) {
          intoManagedObjectContext:(NSManagedObjectContext*)managedObjectContext
                       withOptions:(ATLScheduleImportOptions)options;
 
+/**
+ Imports a zipped GTFS feed without extracting it: every file is inflated in chunks and tokenized while it is inflated.
+ The files are imported in the same steps as from a directory, parallelStopTimes and pipelinedImport are ignored.
+ With sortStopTimes, stop_times is extracted to a temporary file, so that it can be checked and sorted.
+ @param archive The zip archive containing the GTFS files, at its root or in a single directory
+ */
+- (void)importContentsOfArchive:(NSURL*)archive
+       intoManagedObjectContext:(NSManagedObjectContext*)managedObjectContext
+                    withOptions:(ATLScheduleImportOptions)options;
+
+/**
+ Throughput measurements of every import step, assign a delegate to receive progress updates.
+ */
+@property (nonatomic, strong) ATLImportMetrics *metrics;
+
 
 #pragma mark - Testing interface
 
 @property (nonatomic, weak) NSManagedObjectContext *managedObjectContext;
 @property (nonatomic, assign) ATLScheduleImportOptions options;
 
+/**
+ Number of lines after which the import is saved, when zero (the default) each step is saved as a whole.
+ After every batch the saved objects are turned into faults and only their object IDs are retained,
+ so that memory usage does not grow with the size of the feed.
+ */
+@property (nonatomic, assign) NSUInteger batchSize;
+
+/**
+ When set, the trip index built during readTrips is written to this file and memory mapped during readStopTimes,
+ instead of being kept in memory.
+ */
+@property (nonatomic, strong) NSURL *tripIndexURL;
+
+/**
+ File holding a fingerprint of every trip of the previous import, used and updated when options include incrementalImport.
+ An incremental import only inserts, updates or deletes the mission rules of trips whose fingerprint changed.
+ When no fingerprints are available, stored mission rules are matched on their trip_id and all of them are updated.
+ The periods of frequencies.txt are fingerprinted per trip as well, so the import is only finished by the readFrequencies
+ step, which also runs when the feed has no frequencies.txt.
+ */
+@property (nonatomic, strong) NSURL *fingerprintsURL;
+@property (nonatomic, readonly) ATLScheduleImportChanges *lastImportChanges;
+
+/**
+ Imports a single GTFS file.
+ When options include parallelStopTimes, the readStopTimes step is split into shards at trip boundaries,
+ the shards are read concurrently and merged in file order, giving the same result as a serial import.
+ When options include sortStopTimes, stop_times is checked for trips whose rows are not contiguous,
+ such a file is sorted by trip_id and stop_sequence with an external merge sort before it is read.
+ */
 - (void)importContentsOfURL:(NSURL*)url forStep:(ATLScheduleImportStep)step;
 
 @property (nonatomic, readonly) NSDictionary *calendarRules;
 @property (nonatomic, readonly) NSArray *timePaths;
 
+/**
+ Rules selecting the trips to import, by default the rules for the NS feed.
+ */
+@property (nonatomic, strong) ATLRowFilter *rowFilter;
+
 - (BOOL)shouldImportTrainType:(NSString*)trainType;
 - (NSDate *)dateForIdentifier:(NSString *)identifier;
 - (NSSet *)allDatesOnWeekday:(int)weekdayIndex;
@@ -21,17 +21,26 @@
 #import "ATLScheduleImporter.h"
 
 #import "ATLCalendarRule.h"
+#import "ATLFeedCalendar.h"
+#import "ATLFingerprint.h"
 #import "ATLMissionRule.h"
 #import "ATLTimePath.h"
 #import "ATLTimePoint.h"
 #import "ATLSeries.h"
+#import "ATLTripIndex.h"
+#import "ATLTimePathIndex.h"
+#import "ATLRowFilter.h"
+#import "ATLZipArchive.h"
+#import "ATLStopTimesSorter.h"
 
-#import "CHCSVparser.h"
+#import "ATLCSVReader.h"
+#import "ATLError.h"
 #import "NSManagedObjectContext+FFEUtilities.h"
 
+#define MAX_STATION_CODE_LENGTH     60
+#define CHANGED_TRIPS_BATCH_SIZE    500
 
-#define TWELVE_HOURS        43200.0
-#define TWENTYFOUR_HOURS    86400.0
+NSString * const ATLScheduleImporterErrorDomain = @"nl.firstflamingo.scheduleimporter";
 
 typedef enum {
     feed_publisher_name,
@@ -70,6 +79,23 @@ typedef enum {
     drop_off_type
 } GTFSStopTimesFields;
 
+typedef enum {
+    frequency_trip_reference,
+    start_time,
+    end_time,
+    headway_secs,
+    exact_times
+} GTFSFrequenciesFields;
+
+/**
+ One line of frequencies.txt, in minutes
+ */
+typedef struct {
+    int16_t start;
+    int16_t end;
+    int16_t headway;
+} ATLPeriod;
+
 typedef enum {
     regularStopHandling = 0,
     noStopHandling = 1,
@@ -78,29 +104,128 @@ typedef enum {
 } GTFSStopHandling;
 
 ATLTimePointOptions optionsFromStopHandling(GTFSStopHandling dropOffType, GTFSStopHandling pickUpType);
+ATLTimePoint *timePointFromStopTimesLine(ATLCSVReader *reader, ATLSymbolCache *stationSymbols, ATLSymbolCache *platformSymbols);
+uint64_t fingerprintOfTripsLine(ATLCSVReader *reader, ATLCalendarRule *calendarRule);
+
+static const char *nextLineStart(const char *p, const char *end)
+{
+    const char *lineFeed = memchr(p, '\n', end - p);
+    return lineFeed ? lineFeed + 1 : end;
+}
+
+static const char *previousLineStart(const char *start, const char *p)
+{
+    while (p > start && p[-1] != '\n') {
+        p--;
+    }
+    return p;
+}
+
+static NSUInteger firstFieldLength(const char *p, const char *end)
+{
+    const char *q = p;
+    while (q < end && *q != ',' && *q != '\n' && *q != '\r') {
+        q++;
+    }
+    return q - p;
+}
+
+@interface ATLScheduleImporter () <ATLCSVReaderDelegate>
+
+@end
+
+@interface ATLScheduleImportChanges ()
+
+@property (nonatomic, strong) NSMutableSet *insertedTripIDs;
+@property (nonatomic, strong) NSMutableSet *updatedTripIDs;
+@property (nonatomic, strong) NSMutableSet *deletedTripIDs;
+@property (nonatomic, strong) NSMutableSet *changedSeriesIDs;
+@property (nonatomic, assign) NSUInteger nrOfUnchangedTrips;
+
+@end
+
+/**
+ Contents of one line in trips.txt, kept until its stop times are known during an incremental import
+ */
+@interface ATLTripRow : NSObject
+
+@property (nonatomic, strong) NSString *tripID;
+@property (nonatomic, strong) NSString *trainType;
+@property (nonatomic, strong) NSString *headsign;
+@property (nonatomic, assign) int number;
+@property (nonatomic, assign) int block;
+@property (nonatomic, assign) BOOL upDirection;
+@property (nonatomic, strong) ATLCalendarRule *calendarRule;
+@property (nonatomic, assign) uint64_t fingerprint;
+
+@end
+
+/**
+ Time points of one trip, as collected by an ATLStopTimesShard
+ */
+@interface ATLTripTimes : NSObject
 
-@interface ATLScheduleImporter () <CHCSVParserDelegate>
+/**
+ Normalizes the time points and packs them in the format of ATLTimePath.timePointsData
+ */
+- (instancetype)initWithTripID:(NSString *)tripID timePoints:(NSArray *)timePoints;
+
+@property (nonatomic, strong) NSString *tripID;
+@property (nonatomic, strong) NSArray *timePoints;
+@property (nonatomic, strong) NSData *pointsData;
+@property (nonatomic, assign) ATLMinutes offset;
+@property (nonatomic, assign) uint32_t hash_;
+
+@end
+
+/**
+ Reads a range of stop_times.txt that starts and ends at trip boundaries.
+ A shard only creates Foundation objects, so it can be parsed on any thread;
+ the results are merged into the managed object context afterwards.
+ */
+@interface ATLStopTimesShard : NSObject <ATLCSVReaderDelegate>
+
+- (instancetype)initWithData:(NSData *)data range:(NSRange)range tripIDs:(NSSet *)tripIDs rowFilter:(ATLRowFilter *)rowFilter;
+- (void)parse;
+
+@property (nonatomic, readonly) NSArray *trips;
+@property (nonatomic, readonly) NSUInteger nrOfRows;
+@property (nonatomic, readonly) NSRange range;
 
 @end
 
 @implementation ATLScheduleImporter {
     
     // Dates handling
-    NSDate *_startDate, *_endDate;
-    NSMutableDictionary *_datesByIdentifier;
-    NSMutableArray *_allDatesOnWeekday;
+    ATLFeedCalendar *_calendar;
     
     // Import flow
     ATLScheduleImportStep _importStep;
+    BOOL _saveFailed;               // stops the remaining steps, they depend on saved references
     
     // Intermediate results
-    NSMutableArray *_foundData;
     NSMutableDictionary *_calendarRules;
     NSMutableDictionary *_seriesDict;
-    NSMutableArray *_timePoints, *_datesOnWeekday;
-    NSMutableDictionary *_timePaths;
+    NSMutableArray *_timePoints;
+    NSMutableData *_serviceDays;
+    ATLTimePathIndex *_timePathIndex;
+    NSMutableArray *_unsavedSeriesIDs, *_unsavedPathEntries, *_unsavedTripIDs;
+    ATLTripIndex *_tripIndex;
+    ATLSymbolCache *_stationSymbols, *_platformSymbols;
+    
+    // Incremental import
+    NSMutableDictionary *_tripRows, *_fingerprints;
+    NSDictionary *_previousFingerprints, *_storedMissionRules;
+    NSMutableArray *_changedTrips;
+    NSMutableSet *_abandonedTimePaths;
+    ATLScheduleImportChanges *_changes;
     NSString *_identifier;
+    NSMutableData *_tripReference;
     ATLMissionRule *_missionRule;
+    
+    // Periodic trips
+    NSMutableDictionary *_periods, *_nrOfPeriods, *_periodFingerprints, *_tripOffsets;
+    NSDictionary *_previousPeriodFingerprints, *_previousNrOfPeriods;
 }
 
 #pragma mark - External interface
@@ -110,124 +235,248 @@ ATLTimePointOptions optionsFromStopHandling(GTFSStopHandling dropOffType, GTFSSt
 {
     self.managedObjectContext = managedObjectContext;
     self.options = options;
+    _saveFailed = NO;
     
-    for (ATLScheduleImportStep step = 0; step < nrOfImportSteps; step++) {
+    if (options & pipelinedImport) {
+        [self importContentsOfDirectoryInPipeline:directory];
+        return;
+    }
+    for (ATLScheduleImportStep step = 0; step < nrOfImportSteps && !_saveFailed; step++) {
         NSURL *fileURL = [directory URLByAppendingPathComponent:[self fileNameForStep:step]];
         [self importContentsOfURL:fileURL forStep:step];
     }
 }
 
+- (void)importContentsOfArchive:(NSURL *)archive intoManagedObjectContext:(NSManagedObjectContext *)managedObjectContext
+                    withOptions:(ATLScheduleImportOptions)options
+{
+    self.managedObjectContext = managedObjectContext;
+    self.options = options & ~(parallelStopTimes | pipelinedImport);
+    _saveFailed = NO;
+    
+    NSError *error = nil;
+    ATLZipArchive *zipArchive = [[ATLZipArchive alloc] initWithContentsOfURL:archive error:&error];
+    if (!zipArchive) {
+        NSLog(@"error: %@", error);
+        return;
+    }
+    for (ATLScheduleImportStep step = 0; step < nrOfImportSteps && !_saveFailed; step++) {
+        [self importMember:[self fileNameForStep:step] ofArchive:zipArchive forStep:step];
+    }
+}
+
+/**
+ Tokenizing runs ahead on a serial background queue, creating objects stays on the calling thread in step order.
+ This keeps the dependencies between the steps: trips are read after all calendar rules exist,
+ stop_times after the trip index is complete. stop_times itself is only prefetched, it is too large to keep tokenized.
+ */
+- (void)importContentsOfDirectoryInPipeline:(NSURL *)directory
+{
+    dispatch_queue_t queue = dispatch_queue_create("nl.firstflamingo.schedule-tokenizer", DISPATCH_QUEUE_SERIAL);
+    NSMutableArray *readers = [NSMutableArray arrayWithCapacity:nrOfImportSteps];
+    NSMutableArray *groups = [NSMutableArray arrayWithCapacity:nrOfImportSteps];
+    for (ATLScheduleImportStep step = 0; step < nrOfImportSteps; step++) {
+        NSURL *fileURL = [directory URLByAppendingPathComponent:[self fileNameForStep:step]];
+        ATLCSVReader *reader = [[ATLCSVReader alloc] initWithContentsOfCSVFile:fileURL.path];
+        dispatch_group_t group = dispatch_group_create();
+        dispatch_group_async(group, queue, ^{
+            if (step == readStopTimes) {
+                [reader prefetch];
+            } else {
+                [reader tokenize];
+            }
+        });
+        [readers addObject:reader];
+        [groups addObject:group];
+    }
+    for (ATLScheduleImportStep step = 0; step < nrOfImportSteps && !_saveFailed; step++) {
+        dispatch_group_wait(groups[step], DISPATCH_TIME_FOREVER);
+        NSURL *fileURL = [directory URLByAppendingPathComponent:[self fileNameForStep:step]];
+        [self importReader:readers[step] fromURL:fileURL forStep:step];
+        readers[step] = [NSNull null];
+    }
+}
+
 #pragma mark - Testing interface
 
+- (ATLImportMetrics *)metrics
+{
+    if (!_metrics) {
+        _metrics = [ATLImportMetrics new];
+    }
+    return _metrics;
+}
+
 - (void)importContentsOfURL:(NSURL *)url forStep:(ATLScheduleImportStep)step
 {
-    _importStep = step;
-    CHCSVParser *parser = [[CHCSVParser alloc] initWithContentsOfCSVFile:url.path];
-    parser.delegate = self;
-    [parser parse];
+    [self importReader:nil fromURL:url forStep:step];
 }
 
-- (NSDictionary *)calendarRules
+- (void)importReader:(ATLCSVReader *)reader fromURL:(NSURL *)url forStep:(ATLScheduleImportStep)step
 {
-    return _calendarRules;
+    if (step == readFrequencies && ![[NSFileManager defaultManager] fileExistsAtPath:url.path]) {
+        [self importMissingFrequencies];
+        return;
+    }
+    _importStep = step;
+    [self.metrics beginStep:[url lastPathComponent] managedObjectContext:self.managedObjectContext];
+    [self readContentsOfURL:url withReader:reader forStep:step];
+    [self.metrics endStep];
 }
 
-- (NSArray *)timePaths
+- (void)readContentsOfURL:(NSURL *)url withReader:(ATLCSVReader *)reader forStep:(ATLScheduleImportStep)step
 {
-    return [_timePaths allValues];
+    ATLStopTimesSorter *sorter = nil;
+    if (step == readStopTimes && (self.options & sortStopTimes)) {
+        sorter = [[ATLStopTimesSorter alloc] initWithContentsOfURL:url];
+        if ([sorter isSorted]) {
+            sorter = nil;
+        }
+    }
+    if (sorter) {
+        [self importStopTimesWithSorter:sorter];
+    } else if (step == readStopTimes && (self.options & parallelStopTimes)) {
+        [self importStopTimesInParallelFromURL:url];
+    } else {
+        if (!reader) {
+            reader = [[ATLCSVReader alloc] initWithContentsOfCSVFile:url.path];
+        }
+        reader.delegate = self;
+        reader.batchSize = self.batchSize;
+        [reader parse];
+        [self.metrics updateRows:reader.nrOfRecords bytes:reader.totalBytesRead];
+    }
 }
 
-#pragma mark - Dates handling
+/**
+ The checksum of a member is verified before its rows are read, a corrupt member must not leave rows behind,
+ which may already have been saved in batches when the checksum is only known at the end.
+ */
+- (void)importMember:(NSString *)fileName ofArchive:(ATLZipArchive *)archive forStep:(ATLScheduleImportStep)step
+{
+    if (step == readFrequencies && ![archive.memberNames containsObject:fileName]) {
+        [self importMissingFrequencies];
+        return;
+    }
+    _importStep = step;
+    [self.metrics beginStep:fileName managedObjectContext:self.managedObjectContext];
+    if (step == readStopTimes && (self.options & sortStopTimes)) {
+        [self importSortedMember:fileName ofArchive:archive];
+        [self.metrics endStep];
+        return;
+    }
+    NSError *error = nil;
+    if (![archive verifyMember:fileName error:&error]) {
+        [self reader:nil didFailWithError:error];
+        [self.metrics endStep];
+        return;
+    }
+    ATLCSVReader *reader = [[ATLCSVReader alloc] initForStreaming];
+    reader.delegate = self;
+    reader.batchSize = self.batchSize;
+    BOOL success = [archive enumerateChunksOfMember:fileName usingBlock:^(const void *bytes, NSUInteger length, BOOL *stop) {
+        [reader appendBytes:bytes length:length];
+    } error:&error];
+    if (success) {
+        [reader finishStreaming];
+    } else {
+        [self reader:reader didFailWithError:error];
+    }
+    [self.metrics updateRows:reader.nrOfRecords bytes:reader.totalBytesRead];
+    [self.metrics endStep];
+}
 
-- (int)nrOfDays
+/**
+ The sorter needs random access to the rows, so the member is extracted to a temporary file,
+ which verifies its checksum before any row is read.
+ */
+- (void)importSortedMember:(NSString *)fileName ofArchive:(ATLZipArchive *)archive
 {
-    NSDate *endDate = [_endDate dateByAddingTimeInterval:TWELVE_HOURS];
-    return ([endDate timeIntervalSinceDate:_startDate] / TWENTYFOUR_HOURS) + 1;
+    NSString *temporaryName = [NSString stringWithFormat:@"%@-%@", [[NSUUID UUID] UUIDString], fileName];
+    NSURL *url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:temporaryName]];
+    NSError *error = nil;
+    if ([archive extractMember:fileName toURL:url error:&error]) {
+        [self readContentsOfURL:url withReader:nil forStep:_importStep];
+        [[NSFileManager defaultManager] removeItemAtURL:url error:NULL];
+    } else {
+        [self reader:nil didFailWithError:error];
+    }
 }
 
-- (int)nrOfWeeks
+/**
+ Without frequencies.txt an incremental import still has to remove the periods of the previous import,
+ so it is read as an empty file.
+ */
+- (void)importMissingFrequencies
 {
-    return self.nrOfDays / 7;
+    _tripIndex = nil;
+    if (!_tripRows) {
+        return;
+    }
+    _importStep = readFrequencies;
+    [self.metrics beginStep:[self fileNameForStep:readFrequencies] managedObjectContext:self.managedObjectContext];
+    [self readerDidBeginDocument:nil];
+    [self readerDidEndDocument:nil];
+    [self.metrics endStep];
 }
 
-- (NSArray *)dateAndWeekdayForIdentifier:(NSString *)identifier
+- (void)importStopTimesWithSorter:(ATLStopTimesSorter *)sorter
 {
-    if (!_datesByIdentifier) {
-        [self generateDatesCollection];
+    ATLCSVReader *reader = [[ATLCSVReader alloc] initForStreaming];
+    reader.delegate = self;
+    reader.batchSize = self.batchSize;
+    NSError *error = nil;
+    BOOL success = [sorter enumerateSortedChunksUsingBlock:^(const void *bytes, NSUInteger length, BOOL *stop) {
+        [reader appendBytes:bytes length:length];
+    } error:&error];
+    if (success) {
+        [reader finishStreaming];
+    } else {
+        [self reader:reader didFailWithError:error];
     }
-    return _datesByIdentifier[identifier];
+    [self.metrics updateRows:reader.nrOfRecords bytes:reader.totalBytesRead];
+}
+
+- (NSDictionary *)calendarRules
+{
+    return _calendarRules;
 }
 
-- (int)weekdayIndexForIdentifier:(NSString *)identifier
+- (NSArray *)timePaths
 {
-    return [[self dateAndWeekdayForIdentifier:identifier][1] intValue];
+    NSArray *references = _timePathIndex.allReferences;
+    NSMutableArray *timePaths = [NSMutableArray arrayWithCapacity:[references count]];
+    for (id reference in references) {
+        [timePaths addObject:[self objectFromReference:reference]];
+    }
+    return timePaths;
 }
 
+#pragma mark - Dates handling
+
 - (NSDate *)dateForIdentifier:(NSString *)identifier
 {
-    return [self dateAndWeekdayForIdentifier:identifier][0];
+    return [_calendar dateForDay:[_calendar dayForIdentifier:identifier]];
 }
 
 - (NSSet *)allDatesOnWeekday:(int)weekdayIndex
 {
-    if (!_allDatesOnWeekday) {
-        [self generateDatesCollection];
-    }
-    return _allDatesOnWeekday[weekdayIndex];
+    return [_calendar datesForDays:[_calendar daysOnWeekday:weekdayIndex]];
 }
 
-- (void)generateDatesCollection
+#pragma mark - Import flow
+
+- (ATLRowFilter *)rowFilter
 {
-    _datesByIdentifier = [NSMutableDictionary dictionaryWithCapacity:self.nrOfDays];
-    _allDatesOnWeekday = [NSMutableArray arrayWithCapacity:7];
-    for (int i = 0; i < 7; i++) {
-        _allDatesOnWeekday[i] = [NSMutableSet setWithCapacity:self.nrOfWeeks + 1];
-    }
-    NSDate *date = _startDate;
-    NSDate *endDate = [_endDate dateByAddingTimeInterval:TWELVE_HOURS];
-    NSDateFormatter *df = [[NSDateFormatter alloc] init];
-    df.dateFormat = @"yyyyMMdd";
-    int weekday = date.weekdayIndex;
-    
-    while ([date compare:endDate] == NSOrderedAscending) {
-        NSString *identifier = [df stringFromDate:date];
-        _datesByIdentifier[identifier] = @[date, @(weekday)];
-        [_allDatesOnWeekday[weekday] addObject:date];
-        date = [date dateByAddingTimeInterval:TWENTYFOUR_HOURS];
-        weekday++;
-        if (weekday >=7) {
-            weekday = 0;
-        }
+    if (!_rowFilter) {
+        _rowFilter = [ATLRowFilter defaultFilter];
     }
+    return _rowFilter;
 }
 
-#pragma mark - Import flow
-
 - (BOOL)shouldImportTrainType:(NSString*)trainType
 {
-    NSArray *comps = [trainType componentsSeparatedByString:@"-"];
-    switch ([comps[0] intValue]) {
-        case 300: // Thalys
-            return NO;
-        case 310: // EETC
-            return NO;
-        case 910: // DB
-            return NO;
-        case 911: // Keolis
-            return NO;
-        case 920: // NMBS
-            return NO;
-    }
-    if ([[comps[1] substringToIndex:1] isEqualToString:@"S"]) { // Stoptrein, Sneltrein, Sprinter
-        return YES;
-    }
-    else if ([comps[1] isEqualToString:@"IC"]) { // Intercity
-        return YES;
-    }
-    else if ([comps[1] isEqualToString:@"HSN"]) { // Intercity direct
-        return YES;
-    }
-    return NO;
+    return [self.rowFilter acceptsRouteID:trainType];
 }
 
 - (NSString*)fileNameForStep:(ATLScheduleImportStep)step
@@ -245,6 +494,9 @@ ATLTimePointOptions optionsFromStopHandling(GTFSStopHandling dropOffType, GTFSSt
         case readStopTimes:
             return @"stop_times.txt";
             
+        case readFrequencies:
+            return @"frequencies.txt";
+            
         default:
             return nil;
     }
@@ -255,71 +507,674 @@ ATLTimePointOptions optionsFromStopHandling(GTFSStopHandling dropOffType, GTFSSt
     if (!_identifier) {
         return;
     }
-    int criterium = (self.nrOfWeeks / 2) + 1;
-    ATLWeekdays weekdays = noRegularWeekday;
-    NSMutableSet *runningDates = [NSMutableSet setWithCapacity:52];
-    NSMutableSet *notRunningDates = [NSMutableSet setWithCapacity:52];
-    for (int i = 0; i < 7; i++) {
-        if ([_datesOnWeekday[i] count] >= criterium) {
-            weekdays |= 1 << i;
-            NSMutableSet *exceptions = [[self allDatesOnWeekday:i] mutableCopy];
-            [exceptions minusSet:_datesOnWeekday[i]];
-            [notRunningDates unionSet:exceptions];
+    _calendarRules[_identifier] = [[ATLCalendarRule alloc] initWithCalendar:_calendar runningDays:[_serviceDays bytes]];
+    [_serviceDays resetBytesInRange:NSMakeRange(0, [_serviceDays length])];
+}
+
+- (void)createTimePath
+{
+    if (!_identifier) {
+        return;
+    }
+    if ((_missionRule || _tripRows[_identifier]) && [_timePoints count] > 0) {
+        ATLTripTimes *trip = [[ATLTripTimes alloc] initWithTripID:_identifier timePoints:_timePoints];
+        if (_missionRule) {
+            [self assignTripTimes:trip toMissionRule:_missionRule];
         } else {
-            [runningDates unionSet:_datesOnWeekday[i]];
+            [self importTripRow:_tripRows[_identifier] withTripTimes:trip];
         }
-        [_datesOnWeekday[i] removeAllObjects];
     }
-    ATLCalendarRule *calendarRule = [ATLCalendarRule new];
-    calendarRule.weekdays = weekdays;
-    calendarRule.runningDates = runningDates;
-    calendarRule.notRunningDates = notRunningDates;
-    _calendarRules[_identifier] = calendarRule;
+    _timePoints = [NSMutableArray arrayWithCapacity:30];
 }
 
-- (void)createTimePath
+- (void)assignTripTimes:(ATLTripTimes *)trip toMissionRule:(ATLMissionRule *)missionRule
 {
-    if (!_identifier) {
+    NSUInteger entry = [_timePathIndex entryForPointsData:trip.pointsData];
+    ATLTimePath *path = nil;
+    if (entry != NSNotFound) {
+        path = [self objectFromReference:[_timePathIndex referenceAtEntry:entry]];
+    }
+    if (!path) {
+        path = (ATLTimePath*)[self.managedObjectContext createManagedObjectOfType:@"ATLTimePath"];
+        path.hash_ = trip.hash_;
+        path.timePointsData = trip.pointsData;
+        if (entry == NSNotFound) {
+            entry = [_timePathIndex addPointsData:trip.pointsData reference:path];
+        } else {
+            [_timePathIndex setReference:path atEntry:entry];
+        }
+        [_unsavedPathEntries addObject:@(entry)];
+    }
+    missionRule.offset = trip.offset;
+    missionRule.timePath = path;
+}
+
+- (void)fillMissionRule:(ATLMissionRule *)missionRule withTripRow:(ATLTripRow *)row
+{
+    missionRule.id_ = row.tripID;
+    missionRule.number = row.number;
+    missionRule.upDirection = row.upDirection;
+    missionRule.block = row.block;
+    missionRule.headsign = row.headsign;
+    missionRule.trainType = row.trainType;
+    
+    missionRule.weekdays = row.calendarRule.weekdays;
+    missionRule.runningDates = row.calendarRule.runningDates;
+    missionRule.notRunningDates = row.calendarRule.notRunningDates;
+    missionRule.series = [self seriesWithID:missionRule.seriesID];
+    
+    // Periods are assigned again while reading frequencies.txt
+    missionRule.headway = 0;
+    missionRule.lastOffset = 0;
+}
+
+- (ATLSeries *)seriesWithID:(NSString *)seriesID
+{
+    if (!_seriesDict) {
+        _seriesDict = [NSMutableDictionary dictionaryWithCapacity:150];
+        _unsavedSeriesIDs = [NSMutableArray arrayWithCapacity:150];
+    }
+    ATLSeries *series = [self objectFromReference:_seriesDict[seriesID]];
+    if (!series) {
+        series = [self.managedObjectContext objectOfClass:[ATLSeries class] withModelID:seriesID create:YES];
+        _seriesDict[seriesID] = series;
+        [_unsavedSeriesIDs addObject:seriesID];
+    }
+    return series;
+}
+
+/**
+ The first period of a trip is stored in the mission rule of the trip itself,
+ every following period in a copy of that rule, so the number of rules grows with the periods, not with the departures.
+ An incremental import only rewrites the rules of trips whose periods changed, and removes the periods of trips
+ that are no longer in frequencies.txt.
+ */
+- (void)applyPeriods
+{
+    NSMutableSet *changedTripIDs = [NSMutableSet setWithCapacity:[_periods count]];
+    for (NSString *tripID in _periods) {
+        NSData *periods = _periods[tripID];
+        if (_tripRows) {
+            NSNumber *tripFingerprint = _fingerprints[tripID];
+            if (!tripFingerprint) {
+                continue;
+            }
+            uint64_t fingerprint = fingerprintBytes([tripFingerprint longLongValue], [periods bytes], [periods length]);
+            _periodFingerprints[tripID] = @((int64_t)fingerprint);
+            _nrOfPeriods[tripID] = @([periods length] / sizeof(ATLPeriod));
+            id previousFingerprint = _previousPeriodFingerprints[tripID];
+            if ([previousFingerprint isKindOfClass:[NSNumber class]] && (uint64_t)[previousFingerprint longLongValue] == fingerprint) {
+                continue;
+            }
+        }
+        [changedTripIDs addObject:tripID];
+    }
+    NSMutableSet *aperiodicTripIDs = [NSMutableSet set];
+    NSDictionary *storedRules = nil;
+    if (_tripRows) {
+        [aperiodicTripIDs addObjectsFromArray:[_previousPeriodFingerprints allKeys]];
+        [aperiodicTripIDs minusSet:[NSSet setWithArray:[_periods allKeys]]];
+        [aperiodicTripIDs intersectSet:[NSSet setWithArray:[_fingerprints allKeys]]];
+        storedRules = [self storedRulesOfPeriodicTripIDs:[changedTripIDs setByAddingObjectsFromSet:aperiodicTripIDs]];
+    }
+    for (NSString *tripID in aperiodicTripIDs) {
+        ATLMissionRule *missionRule = storedRules[tripID];
+        if (missionRule) {
+            missionRule.headway = 0;
+            missionRule.lastOffset = 0;
+            if (_tripOffsets[tripID]) {
+                missionRule.offset = [_tripOffsets[tripID] shortValue];
+            }
+            [self removePeriodRulesOfTripID:tripID from:1 storedRules:storedRules];
+            [self recordPeriodChangeOfMissionRule:missionRule];
+        }
+    }
+    for (NSString *tripID in changedTripIDs) {
+        ATLMissionRule *missionRule = _tripRows ? storedRules[tripID] : [self missionRuleForTripID:tripID];
+        if (!missionRule) {
+            continue;
+        }
+        const ATLPeriod *periods = [_periods[tripID] bytes];
+        NSUInteger nrOfPeriods = [_periods[tripID] length] / sizeof(ATLPeriod);
+        for (NSUInteger period = 0; period < nrOfPeriods; period++) {
+            ATLMissionRule *periodRule = missionRule;
+            if (period > 0) {
+                periodRule = [self periodRuleWithID:[self periodIDForTripID:tripID period:period] ofMissionRule:missionRule
+                                        storedRules:storedRules];
+            }
+            [periodRule setPeriodWithStart:periods[period].start end:periods[period].end headway:periods[period].headway];
+        }
+        [self removePeriodRulesOfTripID:tripID from:nrOfPeriods storedRules:storedRules];
+        [self recordPeriodChangeOfMissionRule:missionRule];
+    }
+}
+
+- (NSString *)periodIDForTripID:(NSString *)tripID period:(NSUInteger)period
+{
+    return [NSString stringWithFormat:@"%@|%lu", tripID, (unsigned long)period];
+}
+
+- (NSSet *)periodIDsOfTripID:(NSString *)tripID from:(NSUInteger)firstPeriod
+{
+    NSUInteger nrOfPeriods = [_previousNrOfPeriods[tripID] unsignedIntegerValue];
+    NSMutableSet *periodIDs = [NSMutableSet setWithCapacity:nrOfPeriods];
+    for (NSUInteger period = MAX(firstPeriod, 1); period < nrOfPeriods; period++) {
+        [periodIDs addObject:[self periodIDForTripID:tripID period:period]];
+    }
+    return periodIDs;
+}
+
+/**
+ Fetches the mission rules of the trips and of their periods in the previous import with a single request
+ */
+- (NSDictionary *)storedRulesOfPeriodicTripIDs:(NSSet *)tripIDs
+{
+    if ([tripIDs count] == 0) {
+        return @{};
+    }
+    NSMutableSet *ruleIDs = [tripIDs mutableCopy];
+    for (NSString *tripID in tripIDs) {
+        [ruleIDs unionSet:[self periodIDsOfTripID:tripID from:1]];
+    }
+    NSPredicate *predicate = [NSPredicate predicateWithFormat:@"id_ IN %@", ruleIDs];
+    NSArray *missionRules = [self.managedObjectContext fetchInstancesOfType:@"ATLMissionRule" withPredicate:predicate];
+    NSMutableDictionary *storedRules = [NSMutableDictionary dictionaryWithCapacity:[missionRules count]];
+    for (ATLMissionRule *missionRule in missionRules) {
+        storedRules[missionRule.id_] = missionRule;
+    }
+    return storedRules;
+}
+
+- (ATLMissionRule *)periodRuleWithID:(NSString *)periodID ofMissionRule:(ATLMissionRule *)missionRule
+                         storedRules:(NSDictionary *)storedRules
+{
+    ATLMissionRule *periodRule = storedRules[periodID];
+    if (periodRule) {
+        [self abandonMissionRule:periodRule];
+    } else {
+        periodRule = (ATLMissionRule*)[self.managedObjectContext createManagedObjectOfType:@"ATLMissionRule"];
+        periodRule.id_ = periodID;
+    }
+    periodRule.number = missionRule.number;
+    periodRule.upDirection = missionRule.upDirection;
+    periodRule.block = missionRule.block;
+    periodRule.headsign = missionRule.headsign;
+    periodRule.trainType = missionRule.trainType;
+    periodRule.weekdays = missionRule.weekdays;
+    periodRule.runningDates = missionRule.runningDates;
+    periodRule.notRunningDates = missionRule.notRunningDates;
+    periodRule.series = missionRule.series;
+    periodRule.timePath = missionRule.timePath;
+    return periodRule;
+}
+
+- (void)removePeriodRulesOfTripID:(NSString *)tripID from:(NSUInteger)firstPeriod storedRules:(NSDictionary *)storedRules
+{
+    for (NSString *periodID in [self periodIDsOfTripID:tripID from:firstPeriod]) {
+        ATLMissionRule *periodRule = storedRules[periodID];
+        if (periodRule) {
+            [self abandonMissionRule:periodRule];
+            periodRule.timePath = nil;
+            [self.managedObjectContext deleteObject:periodRule];
+        }
+    }
+}
+
+- (void)recordPeriodChangeOfMissionRule:(ATLMissionRule *)missionRule
+{
+    if (!_changes) {
         return;
     }
-    if (_missionRule) {
-        ATLMinutes offset = [ATLTimePath normalizePointsArray:_timePoints];
-        uint32_t hash = [ATLTimePath hashForPointsArray:_timePoints];
-        ATLTimePath *path = _timePaths[@(hash)];
-        if (!path) {
-            path = (ATLTimePath*)[self.managedObjectContext createManagedObjectOfType:@"ATLTimePath"];
-            path.hash_ = hash;
-            path.timePointsData = [NSKeyedArchiver archivedDataWithRootObject:_timePoints];
-            _timePaths[@(hash)] = path;
+    if (missionRule.series.id_) {
+        [_changes.changedSeriesIDs addObject:missionRule.series.id_];
+    }
+    NSString *tripID = missionRule.id_;
+    if (![_changes.insertedTripIDs containsObject:tripID] && ![_changes.updatedTripIDs containsObject:tripID]) {
+        [_changes.updatedTripIDs addObject:tripID];
+        _changes.nrOfUnchangedTrips--;
+    }
+}
+
+#pragma mark - Incremental import
+
+- (void)beginIncrementalImport
+{
+    _tripRows = [NSMutableDictionary dictionaryWithCapacity:10000];
+    _previousFingerprints = nil;
+    _previousPeriodFingerprints = nil;
+    _previousNrOfPeriods = nil;
+    if (self.fingerprintsURL) {
+        NSData *data = [NSData dataWithContentsOfURL:self.fingerprintsURL];
+        NSDictionary *fingerprints = nil;
+        if (data) {
+            fingerprints = [NSPropertyListSerialization propertyListWithData:data options:0 format:NULL error:NULL];
+        }
+        if ([fingerprints isKindOfClass:[NSDictionary class]] && [fingerprints[@"trips"] isKindOfClass:[NSDictionary class]]) {
+            _previousFingerprints = fingerprints[@"trips"];
+            _previousPeriodFingerprints = fingerprints[@"periods"];
+            _previousNrOfPeriods = fingerprints[@"nrOfPeriods"];
+        }
+    }
+    if (!_previousFingerprints) {
+        // Without fingerprints the stored mission rules are matched on their trip_id, and all of them are updated
+        NSArray *missionRules = [self.managedObjectContext fetchInstancesOfType:@"ATLMissionRule" withPredicate:nil];
+        NSMutableDictionary *previousFingerprints = [NSMutableDictionary dictionaryWithCapacity:[missionRules count]];
+        NSMutableDictionary *storedMissionRules = [NSMutableDictionary dictionaryWithCapacity:[missionRules count]];
+        for (ATLMissionRule *missionRule in missionRules) {
+            if (missionRule.id_) {
+                previousFingerprints[missionRule.id_] = [NSNull null];
+                storedMissionRules[missionRule.id_] = missionRule;
+            }
         }
-        _missionRule.offset = offset;
-        _missionRule.timePath = path;
+        _previousFingerprints = previousFingerprints;
+        _storedMissionRules = storedMissionRules;
     }
-    [_timePoints removeAllObjects];
 }
 
-#pragma mark - CHCSVParserDelegate methods
+- (void)prepareIncrementalStopTimes
+{
+    _fingerprints = [NSMutableDictionary dictionaryWithCapacity:[_tripRows count]];
+    _tripOffsets = [NSMutableDictionary dictionaryWithCapacity:[_previousPeriodFingerprints count]];
+    _abandonedTimePaths = [NSMutableSet setWithCapacity:100];
+    _changedTrips = [NSMutableArray arrayWithCapacity:CHANGED_TRIPS_BATCH_SIZE];
+    _changes = [ATLScheduleImportChanges new];
+    
+    // New trips may share time paths with the trips that are already stored
+    NSExpressionDescription *objectID = [NSExpressionDescription new];
+    objectID.name = @"objectID";
+    objectID.expression = [NSExpression expressionForEvaluatedObject];
+    objectID.expressionResultType = NSObjectIDAttributeType;
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"ATLTimePath"];
+    request.resultType = NSDictionaryResultType;
+    request.propertiesToFetch = @[@"timePointsData", objectID];
+    for (NSDictionary *result in [self.managedObjectContext fetchObjectsWithRequest:request]) {
+        NSData *data = [ATLTimePath packedDataWithTimePointsData:result[@"timePointsData"]];
+        if (data) {
+            [_timePathIndex addPointsData:data reference:result[@"objectID"]];
+        }
+    }
+}
 
-- (void)parserDidBeginDocument:(CHCSVParser *)parser
+- (void)importTripRow:(ATLTripRow *)row withTripTimes:(ATLTripTimes *)trip
 {
-    _foundData = [NSMutableArray arrayWithCapacity:12];
+    uint64_t pointsHash = hashOfPointsData(trip.pointsData);
+    ATLMinutes offset = trip.offset;
+    uint64_t fingerprint = fingerprintBytes(row.fingerprint, &pointsHash, sizeof(pointsHash));
+    fingerprint = fingerprintBytes(fingerprint, &offset, sizeof(offset));
+    _fingerprints[row.tripID] = @((int64_t)fingerprint);
+    if (_previousPeriodFingerprints[row.tripID]) {
+        // Needed to restore the offset of the trip when it is no longer in frequencies.txt
+        _tripOffsets[row.tripID] = @(offset);
+    }
     
+    id previousFingerprint = _previousFingerprints[row.tripID];
+    if ([previousFingerprint isKindOfClass:[NSNumber class]] && (uint64_t)[previousFingerprint longLongValue] == fingerprint) {
+        _changes.nrOfUnchangedTrips++;
+        return;
+    }
+    if (previousFingerprint && !_storedMissionRules) {
+        [_changedTrips addObject:trip];
+        if ([_changedTrips count] >= CHANGED_TRIPS_BATCH_SIZE) {
+            [self importChangedTrips];
+        }
+        return;
+    }
+    [self importTripRow:row withTripTimes:trip missionRule:_storedMissionRules[row.tripID]];
+}
+
+/**
+ Fetches the stored mission rules of the changed trips with a single request, and updates them
+ */
+- (void)importChangedTrips
+{
+    if ([_changedTrips count] == 0) {
+        return;
+    }
+    NSArray *tripIDs = [_changedTrips valueForKey:@"tripID"];
+    NSPredicate *predicate = [NSPredicate predicateWithFormat:@"id_ IN %@", tripIDs];
+    NSArray *missionRules = [self.managedObjectContext fetchInstancesOfType:@"ATLMissionRule" withPredicate:predicate];
+    NSMutableDictionary *storedRules = [NSMutableDictionary dictionaryWithCapacity:[missionRules count]];
+    for (ATLMissionRule *missionRule in missionRules) {
+        storedRules[missionRule.id_] = missionRule;
+    }
+    for (ATLTripTimes *trip in _changedTrips) {
+        [self importTripRow:_tripRows[trip.tripID] withTripTimes:trip missionRule:storedRules[trip.tripID]];
+    }
+    [_changedTrips removeAllObjects];
+}
+
+- (void)importTripRow:(ATLTripRow *)row withTripTimes:(ATLTripTimes *)trip missionRule:(ATLMissionRule *)missionRule
+{
+    if (missionRule) {
+        [_changes.updatedTripIDs addObject:row.tripID];
+        [self abandonMissionRule:missionRule];
+    } else {
+        missionRule = (ATLMissionRule*)[self.managedObjectContext createManagedObjectOfType:@"ATLMissionRule"];
+        [_changes.insertedTripIDs addObject:row.tripID];
+    }
+    [self fillMissionRule:missionRule withTripRow:row];
+    [self assignTripTimes:trip toMissionRule:missionRule];
+    if (missionRule.series.id_) {
+        [_changes.changedSeriesIDs addObject:missionRule.series.id_];
+    }
+}
+
+- (void)abandonMissionRule:(ATLMissionRule *)missionRule
+{
+    if (missionRule.series.id_) {
+        [_changes.changedSeriesIDs addObject:missionRule.series.id_];
+    }
+    if (missionRule.timePath) {
+        [_abandonedTimePaths addObject:missionRule.timePath];
+    }
+}
+
+- (void)removeDeletedTrips
+{
+    NSMutableSet *deletedIDs = [NSMutableSet setWithArray:[_previousFingerprints allKeys]];
+    [deletedIDs minusSet:[NSSet setWithArray:[_fingerprints allKeys]]];
+    if ([deletedIDs count] > 0) {
+        // The periods of a deleted trip are deleted with it
+        NSMutableSet *ruleIDs = [deletedIDs mutableCopy];
+        for (NSString *tripID in deletedIDs) {
+            [ruleIDs unionSet:[self periodIDsOfTripID:tripID from:1]];
+        }
+        NSPredicate *predicate = [NSPredicate predicateWithFormat:@"id_ IN %@", ruleIDs];
+        for (ATLMissionRule *missionRule in [self.managedObjectContext fetchInstancesOfType:@"ATLMissionRule" withPredicate:predicate]) {
+            [self abandonMissionRule:missionRule];
+            missionRule.timePath = nil;
+            [self.managedObjectContext deleteObject:missionRule];
+        }
+        [_changes.deletedTripIDs unionSet:deletedIDs];
+    }
+}
+
+/**
+ Runs after frequencies.txt, because the rules of later periods keep the time path of their trip until then
+ */
+- (void)removeAbandonedTimePaths
+{
+    for (ATLTimePath *timePath in _abandonedTimePaths) {
+        if ([timePath.missionRules count] == 0) {
+            NSUInteger entry = [_timePathIndex entryForPointsData:[ATLTimePath packedDataWithTimePointsData:timePath.timePointsData]];
+            if (entry != NSNotFound) {
+                [_timePathIndex setReference:nil atEntry:entry];
+            }
+            [self.managedObjectContext deleteObject:timePath];
+        }
+    }
+}
+
+- (void)finishIncrementalImport
+{
+    NSLog(@"incremental import: %lu inserted, %lu updated, %lu deleted, %lu unchanged",
+          (unsigned long)[_changes.insertedTripIDs count], (unsigned long)[_changes.updatedTripIDs count],
+          (unsigned long)[_changes.deletedTripIDs count], (unsigned long)_changes.nrOfUnchangedTrips);
+    if (self.fingerprintsURL) {
+        NSDictionary *fingerprints = @{@"trips": _fingerprints,
+                                       @"periods": _periodFingerprints ?: @{},
+                                       @"nrOfPeriods": _nrOfPeriods ?: @{}};
+        NSError *error = nil;
+        NSData *data = [NSPropertyListSerialization dataWithPropertyList:fingerprints format:NSPropertyListBinaryFormat_v1_0
+                                                                 options:0 error:&error];
+        if (![data writeToURL:self.fingerprintsURL options:NSDataWritingAtomic error:&error]) {
+            NSLog(@"error: %@", error);
+        }
+    }
+    _lastImportChanges = _changes;
+    _changes = nil;
+    _tripRows = nil;
+    _fingerprints = nil;
+    _previousFingerprints = nil;
+    _storedMissionRules = nil;
+    _changedTrips = nil;
+    _abandonedTimePaths = nil;
+    _seriesDict = nil;
+    _periodFingerprints = nil;
+    _previousPeriodFingerprints = nil;
+    _previousNrOfPeriods = nil;
+    _tripOffsets = nil;
+}
+
+- (void)abandonIncrementalImport
+{
+    _changes = nil;
+    _tripRows = nil;
+    _fingerprints = nil;
+    _previousFingerprints = nil;
+    _storedMissionRules = nil;
+    _changedTrips = nil;
+    _abandonedTimePaths = nil;
+    _seriesDict = nil;
+    _unsavedSeriesIDs = nil;
+    _periodFingerprints = nil;
+    _previousPeriodFingerprints = nil;
+    _previousNrOfPeriods = nil;
+    _tripOffsets = nil;
+}
+
+#pragma mark - Batch handling
+
+- (id)objectFromReference:(id)reference
+{
+    if ([reference isKindOfClass:[NSManagedObjectID class]]) {
+        return [self.managedObjectContext objectWithID:reference];
+    }
+    return reference;
+}
+
+/**
+ Saves the context and replaces the references to the saved objects by their object IDs.
+ A failed save abandons the step and stops the import: its references would stay temporary, the caller stops reading.
+ */
+- (BOOL)saveBatch
+{
+    // Changed trips that are still waiting for their mission rules are part of the batch
+    [self importChangedTrips];
+    NSError *error = nil;
+    if (![self.metrics saveContext:&error]) {
+        NSLog(@"import step %d failed to save: %@", _importStep, error);
+        _saveFailed = YES;
+        [self abandonStep];
+        return NO;
+    }
+
+    // Saved objects now have permanent IDs, retain only those and turn the objects into faults
+    for (NSString *tripID in _unsavedTripIDs) {
+        [_tripIndex setReference:[[_tripIndex referenceForTripID:tripID] objectID] forTripID:tripID];
+    }
+    [_unsavedTripIDs removeAllObjects];
+    for (NSString *seriesID in _unsavedSeriesIDs) {
+        _seriesDict[seriesID] = [_seriesDict[seriesID] objectID];
+    }
+    [_unsavedSeriesIDs removeAllObjects];
+    for (NSNumber *entry in _unsavedPathEntries) {
+        NSUInteger index = [entry unsignedIntegerValue];
+        [_timePathIndex setReference:[[_timePathIndex referenceAtEntry:index] objectID] atEntry:index];
+    }
+    [_unsavedPathEntries removeAllObjects];
+    if (self.batchSize == 0) {
+        return YES;
+    }
+    for (NSManagedObject *object in [[self.managedObjectContext registeredObjects] allObjects]) {
+        if (!object.isFault) {
+            [self.managedObjectContext refreshObject:object mergeChanges:NO];
+        }
+    }
+    return YES;
+}
+
+#pragma mark - Parallel import of stop times
+
+- (void)importStopTimesInParallelFromURL:(NSURL *)url
+{
+    NSError *error = nil;
+    NSData *data = [NSData dataWithContentsOfFile:url.path options:NSDataReadingMappedAlways error:&error];
+    if (!data) {
+        [self reader:nil didFailWithError:error];
+        return;
+    }
+    [self readerDidBeginDocument:nil];
+
+    NSSet *tripIDs = [self missionRuleIDs];
+    ATLRowFilter *rowFilter = self.rowFilter;
+    NSUInteger nrOfShards = [[NSProcessInfo processInfo] activeProcessorCount];
+    NSMutableArray *shards = [NSMutableArray arrayWithCapacity:nrOfShards];
+    NSMutableArray *parsedShards = [NSMutableArray arrayWithCapacity:nrOfShards];
+    for (NSValue *range in [self shardRangesForStopTimes:data count:nrOfShards]) {
+        ATLStopTimesShard *shard = [[ATLStopTimesShard alloc] initWithData:data range:[range rangeValue]
+                                                                          tripIDs:tripIDs rowFilter:rowFilter];
+        dispatch_semaphore_t parsed = dispatch_semaphore_create(0);
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [shard parse];
+            dispatch_semaphore_signal(parsed);
+        });
+        [shards addObject:shard];
+        [parsedShards addObject:parsed];
+    }
+
+    // Merging in file order gives the same time paths as a serial import,
+    // each shard is merged as soon as it is parsed while the following shards are still being parsed
+    NSUInteger nrOfRows = 0;
+    for (NSUInteger shardIndex = 0; shardIndex < [shards count]; shardIndex++) {
+        dispatch_semaphore_wait(parsedShards[shardIndex], DISPATCH_TIME_FOREVER);
+        ATLStopTimesShard *shard = shards[shardIndex];
+        nrOfRows += shard.nrOfRows;
+        [self.metrics updateRows:nrOfRows bytes:NSMaxRange([shard range])];
+        NSArray *trips = shard.trips;
+        NSUInteger batchSize = self.batchSize > 0 ? self.batchSize : [trips count];
+        for (NSUInteger start = 0; start < [trips count]; start += batchSize) {
+            @autoreleasepool {
+                NSUInteger end = MIN(start + batchSize, [trips count]);
+                for (NSUInteger index = start; index < end; index++) {
+                    ATLTripTimes *trip = trips[index];
+                    if (_tripRows) {
+                        [self importTripRow:_tripRows[trip.tripID] withTripTimes:trip];
+                        continue;
+                    }
+                    ATLMissionRule *missionRule = [self missionRuleForTripID:trip.tripID];
+                    if (missionRule) {
+                        [self assignTripTimes:trip toMissionRule:missionRule];
+                    }
+                }
+                if (self.batchSize > 0 && ![self saveBatch]) {
+                    return;
+                }
+            }
+        }
+        shards[shardIndex] = [NSNull null];
+    }
+    [self readerDidEndDocument:nil];
+}
+
+- (ATLMissionRule *)missionRuleForTripID:(NSString *)tripID
+{
+    if (_tripIndex) {
+        return [self objectFromReference:[_tripIndex referenceForTripID:tripID]];
+    }
+    return [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:tripID create:NO];
+}
+
+- (NSSet *)missionRuleIDs
+{
+    if (_tripRows) {
+        return [NSSet setWithArray:[_tripRows allKeys]];
+    }
+    if (_tripIndex) {
+        return [_tripIndex allTripIDs];
+    }
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"ATLMissionRule"];
+    request.resultType = NSDictionaryResultType;
+    request.propertiesToFetch = @[@"id_"];
+    NSArray *result = [self.managedObjectContext fetchObjectsWithRequest:request];
+    return [NSSet setWithArray:[result valueForKey:@"id_"]];
+}
+
+/**
+ Divides the data rows of stop_times.txt into ranges of roughly equal size.
+ Every range starts at the first line of a trip, so that all lines of one trip end up in the same shard.
+ */
+- (NSArray *)shardRangesForStopTimes:(NSData *)data count:(NSUInteger)count
+{
+    const char *bytes = [data bytes];
+    const char *end = bytes + [data length];
+    const char *firstRow = nextLineStart(bytes, end);
+    NSUInteger shardSize = (end - firstRow) / MAX(count, 1) + 1;
+
+    NSMutableArray *ranges = [NSMutableArray arrayWithCapacity:count];
+    const char *shardStart = firstRow;
+    while (shardStart < end) {
+        const char *shardEnd = end;
+        if ((NSUInteger)(end - shardStart) > shardSize) {
+            const char *previousLine = previousLineStart(bytes, shardStart + shardSize);
+            shardEnd = nextLineStart(shardStart + shardSize, end);
+            NSUInteger tripLength = firstFieldLength(previousLine, end);
+            while (shardEnd < end && firstFieldLength(shardEnd, end) == tripLength &&
+                   memcmp(shardEnd, previousLine, tripLength) == 0) {
+                shardEnd = nextLineStart(shardEnd, end);
+            }
+        }
+        [ranges addObject:[NSValue valueWithRange:NSMakeRange(shardStart - bytes, shardEnd - shardStart)]];
+        shardStart = shardEnd;
+    }
+    return ranges;
+}
+
+#pragma mark - ATLCSVReaderDelegate methods
+
+- (void)readerDidBeginDocument:(ATLCSVReader *)reader
+{
     switch (_importStep) {
         case readCalendar:
-            _calendarRules = [NSMutableDictionary dictionaryWithCapacity:5000];
-            _datesOnWeekday = [NSMutableArray arrayWithCapacity:7];
-            for (int i = 0; i < 7; i++) {
-                _datesOnWeekday[i] = [NSMutableSet setWithCapacity:52];
+            if (!_calendar) {
+                // The service days are a bitset over the feed period, which is only known after feed_info.txt
+                NSError *error = nil;
+                failWithError(&error, ATLScheduleImporterErrorDomain, missingFeedPeriodError,
+                              @"calendar_dates.txt was read without the feed period of feed_info.txt");
+                [reader cancelParsing];
+                [self reader:reader didFailWithError:error];
+                break;
             }
+            _calendarRules = [NSMutableDictionary dictionaryWithCapacity:5000];
+            _serviceDays = [NSMutableData dataWithLength:_calendar.nrOfWords * sizeof(ATLDayWord)];
             break;
             
         case readTrips:
             _seriesDict = [NSMutableDictionary dictionaryWithCapacity:150];
+            _unsavedSeriesIDs = [NSMutableArray arrayWithCapacity:150];
+            _tripIndex = [ATLTripIndex new];
+            _unsavedTripIDs = [NSMutableArray arrayWithCapacity:10000];
+            [self.rowFilter removeAllTrips];
+            if (self.options & incrementalImport) {
+                [self beginIncrementalImport];
+            }
             break;
             
         case readStopTimes:
             _timePoints = [NSMutableArray arrayWithCapacity:30];
-            _timePaths = [NSMutableDictionary dictionaryWithCapacity:5000];
+            _tripReference = [NSMutableData dataWithCapacity:32];
+            _timePathIndex = [[ATLTimePathIndex alloc] initWithCapacity:5000];
+            _unsavedPathEntries = [NSMutableArray arrayWithCapacity:5000];
+            _stationSymbols = [[ATLSymbolCache alloc] initWithSymbolTable:[ATLSymbolTable sharedTable] prefix:@"nl."];
+            _platformSymbols = [[ATLSymbolCache alloc] initWithSymbolTable:[ATLSymbolTable sharedTable] prefix:nil];
+            if (!_tripIndex && self.tripIndexURL) {
+                _tripIndex = [ATLTripIndex indexWithContentsOfURL:self.tripIndexURL
+                                       persistentStoreCoordinator:self.managedObjectContext.persistentStoreCoordinator];
+            }
+            if (_tripRows) {
+                [self prepareIncrementalStopTimes];
+            }
+            break;
+            
+        case readFrequencies:
+            _periods = [NSMutableDictionary dictionaryWithCapacity:100];
+            if (_tripRows) {
+                _periodFingerprints = [NSMutableDictionary dictionaryWithCapacity:100];
+                _nrOfPeriods = [NSMutableDictionary dictionaryWithCapacity:100];
+            } else if (!_tripIndex && self.tripIndexURL) {
+                _tripIndex = [ATLTripIndex indexWithContentsOfURL:self.tripIndexURL
+                                       persistentStoreCoordinator:self.managedObjectContext.persistentStoreCoordinator];
+            }
             break;
             
         default:
@@ -327,92 +1182,100 @@ ATLTimePointOptions optionsFromStopHandling(GTFSStopHandling dropOffType, GTFSSt
     }
 }
 
-- (void)parser:(CHCSVParser *)parser didBeginLine:(NSUInteger)recordNumber
-{
-    [_foundData removeAllObjects];
-}
-
-- (void)parser:(CHCSVParser *)parser didReadField:(NSString *)field atIndex:(NSInteger)fieldIndex
-{
-    [_foundData addObject:field];
-}
-
-- (void)parser:(CHCSVParser *)parser didEndLine:(NSUInteger)recordNumber
+- (void)reader:(ATLCSVReader *)reader didEndLine:(NSUInteger)recordNumber
 {
-    if (recordNumber > 1 && [_foundData count] > 1) {
-        static int progressCounter = 0;
-        progressCounter++;
-        if (progressCounter > 5000) {
-            NSString *statusString = [NSString stringWithFormat:@"Import step %d at line %d", _importStep, (int)recordNumber];
-            NSLog(@"%@", statusString);
-            progressCounter = 0;
-        }
+    [_metrics updateRows:recordNumber bytes:reader.totalBytesRead];
+    if (recordNumber > 1 && reader.fieldCount > 1) {
         switch (_importStep) {
-            case readInfo: {
-                NSDateFormatter *df = [[NSDateFormatter alloc] init];
-                df.timeZone = [NSTimeZone timeZoneWithAbbreviation: @"GMT"];
-                df.dateFormat = @"yyyyMMdd";
-                NSDate *roughDate = [df dateFromString:_foundData[feed_start_date]];
-                _startDate = [roughDate dateByAddingTimeInterval:TWELVE_HOURS];
-                roughDate = [df dateFromString:_foundData[feed_end_date]];
-                _endDate = [roughDate dateByAddingTimeInterval:TWELVE_HOURS];
+            case readInfo:
+                _calendar = [[ATLFeedCalendar alloc] initWithStartIdentifier:[reader stringForField:feed_start_date]
+                                                               endIdentifier:[reader stringForField:feed_end_date]];
                 break;
-            }
                 
             case readCalendar: {
-                if ([_foundData[exception_type] isEqualToString:@"1"]) {
-                    if (![_foundData[service_id] isEqualToString:_identifier]) {
+                if ([reader field:exception_type isEqualToCString:"1"]) {
+                    if (![reader field:service_id isEqualToString:_identifier]) {
                         [self createCalendarRecord];
-                        _identifier = _foundData[service_id];
+                        _identifier = [reader stringForField:service_id];
+                    }
+                    ATLCSVField date = [reader field:date_field];
+                    int day = [_calendar dayForIdentifierBytes:date.bytes length:date.length];
+                    if (day != INVALID_DAY) {
+                        addDay([_serviceDays mutableBytes], day);
                     }
-                    NSArray *dateAndWeekday = [self dateAndWeekdayForIdentifier:_foundData[date_field]];
-                    int weekday = [dateAndWeekday[1] intValue];
-                    [_datesOnWeekday[weekday] addObject: dateAndWeekday[0]];
                 }
                 break;
             }
 
-            case readTrips:
-                if ([self shouldImportTrainType:_foundData[route_reference]]) {
-                    ATLCalendarRule *calendarRule = _calendarRules[_foundData[service_reference]];
+            case readTrips: {
+                // Rows are filtered on their raw bytes, strings are only created for accepted trips
+                if ([self.rowFilter acceptsRoute:[reader field:route_reference] service:[reader field:service_reference]]) {
+                    ATLCalendarRule *calendarRule = _calendarRules[[reader stringForField:service_reference]];
                     if ((self.options & includeCalendarExceptions) || calendarRule.weekdays) {
-                        ATLMissionRule *missionRule = (ATLMissionRule*)[self.managedObjectContext createManagedObjectOfType:@"ATLMissionRule"];
-                        missionRule.id_ = _foundData[trip_identifier];
-                        missionRule.number = [_foundData[trip_short_name] intValue];
-                        missionRule.upDirection = ([_foundData[direction_indicator] intValue] == 1);
-                        missionRule.block = [_foundData[block_reference] intValue];
-                        missionRule.headsign = _foundData[trip_headsign];
-                        missionRule.trainType = _foundData[route_reference];
+                        ATLTripRow *row = [ATLTripRow new];
+                        row.tripID = [reader stringForField:trip_identifier];
+                        row.number = [reader intValueForField:trip_short_name];
+                        row.upDirection = ([reader intValueForField:direction_indicator] == 1);
+                        row.block = [reader intValueForField:block_reference];
+                        row.headsign = [reader stringForField:trip_headsign];
+                        row.trainType = [reader stringForField:route_reference];
+                        row.calendarRule = calendarRule;
+                        [self.rowFilter addTrip:[reader field:trip_identifier]];
                         
-                        missionRule.weekdays = calendarRule.weekdays;
-                        missionRule.runningDates = calendarRule.runningDates;
-                        missionRule.notRunningDates = calendarRule.notRunningDates;
-                        NSString *seriesID = missionRule.seriesID;
-                        ATLSeries *series = _seriesDict[seriesID];
-                        if (!series) {
-                            series = [self.managedObjectContext objectOfClass:[ATLSeries class] withModelID:seriesID create:YES];
-                            _seriesDict[seriesID] = series;
+                        if (_tripRows) {
+                            row.fingerprint = fingerprintOfTripsLine(reader, calendarRule);
+                            _tripRows[row.tripID] = row;
+                        } else {
+                            ATLMissionRule *missionRule = (ATLMissionRule*)[self.managedObjectContext createManagedObjectOfType:@"ATLMissionRule"];
+                            [self fillMissionRule:missionRule withTripRow:row];
+                            [_tripIndex setReference:missionRule forTripID:row.tripID];
+                            [_unsavedTripIDs addObject:row.tripID];
                         }
-                        missionRule.series = series;
                     }
                 }
                 break;
+            }
 
-            case readStopTimes:
-                if (![_foundData[trip_reference] isEqualToString:_identifier]) {
+            case readStopTimes: {
+                ATLCSVField trip = [reader field:trip_reference];
+                if (!fieldEqualsBytes(trip, [_tripReference bytes], [_tripReference length])) {
                     [self createTimePath];
-                    _identifier = _foundData[trip_reference];
-                    _missionRule = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:_identifier create:NO];
+                    [_tripReference setLength:0];
+                    [_tripReference appendBytes:trip.bytes length:trip.length];
+                    if ([self.rowFilter acceptsTrip:trip]) {
+                        _identifier = [reader stringForField:trip_reference];
+                        _missionRule = _tripRows ? nil : [self missionRuleForTripID:_identifier];
+                    } else {
+                        _identifier = nil;
+                        _missionRule = nil;
+                    }
                 }
-                if (_missionRule) {
-                    ATLTimePoint *timePoint = [ATLTimePoint new];
-                    timePoint.arrivalString = _foundData[arrival_time];
-                    timePoint.departureString = _foundData[departure_time];
-                    timePoint.stopLocation = _foundData[stop_reference];
-                    timePoint.options = optionsFromStopHandling([_foundData[drop_off_type] intValue], [_foundData[pickup_type] intValue]);
-                    [_timePoints addObject:timePoint];
+                if (_missionRule || _tripRows[_identifier]) {
+                    ATLTimePoint *timePoint = timePointFromStopTimesLine(reader, _stationSymbols, _platformSymbols);
+                    if (timePoint) {
+                        [_timePoints addObject:timePoint];
+                    }
                 }
                 break;
+            }
+
+            case readFrequencies: {
+                // Periods are collected per trip, the rows of a trip need not be contiguous
+                if ([self.rowFilter acceptsTrip:[reader field:frequency_trip_reference]]) {
+                    NSString *tripID = [reader stringForField:frequency_trip_reference];
+                    ATLCSVField start = [reader field:start_time];
+                    ATLCSVField end = [reader field:end_time];
+                    ATLPeriod period = {minutesFromBytes(start.bytes, start.length), minutesFromBytes(end.bytes, end.length),
+                        (int16_t)(([reader intValueForField:headway_secs] + 30) / 60)};
+                    NSMutableData *periods = _periods[tripID];
+                    if (!periods) {
+                        periods = [NSMutableData dataWithCapacity:4 * sizeof(ATLPeriod)];
+                        _periods[tripID] = periods;
+                    }
+                    [periods appendBytes:&period length:sizeof(period)];
+                }
+                break;
+            }
 
             default:
                 break;
@@ -420,39 +1283,252 @@ ATLTimePointOptions optionsFromStopHandling(GTFSStopHandling dropOffType, GTFSSt
     }
 }
 
-- (void)parserDidEndDocument:(CHCSVParser *)parser
+- (void)reader:(ATLCSVReader *)reader didEndBatch:(NSUInteger)recordNumber
 {
-    NSError *error = nil;
-    [self.managedObjectContext save:&error];
-    if (error) {
-        NSLog(@"error: %@", error);
+    if (![self saveBatch]) {
+        [reader cancelParsing];
+    }
+}
+
+- (void)readerDidEndDocument:(ATLCSVReader *)reader
+{
+    if (_importStep == readStopTimes) {
+        [self createTimePath];
+        if (_tripRows) {
+            [self importChangedTrips];
+            [self removeDeletedTrips];
+        }
+    } else if (_importStep == readFrequencies) {
+        [self applyPeriods];
+        if (_tripRows) {
+            [self removeAbandonedTimePaths];
+        }
+    }
+    if (![self saveBatch]) {
+        return;
     }
     switch (_importStep) {
         case readCalendar:
             [self createCalendarRecord];
             _identifier = nil;
-            _datesOnWeekday = nil;
+            _serviceDays = nil;
             break;
             
         case readTrips:
             NSLog(@"calendarRules has %lu elements", (unsigned long)[_calendarRules count]);
             _calendarRules = nil;
             NSLog(@"seriesDict has %lu elements", (unsigned long)[_seriesDict count]);
-            _seriesDict = nil;
+            if (!_tripRows) {
+                _seriesDict = nil;
+            }
+            NSLog(@"tripIndex has %lu elements", (unsigned long)[_tripIndex count]);
+            _unsavedTripIDs = nil;
+            // An incremental import only fills the index with changed trips, that must not replace the stored index
+            if (self.tripIndexURL && !_tripRows) {
+                NSError *error = nil;
+                if (![_tripIndex writeToURL:self.tripIndexURL error:&error]) {
+                    NSLog(@"error: %@", error);
+                    [[NSFileManager defaultManager] removeItemAtURL:self.tripIndexURL error:NULL];
+                }
+                _tripIndex = nil;
+            }
             break;
             
         case readStopTimes:
-            [self createTimePath];
-            NSLog(@"timePaths has %lu elements", (unsigned long)[_timePaths count]);
+            NSLog(@"timePaths has %lu elements, %lu lookups, %lu hits, %lu collisions",
+                  (unsigned long)_timePathIndex.count, (unsigned long)_timePathIndex.nrOfLookups,
+                  (unsigned long)_timePathIndex.nrOfHits, (unsigned long)_timePathIndex.nrOfCollisions);
             _identifier = nil;
+            _tripReference = nil;
             _missionRule = nil;
             _timePoints = nil;
+            _stationSymbols = nil;
+            _platformSymbols = nil;
             break;
             
+        case readFrequencies:
+            NSLog(@"%lu trips are periodic", (unsigned long)[_periods count]);
+            if (_tripRows) {
+                [self finishIncrementalImport];
+            }
+            _periods = nil;
+            _nrOfPeriods = nil;
+            _tripIndex = nil;
+            break;
+            
+        default:
+            break;
+    }
+}
+
+- (void)reader:(ATLCSVReader *)reader didFailWithError:(NSError *)error
+{
+    NSLog(@"import step %d failed: %@", _importStep, error);
+    [self abandonStep];
+}
+
+/**
+ Releases the intermediate results of a step that failed after readerDidBeginDocument:,
+ since readerDidEndDocument: will not be called for it. Objects saved in earlier batches are kept.
+ */
+- (void)abandonStep
+{
+    switch (_importStep) {
+        case readCalendar:
+            _calendarRules = nil;
+            _serviceDays = nil;
+            _identifier = nil;
+            break;
+
+        case readTrips:
+            _calendarRules = nil;
+            _unsavedTripIDs = nil;
+            _tripIndex = nil;
+            [self abandonIncrementalImport];
+            break;
+
+        case readStopTimes:
+            _tripIndex = nil;
+            _identifier = nil;
+            _tripReference = nil;
+            _missionRule = nil;
+            _timePoints = nil;
+            _timePathIndex = nil;
+            _unsavedPathEntries = nil;
+            _stationSymbols = nil;
+            _platformSymbols = nil;
+            [self abandonIncrementalImport];
+            break;
+
+        case readFrequencies:
+            _periods = nil;
+            _nrOfPeriods = nil;
+            _tripIndex = nil;
+            [self abandonIncrementalImport];
+            break;
+
         default:
             break;
     }
-    _foundData = nil;
+}
+
+@end
+
+@implementation ATLScheduleImportChanges
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _insertedTripIDs = [NSMutableSet setWithCapacity:100];
+        _updatedTripIDs = [NSMutableSet setWithCapacity:100];
+        _deletedTripIDs = [NSMutableSet setWithCapacity:100];
+        _changedSeriesIDs = [NSMutableSet setWithCapacity:50];
+    }
+    return self;
+}
+
+@end
+
+@implementation ATLTripRow
+
+@end
+
+@implementation ATLTripTimes
+
+- (instancetype)initWithTripID:(NSString *)tripID timePoints:(NSArray *)timePoints
+{
+    self = [super init];
+    if (self) {
+        _tripID = tripID;
+        _timePoints = timePoints;
+        _offset = [ATLTimePath normalizePointsArray:timePoints];
+        _hash_ = [ATLTimePath hashForPointsArray:timePoints];
+        _pointsData = [ATLTimePath dataForPointsArray:timePoints];
+    }
+    return self;
+}
+
+@end
+
+@implementation ATLStopTimesShard {
+    NSData *_data;
+    NSRange _range;
+    NSSet *_tripIDs;
+    ATLRowFilter *_rowFilter;
+    NSMutableArray *_trips;
+    NSMutableArray *_timePoints;
+    NSString *_identifier;
+    NSMutableData *_tripReference;
+    BOOL _importTrip;
+    ATLSymbolCache *_stationSymbols, *_platformSymbols;
+}
+
+- (instancetype)initWithData:(NSData *)data range:(NSRange)range tripIDs:(NSSet *)tripIDs rowFilter:(ATLRowFilter *)rowFilter
+{
+    self = [super init];
+    if (self) {
+        _data = data;
+        _range = range;
+        _tripIDs = tripIDs;
+        _rowFilter = rowFilter;
+        _tripReference = [NSMutableData dataWithCapacity:32];
+        _trips = [NSMutableArray arrayWithCapacity:1000];
+        _stationSymbols = [[ATLSymbolCache alloc] initWithSymbolTable:[ATLSymbolTable sharedTable] prefix:@"nl."];
+        _platformSymbols = [[ATLSymbolCache alloc] initWithSymbolTable:[ATLSymbolTable sharedTable] prefix:nil];
+    }
+    return self;
+}
+
+- (NSArray *)trips
+{
+    return _trips;
+}
+
+- (void)parse
+{
+    @autoreleasepool {
+        ATLCSVReader *reader = [[ATLCSVReader alloc] initWithData:_data range:_range];
+        reader.delegate = self;
+        [reader parse];
+        _nrOfRows = reader.nrOfRecords;
+    }
+}
+
+- (void)finishTrip
+{
+    if (_importTrip && [_timePoints count] > 0) {
+        [_trips addObject:[[ATLTripTimes alloc] initWithTripID:_identifier timePoints:_timePoints]];
+    }
+    _timePoints = [NSMutableArray arrayWithCapacity:30];
+}
+
+- (void)reader:(ATLCSVReader *)reader didEndLine:(NSUInteger)recordNumber
+{
+    if (reader.fieldCount > 1) {
+        ATLCSVField trip = [reader field:trip_reference];
+        if (!fieldEqualsBytes(trip, [_tripReference bytes], [_tripReference length])) {
+            [self finishTrip];
+            [_tripReference setLength:0];
+            [_tripReference appendBytes:trip.bytes length:trip.length];
+            _importTrip = [_rowFilter acceptsTrip:trip];
+            if (_importTrip) {
+                _identifier = [reader stringForField:trip_reference];
+                _importTrip = [_tripIDs containsObject:_identifier];
+            }
+        }
+        if (_importTrip) {
+            ATLTimePoint *timePoint = timePointFromStopTimesLine(reader, _stationSymbols, _platformSymbols);
+            if (timePoint) {
+                [_timePoints addObject:timePoint];
+            }
+        }
+    }
+}
+
+- (void)readerDidEndDocument:(ATLCSVReader *)reader
+{
+    [self finishTrip];
 }
 
 @end
@@ -511,3 +1587,45 @@ ATLTimePointOptions optionsFromStopHandling(GTFSStopHandling dropOffType, GTFSSt
     return canDropOff | canPickUp | coordinateDriver | coordinateAgency;
 }
 
+ATLTimePoint *timePointFromStopTimesLine(ATLCSVReader *reader, ATLSymbolCache *stationSymbols, ATLSymbolCache *platformSymbols)
+{
+    // stop_id has format like "ut|14", station code and platform are separated by '|'
+    ATLCSVField stop = [reader field:stop_reference];
+    // A stop_id without separator is a station without platform
+    const char *separator = memchr(stop.bytes, '|', stop.length);
+    NSUInteger codeLength = separator ? separator - stop.bytes : stop.length;
+    NSUInteger platformLength = separator ? stop.length - codeLength - 1 : 0;
+    if (codeLength == 0 || codeLength > MAX_STATION_CODE_LENGTH) {
+        NSLog(@"error: stop_id %@ is not a valid station code", [reader stringForField:stop_reference]);
+        return nil;
+    }
+    ATLSymbol stationSymbol = [stationSymbols symbolForBytes:stop.bytes length:codeLength];
+    ATLSymbol platformSymbol = [platformSymbols symbolForBytes:separator ? separator + 1 : stop.bytes + stop.length
+                                                        length:platformLength];
+    if (stationSymbol == NO_SYMBOL || platformSymbol == NO_SYMBOL) {
+        NSLog(@"error: stop_id %@ is not valid UTF-8", [reader stringForField:stop_reference]);
+        return nil;
+    }
+
+    ATLCSVField arrival = [reader field:arrival_time];
+    ATLCSVField departure = [reader field:departure_time];
+    ATLTimePoint *timePoint = [ATLTimePoint new];
+    timePoint.arrival = minutesFromBytes(arrival.bytes, arrival.length);
+    timePoint.departure = minutesFromBytes(departure.bytes, departure.length);
+    timePoint.options = optionsFromStopHandling([reader intValueForField:drop_off_type], [reader intValueForField:pickup_type]);
+    timePoint.stationSymbol = stationSymbol;
+    timePoint.platformSymbol = platformSymbol;
+    return timePoint;
+}
+
+uint64_t fingerprintOfTripsLine(ATLCSVReader *reader, ATLCalendarRule *calendarRule)
+{
+    uint64_t result = calendarRule.fingerprint;
+    GTFSTripFields fields[] = {route_reference, trip_identifier, trip_headsign, direction_indicator, trip_short_name, block_reference};
+    for (NSUInteger i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        ATLCSVField field = [reader field:fields[i]];
+        result = fingerprintBytes(result, field.bytes, field.length);
+        result = fingerprintBytes(result, ",", 1);
+    }
+    return result;
+}
@@ -33,10 +33,6 @@
 
 - (void)syncOffsets;
 
-// XML representation
-- (NSString*)xmlString;
-- (NSString*)xmlReferenceString;
-
 @end
 
 @interface ATLSeries (CoreDataGeneratedAccessors)
@@ -84,36 +84,13 @@
 
 #pragma mark - XML representation
 
-- (NSString*)xmlString
+- (void)writeXMLDataWithWriter:(ATLXMLWriter *)writer
 {
-    NSString *name = [[NSStringFromClass([self class]) substringFromIndex:3] lowercaseString];
-    NSMutableString *theString = [[NSMutableString alloc] initWithCapacity:50];
-    [theString appendFormat:@"<%@", name];
-    [self appendAttributesToXMLString:theString];
-    [theString appendString:@">\n"];
-    [self appendDataToXMLString:theString];
-    [theString appendFormat:@"</%@>\n", name];
-    return theString;
-}
-
-- (NSString *)xmlReferenceString
-{
-    return [NSString stringWithFormat:@"<%@ id=\"%@\"/>\n",
-            NSStringFromClass([self class]), self.id_];
-}
-
-- (void)appendAttributesToXMLString:(NSMutableString*)output
-{
-    [output appendFormat:@" id=\"%@\"", self.id_];
-}
-
-- (void)appendDataToXMLString:(NSMutableString *)output
-{
-    [output appendFormat:@"\t<serviceRefs>\n"];
+    [writer writeCString:"\t<serviceRefs>\n"];
     for (ATLSeriesRef *ref in self.seriesRefs) {
-        [output appendString:ref.xmlServiceRef];
+        [ref writeXMLServiceRefWithWriter:writer];
     }
-    [output appendFormat:@"\t</serviceRefs>\n"];
+    [writer writeCString:"\t</serviceRefs>\n"];
 }
 
 @end
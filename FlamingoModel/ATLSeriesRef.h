@@ -21,7 +21,7 @@
 #import <Foundation/Foundation.h>
 #import <CoreData/CoreData.h>
 
-@class ATLSeries, ATLService, ATLLocation;
+@class ATLSeries, ATLService, ATLLocation, ATLXMLWriter;
 
 
 @interface ATLSeriesRef : NSManagedObject
@@ -40,6 +40,7 @@
 
 // external representation
 @property (nonatomic, readonly) NSArray *refArray;
-@property (nonatomic, readonly) NSString *xmlSeriesRef, *xmlServiceRef;
+- (void)writeXMLSeriesRefWithWriter:(ATLXMLWriter*)writer;
+- (void)writeXMLServiceRefWithWriter:(ATLXMLWriter*)writer;
 
 @end
@@ -50,16 +50,26 @@
     return @[self.series.id_, @(self.sameDirection)];
 }
 
-- (NSString *)xmlSeriesRef
+- (void)writeXMLCorrectionsWithWriter:(ATLXMLWriter *)writer
 {
-    return [NSString stringWithFormat:@"\t\t<ref series=\"%@\" same=\"%d\" up=\"%d\" down=\"%d\"/>\n",
-            self.series.id_, self.sameDirection, self.upCorrection, self.downCorrection];
+    [writer writeAttribute:"same" intValue:self.sameDirection];
+    [writer writeAttribute:"up" intValue:self.upCorrection];
+    [writer writeAttribute:"down" intValue:self.downCorrection];
+    [writer writeCString:"/>\n"];
 }
 
-- (NSString *)xmlServiceRef
+- (void)writeXMLSeriesRefWithWriter:(ATLXMLWriter *)writer
 {
-    return [NSString stringWithFormat:@"\t\t<ref service=\"%@\" same=\"%d\" up=\"%d\" down=\"%d\"/>\n",
-            self.service.id_, self.sameDirection, self.upCorrection, self.downCorrection];
+    [writer writeCString:"\t\t<ref"];
+    [writer writeAttribute:"series" string:self.series.id_];
+    [self writeXMLCorrectionsWithWriter:writer];
+}
+
+- (void)writeXMLServiceRefWithWriter:(ATLXMLWriter *)writer
+{
+    [writer writeCString:"\t\t<ref"];
+    [writer writeAttribute:"service" string:self.service.id_];
+    [self writeXMLCorrectionsWithWriter:writer];
 }
 
 @end
@@ -50,17 +50,17 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
 
 @interface NSMutableDictionary (HistogramWritingMethods)
 
-- (void)addMeasurementAtLabel:(NSString*)label entry:(id)entry amount:(NSInteger)count;
+- (void)addMeasurementAtLabel:(id)label entry:(id)entry amount:(NSInteger)count;
 - (void)addAmount:(NSInteger)amount forEntry:(id)entry;
 
 @end
 
 @interface NSDictionary (HistogramReadingMethods)
 
-- (int)occurrencesForLabel:(NSString*)label;
-- (id)mostCommonEntryForLabel:(NSString*)label;
+- (int)occurrencesForLabel:(id)label;
+- (id)mostCommonEntryForLabel:(id)label;
 - (id)mostCommonEntry;
-- (double)avarageValueForLabel:(NSString*)label;
+- (double)avarageValueForLabel:(id)label;
 - (double)avarageValue;
 
 @end
@@ -237,6 +237,13 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
     NSMutableDictionary *departureHist = [NSMutableDictionary dictionaryWithCapacity:30];
     NSMutableDictionary *platformHist = [NSMutableDictionary dictionaryWithCapacity:30];
     
+    // Histograms are labeled with station symbols, so time points can be matched without string handling
+    ATLSymbolTable *symbolTable = [ATLSymbolTable sharedTable];
+    NSMutableIndexSet *locationSymbols = [NSMutableIndexSet indexSet];
+    for (ATLServicePoint *servicePoint in self.servicePoints) {
+        [locationSymbols addIndex:servicePoint.locationSymbol];
+    }
+    
     for (ATLSeriesRef *ref in self.seriesRefs) {
         BOOL seriesDirection = ref.sameDirection ? upDirection : !upDirection;
         NSArray *missionRules = [ATLRule arrangeRules:ref.series.missionRules inUpDirection:seriesDirection];
@@ -244,28 +251,35 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
         int correction = upDirection ? ref.upCorrection : ref.downCorrection;
         
         for (ATLMissionRule *missionRule in missionRules) {
-            NSString *originCode = nil, *destinationCode = nil;
-            int amount = (int)missionRule.occurrences;
-            for (ATLTimePoint *timePoint in missionRule.timePath.timePoints) {
-                NSString *stationCode = timePoint.stationCode;
-                if ([self containsLocationCode:stationCode]) {
-                    if (originCode) {
-                        destinationCode = stationCode;
+            ATLSymbol origin = NO_SYMBOL, destination = NO_SYMBOL;
+            int amount = (int)(missionRule.occurrences * missionRule.nrOfInstances);
+            ATLTimePath *timePath = missionRule.timePath;
+            const ATLPackedTimePoint *points = timePath.packedPoints;
+            for (NSUInteger i = 0; i < timePath.nrOfPoints; i++) {
+                ATLSymbol station = [timePath symbolAtIndex:points[i].station];
+                if ([locationSymbols containsIndex:station]) {
+                    if (origin) {
+                        destination = station;
                     } else {
-                        originCode = stationCode;
+                        origin = station;
                     }
-                    [arrivalHist addMeasurementAtLabel:stationCode entry:@(timePoint.arrival - correction) amount:amount];
-                    [departureHist addMeasurementAtLabel:stationCode entry:@(timePoint.departure - correction) amount:amount];
-                    [platformHist addMeasurementAtLabel:stationCode entry:timePoint.platform amount:amount];
+                    [arrivalHist addMeasurementAtLabel:@(station) entry:@(points[i].arrival - correction) amount:amount];
+                    [departureHist addMeasurementAtLabel:@(station) entry:@(points[i].departure - correction) amount:amount];
+                    [platformHist addMeasurementAtLabel:@(station) entry:@([timePath symbolAtIndex:points[i].platform]) amount:amount];
                 }
             }
-            if (destinationCode) {
+            if (destination) {
                 ATLMinutes correctedOffset = missionRule.offset + correction;
-                NSString *originID = [NSString stringWithFormat:@"nl.%@", originCode];
-                NSString *destinationID = [NSString stringWithFormat:@"nl.%@", destinationCode];
+                ATLMinutes correctedLastOffset = missionRule.isPeriodic ? missionRule.lastOffset + correction : 0;
+                NSString *originCode = [symbolTable codeForSymbol:origin];
+                NSString *destinationCode = [symbolTable codeForSymbol:destination];
+                NSString *originID = [symbolTable stringForSymbol:origin];
+                NSString *destinationID = [symbolTable stringForSymbol:destination];
                 if (previousRule &&
                     previousRule.number == missionRule.number &&
                     previousRule.offset == correctedOffset &&
+                    previousRule.headway == missionRule.headway &&
+                    previousRule.lastOffset == correctedLastOffset &&
                     [previousRule.stationIDs isEqualToArray:[missionRule.timePath stationIDsFromID:originID toID:destinationID]])
                 {
                     previousRule.weekdays |= missionRule.weekdays;
@@ -278,6 +292,8 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
                     serviceRule.block = missionRule.block;
                     serviceRule.upDirection = upDirection;
                     serviceRule.offset = correctedOffset;
+                    serviceRule.headway = missionRule.headway;
+                    serviceRule.lastOffset = correctedLastOffset;
                     serviceRule.weekdays = missionRule.weekdays;
                     serviceRule.headsign = missionRule.headsign;
                     serviceRule.originCode = originCode;
@@ -291,18 +307,20 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
     }
     for (ATLServicePoint *servicePoint in self.servicePoints) {
         NSString *stationCode = servicePoint.location.code;
-        if ([servicePoint.location isKindOfClass:[ATLStation class]] && [arrivalHist occurrencesForLabel:stationCode] > 0) {
+        NSNumber *station = @(servicePoint.locationSymbol);
+        if ([servicePoint.location isKindOfClass:[ATLStation class]] && [arrivalHist occurrencesForLabel:station] > 0) {
             int16_t difference;
+            NSString *platform = [symbolTable stringForSymbol:[[platformHist mostCommonEntryForLabel:station] unsignedIntValue]];
             if (upDirection) {
-                servicePoint.upPlatform = [platformHist mostCommonEntryForLabel:stationCode];
-                servicePoint.upArrival = roundl([arrivalHist avarageValueForLabel:stationCode]);
-                servicePoint.upDeparture = roundl([departureHist avarageValueForLabel:stationCode]);
-                difference = ABS([[departureHist mostCommonEntryForLabel:stationCode] intValue] - servicePoint.upDeparture);
+                servicePoint.upPlatform = platform;
+                servicePoint.upArrival = roundl([arrivalHist avarageValueForLabel:station]);
+                servicePoint.upDeparture = roundl([departureHist avarageValueForLabel:station]);
+                difference = ABS([[departureHist mostCommonEntryForLabel:station] intValue] - servicePoint.upDeparture);
             } else {
-                servicePoint.downPlatform = [platformHist mostCommonEntryForLabel:stationCode];
-                servicePoint.downArrival = roundl([arrivalHist avarageValueForLabel:stationCode]);
-                servicePoint.downDeparture = roundl([departureHist avarageValueForLabel:stationCode]);
-                difference = ABS([[departureHist mostCommonEntryForLabel:stationCode] intValue] - servicePoint.downDeparture);
+                servicePoint.downPlatform = platform;
+                servicePoint.downArrival = roundl([arrivalHist avarageValueForLabel:station]);
+                servicePoint.downDeparture = roundl([departureHist avarageValueForLabel:station]);
+                difference = ABS([[departureHist mostCommonEntryForLabel:station] intValue] - servicePoint.downDeparture);
             }
             if (difference >= 5) {
                 NSLog(@"WARNING: difference = %d for %@ in direction %d", difference, stationCode, upDirection);
@@ -343,13 +361,17 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
     self.downServiceRules = nil;
 }
 
+/**
+ Periodic rules are selected when their period overlaps the span, their departures are expanded by the caller.
+ */
 - (NSArray*)rulesWithStartOffset:(ATLMinutes)offset span:(ATLMinutes)span upDirection:(BOOL)upDirection
 {
     NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"ATLServiceRule"];
     request.predicate = [NSPredicate predicateWithFormat:
-                         @"service = %@ AND upDirection = %@ AND offset >= %@ AND offset <= %@",
-                         self, @(upDirection), @(offset), @(offset + span)];
-    return [self.managedObjectContext executeFetchRequest:request error:NULL];
+                         @"service = %@ AND upDirection = %@ AND offset <= %@ AND "
+                         "(offset >= %@ OR (headway > 0 AND lastOffset >= %@))",
+                         self, @(upDirection), @(offset + span), @(offset), @(offset)];
+    return [self.managedObjectContext fetchObjectsWithRequest:request];
 }
 
 - (NSArray *)rulesFromPoint:(ATLServicePoint *)startPoint toPoint:(ATLServicePoint *)endPoint
@@ -409,7 +431,9 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
                              " AND !(ANY noStopPoints = %@)",
                              @(point.km + 0.1), @(point.km + 0.1), @(weekdayMask), point];
     for (ATLServiceRule *rule in [upRules filteredArrayUsingPredicate:upFilter]) {
-        [departures addObject:[[ATLDeparture alloc] initWithPoint:point rule:rule atDate:startTime]];
+        [rule enumerateOffsetsFrom:offset - point.upDeparture to:offset - point.upDeparture + span usingBlock:^(int16_t ruleOffset) {
+            [departures addObject:[[ATLDeparture alloc] initWithPoint:point rule:rule offset:ruleOffset atDate:startTime]];
+        }];
     }
     
     NSArray *downRules = [self rulesWithStartOffset:offset - point.downDeparture span:span upDirection:NO];
@@ -418,7 +442,9 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
                                " AND !(ANY noStopPoints = %@)",
                                @(point.km - 0.1), @(point.km - 0.1), @(weekdayMask), point];
     for (ATLServiceRule *rule in [downRules filteredArrayUsingPredicate:downFilter]) {
-        [departures addObject:[[ATLDeparture alloc] initWithPoint:point rule:rule atDate:startTime]];
+        [rule enumerateOffsetsFrom:offset - point.downDeparture to:offset - point.downDeparture + span usingBlock:^(int16_t ruleOffset) {
+            [departures addObject:[[ATLDeparture alloc] initWithPoint:point rule:rule offset:ruleOffset atDate:startTime]];
+        }];
     }
     
     return departures;
@@ -939,73 +965,84 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
 
 #pragma mark - XML representation
 
-- (void)appendAttributesToXMLString:(NSMutableString *)output
+- (void)writeXMLAttributesWithWriter:(ATLXMLWriter *)writer
 {
-    NSString *express = self.expressService ? @"yes" : @"no";
-    [output appendFormat:@" id=\"%@\" express=\"%@\" group=\"%d\" short=\"%@\" long=\"%@\" image=\"%@\"",
-     self.id_, express, self.group, self.shortName, self.longName, self.imageName];
+    [writer writeAttribute:"id" string:self.id_];
+    [writer writeCString:self.expressService ? " express=\"yes\"" : " express=\"no\""];
+    [writer writeAttribute:"group" intValue:self.group];
+    [writer writeAttribute:"short" string:self.shortName];
+    [writer writeAttribute:"long" string:self.longName];
+    [writer writeAttribute:"image" string:self.imageName];
 }
 
-- (void)appendDataToXMLString:(NSMutableString *)output
+- (void)writeXMLDataWithWriter:(ATLXMLWriter *)writer
 {
-    [output appendFormat:@"\t<frequency peak=\"%.1f\" base=\"%.1f\" offPeak=\"%.1f\"/>\n",
-     self.peakFrequency, self.baseFrequency, self.offPeakFrequency];
+    [writer writeCString:"\t<frequency"];
+    [writer writeAttribute:"peak" doubleValue:self.peakFrequency decimals:1];
+    [writer writeAttribute:"base" doubleValue:self.baseFrequency decimals:1];
+    [writer writeAttribute:"offPeak" doubleValue:self.offPeakFrequency decimals:1];
+    [writer writeCString:"/>\n"];
     if (self.serviceOperator) {
-        [output appendFormat:@"\t<operator>\n\t\t%@\t</operator>\n", self.serviceOperator.xmlReferenceString];
+        [writer writeCString:"\t<operator>\n\t\t"];
+        [self.serviceOperator writeXMLReferenceWithWriter:writer];
+        [writer writeCString:"\t</operator>\n"];
     }
     if (self.grantor) {
-        [output appendFormat:@"\t<grantor>\n\t\t%@\t</grantor>\n", self.grantor.xmlReferenceString];
+        [writer writeCString:"\t<grantor>\n\t\t"];
+        [self.grantor writeXMLReferenceWithWriter:writer];
+        [writer writeCString:"\t</grantor>\n"];
     }
-    [output appendFormat:@"\t<seriesRefs>\n"];
+    [writer writeCString:"\t<seriesRefs>\n"];
     for (ATLSeriesRef *ref in self.seriesRefs) {
-        [output appendString:ref.xmlSeriesRef];
+        [ref writeXMLSeriesRefWithWriter:writer];
     }
-    [output appendFormat:@"\t</seriesRefs>\n"];
+    [writer writeCString:"\t</seriesRefs>\n"];
     
     if ([self.previousServices count] > 0) {
-        [output appendFormat:@"\t<previousServices>\n"];
+        [writer writeCString:"\t<previousServices>\n"];
         [self enumeratePreviousServices:^(ATLService *service){
-            [output appendFormat:@"\t\t"];
-            [output appendString:service.xmlReferenceString];
+            [writer writeCString:"\t\t"];
+            [service writeXMLReferenceWithWriter:writer];
         }];
-        [output appendFormat:@"\t</previousServices>\n"];
+        [writer writeCString:"\t</previousServices>\n"];
     }
     if ([self.nextServices count] > 0) {
-        [output appendFormat:@"\t<nextServices>\n"];
+        [writer writeCString:"\t<nextServices>\n"];
         [self enumerateNextServices:^(ATLService *service){
-            [output appendFormat:@"\t\t"];
-            [output appendString:service.xmlReferenceString];
+            [writer writeCString:"\t\t"];
+            [service writeXMLReferenceWithWriter:writer];
         }];
-        [output appendFormat:@"\t</nextServices>\n"];
+        [writer writeCString:"\t</nextServices>\n"];
     }
-    [output appendFormat:@"\t<locations>\n"];
-    for (ATLServicePoint *servicePoint in self.arrangedServicePoints) {
-        [output appendString:servicePoint.xmlItemReference];
+    NSArray *servicePoints = self.arrangedServicePoints;
+    [writer writeCString:"\t<locations>\n"];
+    for (ATLServicePoint *servicePoint in servicePoints) {
+        [servicePoint writeXMLItemReferenceWithWriter:writer];
     }
-    [output appendFormat:@"\t</locations>\n"];
-    [output appendFormat:@"\t<upSchedule>\n"];
-    for (ATLServicePoint *servicePoint in self.arrangedServicePoints) {
+    [writer writeCString:"\t</locations>\n"];
+    [writer writeCString:"\t<upSchedule>\n"];
+    for (ATLServicePoint *servicePoint in servicePoints) {
         if ([servicePoint.location isKindOfClass:[ATLStation class]]) {
-            [output appendString:servicePoint.xmlUpSchedule];
+            [servicePoint writeXMLUpScheduleWithWriter:writer];
         }
     }
-    [output appendFormat:@"\t</upSchedule>\n"];
-    [output appendFormat:@"\t<downSchedule>\n"];
-    for (NSInteger i = [self.arrangedServicePoints count] - 1; i >= 0; i--) {
-        ATLServicePoint *servicePoint = self.arrangedServicePoints[i];
+    [writer writeCString:"\t</upSchedule>\n"];
+    [writer writeCString:"\t<downSchedule>\n"];
+    for (NSInteger i = [servicePoints count] - 1; i >= 0; i--) {
+        ATLServicePoint *servicePoint = servicePoints[i];
         if ([servicePoint.location isKindOfClass:[ATLStation class]]) {
-            [output appendString:servicePoint.xmlDownSchedule];
+            [servicePoint writeXMLDownScheduleWithWriter:writer];
         }
     }
-    [output appendFormat:@"\t</downSchedule>\n"];
-    [output appendFormat:@"\t<serviceRules>\n"];
+    [writer writeCString:"\t</downSchedule>\n"];
+    [writer writeCString:"\t<serviceRules>\n"];
     for (ATLServiceRule *serviceRule in self.upServiceRules) {
-        [output appendString:serviceRule.xmlString];
+        [serviceRule writeXMLWithWriter:writer];
     }
     for (ATLServiceRule *serviceRule in self.downServiceRules) {
-        [output appendString:serviceRule.xmlString];
+        [serviceRule writeXMLWithWriter:writer];
     }
-    [output appendFormat:@"\t</serviceRules>\n"];
+    [writer writeCString:"\t</serviceRules>\n"];
 }
 
 @end
@@ -1014,7 +1051,7 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
 
 @implementation NSMutableDictionary (HistogramWritingMethods)
 
-- (void)addMeasurementAtLabel:(NSString *)label entry:(id)entry amount:(NSInteger)amount
+- (void)addMeasurementAtLabel:(id)label entry:(id)entry amount:(NSInteger)amount
 {
     NSMutableDictionary *histogram = self[label];
     if (!histogram) {
@@ -1040,7 +1077,7 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
 
 @implementation NSDictionary (HistogramReadingMethods)
 
-- (int)occurrencesForLabel:(NSString *)label
+- (int)occurrencesForLabel:(id)label
 {
     NSDictionary *histogram = self[label];
     int occurrences = 0;
@@ -1050,7 +1087,7 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
     return occurrences;
 }
 
-- (id)mostCommonEntryForLabel:(NSString*)label
+- (id)mostCommonEntryForLabel:(id)label
 {
     NSDictionary *histogram = self[label];
     return [histogram mostCommonEntry];
@@ -1070,7 +1107,7 @@ typedef void (^routeSectionInstructions)(ATLRoute *route, float start, float end
     return mostCommonKey;
 }
 
-- (double)avarageValueForLabel:(NSString *)label
+- (double)avarageValueForLabel:(id)label
 {
     NSDictionary *histogram = self[label];
     return [histogram avarageValue];
@@ -22,7 +22,7 @@
 #import <CoreData/CoreData.h>
 #import "ATLTimePoint.h"
 
-@class ATLLocation, ATLService, ATLServiceRule;
+@class ATLLocation, ATLService, ATLServiceRule, ATLXMLWriter;
 
 @interface ATLServicePoint : NSManagedObject
 
@@ -45,11 +45,15 @@
 - (void)clearSchedule;
 
 @property (nonatomic, readonly) NSString *locationCode;
+@property (nonatomic, readonly) ATLSymbol locationSymbol;
 @property (nonatomic, readonly) NSString *name;
 @property (nonatomic, readonly) BOOL referesToStation;
 @property (nonatomic, readonly) BOOL infraDirection;
-@property (nonatomic, readonly) NSString *xmlString, *xmlItemReference, *xmlUpSchedule, *xmlDownSchedule;
-- (void)appendDataToXMLString:(NSMutableString*)output;
+- (void)writeXMLWithWriter:(ATLXMLWriter*)writer;
+- (void)writeXMLItemReferenceWithWriter:(ATLXMLWriter*)writer;
+- (void)writeXMLUpScheduleWithWriter:(ATLXMLWriter*)writer;
+- (void)writeXMLDownScheduleWithWriter:(ATLXMLWriter*)writer;
+- (void)writeXMLDataWithWriter:(ATLXMLWriter*)writer;
 
 @end
 
@@ -23,9 +23,12 @@
 #import "ATLService.h"
 #import "ATLServiceRule.h"
 #import "ATLStation.h"
+#import "ATLXMLWriter.h"
 
 
-@implementation ATLServicePoint
+@implementation ATLServicePoint {
+    ATLSymbol _locationSymbol;
+}
 
 @dynamic km;
 @dynamic upArrival;
@@ -63,6 +66,28 @@
     return self.location.code;
 }
 
+- (ATLSymbol)locationSymbol
+{
+    if (_locationSymbol == NO_SYMBOL) {
+        _locationSymbol = [[ATLSymbolTable sharedTable] symbolForString:self.location.id_];
+    }
+    return _locationSymbol;
+}
+
+- (void)setLocation:(ATLLocation *)location
+{
+    [self willChangeValueForKey:@"location"];
+    [self setPrimitiveValue:location forKey:@"location"];
+    [self didChangeValueForKey:@"location"];
+    _locationSymbol = NO_SYMBOL;
+}
+
+- (void)didTurnIntoFault
+{
+    [super didTurnIntoFault];
+    _locationSymbol = NO_SYMBOL;
+}
+
 - (NSString *)name
 {
     if ([self.location isKindOfClass:[ATLStation class]]) {
@@ -106,40 +131,50 @@
     self.downDeparture = 0;
 }
 
-- (NSString *)xmlString
+- (void)writeXMLWithWriter:(ATLXMLWriter *)writer
 {
-    NSMutableString *theString = [[NSMutableString alloc] initWithCapacity:50];
-    [theString appendFormat:@"\t<routePoint km=\"%.3f\">\n\t\t", self.km];
-    [self appendDataToXMLString:theString];
-    [theString appendString:@"\t</routePoint>\n"];
-    return theString;
+    [writer writeCString:"\t<routePoint"];
+    [writer writeAttribute:"km" doubleValue:self.km decimals:3];
+    [writer writeCString:">\n\t\t"];
+    [self writeXMLDataWithWriter:writer];
+    [writer writeCString:"\t</routePoint>\n"];
 }
 
-- (NSString *)xmlItemReference
+- (void)writeXMLItemReferenceWithWriter:(ATLXMLWriter *)writer
 {
-    NSString *name = [[NSStringFromClass([self.location class]) substringFromIndex:3] lowercaseString];
-    return [NSString stringWithFormat:@"\t\t<%@ km=\"%.3f\" id=\"%@\"/>\n", name, self.km, self.location.id_];
+    [writer writeCString:"\t\t<"];
+    [writer writeElementNameOfClass:[self.location class]];
+    [writer writeAttribute:"km" doubleValue:self.km decimals:3];
+    [writer writeAttribute:"id" string:self.location.id_];
+    [writer writeCString:"/>\n"];
 }
 
-- (NSString *)xmlUpSchedule
+- (void)writeXMLSchedule:(const char *)element arrival:(ATLMinutes)arrival departure:(ATLMinutes)departure
+                platform:(NSString *)platform writer:(ATLXMLWriter *)writer
 {
-    NSString *arrivalString = stringFromMinutes(self.upArrival);
-    NSString *departureString = stringFromMinutes(self.upDeparture);
-    return [NSString stringWithFormat:@"\t\t<up A=\"%@\" V=\"%@\" O=\"%u\" P=\"%@\" S=\"%@\"/>\n",
-            arrivalString, departureString, self.options, self.upPlatform, self.location.id_];
+    [writer writeCString:"\t\t<"];
+    [writer writeCString:element];
+    [writer writeAttribute:"A" minutes:arrival];
+    [writer writeAttribute:"V" minutes:departure];
+    [writer writeAttribute:"O" unsignedValue:self.options];
+    [writer writeAttribute:"P" string:platform];
+    [writer writeAttribute:"S" string:self.location.id_];
+    [writer writeCString:"/>\n"];
 }
 
-- (NSString *)xmlDownSchedule
+- (void)writeXMLUpScheduleWithWriter:(ATLXMLWriter *)writer
 {
-    NSString *arrivalString = stringFromMinutes(self.downArrival);
-    NSString *departureString = stringFromMinutes(self.downDeparture);
-    return [NSString stringWithFormat:@"\t\t<down A=\"%@\" V=\"%@\" O=\"%u\" P=\"%@\" S=\"%@\"/>\n",
-            arrivalString, departureString, self.options, self.downPlatform, self.location.id_];
+    [self writeXMLSchedule:"up" arrival:self.upArrival departure:self.upDeparture platform:self.upPlatform writer:writer];
+}
+
+- (void)writeXMLDownScheduleWithWriter:(ATLXMLWriter *)writer
+{
+    [self writeXMLSchedule:"down" arrival:self.downArrival departure:self.downDeparture platform:self.downPlatform writer:writer];
 }
 
-- (void)appendDataToXMLString:(NSMutableString *)output
+- (void)writeXMLDataWithWriter:(ATLXMLWriter *)writer
 {
-    [output appendString:self.location.xmlReferenceString];
+    [self.location writeXMLReferenceWithWriter:writer];
 }
 
 
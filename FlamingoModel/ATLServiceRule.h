@@ -65,6 +65,7 @@
 @interface ATLDeparture : NSObject
 
 - (instancetype)initWithPoint:(ATLServicePoint*)point rule:(ATLServiceRule*)rule atDate:(NSDate*)date;
+- (instancetype)initWithPoint:(ATLServicePoint*)point rule:(ATLServiceRule*)rule offset:(int16_t)offset atDate:(NSDate*)date;
 
 @property (nonatomic, strong) ATLServicePoint *servicePoint;
 @property (nonatomic, strong) ATLServiceRule *serviceRule;
@@ -109,7 +109,7 @@
     if (!mission) {
         NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"ATLServiceRule"];
         request.predicate = [NSPredicate predicateWithFormat: @"number = %@ ", @(self.number)];
-        NSArray *fetchedRules = [self.managedObjectContext executeFetchRequest:request error:NULL];
+        NSArray *fetchedRules = [self.managedObjectContext fetchObjectsWithRequest:request];
         NSPredicate *filter = [NSPredicate predicateWithFormat: @"(weekdays & %@) > 0", @(date.weekdayMask)];
         NSArray *rules = [fetchedRules filteredArrayUsingPredicate:filter];
         if ([rules count] > 0) {
@@ -282,10 +282,11 @@
 
 #pragma mark - Writing methods
 
-- (void)appendAttributesToXMLString:(NSMutableString *)output
+- (void)writeXMLAttributesWithWriter:(ATLXMLWriter *)writer
 {
-    [super appendAttributesToXMLString:output];
-    [output appendFormat:@" from=\"%@\" to=\"%@\"", self.originCode, self.destinationCode];
+    [super writeXMLAttributesWithWriter:writer];
+    [writer writeAttribute:"from" string:self.originCode];
+    [writer writeAttribute:"to" string:self.destinationCode];
 }
 
 - (BOOL)hasXMLData
@@ -293,10 +294,12 @@
     return [self.noStopPoints count] > 0;
 }
 
-- (void)appendDataToXMLString:(NSMutableString *)output
+- (void)writeXMLDataWithWriter:(ATLXMLWriter *)writer
 {
     for (ATLServicePoint *point in self.noStopPoints) {
-        [output appendFormat:@"<nostop code=\"%@\"/>", point.location.code];
+        [writer writeCString:"<nostop"];
+        [writer writeAttribute:"code" string:point.location.code];
+        [writer writeCString:"/>"];
     }
 }
 
@@ -305,6 +308,14 @@
 @implementation ATLDeparture
 
 - (instancetype)initWithPoint:(ATLServicePoint *)point rule:(ATLServiceRule *)rule atDate:(NSDate *)date
+{
+    return [self initWithPoint:point rule:rule offset:rule.offset atDate:date];
+}
+
+/**
+ The offset selects one departure of a periodic rule
+ */
+- (instancetype)initWithPoint:(ATLServicePoint *)point rule:(ATLServiceRule *)rule offset:(int16_t)offset atDate:(NSDate *)date
 {
     self = [super init];
     if (self) {
@@ -312,9 +323,9 @@
         self.serviceRule = rule;
         self.date = date;
         if (rule.upDirection) {
-            self.plannedDeparture = [date dateByReplacingTimeWith:rule.offset + point.upDeparture];
+            self.plannedDeparture = [date dateByReplacingTimeWith:offset + point.upDeparture];
         } else {
-            self.plannedDeparture = [date dateByReplacingTimeWith:rule.offset + point.downDeparture];
+            self.plannedDeparture = [date dateByReplacingTimeWith:offset + point.downDeparture];
         }
     }
     return self;
@@ -293,30 +293,38 @@
 
 #pragma mark - XML representation
 
-- (void)appendAttributesToXMLString:(NSMutableString *)output
+- (void)writeXMLAttributesWithWriter:(ATLXMLWriter *)writer
 {
-    [super appendAttributesToXMLString:output];
-    [output appendFormat:@" name=\"%@\" importance=\"%d\" corridor=\"%d\" region=\"%d\"", self.name, self.importance, self.icGroup, self.regionGroup];
+    [super writeXMLAttributesWithWriter:writer];
+    [writer writeAttribute:"name" string:self.name];
+    [writer writeAttribute:"importance" intValue:self.importance];
+    [writer writeAttribute:"corridor" intValue:self.icGroup];
+    [writer writeAttribute:"region" intValue:self.regionGroup];
 }
 
-- (void)appendDataToXMLString:(NSMutableString *)output
+- (void)writeXMLDataWithWriter:(ATLXMLWriter *)writer
 {
-    [super appendDataToXMLString:output];
+    [super writeXMLDataWithWriter:writer];
     if (self.displayName) {
-        [output appendFormat:@"<display angle=\"%d\">%@</display>\n", self.labelAngle, self.displayName];
+        [writer writeCString:"<display"];
+        [writer writeAttribute:"angle" intValue:self.labelAngle];
+        [writer writeCString:">"];
+        [writer writeEscapedString:self.displayName];
+        [writer writeCString:"</display>\n"];
     }
     if (self.openedString) {
-        [output appendFormat:@"<opened>%@</opened>\n", self.openedString];
+        [writer writeElement:"opened" text:self.openedString];
     }
     if (self.wikiString && [self.wikiString length] > 3) {
-        [output appendFormat:@"<wiki>%@</wiki>\n", self.wikiString];
+        [writer writeElement:"wiki" text:self.wikiString];
     }
     if ([self.aliases count] > 0) {
-        [output appendString:@"<aliases>\n"];
+        [writer writeCString:"<aliases>\n"];
         for (ATLAlias *alias in self.aliases) {
-            [output appendFormat:@"\t<name>%@</name>\n", alias.name];
+            [writer writeCString:"\t"];
+            [writer writeElement:"name" text:alias.name];
         }
-        [output appendString:@"</aliases>\n"];
+        [writer writeCString:"</aliases>\n"];
     }
 }
 
@@ -0,0 +1,64 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLStationIndex.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreLocation/CoreLocation.h>
+
+@class ATLStation;
+
+/**
+ ATLStationIndex is a uniform grid over the coordinates of stations, for proximity queries without Core Data.
+ Distances are in meters on an equirectangular projection at the latitude of the query,
+ the same measure that ATLDataController uses to compare stations.
+ A station is indexed at the average of its route positions, read when the index is built,
+ stations without route positions are not indexed. The index is read only, build a new one when stations move.
+ */
+@interface ATLStationIndex : NSObject
+
+- (instancetype)initWithStations:(NSArray *)stations;
+
+/**
+ Indexes the stations at the given coordinates instead of their route positions, e.g. those of an atlas snapshot.
+ */
+- (instancetype)initWithStations:(NSArray *)stations coordinates:(const CLLocationCoordinate2D *)coordinates;
+
+@property (nonatomic, readonly) NSUInteger count;
+- (ATLStation *)stationAtIndex:(NSUInteger)index;
+
+/**
+ All stations within range of the coordinate, closest first.
+ */
+- (NSArray *)stationsWithinRange:(double)distanceInMeters ofCoordinate:(CLLocationCoordinate2D)coordinate;
+
+/**
+ At most k stations within range of the coordinate, closest first.
+ */
+- (NSArray *)nearestStations:(NSUInteger)k toCoordinate:(CLLocationCoordinate2D)coordinate withinRange:(double)distanceInMeters;
+
+/**
+ The nearest station for each of count coordinates, as index for stationAtIndex: and distance in meters.
+ Coordinates without a station in range get NSNotFound and a distance of -1. Nothing is allocated per coordinate,
+ so this can be called for many devices at GPS rate.
+ */
+- (void)getNearestStationIndexes:(NSUInteger *)indexes distances:(double *)distances
+                  forCoordinates:(const CLLocationCoordinate2D *)coordinates count:(NSUInteger)count
+                     withinRange:(double)distanceInMeters;
+
+@end
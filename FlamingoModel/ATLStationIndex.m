@@ -0,0 +1,256 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLStationIndex.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLStationIndex.h"
+#import "ATLStation.h"
+#import "GeoMetricFunctions.h"
+
+#define CELL_SIZE           2000.0      // meters
+#define CELLS_PER_STATION   4
+
+typedef struct {
+    double latitude, longitude;
+    uint32_t station;
+    uint32_t reserved;
+} ATLStationPoint;
+
+/**
+ The k closest stations found so far, ordered by distance.
+ */
+typedef struct {
+    double latitude, longitude;
+    double horScale;
+    double maxDistance2;
+    NSUInteger k, found;
+    uint32_t *stations;
+    double *distances2;
+} ATLNearestStations;
+
+static inline double distance2(double latitude, double longitude, double horScale, const ATLStationPoint *point)
+{
+    double dx = (point->longitude - longitude) * horScale;
+    double dy = (point->latitude - latitude) * VER_SCALE;
+    return dx * dx + dy * dy;
+}
+
+static void considerPoints(ATLNearestStations *nearest, const ATLStationPoint *points, uint32_t start, uint32_t end)
+{
+    for (uint32_t i = start; i < end; i++) {
+        double d2 = distance2(nearest->latitude, nearest->longitude, nearest->horScale, &points[i]);
+        if (d2 > nearest->maxDistance2 || (nearest->found == nearest->k && d2 >= nearest->distances2[nearest->k - 1])) {
+            continue;
+        }
+        NSUInteger position = MIN(nearest->found, nearest->k - 1);
+        while (position > 0 && nearest->distances2[position - 1] > d2) {
+            nearest->stations[position] = nearest->stations[position - 1];
+            nearest->distances2[position] = nearest->distances2[position - 1];
+            position--;
+        }
+        nearest->stations[position] = points[i].station;
+        nearest->distances2[position] = d2;
+        nearest->found = MIN(nearest->found + 1, nearest->k);
+    }
+}
+
+@implementation ATLStationIndex {
+    NSArray *_stations;
+    NSMutableData *_pointData;
+    const ATLStationPoint *_points;
+    NSMutableData *_cellData;
+    const uint32_t *_cellStarts;        // points of cell i are _cellStarts[i] ..< _cellStarts[i + 1]
+    double _minLatitude, _minLongitude;
+    double _cellLatitude, _cellLongitude;
+    NSInteger _columns, _rows;
+}
+
+- (instancetype)initWithStations:(NSArray *)stations
+{
+    NSUInteger count = [stations count];
+    CLLocationCoordinate2D *coordinates = malloc(MAX(count, 1) * sizeof(CLLocationCoordinate2D));
+    for (NSUInteger i = 0; i < count; i++) {
+        coordinates[i] = [stations[i] averagedCoordinate];
+    }
+    self = [self initWithStations:stations coordinates:coordinates];
+    free(coordinates);
+    return self;
+}
+
+- (instancetype)initWithStations:(NSArray *)stations coordinates:(const CLLocationCoordinate2D *)coordinates
+{
+    self = [super init];
+    if (self) {
+        _stations = [stations copy];
+        _pointData = [NSMutableData dataWithLength:MAX([stations count], 1) * sizeof(ATLStationPoint)];
+        ATLStationPoint *points = [_pointData mutableBytes];
+        NSUInteger nrOfPoints = 0;
+        double maxLatitude = -90, maxLongitude = -180;
+        _minLatitude = 90;
+        _minLongitude = 180;
+        for (NSUInteger i = 0; i < [stations count]; i++) {
+            CLLocationCoordinate2D coordinate = coordinates[i];
+            if (!isfinite(coordinate.latitude) || !isfinite(coordinate.longitude) || !CLLocationCoordinate2DIsValid(coordinate)) {
+                continue;
+            }
+            points[nrOfPoints++] = (ATLStationPoint){coordinate.latitude, coordinate.longitude, (uint32_t)i, 0};
+            _minLatitude = MIN(_minLatitude, coordinate.latitude);
+            _minLongitude = MIN(_minLongitude, coordinate.longitude);
+            maxLatitude = MAX(maxLatitude, coordinate.latitude);
+            maxLongitude = MAX(maxLongitude, coordinate.longitude);
+        }
+        _count = nrOfPoints;
+        [self buildGridWithPoints:points maxLatitude:maxLatitude maxLongitude:maxLongitude];
+    }
+    return self;
+}
+
+/**
+ Sorts the points by cell. Cells are CELL_SIZE meters at the latitude in the middle of the stations,
+ and grow when the stations are so sparse that most cells would be empty.
+ */
+- (void)buildGridWithPoints:(ATLStationPoint *)points maxLatitude:(double)maxLatitude maxLongitude:(double)maxLongitude
+{
+    if (_count == 0) {
+        _minLatitude = _minLongitude = 0;
+        maxLatitude = maxLongitude = 0;
+    }
+    double horScale = horScaleForLatitude((_minLatitude + maxLatitude) / 2);
+    double cellSize = CELL_SIZE;
+    do {
+        _cellLatitude = cellSize / VER_SCALE;
+        _cellLongitude = cellSize / horScale;
+        _rows = (NSInteger)floor((maxLatitude - _minLatitude) / _cellLatitude) + 1;
+        _columns = (NSInteger)floor((maxLongitude - _minLongitude) / _cellLongitude) + 1;
+        cellSize *= 2;
+    } while ((NSUInteger)(_rows * _columns) > CELLS_PER_STATION * _count + 64);
+
+    NSUInteger nrOfCells = _rows * _columns;
+    _cellData = [NSMutableData dataWithLength:(nrOfCells + 1) * sizeof(uint32_t)];
+    uint32_t *cellStarts = [_cellData mutableBytes];
+    uint32_t *cellOfPoint = malloc(MAX(_count, 1) * sizeof(uint32_t));
+    for (NSUInteger i = 0; i < _count; i++) {
+        NSInteger row = MIN((NSInteger)((points[i].latitude - _minLatitude) / _cellLatitude), _rows - 1);
+        NSInteger column = MIN((NSInteger)((points[i].longitude - _minLongitude) / _cellLongitude), _columns - 1);
+        cellOfPoint[i] = (uint32_t)(row * _columns + column);
+        cellStarts[cellOfPoint[i] + 1]++;
+    }
+    for (NSUInteger cell = 0; cell < nrOfCells; cell++) {
+        cellStarts[cell + 1] += cellStarts[cell];
+    }
+
+    // Counting sort of the points into their cells
+    NSMutableData *sortedData = [NSMutableData dataWithLength:MAX(_count, 1) * sizeof(ATLStationPoint)];
+    ATLStationPoint *sorted = [sortedData mutableBytes];
+    uint32_t *next = malloc(nrOfCells * sizeof(uint32_t));
+    memcpy(next, cellStarts, nrOfCells * sizeof(uint32_t));
+    for (NSUInteger i = 0; i < _count; i++) {
+        sorted[next[cellOfPoint[i]]++] = points[i];
+    }
+    free(next);
+    free(cellOfPoint);
+
+    _pointData = sortedData;
+    _points = sorted;
+    _cellStarts = cellStarts;
+}
+
+- (ATLStation *)stationAtIndex:(NSUInteger)index
+{
+    return _stations[index];
+}
+
+#pragma mark - Queries
+
+- (NSArray *)stationsWithinRange:(double)distanceInMeters ofCoordinate:(CLLocationCoordinate2D)coordinate
+{
+    return [self nearestStations:_count toCoordinate:coordinate withinRange:distanceInMeters];
+}
+
+- (NSArray *)nearestStations:(NSUInteger)k toCoordinate:(CLLocationCoordinate2D)coordinate withinRange:(double)distanceInMeters
+{
+    k = MIN(k, _count);
+    if (k == 0) {
+        return @[];
+    }
+    uint32_t *stations = malloc(k * sizeof(uint32_t));
+    double *distances2 = malloc(k * sizeof(double));
+    ATLNearestStations nearest = {coordinate.latitude, coordinate.longitude, horScaleForLatitude(coordinate.latitude),
+                                  distanceInMeters * distanceInMeters, k, 0, stations, distances2};
+    [self searchNearestStations:&nearest withinRange:distanceInMeters];
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:nearest.found];
+    for (NSUInteger i = 0; i < nearest.found; i++) {
+        [result addObject:_stations[stations[i]]];
+    }
+    free(stations);
+    free(distances2);
+    return result;
+}
+
+- (void)getNearestStationIndexes:(NSUInteger *)indexes distances:(double *)distances
+                  forCoordinates:(const CLLocationCoordinate2D *)coordinates count:(NSUInteger)count
+                     withinRange:(double)distanceInMeters
+{
+    uint32_t station = 0;
+    double stationDistance2 = 0;
+    for (NSUInteger i = 0; i < count; i++) {
+        ATLNearestStations nearest = {coordinates[i].latitude, coordinates[i].longitude, horScaleForLatitude(coordinates[i].latitude),
+                                      distanceInMeters * distanceInMeters, 1, 0, &station, &stationDistance2};
+        if (_count > 0) {
+            [self searchNearestStations:&nearest withinRange:distanceInMeters];
+        }
+        indexes[i] = nearest.found > 0 ? station : NSNotFound;
+        distances[i] = nearest.found > 0 ? sqrt(stationDistance2) : -1;
+    }
+}
+
+/**
+ Visits rings of cells around the cell of the coordinate, until the ring is further away than the k-th station found,
+ than the range, or covers the whole grid.
+ */
+- (void)searchNearestStations:(ATLNearestStations *)nearest withinRange:(double)distanceInMeters
+{
+    NSInteger column = (NSInteger)floor((nearest->longitude - _minLongitude) / _cellLongitude);
+    NSInteger row = (NSInteger)floor((nearest->latitude - _minLatitude) / _cellLatitude);
+    double ringWidth = MIN(_cellLongitude * nearest->horScale, _cellLatitude * VER_SCALE);
+
+    // Rings that lie completely outside the grid are skipped
+    NSInteger firstRing = MAX(MAX(-column, column - (_columns - 1)), MAX(-row, row - (_rows - 1)));
+    NSInteger lastRing = MAX(MAX(column, (_columns - 1) - column), MAX(row, (_rows - 1) - row));
+    for (NSInteger ring = MAX(firstRing, 0); ring <= lastRing; ring++) {
+        double ringDistance = (ring - 1) * ringWidth;
+        if (ring > 0 && (ringDistance > distanceInMeters ||
+                         (nearest->found == nearest->k && ringDistance * ringDistance >= nearest->distances2[nearest->k - 1]))) {
+            break;
+        }
+        NSInteger minRow = MAX(row - ring, 0), maxRow = MIN(row + ring, _rows - 1);
+        for (NSInteger r = minRow; r <= maxRow; r++) {
+            BOOL edgeRow = (r == row - ring || r == row + ring);
+            NSInteger step = (edgeRow || ring == 0) ? 1 : 2 * ring;
+            for (NSInteger c = column - ring; c <= column + ring; c += step) {
+                if (c < 0 || c >= _columns) {
+                    continue;
+                }
+                NSInteger cell = r * _columns + c;
+                considerPoints(nearest, _points, _cellStarts[cell], _cellStarts[cell + 1]);
+            }
+        }
+    }
+}
+
+@end
@@ -0,0 +1,50 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLStopTimesSorter.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ ATLStopTimesSorter brings the rows of stop_times.txt in (trip_id, stop_sequence) order with an external merge sort,
+ for feeds that interleave the rows of different trips.
+ Rows are sorted in runs of at most maxRowsPerRun, the sorted runs are written to temporary files
+ and merged while the output is passed on in chunks. Memory use is bounded by the run size, not by the size of the file.
+ */
+@interface ATLStopTimesSorter : NSObject
+
+- (instancetype)initWithContentsOfURL:(NSURL *)url;
+
+@property (nonatomic, assign) NSUInteger maxRowsPerRun;         // default 500000
+@property (nonatomic, strong) NSURL *temporaryDirectory;        // default NSTemporaryDirectory()
+@property (nonatomic, readonly) NSUInteger nrOfRuns;
+
+/**
+ Checks whether the rows of every trip are contiguous and in stop_sequence order,
+ the check stops at the first row that is out of order. A file that cannot be read is not sorted.
+ */
+- (BOOL)isSorted;
+
+/**
+ Passes the sorted document, header line included, to the block in chunks. The bytes are only valid during the call.
+ Temporary files are removed before returning.
+ */
+- (BOOL)enumerateSortedChunksUsingBlock:(void (^)(const void *bytes, NSUInteger length, BOOL *stop))block
+                                  error:(NSError **)error;
+
+@end
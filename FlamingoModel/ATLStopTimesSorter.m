@@ -0,0 +1,423 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLStopTimesSorter.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLStopTimesSorter.h"
+#import "ATLCSVReader.h"
+
+#define DEFAULT_ROWS_PER_RUN    500000
+#define CHUNK_SIZE              (256 * 1024)
+#define LINE_FEED               '\n'
+
+/**
+ A row of the current run, referring to the mapped file
+ */
+typedef struct {
+    uint64_t lineOffset;
+    uint32_t lineLength;
+    uint32_t tripOffset;        // relative to the start of the line
+    uint32_t tripLength;
+    int32_t sequence;
+} ATLStopTimeEntry;
+
+/**
+ Header of a row in a run file, followed by the line itself, which always ends with a line feed
+ */
+typedef struct {
+    uint32_t lineLength;
+    uint32_t tripOffset;
+    uint32_t tripLength;
+    int32_t sequence;
+} ATLRunRecord;
+
+/**
+ Read position in a mapped run file
+ */
+typedef struct {
+    const char *p;
+    const char *end;
+} ATLRunCursor;
+
+static int compareKeys(const char *trip1, NSUInteger length1, int32_t sequence1,
+                       const char *trip2, NSUInteger length2, int32_t sequence2)
+{
+    int result = memcmp(trip1, trip2, MIN(length1, length2));
+    if (result == 0 && length1 != length2) {
+        result = length1 < length2 ? -1 : 1;
+    }
+    if (result == 0 && sequence1 != sequence2) {
+        result = sequence1 < sequence2 ? -1 : 1;
+    }
+    return result;
+}
+
+// Records in a run file are not aligned
+static ATLRunRecord recordAtCursor(const ATLRunCursor *cursor)
+{
+    ATLRunRecord record;
+    memcpy(&record, cursor->p, sizeof(record));
+    return record;
+}
+
+static int compareRunCursors(const ATLRunCursor *cursor1, const ATLRunCursor *cursor2)
+{
+    ATLRunRecord record1 = recordAtCursor(cursor1);
+    ATLRunRecord record2 = recordAtCursor(cursor2);
+    const char *line1 = cursor1->p + sizeof(ATLRunRecord);
+    const char *line2 = cursor2->p + sizeof(ATLRunRecord);
+    return compareKeys(line1 + record1.tripOffset, record1.tripLength, record1.sequence,
+                       line2 + record2.tripOffset, record2.tripLength, record2.sequence);
+}
+
+static void siftDown(NSUInteger *heap, NSUInteger heapSize, NSUInteger i, const ATLRunCursor *cursors)
+{
+    while (YES) {
+        NSUInteger smallest = i;
+        NSUInteger left = 2 * i + 1, right = 2 * i + 2;
+        if (left < heapSize && compareRunCursors(&cursors[heap[left]], &cursors[heap[smallest]]) < 0) {
+            smallest = left;
+        }
+        if (right < heapSize && compareRunCursors(&cursors[heap[right]], &cursors[heap[smallest]]) < 0) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        NSUInteger swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+static NSError *posixError(void)
+{
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+}
+
+@interface ATLStopTimesSorter () <ATLCSVReaderDelegate>
+
+@end
+
+@implementation ATLStopTimesSorter {
+    NSURL *_url;
+    NSData *_data;
+    NSError *_error;
+    BOOL _checking;
+
+    // Columns
+    NSUInteger _tripColumn, _sequenceColumn;
+    NSMutableData *_headerLine;
+
+    // Sort check
+    BOOL _sorted;
+    NSMutableData *_previousTrip;
+    int32_t _previousSequence;
+    NSMutableSet *_seenTrips;
+
+    // Runs
+    NSMutableData *_entries;
+    NSMutableArray *_runURLs;
+}
+
+#pragma mark - Object lifecycle
+
+- (instancetype)initWithContentsOfURL:(NSURL *)url
+{
+    self = [super init];
+    if (self) {
+        _url = url;
+        _maxRowsPerRun = DEFAULT_ROWS_PER_RUN;
+        _temporaryDirectory = [NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES];
+    }
+    return self;
+}
+
+- (NSUInteger)nrOfRuns
+{
+    return [_runURLs count];
+}
+
+- (BOOL)readWithChecking:(BOOL)checking error:(NSError **)error
+{
+    if (!_data) {
+        _data = [NSData dataWithContentsOfURL:_url options:NSDataReadingMappedAlways error:error];
+        if (!_data) {
+            return NO;
+        }
+    }
+    _checking = checking;
+    _tripColumn = NSNotFound;
+    _sequenceColumn = NSNotFound;
+    _error = nil;
+    ATLCSVReader *reader = [[ATLCSVReader alloc] initWithData:_data];
+    reader.delegate = self;
+    reader.batchSize = 10000;
+    [reader parse];
+    if (_error) {
+        if (error) {
+            *error = _error;
+        }
+        return NO;
+    }
+    return YES;
+}
+
+#pragma mark - Checking the order
+
+- (BOOL)isSorted
+{
+    _sorted = YES;
+    _previousTrip = [NSMutableData dataWithCapacity:32];
+    _seenTrips = [NSMutableSet setWithCapacity:10000];
+    NSError *error = nil;
+    if (![self readWithChecking:YES error:&error]) {
+        NSLog(@"error: %@", error);
+        _sorted = NO;
+    }
+    _previousTrip = nil;
+    _seenTrips = nil;
+    return _sorted;
+}
+
+- (void)checkTrip:(ATLCSVField)trip sequence:(int32_t)sequence reader:(ATLCSVReader *)reader
+{
+    if (fieldEqualsBytes(trip, [_previousTrip bytes], [_previousTrip length])) {
+        _sorted = sequence >= _previousSequence;
+    } else {
+        NSString *tripID = [reader stringForField:_tripColumn];
+        _sorted = ![_seenTrips containsObject:tripID];
+        [_seenTrips addObject:tripID];
+        [_previousTrip setLength:0];
+        [_previousTrip appendBytes:trip.bytes length:trip.length];
+    }
+    _previousSequence = sequence;
+    if (!_sorted) {
+        [reader cancelParsing];
+    }
+}
+
+#pragma mark - Sorting
+
+- (BOOL)enumerateSortedChunksUsingBlock:(void (^)(const void *, NSUInteger, BOOL *))block error:(NSError **)error
+{
+    _entries = [NSMutableData dataWithCapacity:MIN(_maxRowsPerRun, DEFAULT_ROWS_PER_RUN) * sizeof(ATLStopTimeEntry)];
+    _runURLs = [NSMutableArray arrayWithCapacity:16];
+    BOOL success = [self readWithChecking:NO error:error];
+
+    NSMutableData *output = [NSMutableData dataWithCapacity:CHUNK_SIZE + 1024];
+    __block BOOL stop = NO;
+    void (^emit)(const char *, NSUInteger) = ^(const char *bytes, NSUInteger length) {
+        [output appendBytes:bytes length:length];
+        if ([output length] >= CHUNK_SIZE && !stop) {
+            block([output bytes], [output length], &stop);
+            [output setLength:0];
+        }
+    };
+    if (success && _headerLine) {
+        emit([_headerLine bytes], [_headerLine length]);
+    }
+
+    if (success && [_runURLs count] == 0) {
+        // The whole file fitted in a single run, it is passed on straight from the mapped file
+        [self sortEntries];
+        const char *base = [_data bytes];
+        const ATLStopTimeEntry *entries = [_entries bytes];
+        NSUInteger count = [_entries length] / sizeof(ATLStopTimeEntry);
+        for (NSUInteger i = 0; i < count && !stop; i++) {
+            emit(base + entries[i].lineOffset, entries[i].lineLength);
+            if (base[entries[i].lineOffset + entries[i].lineLength - 1] != LINE_FEED) {
+                emit("\n", 1);
+            }
+        }
+    } else if (success) {
+        if ([_entries length] > 0) {
+            success = [self writeRun:error];
+        }
+        if (success) {
+            success = [self mergeRunsWithBlock:emit stop:&stop error:error];
+        }
+    }
+    if (success && [output length] > 0 && !stop) {
+        block([output bytes], [output length], &stop);
+    }
+
+    for (NSURL *runURL in _runURLs) {
+        [[NSFileManager defaultManager] removeItemAtURL:runURL error:NULL];
+    }
+    _entries = nil;
+    _data = nil;
+    return success;
+}
+
+- (void)addEntryForLine:(ATLCSVField)line trip:(ATLCSVField)trip sequence:(int32_t)sequence
+{
+    ATLStopTimeEntry entry;
+    entry.lineOffset = line.bytes - (const char *)[_data bytes];
+    entry.lineLength = (uint32_t)line.length;
+    entry.tripOffset = (uint32_t)(trip.bytes - line.bytes);
+    entry.tripLength = (uint32_t)trip.length;
+    entry.sequence = sequence;
+    [_entries appendBytes:&entry length:sizeof(entry)];
+    if ([_entries length] / sizeof(ATLStopTimeEntry) >= _maxRowsPerRun) {
+        NSError *error = nil;
+        if (![self writeRun:&error]) {
+            _error = error;
+        }
+    }
+}
+
+- (void)sortEntries
+{
+    const char *base = [_data bytes];
+    mergesort_b([_entries mutableBytes], [_entries length] / sizeof(ATLStopTimeEntry), sizeof(ATLStopTimeEntry),
+                ^int(const void *p1, const void *p2) {
+                    const ATLStopTimeEntry *entry1 = p1, *entry2 = p2;
+                    return compareKeys(base + entry1->lineOffset + entry1->tripOffset, entry1->tripLength, entry1->sequence,
+                                       base + entry2->lineOffset + entry2->tripOffset, entry2->tripLength, entry2->sequence);
+                });
+}
+
+- (BOOL)writeRun:(NSError **)error
+{
+    [self sortEntries];
+    NSString *fileName = [NSString stringWithFormat:@"stop_times-run-%@.bin", [[NSUUID UUID] UUIDString]];
+    NSURL *runURL = [self.temporaryDirectory URLByAppendingPathComponent:fileName];
+    FILE *file = fopen([runURL fileSystemRepresentation], "wb");
+    if (!file) {
+        if (error) {
+            *error = posixError();
+        }
+        return NO;
+    }
+    [_runURLs addObject:runURL];
+
+    const char *base = [_data bytes];
+    const ATLStopTimeEntry *entries = [_entries bytes];
+    NSUInteger count = [_entries length] / sizeof(ATLStopTimeEntry);
+    BOOL success = YES;
+    for (NSUInteger i = 0; i < count && success; i++) {
+        const char *line = base + entries[i].lineOffset;
+        BOOL terminated = line[entries[i].lineLength - 1] == LINE_FEED;
+        ATLRunRecord record = {entries[i].lineLength + (terminated ? 0 : 1), entries[i].tripOffset,
+                               entries[i].tripLength, entries[i].sequence};
+        success = fwrite(&record, sizeof(record), 1, file) == 1 &&
+                  fwrite(line, 1, entries[i].lineLength, file) == entries[i].lineLength &&
+                  (terminated || fputc(LINE_FEED, file) != EOF);
+    }
+    if (fclose(file) != 0) {
+        success = NO;
+    }
+    if (!success && error) {
+        *error = posixError();
+    }
+    [_entries setLength:0];
+    return success;
+}
+
+/**
+ K-way merge of the run files, using a binary heap of run cursors ordered by their current row
+ */
+- (BOOL)mergeRunsWithBlock:(void (^)(const char *, NSUInteger))emit stop:(BOOL *)stop error:(NSError **)error
+{
+    NSUInteger count = [_runURLs count];
+    NSMutableArray *runs = [NSMutableArray arrayWithCapacity:count];
+    ATLRunCursor *cursors = calloc(count, sizeof(ATLRunCursor));
+    NSUInteger *heap = calloc(count, sizeof(NSUInteger));
+    NSUInteger heapSize = 0;
+    for (NSURL *runURL in _runURLs) {
+        NSData *run = [NSData dataWithContentsOfURL:runURL options:NSDataReadingMappedAlways error:error];
+        if (!run) {
+            free(cursors);
+            free(heap);
+            return NO;
+        }
+        [runs addObject:run];
+        NSUInteger index = [runs count] - 1;
+        cursors[index].p = [run bytes];
+        cursors[index].end = cursors[index].p + [run length];
+        if (cursors[index].p < cursors[index].end) {
+            heap[heapSize++] = index;
+        }
+    }
+
+    // Heapify, then repeatedly emit the smallest row and sift its cursor down
+    for (NSUInteger i = heapSize / 2; i-- > 0; ) {
+        siftDown(heap, heapSize, i, cursors);
+    }
+    while (heapSize > 0 && !*stop) {
+        ATLRunCursor *cursor = &cursors[heap[0]];
+        ATLRunRecord record = recordAtCursor(cursor);
+        emit(cursor->p + sizeof(ATLRunRecord), record.lineLength);
+        cursor->p += sizeof(ATLRunRecord) + record.lineLength;
+        if (cursor->p >= cursor->end) {
+            heap[0] = heap[--heapSize];
+        }
+        siftDown(heap, heapSize, 0, cursors);
+    }
+    free(cursors);
+    free(heap);
+    return YES;
+}
+
+#pragma mark - ATLCSVReaderDelegate methods
+
+- (void)reader:(ATLCSVReader *)reader didEndLine:(NSUInteger)recordNumber
+{
+    if (recordNumber == 1) {
+        for (NSUInteger i = 0; i < reader.fieldCount; i++) {
+            if ([reader field:i isEqualToCString:"trip_id"]) {
+                _tripColumn = i;
+            } else if ([reader field:i isEqualToCString:"stop_sequence"]) {
+                _sequenceColumn = i;
+            }
+        }
+        ATLCSVField line = reader.currentLine;
+        _headerLine = [NSMutableData dataWithBytes:line.bytes length:line.length];
+        if (line.length == 0 || line.bytes[line.length - 1] != LINE_FEED) {
+            [_headerLine appendBytes:"\n" length:1];
+        }
+        if (_tripColumn == NSNotFound || _sequenceColumn == NSNotFound) {
+            _error = [NSError errorWithDomain:ATLCSVReaderErrorDomain code:2
+                                     userInfo:@{NSLocalizedDescriptionKey: @"stop_times has no trip_id or stop_sequence column"}];
+            [reader cancelParsing];
+        }
+        return;
+    }
+    if (reader.fieldCount <= MAX(_tripColumn, _sequenceColumn)) {
+        return;
+    }
+    ATLCSVField trip = [reader field:_tripColumn];
+    int32_t sequence = [reader intValueForField:_sequenceColumn];
+    if (_checking) {
+        [self checkTrip:trip sequence:sequence reader:reader];
+    } else {
+        [self addEntryForLine:reader.currentLine trip:trip sequence:sequence];
+        if (_error) {
+            [reader cancelParsing];
+        }
+    }
+}
+
+- (void)reader:(ATLCSVReader *)reader didFailWithError:(NSError *)error
+{
+    _error = error;
+}
+
+@end
@@ -69,6 +69,6 @@
 
 // XML representation
 
-- (NSString*)xmlString;
+- (void)writeXMLWithWriter:(ATLXMLWriter*)writer;
 
 @end
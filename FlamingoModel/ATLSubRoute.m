@@ -198,21 +198,34 @@
 
 #pragma mark - XML representation
 
-- (NSString *)xmlString
-{
-    NSMutableString *output = [NSMutableString stringWithCapacity:50];
-    [output appendFormat:@"\t<subRoute name=\"%@\" from=\"%.3f\" to=\"%.3f\" importance=\"%d\" corridor=\"%d\" region=\"%d\">\n",
-     self.name, self.start, self.end, self.importance, self.icGroup, self.regionGroup];
-    [output appendFormat:@"\t\t<bounds minLat=\"%.7f\" minLon=\"%.7f\" maxLat=\"%.7f\" maxLon=\"%.7f\"/>\n",
-     self.minLat, self.minLon, self.maxLat, self.maxLon];
-    [output appendFormat:@"\t\t<track tracks=\"%d\" gauge=\"%d\" speed=\"%d\"/>\n", self.nrOfTracks, self.gauge, self.speed];
+- (void)writeXMLWithWriter:(ATLXMLWriter *)writer
+{
+    [writer writeCString:"\t<subRoute"];
+    [writer writeAttribute:"name" string:self.name];
+    [writer writeAttribute:"from" doubleValue:self.start decimals:3];
+    [writer writeAttribute:"to" doubleValue:self.end decimals:3];
+    [writer writeAttribute:"importance" intValue:self.importance];
+    [writer writeAttribute:"corridor" intValue:self.icGroup];
+    [writer writeAttribute:"region" intValue:self.regionGroup];
+    [writer writeCString:">\n\t\t<bounds"];
+    [writer writeAttribute:"minLat" doubleValue:self.minLat decimals:7];
+    [writer writeAttribute:"minLon" doubleValue:self.minLon decimals:7];
+    [writer writeAttribute:"maxLat" doubleValue:self.maxLat decimals:7];
+    [writer writeAttribute:"maxLon" doubleValue:self.maxLon decimals:7];
+    [writer writeCString:"/>\n\t\t<track"];
+    [writer writeAttribute:"tracks" intValue:self.nrOfTracks];
+    [writer writeAttribute:"gauge" intValue:self.gauge];
+    [writer writeAttribute:"speed" intValue:self.speed];
+    [writer writeCString:"/>\n"];
     if (self.openedString) {
-        [output appendFormat:@"\t\t<opened>%@</opened>\n", self.openedString];
+        [writer writeCString:"\t\t"];
+        [writer writeElement:"opened" text:self.openedString];
     }
-    [output appendFormat:@"\t\t<electrification>%@</electrification>\n", self.electrificationString];
-    [output appendFormat:@"\t\t<signaling>%@</signaling>\n", self.signaling];
-    [output appendString:@"\t</subRoute>\n"];
-    return output;
+    [writer writeCString:"\t\t"];
+    [writer writeElement:"electrification" text:self.electrificationString];
+    [writer writeCString:"\t\t"];
+    [writer writeElement:"signaling" text:self.signaling];
+    [writer writeCString:"\t</subRoute>\n"];
 }
 
 @end
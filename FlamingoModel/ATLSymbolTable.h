@@ -0,0 +1,66 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLSymbolTable.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef uint32_t ATLSymbol;
+
+#define NO_SYMBOL 0
+
+/**
+ ATLSymbolTable interns station IDs and platforms to small integers.
+ Symbols are only valid within the running process, they must not be stored.
+ The table can be used from several threads at once.
+ */
+@interface ATLSymbolTable : NSObject
+
++ (instancetype)sharedTable;
+
+@property (nonatomic, readonly) NSUInteger count;
+
+- (ATLSymbol)symbolForString:(NSString *)string;
+- (ATLSymbol)symbolForBytes:(const char *)bytes length:(NSUInteger)length;
+- (NSString *)stringForSymbol:(ATLSymbol)symbol;
+
+/**
+ The part of the string after the country prefix, e.g. "ut" for symbol of "nl.ut".
+ */
+- (NSString *)codeForSymbol:(ATLSymbol)symbol;
+
+@end
+
+/**
+ ATLSymbolCache looks up symbols of an ATLSymbolTable by their raw bytes, e.g. fields of an ATLCSVReader.
+ Byte sequences that were seen before are found in the cache without creating a string or locking the table,
+ only new ones are interned in the table. Every key is prefixed with the prefix of the cache, so "ut" in a cache
+ with prefix "nl." gives the symbol of "nl.ut". A cache is not thread safe, use one cache per reader.
+ */
+@interface ATLSymbolCache : NSObject
+
+- (instancetype)initWithSymbolTable:(ATLSymbolTable *)symbolTable prefix:(NSString *)prefix;
+
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+ Returns NO_SYMBOL for bytes that are not valid UTF-8.
+ */
+- (ATLSymbol)symbolForBytes:(const char *)bytes length:(NSUInteger)length;
+
+@end
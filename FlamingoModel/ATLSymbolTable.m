@@ -0,0 +1,199 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLSymbolTable.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLSymbolTable.h"
+#import "ATLFingerprint.h"
+
+#define INITIAL_CACHE_CAPACITY  1024
+
+typedef struct {
+    uint64_t hash;
+    uint32_t keyOffset;
+    uint32_t keyLength;
+    ATLSymbol symbol;       // NO_SYMBOL marks an empty slot
+} ATLSymbolCacheSlot;
+
+@implementation ATLSymbolTable {
+    NSMutableDictionary *_symbols;
+    NSMutableArray *_strings;
+    NSMutableArray *_codes;
+}
+
+#pragma mark - Object lifecycle
+
++ (instancetype)sharedTable
+{
+    static ATLSymbolTable *sharedTable = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedTable = [[ATLSymbolTable alloc] init];
+    });
+    return sharedTable;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _symbols = [NSMutableDictionary dictionaryWithCapacity:4000];
+        _strings = [NSMutableArray arrayWithCapacity:4000];
+        _codes = [NSMutableArray arrayWithCapacity:4000];
+    }
+    return self;
+}
+
+#pragma mark - Interning strings
+
+- (NSUInteger)count
+{
+    @synchronized(self) {
+        return [_strings count];
+    }
+}
+
+- (ATLSymbol)symbolForString:(NSString *)string
+{
+    if (!string) {
+        return NO_SYMBOL;
+    }
+    @synchronized(self) {
+        NSNumber *symbol = _symbols[string];
+        if (symbol) {
+            return [symbol unsignedIntValue];
+        }
+        NSString *key = [string copy];
+        NSRange separator = [key rangeOfString:@"."];
+        [_strings addObject:key];
+        [_codes addObject:separator.location == NSNotFound ? key : [key substringFromIndex:NSMaxRange(separator)]];
+        ATLSymbol newSymbol = (ATLSymbol)[_strings count];
+        _symbols[key] = @(newSymbol);
+        return newSymbol;
+    }
+}
+
+- (ATLSymbol)symbolForBytes:(const char *)bytes length:(NSUInteger)length
+{
+    // The lookup key wraps the bytes without copying, the string is only copied when it is new
+    NSString *string = [[NSString alloc] initWithBytesNoCopy:(void *)bytes length:length
+                                                    encoding:NSUTF8StringEncoding freeWhenDone:NO];
+    return [self symbolForString:string];
+}
+
+- (NSString *)stringForSymbol:(ATLSymbol)symbol
+{
+    if (symbol == NO_SYMBOL) {
+        return nil;
+    }
+    @synchronized(self) {
+        return symbol <= [_strings count] ? _strings[symbol - 1] : nil;
+    }
+}
+
+- (NSString *)codeForSymbol:(ATLSymbol)symbol
+{
+    if (symbol == NO_SYMBOL) {
+        return nil;
+    }
+    @synchronized(self) {
+        return symbol <= [_codes count] ? _codes[symbol - 1] : nil;
+    }
+}
+
+@end
+
+@implementation ATLSymbolCache {
+    ATLSymbolTable *_symbolTable;
+    NSData *_prefix;
+    NSMutableData *_keys;
+    ATLSymbolCacheSlot *_slots;
+    NSUInteger _capacity;       // always a power of two
+}
+
+#pragma mark - Object lifecycle
+
+- (instancetype)initWithSymbolTable:(ATLSymbolTable *)symbolTable prefix:(NSString *)prefix
+{
+    self = [super init];
+    if (self) {
+        _symbolTable = symbolTable;
+        _prefix = prefix ? [prefix dataUsingEncoding:NSUTF8StringEncoding] : [NSData data];
+        _keys = [NSMutableData dataWithCapacity:INITIAL_CACHE_CAPACITY * 8];
+        _capacity = INITIAL_CACHE_CAPACITY;
+        _slots = calloc(_capacity, sizeof(ATLSymbolCacheSlot));
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_slots);
+}
+
+#pragma mark - Looking up symbols
+
+- (ATLSymbol)symbolForBytes:(const char *)bytes length:(NSUInteger)length
+{
+    uint64_t hash = fingerprintBytes(FINGERPRINT_SEED, bytes, length);
+    const char *keys = [_keys bytes];
+    NSUInteger index = (NSUInteger)hash & (_capacity - 1);
+    while (_slots[index].symbol != NO_SYMBOL) {
+        ATLSymbolCacheSlot *slot = &_slots[index];
+        if (slot->hash == hash && slot->keyLength == length && memcmp(keys + slot->keyOffset, bytes, length) == 0) {
+            return slot->symbol;
+        }
+        index = (index + 1) & (_capacity - 1);
+    }
+
+    // Not seen before, intern the prefixed key in the table
+    NSMutableData *key = [NSMutableData dataWithCapacity:[_prefix length] + length];
+    [key appendData:_prefix];
+    [key appendBytes:bytes length:length];
+    ATLSymbol symbol = [_symbolTable symbolForBytes:[key bytes] length:[key length]];
+    if (symbol == NO_SYMBOL) {
+        return NO_SYMBOL;
+    }
+    _slots[index] = (ATLSymbolCacheSlot){hash, (uint32_t)[_keys length], (uint32_t)length, symbol};
+    [_keys appendBytes:bytes length:length];
+    _count++;
+    if (2 * _count > _capacity) {
+        [self grow];
+    }
+    return symbol;
+}
+
+- (void)grow
+{
+    NSUInteger oldCapacity = _capacity;
+    ATLSymbolCacheSlot *oldSlots = _slots;
+    _capacity = 2 * oldCapacity;
+    _slots = calloc(_capacity, sizeof(ATLSymbolCacheSlot));
+    for (NSUInteger i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i].symbol != NO_SYMBOL) {
+            NSUInteger index = (NSUInteger)oldSlots[i].hash & (_capacity - 1);
+            while (_slots[index].symbol != NO_SYMBOL) {
+                index = (index + 1) & (_capacity - 1);
+            }
+            _slots[index] = oldSlots[i];
+        }
+    }
+    free(oldSlots);
+}
+
+@end
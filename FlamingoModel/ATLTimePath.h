@@ -20,8 +20,26 @@
 
 #import <Foundation/Foundation.h>
 #import <CoreData/CoreData.h>
+#import "ATLTimePoint.h"
 
-@class ATLMissionRule, ATLTimePoint;
+@class ATLMissionRule;
+
+#define TIME_PATH_FORMAT_VERSION 1
+
+/**
+ A time point as stored in timePointsData.
+ Station and platform are indexes in the string table of the path, NO_STRING_INDEX when absent.
+ */
+typedef struct {
+    ATLMinutes arrival;
+    ATLMinutes departure;
+    uint16_t station;
+    uint16_t platform;
+    uint8_t options;
+    uint8_t reserved;
+} ATLPackedTimePoint;
+
+#define NO_STRING_INDEX 0xFFFF
 
 @interface ATLTimePath : NSManagedObject
 
@@ -35,6 +53,16 @@
 @property (nonatomic, readonly) NSString *originCode;
 @property (nonatomic, readonly) NSString *destinationCode;
 
+// Packed time points, read in place from timePointsData
+@property (nonatomic, readonly) NSUInteger nrOfPoints;
+@property (nonatomic, readonly) const ATLPackedTimePoint *packedPoints;
+- (NSString *)stringAtIndex:(uint16_t)index;
+- (ATLSymbol)symbolAtIndex:(uint16_t)index;
+
++ (NSData *)dataForPointsArray:(NSArray*)array;
++ (NSData *)packedDataWithTimePointsData:(NSData*)data;
+- (BOOL)migrateTimePointsData;
+
 + (int16_t)normalizePointsArray:(NSArray*)array;
 + (uint32_t)hashForPointsArray:(NSArray*)array;
 - (void)correctOffsetWith:(int)correction;
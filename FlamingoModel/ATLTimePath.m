@@ -22,8 +22,42 @@
 #import "ATLMissionRule.h"
 #import "ATLTimePoint.h"
 
+#define PACKED_MAGIC    "TP"
+
+/*
+ Layout of packed timePointsData:
+ header, nrOfPoints ATLPackedTimePoint structs, nrOfStrings + 1 uint16 string offsets, UTF-8 string heap.
+ Data in the old format is an NSKeyedArchiver archive of ATLTimePoint objects.
+ */
+typedef struct {
+    char magic[2];
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t nrOfPoints;
+    uint16_t nrOfStrings;
+} ATLPackedTimePathHeader;
+
+static const ATLPackedTimePathHeader *packedHeaderOfData(NSData *data)
+{
+    if ([data length] < sizeof(ATLPackedTimePathHeader)) {
+        return NULL;
+    }
+    const ATLPackedTimePathHeader *header = [data bytes];
+    if (memcmp(header->magic, PACKED_MAGIC, 2) != 0 || header->version != TIME_PATH_FORMAT_VERSION) {
+        return NULL;
+    }
+    NSUInteger minimumLength = sizeof(ATLPackedTimePathHeader) + header->nrOfPoints * sizeof(ATLPackedTimePoint) +
+                               (header->nrOfStrings + 1) * sizeof(uint16_t);
+    return [data length] >= minimumLength ? header : NULL;
+}
+
 @implementation ATLTimePath {
     NSArray *_timePoints;
+    NSData *_packedData;
+    const ATLPackedTimePathHeader *_header;
+    const uint16_t *_stringOffsets;
+    const char *_heap;
+    NSMutableData *_symbols;
 }
 
 @dynamic hash_;
@@ -41,12 +75,44 @@
     return string;
 }
 
+- (void)setTimePointsData:(NSData *)timePointsData
+{
+    [self willChangeValueForKey:@"timePointsData"];
+    [self setPrimitiveValue:timePointsData forKey:@"timePointsData"];
+    [self didChangeValueForKey:@"timePointsData"];
+    [self resetTimePoints];
+}
+
+- (void)didTurnIntoFault
+{
+    [super didTurnIntoFault];
+    [self resetTimePoints];
+}
+
+- (void)resetTimePoints
+{
+    _timePoints = nil;
+    _packedData = nil;
+    _header = NULL;
+    _symbols = nil;
+}
+
+#pragma mark - Time points
+
 - (NSArray *)timePoints
 {
     if (!_timePoints) {
-        NSData *data = self.timePointsData;
-        if (data != nil) {
-            _timePoints = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+        if ([self loadPackedData]) {
+            NSMutableArray *timePoints = [NSMutableArray arrayWithCapacity:_header->nrOfPoints];
+            for (NSUInteger i = 0; i < _header->nrOfPoints; i++) {
+                [timePoints addObject:[self pointAtIndex:i]];
+            }
+            _timePoints = timePoints;
+        } else {
+            NSData *data = self.timePointsData;
+            if (data != nil) {
+                _timePoints = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+            }
         }
     }
     return _timePoints;
@@ -54,14 +120,179 @@
 
 - (ATLTimePoint *)firstPoint
 {
+    if (!_timePoints && [self loadPackedData]) {
+        return _header->nrOfPoints > 0 ? [self pointAtIndex:0] : nil;
+    }
     return [self.timePoints firstObject];
 }
 
 - (ATLTimePoint *)lastPoint
 {
+    if (!_timePoints && [self loadPackedData]) {
+        return _header->nrOfPoints > 0 ? [self pointAtIndex:_header->nrOfPoints - 1] : nil;
+    }
     return [self.timePoints lastObject];
 }
 
+- (ATLTimePoint *)pointAtIndex:(NSUInteger)index
+{
+    const ATLPackedTimePoint *point = &self.packedPoints[index];
+    ATLTimePoint *timePoint = [[ATLTimePoint alloc] init];
+    timePoint.arrival = point->arrival;
+    timePoint.departure = point->departure;
+    timePoint.stationSymbol = [self symbolAtIndex:point->station];
+    timePoint.platformSymbol = [self symbolAtIndex:point->platform];
+    timePoint.options = point->options;
+    return timePoint;
+}
+
+#pragma mark - Packed time points
+
+/**
+ Makes the packed points available, timePointsData in the old format is packed in memory.
+ @returns NO if there are no time points.
+ */
+- (BOOL)loadPackedData
+{
+    if (!_header) {
+        NSData *data = self.timePointsData;
+        if (data && !packedHeaderOfData(data)) {
+            data = [ATLTimePath dataForPointsArray:[NSKeyedUnarchiver unarchiveObjectWithData:data]];
+        }
+        const ATLPackedTimePathHeader *header = packedHeaderOfData(data);
+        if (!header) {
+            return NO;
+        }
+        _packedData = data;
+        _header = header;
+        _stringOffsets = (const uint16_t *)((const ATLPackedTimePoint *)(header + 1) + header->nrOfPoints);
+        _heap = (const char *)(_stringOffsets + header->nrOfStrings + 1);
+    }
+    return YES;
+}
+
+- (NSUInteger)nrOfPoints
+{
+    return [self loadPackedData] ? _header->nrOfPoints : 0;
+}
+
+- (const ATLPackedTimePoint *)packedPoints
+{
+    return [self loadPackedData] ? (const ATLPackedTimePoint *)(_header + 1) : NULL;
+}
+
+- (NSString *)stringAtIndex:(uint16_t)index
+{
+    if (![self loadPackedData] || index >= _header->nrOfStrings) {
+        return nil;
+    }
+    return [[NSString alloc] initWithBytes:_heap + _stringOffsets[index] length:_stringOffsets[index + 1] - _stringOffsets[index]
+                                  encoding:NSUTF8StringEncoding];
+}
+
+/**
+ Symbol in the shared symbol table for a string of this path, the symbols are looked up once per path.
+ */
+- (ATLSymbol)symbolAtIndex:(uint16_t)index
+{
+    if (![self loadPackedData] || index >= _header->nrOfStrings) {
+        return NO_SYMBOL;
+    }
+    if (!_symbols) {
+        _symbols = [NSMutableData dataWithLength:_header->nrOfStrings * sizeof(ATLSymbol)];
+        ATLSymbol *symbols = [_symbols mutableBytes];
+        ATLSymbolTable *table = [ATLSymbolTable sharedTable];
+        for (uint16_t i = 0; i < _header->nrOfStrings; i++) {
+            symbols[i] = [table symbolForBytes:_heap + _stringOffsets[i] length:_stringOffsets[i + 1] - _stringOffsets[i]];
+        }
+    }
+    return ((const ATLSymbol *)[_symbols bytes])[index];
+}
+
+- (uint16_t)indexOfString:(NSString *)string
+{
+    if (string && [self loadPackedData]) {
+        const char *bytes = [string UTF8String];
+        NSUInteger length = strlen(bytes);
+        for (uint16_t index = 0; index < _header->nrOfStrings; index++) {
+            if (_stringOffsets[index + 1] - _stringOffsets[index] == length &&
+                memcmp(_heap + _stringOffsets[index], bytes, length) == 0) {
+                return index;
+            }
+        }
+    }
+    return NO_STRING_INDEX;
+}
+
++ (NSData *)dataForPointsArray:(NSArray *)array
+{
+    NSMutableDictionary *stringIndexes = [NSMutableDictionary dictionaryWithCapacity:2 * [array count]];
+    NSMutableData *heap = [NSMutableData dataWithCapacity:8 * [array count]];
+    NSMutableData *offsets = [NSMutableData dataWithCapacity:2 * [array count]];
+    uint16_t (^indexOfString)(NSString *) = ^uint16_t(NSString *string) {
+        if (!string) {
+            return NO_STRING_INDEX;
+        }
+        NSNumber *index = stringIndexes[string];
+        if (!index) {
+            index = @([stringIndexes count]);
+            stringIndexes[string] = index;
+            uint16_t offset = (uint16_t)[heap length];
+            [offsets appendBytes:&offset length:sizeof(offset)];
+            [heap appendData:[string dataUsingEncoding:NSUTF8StringEncoding]];
+        }
+        return [index unsignedShortValue];
+    };
+
+    NSMutableData *points = [NSMutableData dataWithLength:[array count] * sizeof(ATLPackedTimePoint)];
+    ATLPackedTimePoint *packedPoint = [points mutableBytes];
+    for (ATLTimePoint *point in array) {
+        packedPoint->arrival = point.arrival;
+        packedPoint->departure = point.departure;
+        packedPoint->station = indexOfString(point.stationID);
+        packedPoint->platform = indexOfString(point.platform);
+        packedPoint->options = (uint8_t)point.options;
+        packedPoint->reserved = 0;
+        packedPoint++;
+    }
+    NSAssert([heap length] <= UINT16_MAX && [stringIndexes count] < NO_STRING_INDEX, @"Too many strings in time path");
+    uint16_t endOffset = (uint16_t)[heap length];
+    [offsets appendBytes:&endOffset length:sizeof(endOffset)];
+
+    ATLPackedTimePathHeader header = {{'T', 'P'}, TIME_PATH_FORMAT_VERSION, 0,
+                                      (uint16_t)[array count], (uint16_t)[stringIndexes count]};
+    NSMutableData *data = [NSMutableData dataWithBytes:&header length:sizeof(header)];
+    [data appendData:points];
+    [data appendData:offsets];
+    [data appendData:heap];
+    return data;
+}
+
++ (NSData *)packedDataWithTimePointsData:(NSData *)data
+{
+    if (!data || packedHeaderOfData(data)) {
+        return data;
+    }
+    return [self dataForPointsArray:[NSKeyedUnarchiver unarchiveObjectWithData:data]];
+}
+
+/**
+ Replaces timePointsData in the old keyed archive format by the packed format.
+ @returns YES if the data was migrated.
+ */
+- (BOOL)migrateTimePointsData
+{
+    NSData *data = self.timePointsData;
+    if (!data || packedHeaderOfData(data)) {
+        return NO;
+    }
+    [self loadPackedData];
+    NSArray *timePoints = _timePoints;
+    self.timePointsData = _packedData;
+    _timePoints = timePoints;
+    return YES;
+}
+
 - (NSString *)originCode
 {
     return self.firstPoint.stationCode;
@@ -105,17 +336,24 @@
     for (ATLMissionRule *missionRule in self.missionRules) {
         missionRule.offset += correction;
     }
-    for (ATLTimePoint *timePoint in self.timePoints) {
+    NSArray *timePoints = self.timePoints;
+    for (ATLTimePoint *timePoint in timePoints) {
         timePoint.arrival -= correction;
         timePoint.departure -= correction;
     }
-    self.timePointsData = [NSKeyedArchiver archivedDataWithRootObject:self.timePoints];
+    self.timePointsData = [ATLTimePath dataForPointsArray:timePoints];
+    _timePoints = timePoints;
 }
 
 - (BOOL)callsAtStationWithID:(NSString *)stationID
 {
-    for (ATLTimePoint *point in self.timePoints) {
-        if ([point.stationID isEqualToString:stationID]) {
+    uint16_t station = [self indexOfString:stationID];
+    if (station == NO_STRING_INDEX) {
+        return NO;
+    }
+    const ATLPackedTimePoint *points = self.packedPoints;
+    for (NSUInteger i = 0; i < _header->nrOfPoints; i++) {
+        if (points[i].station == station) {
             return YES;
         }
     }
@@ -124,19 +362,21 @@
 
 - (NSArray *)stationIDsFromID:(NSString *)firstID toID:(NSString *)lastID
 {
-    BOOL flag = NO;
     NSMutableArray *stationIDs = [NSMutableArray arrayWithCapacity:30];
-    for (ATLTimePoint *point in self.timePoints) {
-        if (flag) {
-            [stationIDs addObject:point.stationID];
-            if ([point.stationID isEqualToString:lastID]) {
+    uint16_t firstStation = [self indexOfString:firstID];
+    if (firstStation == NO_STRING_INDEX) {
+        return stationIDs;
+    }
+    uint16_t lastStation = [self indexOfString:lastID];
+    BOOL flag = NO;
+    const ATLPackedTimePoint *points = self.packedPoints;
+    for (NSUInteger i = 0; i < _header->nrOfPoints; i++) {
+        if (flag || points[i].station == firstStation) {
+            [stationIDs addObject:[self stringAtIndex:points[i].station]];
+            if (flag && points[i].station == lastStation) {
                 break;
             }
-        } else {
-            if ([point.stationID isEqualToString:firstID]) {
-                [stationIDs addObject:point.stationID];
-                flag = YES;
-            }
+            flag = YES;
         }
     }
     return stationIDs;
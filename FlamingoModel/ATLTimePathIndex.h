@@ -0,0 +1,51 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLTimePathIndex.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ ATLTimePathIndex finds time paths by their packed timePointsData.
+ Entries are kept in an open addressing table keyed by a 64-bit hash of the data;
+ data with equal hashes is compared in full, so equal entries always contain identical time points.
+ References are time paths or their object IDs, an entry can lose its reference while its data stays indexed.
+ */
+@interface ATLTimePathIndex : NSObject
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity;
+
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, readonly) NSArray *allReferences;
+
+/**
+ @returns the entry holding the same data, or NSNotFound.
+ */
+- (NSUInteger)entryForPointsData:(NSData *)data;
+- (NSUInteger)addPointsData:(NSData *)data reference:(id)reference;
+- (id)referenceAtEntry:(NSUInteger)entry;
+- (void)setReference:(id)reference atEntry:(NSUInteger)entry;
+
+// Statistics
+@property (nonatomic, readonly) NSUInteger nrOfLookups;
+@property (nonatomic, readonly) NSUInteger nrOfHits;
+@property (nonatomic, readonly) NSUInteger nrOfCollisions;
+
+@end
+
+uint64_t hashOfPointsData(NSData *data);
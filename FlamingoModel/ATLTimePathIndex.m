@@ -0,0 +1,168 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLTimePathIndex.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLTimePathIndex.h"
+#import "ATLFingerprint.h"
+
+#define EMPTY_SLOT      UINT32_MAX
+#define MIN_CAPACITY    64
+
+@implementation ATLTimePathIndex {
+    NSMutableArray *_pointsData;
+    NSMutableArray *_references;
+
+    // Open addressing table with linear probing, load factor is kept below 1/2
+    uint64_t *_keys;
+    uint32_t *_slots;
+    NSUInteger _capacity;
+}
+
+#pragma mark - Object lifecycle
+
+- (instancetype)init
+{
+    return [self initWithCapacity:MIN_CAPACITY];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if (self) {
+        _pointsData = [NSMutableArray arrayWithCapacity:capacity];
+        _references = [NSMutableArray arrayWithCapacity:capacity];
+        _capacity = MIN_CAPACITY;
+        while (_capacity < 2 * capacity) {
+            _capacity *= 2;
+        }
+        _keys = malloc(_capacity * sizeof(uint64_t));
+        _slots = malloc(_capacity * sizeof(uint32_t));
+        memset(_slots, 0xFF, _capacity * sizeof(uint32_t));
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_keys);
+    free(_slots);
+}
+
+#pragma mark - Accessing entries
+
+- (NSUInteger)count
+{
+    NSUInteger count = 0;
+    for (id reference in _references) {
+        if (reference != [NSNull null]) {
+            count++;
+        }
+    }
+    return count;
+}
+
+- (NSArray *)allReferences
+{
+    NSMutableArray *references = [NSMutableArray arrayWithCapacity:[_references count]];
+    for (id reference in _references) {
+        if (reference != [NSNull null]) {
+            [references addObject:reference];
+        }
+    }
+    return references;
+}
+
+- (NSUInteger)entryForPointsData:(NSData *)data
+{
+    _nrOfLookups++;
+    uint64_t key = hashOfPointsData(data);
+    NSUInteger mask = _capacity - 1;
+    for (NSUInteger i = key & mask; _slots[i] != EMPTY_SLOT; i = (i + 1) & mask) {
+        if (_keys[i] == key) {
+            if ([_pointsData[_slots[i]] isEqualToData:data]) {
+                _nrOfHits++;
+                return _slots[i];
+            }
+            _nrOfCollisions++;
+        }
+    }
+    return NSNotFound;
+}
+
+- (NSUInteger)addPointsData:(NSData *)data reference:(id)reference
+{
+    if (2 * ([_pointsData count] + 1) > _capacity) {
+        [self grow];
+    }
+    NSUInteger entry = [_pointsData count];
+    [_pointsData addObject:data];
+    [_references addObject:reference ? reference : [NSNull null]];
+    [self insertKey:hashOfPointsData(data) entry:(uint32_t)entry];
+    return entry;
+}
+
+- (id)referenceAtEntry:(NSUInteger)entry
+{
+    id reference = _references[entry];
+    return reference != [NSNull null] ? reference : nil;
+}
+
+- (void)setReference:(id)reference atEntry:(NSUInteger)entry
+{
+    _references[entry] = reference ? reference : [NSNull null];
+}
+
+#pragma mark - Table maintenance
+
+- (void)insertKey:(uint64_t)key entry:(uint32_t)entry
+{
+    NSUInteger mask = _capacity - 1;
+    NSUInteger i = key & mask;
+    while (_slots[i] != EMPTY_SLOT) {
+        i = (i + 1) & mask;
+    }
+    _keys[i] = key;
+    _slots[i] = entry;
+}
+
+- (void)grow
+{
+    uint64_t *oldKeys = _keys;
+    uint32_t *oldSlots = _slots;
+    NSUInteger oldCapacity = _capacity;
+
+    _capacity *= 2;
+    _keys = malloc(_capacity * sizeof(uint64_t));
+    _slots = malloc(_capacity * sizeof(uint32_t));
+    memset(_slots, 0xFF, _capacity * sizeof(uint32_t));
+    for (NSUInteger i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i] != EMPTY_SLOT) {
+            [self insertKey:oldKeys[i] entry:oldSlots[i]];
+        }
+    }
+    free(oldKeys);
+    free(oldSlots);
+}
+
+@end
+
+uint64_t hashOfPointsData(NSData *data)
+{
+    return fingerprintBytes(FINGERPRINT_SEED, [data bytes], [data length]);
+}
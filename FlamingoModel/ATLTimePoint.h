@@ -19,10 +19,12 @@
 //
 
 #import <Foundation/Foundation.h>
+#import "ATLSymbolTable.h"
 
 typedef int16_t ATLMinutes;
 
 ATLMinutes minutesFromString(NSString *string);
+ATLMinutes minutesFromBytes(const char *bytes, NSUInteger length);
 NSString *stringFromMinutes(ATLMinutes minutes);
 
 typedef NS_OPTIONS(uint16_t, ATLTimePointOptions) {
@@ -49,9 +51,11 @@ typedef NS_OPTIONS(uint16_t, ATLTimePointOptions) {
 @property (nonatomic, strong) NSString *arrivalString;
 @property (nonatomic, strong) NSString *departureString;
 
-// Location properties
-@property (nonatomic, strong) NSString *stationID;
-@property (nonatomic, strong) NSString *platform;
+// Location properties, stored as symbols of the shared symbol table
+@property (nonatomic, assign) ATLSymbol stationSymbol;
+@property (nonatomic, assign) ATLSymbol platformSymbol;
+@property (nonatomic) NSString *stationID;
+@property (nonatomic) NSString *platform;
 @property (nonatomic) NSString *stationCode;
 @property (nonatomic) NSString *stopLocation;
 
@@ -94,11 +94,29 @@
 
 #pragma mark - Location properties
 
+- (NSString *)stationID
+{
+    return [[ATLSymbolTable sharedTable] stringForSymbol:self.stationSymbol];
+}
+
+- (void)setStationID:(NSString *)stationID
+{
+    self.stationSymbol = [[ATLSymbolTable sharedTable] symbolForString:stationID];
+}
+
+- (NSString *)platform
+{
+    return [[ATLSymbolTable sharedTable] stringForSymbol:self.platformSymbol];
+}
+
+- (void)setPlatform:(NSString *)platform
+{
+    self.platformSymbol = [[ATLSymbolTable sharedTable] symbolForString:platform];
+}
+
 - (NSString *)stationCode
 {
-    NSArray *comps = [self.stationID componentsSeparatedByString:@"."];
-    NSAssert([comps count] == 2, @"stationID mist be in format like nl.xxx");
-    return comps[1];
+    return [[ATLSymbolTable sharedTable] codeForSymbol:self.stationSymbol];
 }
 
 - (void)setStationCode:(NSString *)stationCode
@@ -217,9 +235,7 @@
     if (!point) {
         return NO;
     }
-    BOOL haveEqualStations = (!self.stationID && !point.stationID) || [self.stationID isEqualToString:point.stationID];
-    BOOL haveEqualPlatforms = (!self.platform && !point.platform) || [self.platform isEqualToString:point.platform];
-    return haveEqualStations && haveEqualPlatforms &&
+    return (self.stationSymbol == point.stationSymbol) && (self.platformSymbol == point.platformSymbol) &&
     (self.arrival == point.arrival) && (self.departure == point.departure) && (self.options == point.options);
 }
 
@@ -231,6 +247,22 @@ ATLMinutes minutesFromString(NSString *string)
     return 60 * [components[0] intValue] + [components[1] intValue];
 }
 
+ATLMinutes minutesFromBytes(const char *bytes, NSUInteger length)
+{
+    int hours = 0, minutes = 0;
+    NSUInteger i = 0;
+    while (i < length && bytes[i] >= '0' && bytes[i] <= '9') {
+        hours = 10 * hours + (bytes[i++] - '0');
+    }
+    if (i < length && bytes[i] == ':') {
+        i++;
+    }
+    while (i < length && bytes[i] >= '0' && bytes[i] <= '9') {
+        minutes = 10 * minutes + (bytes[i++] - '0');
+    }
+    return 60 * hours + minutes;
+}
+
 NSString *stringFromMinutes(ATLMinutes minutes)
 {
     return [NSString stringWithFormat:@"%02d:%02d", minutes / 60, minutes % 60];
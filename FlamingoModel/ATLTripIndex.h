@@ -0,0 +1,54 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLTripIndex.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+extern NSString * const ATLTripIndexErrorDomain;
+
+typedef NS_ENUM(NSInteger, ATLTripIndexError) {
+    unsavedReferenceError = 1,
+    oversizedEntryError
+};
+
+/**
+ ATLTripIndex maps GTFS trip_ids to the mission rules created for them,
+ so that stop_times can be attached to their mission rule without a fetch request per trip.
+ References are either managed objects or (after saving) their object IDs.
+ The index can be spilled to disk, it is then memory mapped and searched in place.
+ */
+@interface ATLTripIndex : NSObject
+
++ (instancetype)indexWithContentsOfURL:(NSURL *)url
+            persistentStoreCoordinator:(NSPersistentStoreCoordinator *)coordinator;
+
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, readonly) NSSet *allTripIDs;
+
+- (id)referenceForTripID:(NSString *)tripID;
+- (void)setReference:(id)reference forTripID:(NSString *)tripID;
+
+/**
+ Writes the index to a file, sorted by trip_id. Fails without writing when a reference is not saved,
+ or when a trip_id or object URI does not fit an entry.
+ */
+- (BOOL)writeToURL:(NSURL *)url error:(NSError **)error;
+
+@end
@@ -0,0 +1,213 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLTripIndex.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLTripIndex.h"
+#import "ATLError.h"
+
+#define TRIP_INDEX_MAGIC    "ATLT"
+#define TRIP_INDEX_VERSION  2
+
+NSString * const ATLTripIndexErrorDomain = @"nl.firstflamingo.tripindex";
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t heapLength;
+} ATLTripIndexHeader;
+
+typedef struct {
+    uint32_t keyOffset;
+    uint32_t valueOffset;
+    uint16_t keyLength;
+    uint16_t valueLength;
+} ATLTripIndexEntry;
+
+static int compareBytes(const char *bytes1, NSUInteger length1, const char *bytes2, NSUInteger length2)
+{
+    int result = memcmp(bytes1, bytes2, MIN(length1, length2));
+    if (result == 0 && length1 != length2) {
+        result = length1 < length2 ? -1 : 1;
+    }
+    return result;
+}
+
+@implementation ATLTripIndex {
+    NSMutableDictionary *_references;
+
+    // Spilled index
+    NSData *_data;
+    NSPersistentStoreCoordinator *_coordinator;
+    const ATLTripIndexEntry *_entries;
+    const char *_heap;
+    NSUInteger _count;
+}
+
+/**
+ Checks that the file is not truncated and that every key and value lies inside the heap,
+ so that a damaged or outdated file is refused instead of being read beyond its end.
+ */
++ (BOOL)hasValidEntriesInData:(NSData *)data
+{
+    if ([data length] < sizeof(ATLTripIndexHeader)) {
+        return NO;
+    }
+    const ATLTripIndexHeader *header = [data bytes];
+    if (memcmp(header->magic, TRIP_INDEX_MAGIC, 4) != 0 || header->version != TRIP_INDEX_VERSION) {
+        return NO;
+    }
+    uint64_t entriesLength = (uint64_t)header->count * sizeof(ATLTripIndexEntry);
+    if ([data length] != sizeof(ATLTripIndexHeader) + entriesLength + header->heapLength) {
+        return NO;
+    }
+    const ATLTripIndexEntry *entries = (const ATLTripIndexEntry *)(header + 1);
+    for (uint32_t i = 0; i < header->count; i++) {
+        if ((uint64_t)entries[i].keyOffset + entries[i].keyLength > header->heapLength ||
+            (uint64_t)entries[i].valueOffset + entries[i].valueLength > header->heapLength) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+#pragma mark - Object lifecycle
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _references = [NSMutableDictionary dictionaryWithCapacity:10000];
+    }
+    return self;
+}
+
++ (instancetype)indexWithContentsOfURL:(NSURL *)url persistentStoreCoordinator:(NSPersistentStoreCoordinator *)coordinator
+{
+    NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedAlways error:NULL];
+    if (![self hasValidEntriesInData:data]) {
+        NSLog(@"error: %@ is not a valid trip index", [url lastPathComponent]);
+        return nil;
+    }
+    const ATLTripIndexHeader *header = [data bytes];
+    ATLTripIndex *index = [[self alloc] init];
+    index->_references = nil;
+    index->_data = data;
+    index->_coordinator = coordinator;
+    index->_count = header->count;
+    index->_entries = (const ATLTripIndexEntry *)(header + 1);
+    index->_heap = (const char *)(index->_entries + header->count);
+    return index;
+}
+
+#pragma mark - Accessing the index
+
+- (NSUInteger)count
+{
+    return _references ? [_references count] : _count;
+}
+
+- (NSSet *)allTripIDs
+{
+    if (_references) {
+        return [NSSet setWithArray:[_references allKeys]];
+    }
+    NSMutableSet *tripIDs = [NSMutableSet setWithCapacity:_count];
+    for (NSUInteger i = 0; i < _count; i++) {
+        [tripIDs addObject:[[NSString alloc] initWithBytes:_heap + _entries[i].keyOffset length:_entries[i].keyLength
+                                                  encoding:NSUTF8StringEncoding]];
+    }
+    return tripIDs;
+}
+
+- (id)referenceForTripID:(NSString *)tripID
+{
+    if (_references) {
+        return _references[tripID];
+    }
+    const char *key = [tripID UTF8String];
+    NSUInteger keyLength = strlen(key);
+    NSUInteger low = 0, high = _count;
+    while (low < high) {
+        NSUInteger middle = (low + high) / 2;
+        const ATLTripIndexEntry *entry = &_entries[middle];
+        int comparison = compareBytes(_heap + entry->keyOffset, entry->keyLength, key, keyLength);
+        if (comparison == 0) {
+            NSString *uri = [[NSString alloc] initWithBytes:_heap + entry->valueOffset length:entry->valueLength
+                                                   encoding:NSUTF8StringEncoding];
+            return [_coordinator managedObjectIDForURIRepresentation:[NSURL URLWithString:uri]];
+        } else if (comparison < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return nil;
+}
+
+- (void)setReference:(id)reference forTripID:(NSString *)tripID
+{
+    NSAssert(_references != nil, @"A spilled trip index is read only");
+    _references[tripID] = reference;
+}
+
+#pragma mark - Spilling to disk
+
+- (BOOL)writeToURL:(NSURL *)url error:(NSError **)error
+{
+    NSArray *tripIDs = [[_references allKeys] sortedArrayUsingComparator:^NSComparisonResult(NSString *id1, NSString *id2) {
+        int comparison = strcmp([id1 UTF8String], [id2 UTF8String]);
+        return comparison < 0 ? NSOrderedAscending : (comparison > 0 ? NSOrderedDescending : NSOrderedSame);
+    }];
+    ATLTripIndexHeader header = {TRIP_INDEX_MAGIC, TRIP_INDEX_VERSION, (uint32_t)[tripIDs count], 0};
+    NSMutableData *entries = [NSMutableData dataWithCapacity:[tripIDs count] * sizeof(ATLTripIndexEntry)];
+    NSMutableData *heap = [NSMutableData dataWithCapacity:[tripIDs count] * 64];
+
+    for (NSString *tripID in tripIDs) {
+        id reference = _references[tripID];
+        NSManagedObjectID *objectID = [reference isKindOfClass:[NSManagedObjectID class]] ? reference : [reference objectID];
+        if (!objectID || [objectID isTemporaryID]) {
+            NSString *description = [NSString stringWithFormat:@"Trip %@ is not saved, the trip index can only be written after saving", tripID];
+            return failWithError(error, ATLTripIndexErrorDomain, unsavedReferenceError, description);
+        }
+        NSData *key = [tripID dataUsingEncoding:NSUTF8StringEncoding];
+        NSData *value = [[[objectID URIRepresentation] absoluteString] dataUsingEncoding:NSUTF8StringEncoding];
+        if ([key length] > UINT16_MAX || [value length] > UINT16_MAX || [heap length] + [key length] + [value length] > UINT32_MAX) {
+            NSString *description = [NSString stringWithFormat:@"Trip %@ does not fit the trip index", tripID];
+            return failWithError(error, ATLTripIndexErrorDomain, oversizedEntryError, description);
+        }
+
+        ATLTripIndexEntry entry;
+        entry.keyOffset = (uint32_t)[heap length];
+        entry.keyLength = (uint16_t)[key length];
+        [heap appendData:key];
+        entry.valueOffset = (uint32_t)[heap length];
+        entry.valueLength = (uint16_t)[value length];
+        [heap appendData:value];
+        [entries appendBytes:&entry length:sizeof(entry)];
+    }
+
+    header.heapLength = (uint32_t)[heap length];
+    NSMutableData *output = [NSMutableData dataWithBytes:&header length:sizeof(header)];
+    [output appendData:entries];
+    [output appendData:heap];
+    return [output writeToURL:url options:NSDataWritingAtomic error:error];
+}
+
+@end
@@ -0,0 +1,83 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLXMLWriter.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ ATLXMLWriter writes XML to an output stream through a fixed size buffer, so that memory does not grow with the output.
+ Numbers are formatted into the buffer directly and strings are escaped without creating intermediate objects.
+ The formats equal those of the former NSMutableString based output: nil strings are written as (null)
+ and numbers as with the printf formats %d, %u and %.nf.
+ */
+@interface ATLXMLWriter : NSObject
+
+- (instancetype)initWithOutputStream:(NSOutputStream *)stream;
+- (instancetype)initWithURL:(NSURL *)url;
+
+/**
+ A writer collecting its output in memory, the result is available as string.
+ */
++ (instancetype)memoryWriter;
+@property (nonatomic, readonly) NSString *string;
+
+@property (nonatomic, readonly) NSUInteger totalBytesWritten;
+@property (nonatomic, readonly) NSError *error;
+
+/**
+ Writes the remaining buffer and closes the stream. Returns NO when any write failed.
+ */
+- (BOOL)close;
+
+#pragma mark - Raw output
+
+- (void)writeBytes:(const char *)bytes length:(NSUInteger)length;
+- (void)writeCString:(const char *)string;
+- (void)writeString:(NSString *)string;
+
+#pragma mark - Values
+
+- (void)writeEscapedString:(NSString *)string;
+- (void)writeInt:(int)value;
+- (void)writeUnsignedInt:(unsigned)value;
+- (void)writeDouble:(double)value decimals:(int)decimals;
+- (void)writeMinutes:(int)minutes;
+
+#pragma mark - Markup
+
+/**
+ Writes the class name without its three letter prefix in lower case, e.g. station for ATLStation.
+ */
+- (void)writeElementNameOfClass:(Class)aClass;
+
+/**
+ Writes ' name="value"', the value is escaped.
+ */
+- (void)writeAttribute:(const char *)name string:(NSString *)value;
+- (void)writeAttribute:(const char *)name intValue:(int)value;
+- (void)writeAttribute:(const char *)name unsignedValue:(unsigned)value;
+- (void)writeAttribute:(const char *)name doubleValue:(double)value decimals:(int)decimals;
+- (void)writeAttribute:(const char *)name minutes:(int)minutes;
+
+/**
+ Writes '<name>text</name>' followed by a newline, the text is escaped.
+ */
+- (void)writeElement:(const char *)name text:(NSString *)text;
+
+@end
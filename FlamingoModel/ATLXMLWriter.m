@@ -0,0 +1,318 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLXMLWriter.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLXMLWriter.h"
+#import <objc/runtime.h>
+
+#define WRITER_BUFFER_SIZE  65536
+#define STRING_CHUNK_SIZE   512
+
+@implementation ATLXMLWriter {
+    NSOutputStream *_stream;
+    uint8_t *_buffer;
+    NSUInteger _length;
+    BOOL _closed;
+}
+
+#pragma mark - Object lifecycle
+
+- (instancetype)initWithOutputStream:(NSOutputStream *)stream
+{
+    self = [super init];
+    if (self) {
+        _stream = stream;
+        _buffer = malloc(WRITER_BUFFER_SIZE);
+        if ([_stream streamStatus] == NSStreamStatusNotOpen) {
+            [_stream open];
+        }
+    }
+    return self;
+}
+
+- (instancetype)initWithURL:(NSURL *)url
+{
+    return [self initWithOutputStream:[NSOutputStream outputStreamWithURL:url append:NO]];
+}
+
++ (instancetype)memoryWriter
+{
+    return [[self alloc] initWithOutputStream:[NSOutputStream outputStreamToMemory]];
+}
+
+- (void)dealloc
+{
+    if (!_closed) {
+        [self close];
+    }
+    free(_buffer);
+}
+
+#pragma mark - Output
+
+- (void)writeToStream:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    NSUInteger written = 0;
+    while (written < length && !_error) {
+        NSInteger result = [_stream write:bytes + written maxLength:length - written];
+        if (result <= 0) {
+            _error = [_stream streamError];
+            if (!_error) {
+                _error = [NSError errorWithDomain:NSPOSIXErrorDomain code:EIO userInfo:nil];
+            }
+            NSLog(@"XML output failed: %@", _error);
+        } else {
+            written += result;
+        }
+    }
+}
+
+- (void)flushBuffer
+{
+    [self writeToStream:_buffer length:_length];
+    _length = 0;
+}
+
+- (BOOL)close
+{
+    [self flushBuffer];
+    [_stream close];
+    _closed = YES;
+    return _error == nil;
+}
+
+- (NSString *)string
+{
+    [self flushBuffer];
+    NSData *data = [_stream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+    return data ? [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] : nil;
+}
+
+#pragma mark - Raw output
+
+- (void)writeBytes:(const char *)bytes length:(NSUInteger)length
+{
+    _totalBytesWritten += length;
+    if (_length + length > WRITER_BUFFER_SIZE) {
+        [self flushBuffer];
+        if (length >= WRITER_BUFFER_SIZE) {
+            [self writeToStream:(const uint8_t *)bytes length:length];
+            return;
+        }
+    }
+    memcpy(_buffer + _length, bytes, length);
+    _length += length;
+}
+
+- (void)writeCString:(const char *)string
+{
+    [self writeBytes:string length:strlen(string)];
+}
+
+- (void)writeString:(NSString *)string
+{
+    [self writeString:string escaped:NO];
+}
+
+/**
+ Converts the string to UTF-8 in small chunks on the stack, escaping the XML special characters when needed.
+ */
+- (void)writeString:(NSString *)string escaped:(BOOL)escaped
+{
+    if (!string) {
+        [self writeBytes:"(null)" length:6];
+        return;
+    }
+    const char *cString = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingUTF8);
+    if (cString) {
+        [self writeUTF8:cString length:strlen(cString) escaped:escaped];
+        return;
+    }
+    char chunk[STRING_CHUNK_SIZE];
+    NSRange remaining = NSMakeRange(0, [string length]);
+    while (remaining.length > 0) {
+        NSUInteger used = 0;
+        if (![string getBytes:chunk maxLength:sizeof(chunk) usedLength:&used encoding:NSUTF8StringEncoding
+                      options:0 range:remaining remainingRange:&remaining] || used == 0) {
+            break;
+        }
+        [self writeUTF8:chunk length:used escaped:escaped];
+    }
+}
+
+- (void)writeUTF8:(const char *)bytes length:(NSUInteger)length escaped:(BOOL)escaped
+{
+    if (!escaped) {
+        [self writeBytes:bytes length:length];
+        return;
+    }
+    NSUInteger start = 0;
+    for (NSUInteger i = 0; i < length; i++) {
+        const char *entity = NULL;
+        NSUInteger entityLength = 0;
+        switch (bytes[i]) {
+            case '&':
+                entity = "&amp;";
+                entityLength = 5;
+                break;
+            case '<':
+                entity = "&lt;";
+                entityLength = 4;
+                break;
+            case '>':
+                entity = "&gt;";
+                entityLength = 4;
+                break;
+            case '"':
+                entity = "&quot;";
+                entityLength = 6;
+                break;
+            default:
+                break;
+        }
+        if (entity) {
+            [self writeBytes:bytes + start length:i - start];
+            [self writeBytes:entity length:entityLength];
+            start = i + 1;
+        }
+    }
+    [self writeBytes:bytes + start length:length - start];
+}
+
+#pragma mark - Values
+
+- (void)writeEscapedString:(NSString *)string
+{
+    [self writeString:string escaped:YES];
+}
+
+- (void)writeUnsignedLong:(unsigned long)value negative:(BOOL)negative
+{
+    char digits[24];
+    char *cursor = digits + sizeof(digits);
+    do {
+        *--cursor = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    if (negative) {
+        *--cursor = '-';
+    }
+    [self writeBytes:cursor length:digits + sizeof(digits) - cursor];
+}
+
+- (void)writeInt:(int)value
+{
+    if (value < 0) {
+        [self writeUnsignedLong:-(long)value negative:YES];
+    } else {
+        [self writeUnsignedLong:value negative:NO];
+    }
+}
+
+- (void)writeUnsignedInt:(unsigned)value
+{
+    [self writeUnsignedLong:value negative:NO];
+}
+
+- (void)writeDouble:(double)value decimals:(int)decimals
+{
+    // Rounding must be exactly that of printf, so the formatting itself is left to snprintf
+    char digits[64];
+    int length = snprintf(digits, sizeof(digits), "%.*f", decimals, value);
+    if (length > 0) {
+        [self writeBytes:digits length:MIN((NSUInteger)length, sizeof(digits) - 1)];
+    }
+}
+
+- (void)writeMinutes:(int)minutes
+{
+    char digits[32];
+    int length = snprintf(digits, sizeof(digits), "%02d:%02d", minutes / 60, minutes % 60);
+    if (length > 0) {
+        [self writeBytes:digits length:MIN((NSUInteger)length, sizeof(digits) - 1)];
+    }
+}
+
+#pragma mark - Markup
+
+- (void)writeElementNameOfClass:(Class)aClass
+{
+    const char *className = class_getName(aClass);
+    char name[128];
+    NSUInteger length = 0;
+    for (const char *c = className + MIN(strlen(className), 3); *c && length < sizeof(name); c++) {
+        name[length++] = (char)tolower(*c);
+    }
+    [self writeBytes:name length:length];
+}
+
+- (void)writeAttributeName:(const char *)name
+{
+    [self writeBytes:" " length:1];
+    [self writeCString:name];
+    [self writeBytes:"=\"" length:2];
+}
+
+- (void)writeAttribute:(const char *)name string:(NSString *)value
+{
+    [self writeAttributeName:name];
+    [self writeString:value escaped:YES];
+    [self writeBytes:"\"" length:1];
+}
+
+- (void)writeAttribute:(const char *)name intValue:(int)value
+{
+    [self writeAttributeName:name];
+    [self writeInt:value];
+    [self writeBytes:"\"" length:1];
+}
+
+- (void)writeAttribute:(const char *)name unsignedValue:(unsigned)value
+{
+    [self writeAttributeName:name];
+    [self writeUnsignedInt:value];
+    [self writeBytes:"\"" length:1];
+}
+
+- (void)writeAttribute:(const char *)name doubleValue:(double)value decimals:(int)decimals
+{
+    [self writeAttributeName:name];
+    [self writeDouble:value decimals:decimals];
+    [self writeBytes:"\"" length:1];
+}
+
+- (void)writeAttribute:(const char *)name minutes:(int)minutes
+{
+    [self writeAttributeName:name];
+    [self writeMinutes:minutes];
+    [self writeBytes:"\"" length:1];
+}
+
+- (void)writeElement:(const char *)name text:(NSString *)text
+{
+    [self writeBytes:"<" length:1];
+    [self writeCString:name];
+    [self writeBytes:">" length:1];
+    [self writeString:text escaped:YES];
+    [self writeBytes:"</" length:2];
+    [self writeCString:name];
+    [self writeBytes:">\n" length:2];
+}
+
+@end
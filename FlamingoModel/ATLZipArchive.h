@@ -0,0 +1,65 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLZipArchive.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+
+extern NSString * const ATLZipArchiveErrorDomain;
+
+typedef NS_ENUM(NSInteger, ATLZipArchiveError) {
+    invalidArchiveError = 1,
+    missingMemberError,
+    unsupportedMemberError,
+    corruptMemberError
+};
+
+/**
+ ATLZipArchive reads the members of a zip archive without extracting them to disk.
+ The archive is memory mapped, members are inflated in chunks that are passed on as soon as they are produced.
+ Only stored and deflated members are supported, zip64 and encrypted members are not.
+ */
+@interface ATLZipArchive : NSObject
+
+- (instancetype)initWithContentsOfURL:(NSURL *)url error:(NSError **)error;
+
+/**
+ Members are identified by their file name, directories inside the archive are ignored.
+ */
+@property (nonatomic, readonly) NSArray *memberNames;
+- (unsigned long long)uncompressedSizeOfMember:(NSString *)name;
+
+/**
+ Inflates a member, calling the block for every chunk. The bytes are only valid during the call.
+ The checksum of the member is verified when all chunks have been read.
+ */
+- (BOOL)enumerateChunksOfMember:(NSString *)name
+                     usingBlock:(void (^)(const void *bytes, NSUInteger length, BOOL *stop))block
+                          error:(NSError **)error;
+
+/**
+ Inflates a member without passing on its bytes, to verify its checksum before any of them are used.
+ */
+- (BOOL)verifyMember:(NSString *)name error:(NSError **)error;
+
+/**
+ Writes a member to a file, for readers that need random access. The file is removed when the member fails.
+ */
+- (BOOL)extractMember:(NSString *)name toURL:(NSURL *)url error:(NSError **)error;
+
+@end
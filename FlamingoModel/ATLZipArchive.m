@@ -0,0 +1,269 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLZipArchive.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLZipArchive.h"
+#import "ATLError.h"
+#import <zlib.h>
+
+NSString * const ATLZipArchiveErrorDomain = @"nl.firstflamingo.ziparchive";
+
+#define END_OF_DIRECTORY_SIGNATURE  0x06054b50
+#define DIRECTORY_ENTRY_SIGNATURE   0x02014b50
+#define LOCAL_HEADER_SIGNATURE      0x04034b50
+#define END_OF_DIRECTORY_SIZE       22
+#define DIRECTORY_ENTRY_SIZE        46
+#define LOCAL_HEADER_SIZE           30
+#define MAX_COMMENT_LENGTH          0xFFFF
+#define ZIP64_MARKER                0xFFFFFFFF
+#define ENCRYPTED_FLAG              0x0001
+#define STORED_METHOD               0
+#define DEFLATED_METHOD             8
+#define CHUNK_SIZE                  (256 * 1024)
+
+typedef struct {
+    uint16_t method;
+    uint16_t flags;
+    uint32_t crc;
+    uint32_t compressedSize;
+    uint32_t uncompressedSize;
+    uint32_t localHeaderOffset;
+} ATLZipMember;
+
+static uint16_t readUInt16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t readUInt32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+@implementation ATLZipArchive {
+    NSData *_data;
+    NSMutableData *_members;
+    NSMutableDictionary *_memberIndexes;
+    NSMutableArray *_memberNames;
+}
+
+#pragma mark - Object lifecycle
+
+- (instancetype)initWithContentsOfURL:(NSURL *)url error:(NSError **)error
+{
+    self = [super init];
+    if (self) {
+        _data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedAlways error:error];
+        if (!_data || ![self readDirectory:error]) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (BOOL)readDirectory:(NSError **)error
+{
+    const uint8_t *bytes = [_data bytes];
+    NSUInteger length = [_data length];
+    if (length < END_OF_DIRECTORY_SIZE) {
+        return failWithError(error, ATLZipArchiveErrorDomain, invalidArchiveError, @"File is too small to be a zip archive");
+    }
+
+    // The end of directory record is followed by a comment of variable length
+    const uint8_t *end = NULL;
+    NSUInteger searchStart = length > END_OF_DIRECTORY_SIZE + MAX_COMMENT_LENGTH ? length - END_OF_DIRECTORY_SIZE - MAX_COMMENT_LENGTH : 0;
+    for (NSUInteger offset = length - END_OF_DIRECTORY_SIZE + 1; offset-- > searchStart; ) {
+        if (readUInt32(bytes + offset) == END_OF_DIRECTORY_SIGNATURE) {
+            end = bytes + offset;
+            break;
+        }
+    }
+    if (!end) {
+        return failWithError(error, ATLZipArchiveErrorDomain, invalidArchiveError, @"End of central directory not found");
+    }
+
+    NSUInteger count = readUInt16(end + 10);
+    NSUInteger directorySize = readUInt32(end + 12);
+    NSUInteger directoryOffset = readUInt32(end + 16);
+    if (directoryOffset + directorySize > length) {
+        return failWithError(error, ATLZipArchiveErrorDomain, invalidArchiveError, @"Central directory exceeds the archive");
+    }
+
+    _members = [NSMutableData dataWithCapacity:count * sizeof(ATLZipMember)];
+    _memberIndexes = [NSMutableDictionary dictionaryWithCapacity:count];
+    _memberNames = [NSMutableArray arrayWithCapacity:count];
+    const uint8_t *p = bytes + directoryOffset;
+    const uint8_t *directoryEnd = p + directorySize;
+    for (NSUInteger i = 0; i < count; i++) {
+        if (p + DIRECTORY_ENTRY_SIZE > directoryEnd || readUInt32(p) != DIRECTORY_ENTRY_SIGNATURE) {
+            return failWithError(error, ATLZipArchiveErrorDomain, invalidArchiveError, @"Invalid central directory entry");
+        }
+        ATLZipMember member;
+        member.flags = readUInt16(p + 8);
+        member.method = readUInt16(p + 10);
+        member.crc = readUInt32(p + 16);
+        member.compressedSize = readUInt32(p + 20);
+        member.uncompressedSize = readUInt32(p + 24);
+        member.localHeaderOffset = readUInt32(p + 42);
+        NSUInteger nameLength = readUInt16(p + 28);
+        NSUInteger extraLength = readUInt16(p + 30);
+        NSUInteger commentLength = readUInt16(p + 32);
+        if (p + DIRECTORY_ENTRY_SIZE + nameLength > directoryEnd) {
+            return failWithError(error, ATLZipArchiveErrorDomain, invalidArchiveError, @"Invalid central directory entry");
+        }
+        NSString *path = [[NSString alloc] initWithBytes:p + DIRECTORY_ENTRY_SIZE length:nameLength encoding:NSUTF8StringEncoding];
+        NSString *name = [path lastPathComponent];
+        if (![path hasSuffix:@"/"] && [name length] > 0 && !_memberIndexes[name]) {
+            _memberIndexes[name] = @([_memberNames count]);
+            [_memberNames addObject:name];
+            [_members appendBytes:&member length:sizeof(member)];
+        }
+        p += DIRECTORY_ENTRY_SIZE + nameLength + extraLength + commentLength;
+    }
+    return YES;
+}
+
+#pragma mark - Accessing members
+
+- (NSArray *)memberNames
+{
+    return _memberNames;
+}
+
+- (const ATLZipMember *)memberWithName:(NSString *)name
+{
+    NSNumber *index = _memberIndexes[name];
+    if (!index) {
+        return NULL;
+    }
+    return (const ATLZipMember *)[_members bytes] + [index unsignedIntegerValue];
+}
+
+- (unsigned long long)uncompressedSizeOfMember:(NSString *)name
+{
+    const ATLZipMember *member = [self memberWithName:name];
+    return member ? member->uncompressedSize : 0;
+}
+
+- (BOOL)enumerateChunksOfMember:(NSString *)name
+                     usingBlock:(void (^)(const void *bytes, NSUInteger length, BOOL *stop))block
+                          error:(NSError **)error
+{
+    const ATLZipMember *member = [self memberWithName:name];
+    if (!member) {
+        return failWithError(error, ATLZipArchiveErrorDomain, missingMemberError, [NSString stringWithFormat:@"%@ not found in archive", name]);
+    }
+    if ((member->flags & ENCRYPTED_FLAG) || member->compressedSize == ZIP64_MARKER || member->uncompressedSize == ZIP64_MARKER ||
+        (member->method != STORED_METHOD && member->method != DEFLATED_METHOD)) {
+        NSString *description = [NSString stringWithFormat:@"%@ is encrypted, zip64 or compressed with method %d", name, member->method];
+        return failWithError(error, ATLZipArchiveErrorDomain, unsupportedMemberError, description);
+    }
+
+    const uint8_t *bytes = [_data bytes];
+    NSUInteger length = [_data length];
+    const uint8_t *header = bytes + member->localHeaderOffset;
+    if (member->localHeaderOffset + LOCAL_HEADER_SIZE > length || readUInt32(header) != LOCAL_HEADER_SIGNATURE) {
+        return failWithError(error, ATLZipArchiveErrorDomain, invalidArchiveError, [NSString stringWithFormat:@"Invalid local header of %@", name]);
+    }
+    NSUInteger dataOffset = member->localHeaderOffset + LOCAL_HEADER_SIZE + readUInt16(header + 26) + readUInt16(header + 28);
+    if (dataOffset + member->compressedSize > length) {
+        return failWithError(error, ATLZipArchiveErrorDomain, invalidArchiveError, [NSString stringWithFormat:@"%@ exceeds the archive", name]);
+    }
+
+    BOOL stop = NO;
+    uLong crc = crc32(0, Z_NULL, 0);
+    NSUInteger nrOfBytes = 0;
+
+    if (member->method == STORED_METHOD) {
+        // Stored members are passed on directly from the mapped archive
+        const uint8_t *p = bytes + dataOffset;
+        const uint8_t *end = p + member->compressedSize;
+        while (p < end && !stop) {
+            NSUInteger chunkLength = MIN(CHUNK_SIZE, (NSUInteger)(end - p));
+            crc = crc32(crc, p, (uInt)chunkLength);
+            block(p, chunkLength, &stop);
+            p += chunkLength;
+            nrOfBytes += chunkLength;
+        }
+
+    } else {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+            return failWithError(error, ATLZipArchiveErrorDomain, corruptMemberError, @"Could not initialize inflate");
+        }
+        stream.next_in = (Bytef *)(bytes + dataOffset);
+        stream.avail_in = member->compressedSize;
+        NSMutableData *buffer = [NSMutableData dataWithLength:CHUNK_SIZE];
+        int status = Z_OK;
+        while (status != Z_STREAM_END && !stop) {
+            stream.next_out = [buffer mutableBytes];
+            stream.avail_out = CHUNK_SIZE;
+            status = inflate(&stream, Z_NO_FLUSH);
+            NSUInteger chunkLength = CHUNK_SIZE - stream.avail_out;
+            if ((status != Z_OK && status != Z_STREAM_END) || (chunkLength == 0 && stream.avail_in == 0 && status != Z_STREAM_END)) {
+                inflateEnd(&stream);
+                return failWithError(error, ATLZipArchiveErrorDomain, corruptMemberError, [NSString stringWithFormat:@"%@ could not be inflated (%d)", name, status]);
+            }
+            if (chunkLength > 0) {
+                crc = crc32(crc, [buffer bytes], (uInt)chunkLength);
+                block([buffer bytes], chunkLength, &stop);
+                nrOfBytes += chunkLength;
+            }
+        }
+        inflateEnd(&stream);
+    }
+
+    if (!stop && (crc != member->crc || nrOfBytes != member->uncompressedSize)) {
+        return failWithError(error, ATLZipArchiveErrorDomain, corruptMemberError, [NSString stringWithFormat:@"Checksum of %@ does not match", name]);
+    }
+    return YES;
+}
+
+- (BOOL)verifyMember:(NSString *)name error:(NSError **)error
+{
+    return [self enumerateChunksOfMember:name usingBlock:^(const void *bytes, NSUInteger length, BOOL *stop) {} error:error];
+}
+
+- (BOOL)extractMember:(NSString *)name toURL:(NSURL *)url error:(NSError **)error
+{
+    FILE *file = fopen([url fileSystemRepresentation], "wb");
+    if (!file) {
+        return failWithError(error, NSPOSIXErrorDomain, errno, [NSString stringWithFormat:@"%@ could not be created", [url lastPathComponent]]);
+    }
+    __block BOOL written = YES;
+    BOOL success = [self enumerateChunksOfMember:name usingBlock:^(const void *bytes, NSUInteger length, BOOL *stop) {
+        if (fwrite(bytes, 1, length, file) != length) {
+            written = NO;
+            *stop = YES;
+        }
+    } error:error];
+    if (fclose(file) != 0) {
+        written = NO;
+    }
+    if (success && !written) {
+        success = failWithError(error, NSPOSIXErrorDomain, errno, [NSString stringWithFormat:@"%@ could not be written", [url lastPathComponent]]);
+    }
+    if (!success) {
+        [[NSFileManager defaultManager] removeItemAtURL:url error:NULL];
+    }
+    return success;
+}
+
+@end
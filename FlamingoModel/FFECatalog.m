@@ -19,6 +19,7 @@
 //
 
 #import "FFECatalog.h"
+#import "NSManagedObjectContext+FFEUtilities.h"
 
 @interface FFECatalog ()
 
@@ -90,7 +91,7 @@
 {
 	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:self.catalogedType];
 	[request setPredicate:[self.catalogedClass predicateWithModelID:modelID]];
-	NSArray *result = [self.managedObjectContext executeFetchRequest:request error:NULL];
+	NSArray *result = [self.managedObjectContext fetchObjectsWithRequest:request];
     if ([result count] != 1) {
         return nil;
     }
@@ -100,7 +101,7 @@
 - (NSArray*)allLocalObjects
 {
     NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:self.catalogedType];
-	return [self.managedObjectContext executeFetchRequest:request error:NULL];
+	return [self.managedObjectContext fetchObjectsWithRequest:request];
 }
 
 #pragma mark - Collections
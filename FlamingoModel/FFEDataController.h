@@ -61,6 +61,11 @@ typedef enum {
  */
 - (instancetype)initWithStoreURL:(NSURL *)url;
 
+/**
+ The URL of the data store, nil for a testing instance.
+ */
+@property (nonatomic, readonly) NSURL *storeURL;
+
 /**
  @returns the date when the datastore was last changed
  */
@@ -136,6 +141,12 @@ typedef enum {
  */
 - (void)saveContext;
 
+/**
+ Called before and after every save of the managed object context, subclasses that override these must call super.
+ */
+- (void)contextWillSave:(NSNotification*)notification;
+- (void)contextDidSave:(NSNotification*)notification;
+
 #pragma mark - REST interface
 
 @property (nonatomic, readonly) NSURLSession *remoteSession;
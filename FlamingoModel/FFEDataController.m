@@ -158,6 +158,10 @@ NSString *const kFFEBasicsErrorDomain = @"nl.firstflamingo.basics.error";
                                                      selector:@selector(contextWillSave:)
                                                          name:NSManagedObjectContextWillSaveNotification
                                                        object:_managedObjectContext];
+            [[NSNotificationCenter defaultCenter] addObserver:self
+                                                     selector:@selector(contextDidSave:)
+                                                         name:NSManagedObjectContextDidSaveNotification
+                                                       object:_managedObjectContext];
         }
     }
     return _managedObjectContext;
@@ -216,6 +220,10 @@ NSString *const kFFEBasicsErrorDomain = @"nl.firstflamingo.basics.error";
     }
 }
 
+- (void)contextDidSave:(NSNotification*)notification
+{
+}
+
 - (void)setLastModifiedFor:(NSSet*)collection
 {
     for (id object in collection) {
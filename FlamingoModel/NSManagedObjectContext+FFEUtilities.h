@@ -41,4 +41,16 @@
 - (NSManagedObject*)fetchUniqueInstanceOfType: (NSString*)type withPredicate: (NSPredicate*)predicate;
 - (NSArray*)fetchInstancesOfType: (NSString*)type withPredicate: (NSPredicate*)predicate;
 
+/**
+ Executes a fetch request, counting it in numberOfFetchRequests
+ */
+- (NSArray *)fetchObjectsWithRequest:(NSFetchRequest *)request;
+- (NSArray *)fetchObjectsWithRequest:(NSFetchRequest *)request error:(NSError **)error;
+
+/**
+ Number of fetch requests executed by this context through fetchObjectsWithRequest:,
+ kept in its userInfo so that it is confined to the queue of the context
+ */
+@property (nonatomic, readonly) NSUInteger numberOfFetchRequests;
+
 @end
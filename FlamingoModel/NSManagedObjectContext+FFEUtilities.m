@@ -21,6 +21,8 @@
 #import "NSManagedObjectContext+FFEUtilities.h"
 #import "FFESyncing.h"
 
+static NSString * const FFEFetchRequestCountKey = @"FFEFetchRequestCount";
+
 @implementation NSManagedObjectContext (FFEUtilities)
 
 
@@ -59,7 +61,7 @@
 - (NSArray *)allObjectsOfClass:(Class)objectClass
 {
     NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:NSStringFromClass(objectClass)];
-	return [self executeFetchRequest:request error:NULL];
+	return [self fetchObjectsWithRequest:request];
 }
 
 - (NSManagedObject*)fetchUniqueInstanceOfType:(NSString*)type withPredicate:(NSPredicate*)predicate
@@ -76,7 +78,23 @@
 {
 	NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:type];
 	[request setPredicate:predicate];
-	return [self executeFetchRequest:request error:NULL];
+	return [self fetchObjectsWithRequest:request];
+}
+
+- (NSArray *)fetchObjectsWithRequest:(NSFetchRequest *)request
+{
+    return [self fetchObjectsWithRequest:request error:NULL];
+}
+
+- (NSArray *)fetchObjectsWithRequest:(NSFetchRequest *)request error:(NSError **)error
+{
+    self.userInfo[FFEFetchRequestCountKey] = @(self.numberOfFetchRequests + 1);
+    return [self executeFetchRequest:request error:error];
+}
+
+- (NSUInteger)numberOfFetchRequests
+{
+    return [self.userInfo[FFEFetchRequestCountKey] unsignedIntegerValue];
 }
 
 @end
@@ -0,0 +1,84 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLAtlasExportTests.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <XCTest/XCTest.h>
+#import "ATLDataController.h"
+#import "ATLFileImporter.h"
+#import "ATLXMLWriter.h"
+#import "ATLAtlasExporter.h"
+
+#import "ATLJunction.h"
+#import "ATLStation.h"
+#import "ATLSeries.h"
+
+#import "NSManagedObjectContext+FFEUtilities.h"
+
+@interface ATLAtlasExportTests : XCTestCase
+
+@property (nonatomic, strong) ATLDataController *dataController;
+@property (nonatomic, weak) NSManagedObjectContext *managedObjectContext;
+
+@end
+
+@implementation ATLAtlasExportTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.dataController = [ATLDataController testingInstance];
+    self.dataController.testingDate = [NSDate date];
+    self.managedObjectContext = self.dataController.managedObjectContext;
+}
+
+- (void)testXMLExport
+{
+    ATLXMLWriter *writer = [ATLXMLWriter memoryWriter];
+    [writer writeAttribute:"name" string:@"Sint & \"Zuid\" <N>"];
+    [writer writeAttribute:"km" doubleValue:56.5039 decimals:3];
+    [writer writeAttribute:"nr" intValue:-15];
+    [writer writeAttribute:"o" minutes:75];
+    [writer writeString:nil];
+    XCTAssertEqualObjects(writer.string, @" name=\"Sint &amp; &quot;Zuid&quot; &lt;N&gt;\" km=\"56.504\" nr=\"-15\" o=\"01:15\"(null)");
+
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    [[ATLFileImporter new] importContentsOfURL:[bundle URLForResource:@"t2_data" withExtension:@"xml"]
+                      intoManagedObjectContext:self.managedObjectContext];
+    ATLJunction *junction = [self.managedObjectContext objectOfClass:[ATLJunction class] withModelID:@"nl.j_041" create:NO];
+    XCTAssertEqualObjects(junction.xmlString, @"<junction id=\"nl.j_041\" sameDirection=\"yes\">\n</junction>\n");
+    XCTAssertEqualObjects(junction.xmlReferenceString, @"<ATLJunction id=\"nl.j_041\"/>\n");
+
+    NSURL *url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"atlas.xml"]];
+    NSError *error = nil;
+    XCTAssertTrue([[ATLAtlasExporter new] exportContentsOfManagedObjectContext:self.managedObjectContext toURL:url error:&error], @"%@", error);
+
+    ATLDataController *otherController = [ATLDataController testingInstance];
+    otherController.testingDate = [NSDate date];
+    NSManagedObjectContext *otherContext = otherController.managedObjectContext;
+    [[ATLFileImporter new] importContentsOfURL:url intoManagedObjectContext:otherContext];
+    XCTAssertEqual([[otherContext allObjectsOfClass:[ATLJunction class]] count], 2);
+    XCTAssertEqual([[otherContext allObjectsOfClass:[ATLStation class]] count], 6);
+    XCTAssertEqual([[otherContext allObjectsOfClass:[ATLSeries class]] count], 2);
+    ATLStation *utrecht = [self.managedObjectContext objectOfClass:[ATLStation class] withModelID:@"nl.ut" create:NO];
+    ATLStation *otherUtrecht = [otherContext objectOfClass:[ATLStation class] withModelID:@"nl.ut" create:NO];
+    XCTAssertEqualObjects(otherUtrecht.xmlString, utrecht.xmlString);
+    [[NSFileManager defaultManager] removeItemAtURL:url error:NULL];
+}
+
+@end
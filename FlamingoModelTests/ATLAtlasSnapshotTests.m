@@ -0,0 +1,227 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLAtlasSnapshotTests.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <XCTest/XCTest.h>
+#import "ATLDataController.h"
+#import "ATLFileImporter.h"
+#import "ATLAtlasSnapshot.h"
+
+#import "ATLJunction.h"
+#import "ATLStation.h"
+#import "ATLRoute.h"
+#import "ATLNode.h"
+
+#import "NSManagedObjectContext+FFEUtilities.h"
+
+// Magic, version, six counts, the heap length and a reserved word
+#define SNAPSHOT_HEADER_SIZE    40
+
+@interface ATLAtlasSnapshotTests : XCTestCase
+
+@property (nonatomic, strong) ATLDataController *dataController;
+@property (nonatomic, weak) NSManagedObjectContext *managedObjectContext;
+
+@end
+
+@implementation ATLAtlasSnapshotTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.dataController = [ATLDataController testingInstance];
+    self.dataController.testingDate = [NSDate date];
+    self.managedObjectContext = self.dataController.managedObjectContext;
+}
+
+/**
+ Imports the test atlas and adds a route from Utrecht to junction nl.j_041
+ */
+- (ATLRoute *)routeWithStations
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    [[ATLFileImporter new] importContentsOfURL:[bundle URLForResource:@"t2_data" withExtension:@"xml"]
+                      intoManagedObjectContext:self.managedObjectContext];
+    ATLRoute *route = (ATLRoute*)[self.managedObjectContext createManagedObjectOfType:@"ATLRoute"];
+    route.id_ = @"nl.r_test";
+    route.name = @"Utrecht - Test";
+    route.heartLine = @[[[ATLNode alloc] initWithLatitude:52.00 longitude:5.00 radius:0 km_a:0 km_b:0],
+                        [[ATLNode alloc] initWithLatitude:52.01 longitude:5.00 radius:500 km_a:0 km_b:0],
+                        [[ATLNode alloc] initWithLatitude:52.01 longitude:5.02 radius:0 km_a:0 km_b:0]];
+    [route insertLocation:[self.managedObjectContext objectOfClass:[ATLJunction class] withModelID:@"nl.j_041" create:NO] atPosition:1.5];
+    [route insertLocation:[self.managedObjectContext objectOfClass:[ATLStation class] withModelID:@"nl.ut" create:NO] atPosition:0.0];
+    return route;
+}
+
+- (void)testAtlasSnapshot
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    [[ATLFileImporter new] importContentsOfURL:[bundle URLForResource:@"t2_data" withExtension:@"xml"]
+                      intoManagedObjectContext:self.managedObjectContext];
+    NSURL *url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"t2_data.atls"]];
+    NSError *error = nil;
+    XCTAssert([ATLAtlasSnapshot writeSnapshotOfManagedObjectContext:self.managedObjectContext toURL:url error:&error]);
+    ATLAtlasSnapshot *snapshot = [ATLAtlasSnapshot snapshotWithContentsOfURL:url error:&error];
+    XCTAssertNotNil(snapshot, @"%@", error);
+    XCTAssertEqual(snapshot.nrOfLocations, 8);
+    XCTAssertEqual(snapshot.nrOfServices, 1);
+
+    NSUInteger utrecht = [snapshot indexOfLocationWithID:@"nl.ut"];
+    XCTAssertNotEqual(utrecht, NSNotFound);
+    XCTAssertEqualObjects([snapshot stringForReference:snapshot.locations[utrecht].name], @"Utrecht Centraal");
+    XCTAssertEqual(snapshot.locations[utrecht].kind, snapshotStation);
+    XCTAssertEqual([snapshot indexOfLocationWithID:@"nl.xx"], NSNotFound);
+
+    NSUInteger service = [snapshot indexOfServiceWithID:@"ic.j"];
+    XCTAssertNotEqual(service, NSNotFound);
+    NSUInteger count = 0;
+    const ATLSnapshotServicePoint *servicePoints = [snapshot servicePointsOfService:service count:&count];
+    XCTAssertEqual(count, 8);
+    XCTAssertEqual(servicePoints[0].location, utrecht);
+    XCTAssertEqualWithAccuracy(servicePoints[0].km, 0.0, 0.001);
+    NSUInteger junction = [snapshot indexOfLocationWithID:@"nl.j_041"];
+    XCTAssertEqual(servicePoints[1].location, junction);
+    XCTAssertEqual(snapshot.locations[junction].kind, snapshotJunction);
+    XCTAssertEqualWithAccuracy(servicePoints[1].km, 2.612, 0.001);
+
+    // A file that is not a snapshot is refused
+    XCTAssertNil([ATLAtlasSnapshot snapshotWithContentsOfURL:[bundle URLForResource:@"t2_data" withExtension:@"xml"] error:&error]);
+    XCTAssertEqualObjects(error.domain, ATLAtlasSnapshotErrorDomain);
+    XCTAssertEqual(error.code, invalidSnapshotError);
+    [[NSFileManager defaultManager] removeItemAtURL:url error:NULL];
+}
+
+- (void)testSnapshotGeometry
+{
+    ATLRoute *route = [self routeWithStations];
+    NSURL *url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"t2_geometry.atls"]];
+    NSError *error = nil;
+    XCTAssert([ATLAtlasSnapshot writeSnapshotOfManagedObjectContext:self.managedObjectContext toURL:url error:&error]);
+    ATLAtlasSnapshot *snapshot = [ATLAtlasSnapshot snapshotWithContentsOfURL:url error:&error];
+    XCTAssertNotNil(snapshot, @"%@", error);
+    XCTAssertEqual(snapshot.nrOfRoutes, 1);
+
+    NSUInteger routeIndex = [snapshot indexOfRouteWithID:@"nl.r_test"];
+    XCTAssertNotEqual(routeIndex, NSNotFound);
+    XCTAssertEqualObjects([snapshot stringForReference:snapshot.routes[routeIndex].name], @"Utrecht - Test");
+    XCTAssertEqual([snapshot indexOfRouteWithID:@"nl.r_xx"], NSNotFound);
+
+    NSUInteger count = 0;
+    const ATLSnapshotNode *nodes = [snapshot nodesOfRoute:routeIndex count:&count];
+    XCTAssertEqual(count, 3);
+    XCTAssertEqualWithAccuracy(nodes[1].latitude, 52.01, 1e-9);
+    XCTAssertEqual(nodes[1].radius, 500);
+
+    NSArray *heartLine = [snapshot heartLineOfRoute:routeIndex];
+    XCTAssertEqual([heartLine count], [route.heartLine count]);
+    for (NSUInteger i = 0; i < [heartLine count]; i++) {
+        ATLNode *node = heartLine[i], *original = route.heartLine[i];
+        XCTAssertEqualWithAccuracy(node.coordinate.latitude, original.coordinate.latitude, 1e-9);
+        XCTAssertEqualWithAccuracy(node.coordinate.longitude, original.coordinate.longitude, 1e-9);
+        XCTAssertEqual(node.radius, original.radius);
+    }
+
+    // Positions are sorted by km
+    const ATLSnapshotPosition *positions = [snapshot positionsOfRoute:routeIndex count:&count];
+    XCTAssertEqual(count, 2);
+    NSUInteger utrecht = [snapshot indexOfLocationWithID:@"nl.ut"];
+    NSUInteger junction = [snapshot indexOfLocationWithID:@"nl.j_041"];
+    XCTAssertEqual(positions[0].location, utrecht);
+    XCTAssertEqual(positions[1].location, junction);
+    XCTAssertEqualWithAccuracy([snapshot kmOfLocation:junction onRoute:routeIndex], 1.5, 0.001);
+    XCTAssertTrue(isnan([snapshot kmOfLocation:[snapshot indexOfLocationWithID:@"nl.ah"] onRoute:routeIndex]));
+    [[NSFileManager defaultManager] removeItemAtURL:url error:NULL];
+}
+
+- (void)testInvalidSnapshot
+{
+    [self routeWithStations];
+    NSURL *url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"t2_invalid.atls"]];
+    XCTAssert([ATLAtlasSnapshot writeSnapshotOfManagedObjectContext:self.managedObjectContext toURL:url error:NULL]);
+    NSData *original = [NSData dataWithContentsOfURL:url];
+    ATLAtlasSnapshot *snapshot = [ATLAtlasSnapshot snapshotWithContentsOfURL:url error:NULL];
+    NSUInteger nrOfLocations = snapshot.nrOfLocations, nrOfRoutes = snapshot.nrOfRoutes;
+    NSUInteger nodeCount = 0;
+    [snapshot nodesOfRoute:0 count:&nodeCount];
+    snapshot = nil;
+
+    // The header is followed by the locations, routes, nodes and positions
+    NSUInteger locations = SNAPSHOT_HEADER_SIZE;
+    NSUInteger positions = locations + nrOfLocations * sizeof(ATLSnapshotLocation) + nrOfRoutes * sizeof(ATLSnapshotRoute) +
+        nodeCount * sizeof(ATLSnapshotNode);
+    NSDictionary *corruptions = @{@"string outside the heap": @(locations + offsetof(ATLSnapshotLocation, name)),
+                                  @"unknown location": @(positions + offsetof(ATLSnapshotPosition, location))};
+    for (NSString *corruption in corruptions) {
+        NSMutableData *data = [original mutableCopy];
+        uint32_t invalid = 0x7FFFFFFF;
+        [data replaceBytesInRange:NSMakeRange([corruptions[corruption] unsignedIntegerValue], sizeof(invalid)) withBytes:&invalid];
+        [data writeToURL:url atomically:YES];
+        NSError *error = nil;
+        XCTAssertNil([ATLAtlasSnapshot snapshotWithContentsOfURL:url error:&error], @"%@", corruption);
+        XCTAssertEqual(error.code, invalidSnapshotError, @"%@", corruption);
+    }
+    [[NSFileManager defaultManager] removeItemAtURL:url error:NULL];
+}
+
+
+- (void)testSnapshotOfStore
+{
+    NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"snapshot-store"];
+    [[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+    NSURL *storeURL = [NSURL fileURLWithPath:[directory stringByAppendingPathComponent:@"atlas.sqlite"]];
+    ATLDataController *dataController = [[ATLDataController alloc] initWithStoreURL:storeURL];
+    NSManagedObjectContext *context = dataController.managedObjectContext;
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    [[ATLFileImporter new] importContentsOfURL:[bundle URLForResource:@"t2_data" withExtension:@"xml"]
+                      intoManagedObjectContext:context];
+    XCTAssertNil(dataController.atlasSnapshot);
+
+    // Saving the atlas writes its snapshot next to the store, the station index is built from it
+    [dataController saveContext];
+    NSString *snapshotPath = [directory stringByAppendingPathComponent:@"atlas.atls"];
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:snapshotPath]);
+    ATLAtlasSnapshot *snapshot = dataController.atlasSnapshot;
+    XCTAssertEqual(snapshot.nrOfLocations, 8);
+    ATLStation *utrecht = [context objectOfClass:[ATLStation class] withModelID:@"nl.ut" create:NO];
+    NSUInteger index = [snapshot indexOfLocationWithID:@"nl.ut"];
+    XCTAssertEqualWithAccuracy(snapshot.locations[index].latitude, utrecht.averagedCoordinate.latitude, 1e-9);
+    XCTAssertEqualWithAccuracy(snapshot.locations[index].longitude, utrecht.averagedCoordinate.longitude, 1e-9);
+    XCTAssertEqual([dataController stationClosestToCoordinate:utrecht.averagedCoordinate], utrecht);
+
+    // Moving the station replaces the snapshot on the next save
+    for (ATLRoutePosition *position in utrecht.routePositions) {
+        position.coordinate = CLLocationCoordinate2DMake(53.5, 7.5);
+    }
+    [dataController saveContext];
+    XCTAssertNotEqual(dataController.atlasSnapshot, snapshot);
+    snapshot = dataController.atlasSnapshot;
+    index = [snapshot indexOfLocationWithID:@"nl.ut"];
+    XCTAssertEqualWithAccuracy(snapshot.locations[index].latitude, 53.5, 1e-9);
+    XCTAssertEqual([dataController stationClosestToCoordinate:CLLocationCoordinate2DMake(53.5, 7.5)], utrecht);
+
+    // Another controller of the same store opens the snapshot to index the stations
+    ATLDataController *reopened = [[ATLDataController alloc] initWithStoreURL:storeURL];
+    XCTAssertNotNil(reopened.atlasSnapshot);
+    ATLStation *station = [reopened stationClosestToCoordinate:CLLocationCoordinate2DMake(53.5, 7.5)];
+    XCTAssertEqualObjects(station.id_, @"nl.ut");
+    [[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+}
+
+@end
@@ -0,0 +1,64 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLFeedGenerator.h
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ ATLFeedGenerator writes a synthetic GTFS feed in the format of the NS feed, to measure how the import scales.
+ The feed is fully determined by the seed and the configuration, so two runs with equal settings produce identical files.
+ Series run along a fixed sequence of stations, every trip belongs to a series and a calendar service.
+ */
+@interface ATLFeedGenerator : NSObject
+
+- (instancetype)initWithSeed:(uint64_t)seed;
+
+/**
+ Creates a generator with the default network, with enough trips for approximately the requested number of stop_times rows.
+ */
++ (instancetype)generatorForNrOfStopTimes:(NSUInteger)nrOfStopTimes;
+
+@property (nonatomic, readonly) uint64_t seed;
+
+@property (nonatomic, assign) NSUInteger nrOfStations;
+@property (nonatomic, assign) NSUInteger nrOfSeries;
+@property (nonatomic, assign) NSUInteger nrOfTrips;
+@property (nonatomic, assign) NSUInteger minStopsPerTrip;
+@property (nonatomic, assign) NSUInteger maxStopsPerTrip;
+
+/**
+ Calendar variety: the number of distinct services and the number of days covered by the feed.
+ Each service runs on a random set of weekdays, with some random days added or left out.
+ */
+@property (nonatomic, assign) NSUInteger nrOfServices;
+@property (nonatomic, assign) NSUInteger nrOfDays;
+@property (nonatomic, strong) NSDate *startDate;
+
+/**
+ The number of rows written to stop_times.txt by the last call to writeFeedToDirectory:error:
+ */
+@property (nonatomic, readonly) NSUInteger nrOfStopTimes;
+
+/**
+ Writes feed_info.txt, calendar_dates.txt, trips.txt and stop_times.txt into the directory, which is created if needed.
+ Fails when a file can not be created or written completely.
+ */
+- (BOOL)writeFeedToDirectory:(NSURL *)directory error:(NSError **)error;
+
+@end
@@ -0,0 +1,296 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLFeedGenerator.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import "ATLFeedGenerator.h"
+
+#define DEFAULT_SEED 20140301
+
+typedef struct {
+    NSUInteger nrOfStops;
+    BOOL intercity;
+} ATLGeneratedSeries;
+
+static uint64_t nextRandom(uint64_t *state)
+{
+    // xorshift64*, small and fast but more than random enough for test data
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static NSUInteger randomBelow(uint64_t *state, NSUInteger limit)
+{
+    return limit > 0 ? (NSUInteger)(nextRandom(state) % limit) : 0;
+}
+
+static void writeTime(FILE *file, NSUInteger minutes)
+{
+    fprintf(file, "%02lu:%02lu:00", (unsigned long)(minutes / 60), (unsigned long)(minutes % 60));
+}
+
+@implementation ATLFeedGenerator {
+    uint64_t _state;
+    NSMutableArray *_dayIdentifiers;
+    NSMutableData *_dayWeekdays;
+    NSMutableData *_series;
+    NSMutableData *_seriesStations;
+    NSMutableData *_seriesSegments;
+}
+
+#pragma mark - Object lifecycle
+
+- (instancetype)init
+{
+    return [self initWithSeed:DEFAULT_SEED];
+}
+
+- (instancetype)initWithSeed:(uint64_t)seed
+{
+    self = [super init];
+    if (self) {
+        _seed = seed;
+        _nrOfStations = 400;
+        _nrOfSeries = 80;
+        _nrOfTrips = 1000;
+        _minStopsPerTrip = 4;
+        _maxStopsPerTrip = 24;
+        _nrOfServices = 60;
+        _nrOfDays = 31;
+        NSDateComponents *components = [NSDateComponents new];
+        components.year = 2014;
+        components.month = 3;
+        components.day = 1;
+        _startDate = [[self calendar] dateFromComponents:components];
+    }
+    return self;
+}
+
++ (instancetype)generatorForNrOfStopTimes:(NSUInteger)nrOfStopTimes
+{
+    ATLFeedGenerator *generator = [self new];
+    NSUInteger averageStops = (generator.minStopsPerTrip + generator.maxStopsPerTrip) / 2;
+    generator.nrOfTrips = MAX(1, nrOfStopTimes / averageStops);
+    return generator;
+}
+
+- (NSCalendar *)calendar
+{
+    NSCalendar *calendar = [[NSCalendar alloc] initWithCalendarIdentifier:NSCalendarIdentifierGregorian];
+    calendar.timeZone = [NSTimeZone timeZoneWithName:@"Europe/Amsterdam"];
+    return calendar;
+}
+
+#pragma mark - Generating the network
+
+- (void)prepare
+{
+    NSAssert(self.minStopsPerTrip >= 2 && self.minStopsPerTrip <= self.maxStopsPerTrip, @"Invalid number of stops per trip");
+    NSAssert(self.maxStopsPerTrip <= self.nrOfStations, @"A trip can not have more stops than there are stations");
+    _state = self.seed ? self.seed : DEFAULT_SEED;
+
+    NSCalendar *calendar = [self calendar];
+    NSDateFormatter *formatter = [NSDateFormatter new];
+    formatter.calendar = calendar;
+    formatter.timeZone = calendar.timeZone;
+    formatter.dateFormat = @"yyyyMMdd";
+    _dayIdentifiers = [NSMutableArray arrayWithCapacity:self.nrOfDays];
+    _dayWeekdays = [NSMutableData dataWithLength:self.nrOfDays];
+    uint8_t *weekdays = [_dayWeekdays mutableBytes];
+    for (NSUInteger day = 0; day < self.nrOfDays; day++) {
+        NSDate *date = [calendar dateByAddingUnit:NSCalendarUnitDay value:day toDate:self.startDate options:0];
+        [_dayIdentifiers addObject:[formatter stringFromDate:date]];
+        // Gregorian weekday 1 is sunday, in the model 0 is monday
+        weekdays[day] = ([calendar component:NSCalendarUnitWeekday fromDate:date] + 5) % 7;
+    }
+
+    // Every series runs along distinct stations, drawn by a partial Fisher-Yates shuffle
+    NSUInteger maxStops = self.maxStopsPerTrip;
+    _series = [NSMutableData dataWithLength:self.nrOfSeries * sizeof(ATLGeneratedSeries)];
+    _seriesStations = [NSMutableData dataWithLength:self.nrOfSeries * maxStops * sizeof(NSUInteger)];
+    _seriesSegments = [NSMutableData dataWithLength:self.nrOfSeries * maxStops * sizeof(NSUInteger)];
+    ATLGeneratedSeries *series = [_series mutableBytes];
+    NSUInteger *stations = [_seriesStations mutableBytes];
+    NSUInteger *segments = [_seriesSegments mutableBytes];
+    NSUInteger *shuffled = malloc(self.nrOfStations * sizeof(NSUInteger));
+    for (NSUInteger i = 0; i < self.nrOfStations; i++) {
+        shuffled[i] = i;
+    }
+    for (NSUInteger s = 0; s < self.nrOfSeries; s++) {
+        series[s].nrOfStops = self.minStopsPerTrip + randomBelow(&_state, self.maxStopsPerTrip - self.minStopsPerTrip + 1);
+        series[s].intercity = (s % 3 == 0);
+        for (NSUInteger j = 0; j < series[s].nrOfStops; j++) {
+            NSUInteger k = j + randomBelow(&_state, self.nrOfStations - j);
+            NSUInteger station = shuffled[k];
+            shuffled[k] = shuffled[j];
+            shuffled[j] = station;
+            stations[s * maxStops + j] = station;
+            segments[s * maxStops + j] = (series[s].intercity ? 8 : 3) + randomBelow(&_state, 12);
+        }
+    }
+    free(shuffled);
+}
+
+#pragma mark - Writing the feed
+
+- (FILE *)openFile:(NSString *)name inDirectory:(NSURL *)directory error:(NSError **)error
+{
+    NSString *path = [[directory URLByAppendingPathComponent:name] path];
+    FILE *file = fopen([path fileSystemRepresentation], "w");
+    if (!file) {
+        NSLog(@"Could not create %@: %s", path, strerror(errno));
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSFilePathErrorKey: path}];
+        }
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    return file;
+}
+
+/**
+ Closes the file, failing when any write to it or flushing it failed.
+ */
+- (BOOL)closeFile:(FILE *)file named:(NSString *)name error:(NSError **)error
+{
+    BOOL failed = ferror(file) != 0;
+    int closeError = errno;
+    if (fclose(file) != 0) {
+        failed = YES;
+        closeError = errno;
+    }
+    if (failed) {
+        NSLog(@"Could not write %@: %s", name, strerror(closeError));
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:closeError userInfo:@{NSFilePathErrorKey: name}];
+        }
+        return NO;
+    }
+    return YES;
+}
+
+- (BOOL)writeFeedToDirectory:(NSURL *)directory error:(NSError **)error
+{
+    if (![[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:error]) {
+        return NO;
+    }
+    [self prepare];
+    _nrOfStopTimes = 0;
+
+    FILE *file = [self openFile:@"feed_info.txt" inDirectory:directory error:error];
+    if (!file) {
+        return NO;
+    }
+    fprintf(file, "feed_publisher_name,feed_publisher_url,feed_lang,feed_start_date,feed_end_date,feed_version\n");
+    fprintf(file, "Flamingo,http://www.firstflamingo.com/,nl,%s,%s,synthetic-%llu\n",
+            [[_dayIdentifiers firstObject] UTF8String], [[_dayIdentifiers lastObject] UTF8String], (unsigned long long)self.seed);
+    if (![self closeFile:file named:@"feed_info.txt" error:error]) {
+        return NO;
+    }
+
+    file = [self openFile:@"calendar_dates.txt" inDirectory:directory error:error];
+    if (!file) {
+        return NO;
+    }
+    [self writeCalendarDates:file];
+    if (![self closeFile:file named:@"calendar_dates.txt" error:error]) {
+        return NO;
+    }
+
+    file = [self openFile:@"trips.txt" inDirectory:directory error:error];
+    if (!file) {
+        return NO;
+    }
+    FILE *stopTimes = [self openFile:@"stop_times.txt" inDirectory:directory error:error];
+    if (!stopTimes) {
+        fclose(file);
+        return NO;
+    }
+    [self writeTrips:file stopTimes:stopTimes];
+    BOOL tripsClosed = [self closeFile:file named:@"trips.txt" error:error];
+    BOOL stopTimesClosed = [self closeFile:stopTimes named:@"stop_times.txt" error:tripsClosed ? error : NULL];
+    return tripsClosed && stopTimesClosed;
+}
+
+- (void)writeCalendarDates:(FILE *)file
+{
+    const uint8_t *weekdays = [_dayWeekdays bytes];
+    fprintf(file, "service_id,date,exception_type\n");
+    for (NSUInteger service = 0; service < self.nrOfServices; service++) {
+        // The first service runs daily, the others on a random pattern with about one in twenty days changed
+        uint8_t weekdayMask = service == 0 ? 0x7F : (uint8_t)(1 + randomBelow(&_state, 0x7F));
+        NSUInteger nrOfDates = 0;
+        for (NSUInteger day = 0; day < self.nrOfDays; day++) {
+            BOOL running = (weekdayMask & (1 << weekdays[day])) != 0;
+            if (service > 0 && randomBelow(&_state, 20) == 0) {
+                running = !running;
+            }
+            if (running || (nrOfDates == 0 && day == self.nrOfDays - 1)) {
+                fprintf(file, "NS:%lu,%s,1\n", (unsigned long)service, [_dayIdentifiers[day] UTF8String]);
+                nrOfDates++;
+            }
+        }
+    }
+}
+
+- (void)writeTrips:(FILE *)trips stopTimes:(FILE *)stopTimes
+{
+    const ATLGeneratedSeries *series = [_series bytes];
+    const NSUInteger *stations = [_seriesStations bytes];
+    const NSUInteger *segments = [_seriesSegments bytes];
+    NSUInteger maxStops = self.maxStopsPerTrip;
+
+    fprintf(trips, "route_id,service_id,trip_id,trip_headsign,direction_id,trip_short_name,block_id,bikes_allowed\n");
+    fprintf(stopTimes, "trip_id,arrival_time,departure_time,stop_id,arrival_stop_id,stop_sequence,pickup_type,drop_off_type\n");
+    for (NSUInteger trip = 0; trip < self.nrOfTrips; trip++) {
+        NSUInteger s = trip % self.nrOfSeries;
+        NSUInteger k = trip / self.nrOfSeries;
+        NSUInteger direction = k % 2;
+        NSUInteger nrOfStops = series[s].nrOfStops;
+        const NSUInteger *route = &stations[s * maxStops];
+        NSUInteger lastStation = direction ? route[0] : route[nrOfStops - 1];
+        unsigned long tripID = 1000 + trip;
+
+        fprintf(trips, "100-%s,NS:%lu,%lu,Station %lu,%lu,%lu,%lu,1\n",
+                series[s].intercity ? "IC" : "SPR",
+                (unsigned long)randomBelow(&_state, self.nrOfServices), tripID, (unsigned long)lastStation,
+                (unsigned long)direction, (unsigned long)((s + 1) * 100 + (k / 2) % 50 * 2 + direction), 100000 + tripID);
+
+        NSUInteger minutes = 5 * 60 + randomBelow(&_state, 18 * 60);
+        for (NSUInteger j = 0; j < nrOfStops; j++) {
+            NSUInteger index = direction ? nrOfStops - 1 - j : j;
+            NSUInteger station = route[index];
+            BOOL terminal = (j == 0 || j == nrOfStops - 1);
+            NSUInteger dwell = terminal ? 0 : randomBelow(&_state, 3);
+            fprintf(stopTimes, "%lu,", tripID);
+            writeTime(stopTimes, minutes);
+            fputc(',', stopTimes);
+            writeTime(stopTimes, minutes + dwell);
+            fprintf(stopTimes, ",st%lu|%lu,,%lu,%d,%d\n", (unsigned long)station, (unsigned long)(1 + (station + s + direction) % 12),
+                    (unsigned long)(j + 1), j == nrOfStops - 1 ? 1 : 0, j == 0 ? 1 : 0);
+            minutes += dwell + segments[s * maxStops + (direction ? MAX(index, 1) - 1 : index)];
+        }
+        _nrOfStopTimes += nrOfStops;
+    }
+}
+
+@end
@@ -0,0 +1,174 @@
+//  Copyright (c) 2014-2015 First Flamingo Enterprise B.V.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  ATLImportBenchmarkTests.m
+//  FlamingoModel
+//
+//  Created by Berend Schotanus on 17-10-26.
+//
+
+#import <XCTest/XCTest.h>
+#import "ATLDataController.h"
+#import "ATLScheduleImporter.h"
+#import "ATLImportMetrics.h"
+#import "ATLFeedGenerator.h"
+
+#import "ATLMissionRule.h"
+
+/**
+ Imports synthetic feeds into an SQLite store and reports duration, memory and store size per step.
+ The sizes are set in the environment of the test scheme, e.g. ATL_BENCHMARK_ROWS=10000,1000000,10000000
+ Without ATL_BENCHMARK_ROWS a feed of DEFAULT_BENCHMARK_ROWS stop_times is imported, small enough for every test run.
+ When ATL_BENCHMARK_REPORT contains a path, the JSON report is also written to that file.
+ */
+#define DEFAULT_BENCHMARK_ROWS  10000
+
+@interface ATLImportBenchmarkTests : XCTestCase <ATLImportMetricsDelegate>
+
+@property (nonatomic, strong) NSURL *workingDirectory;
+@property (nonatomic, strong) NSURL *storeURL;
+@property (nonatomic, strong) NSMutableDictionary *storeSizes;
+
+@end
+
+@implementation ATLImportBenchmarkTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.workingDirectory = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES]
+                             URLByAppendingPathComponent:@"ATLImportBenchmark" isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:self.workingDirectory withIntermediateDirectories:YES attributes:nil error:NULL];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:self.workingDirectory error:NULL];
+    [super tearDown];
+}
+
+#pragma mark - Helpers
+
+- (NSArray *)benchmarkSizes
+{
+    NSString *setting = [[NSProcessInfo processInfo] environment][@"ATL_BENCHMARK_ROWS"];
+    if ([setting length] == 0) {
+        return @[@DEFAULT_BENCHMARK_ROWS];
+    }
+    NSMutableArray *sizes = [NSMutableArray array];
+    for (NSString *item in [setting componentsSeparatedByString:@","]) {
+        long long size = [item longLongValue];
+        if (size > 0) {
+            [sizes addObject:@(size)];
+        }
+    }
+    return sizes;
+}
+
+- (uint64_t)storeSize
+{
+    uint64_t size = 0;
+    for (NSString *suffix in @[@"", @"-wal", @"-shm"]) {
+        NSString *path = [[self.storeURL path] stringByAppendingString:suffix];
+        size += [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL] fileSize];
+    }
+    return size;
+}
+
+- (void)importMetrics:(ATLImportMetrics *)metrics didFinishStep:(ATLImportStepMetrics *)step
+{
+    self.storeSizes[step.name] = @([self storeSize]);
+}
+
+- (NSDictionary *)runBenchmarkWithNrOfRows:(NSUInteger)nrOfRows
+{
+    ATLFeedGenerator *generator = [ATLFeedGenerator generatorForNrOfStopTimes:nrOfRows];
+    NSURL *feedDirectory = [self.workingDirectory URLByAppendingPathComponent:[NSString stringWithFormat:@"feed-%lu", (unsigned long)nrOfRows]
+                                                                  isDirectory:YES];
+    NSError *error = nil;
+    XCTAssertTrue([generator writeFeedToDirectory:feedDirectory error:&error], @"%@", error);
+
+    self.storeURL = [self.workingDirectory URLByAppendingPathComponent:[NSString stringWithFormat:@"store-%lu.sqlite", (unsigned long)nrOfRows]];
+    self.storeSizes = [NSMutableDictionary dictionary];
+    ATLDataController *dataController = [[ATLDataController alloc] initWithStoreURL:self.storeURL];
+    ATLScheduleImporter *importer = [ATLScheduleImporter new];
+    importer.metrics.delegate = self;
+    [importer importContentsOfDirectory:feedDirectory intoManagedObjectContext:dataController.managedObjectContext
+                            withOptions:includeCalendarExceptions];
+
+    NSMutableArray *steps = [NSMutableArray array];
+    for (ATLImportStepMetrics *step in importer.metrics.steps) {
+        NSMutableDictionary *report = [step.dictionaryRepresentation mutableCopy];
+        report[@"storeSize"] = self.storeSizes[step.name] ?: @0;
+        [steps addObject:report];
+    }
+    XCTAssertEqual([steps count], 4);
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:NSStringFromClass([ATLMissionRule class])];
+    NSUInteger nrOfMissionRules = [dataController.managedObjectContext countForFetchRequest:request error:NULL];
+    XCTAssertEqual(nrOfMissionRules, generator.nrOfTrips);
+
+    NSDictionary *summary = importer.metrics.summary;
+    return @{@"stopTimes": @(generator.nrOfStopTimes),
+             @"trips": @(generator.nrOfTrips),
+             @"duration": summary[@"duration"],
+             @"peakMemory": summary[@"peakMemory"],
+             @"storeSize": @([self storeSize]),
+             @"steps": steps};
+}
+
+#pragma mark - Tests
+
+- (void)testGeneratorIsDeterministic
+{
+    NSURL *directory1 = [self.workingDirectory URLByAppendingPathComponent:@"run1" isDirectory:YES];
+    NSURL *directory2 = [self.workingDirectory URLByAppendingPathComponent:@"run2" isDirectory:YES];
+    ATLFeedGenerator *generator = [ATLFeedGenerator generatorForNrOfStopTimes:2000];
+    XCTAssertTrue([generator writeFeedToDirectory:directory1 error:NULL]);
+    NSUInteger nrOfStopTimes = generator.nrOfStopTimes;
+    XCTAssertTrue([[ATLFeedGenerator generatorForNrOfStopTimes:2000] writeFeedToDirectory:directory2 error:NULL]);
+    XCTAssertGreaterThan(nrOfStopTimes, 1000);
+
+    for (NSString *name in @[@"feed_info.txt", @"calendar_dates.txt", @"trips.txt", @"stop_times.txt"]) {
+        NSData *data1 = [NSData dataWithContentsOfURL:[directory1 URLByAppendingPathComponent:name]];
+        NSData *data2 = [NSData dataWithContentsOfURL:[directory2 URLByAppendingPathComponent:name]];
+        XCTAssertGreaterThan([data1 length], 0, @"%@", name);
+        XCTAssertEqualObjects(data1, data2, @"%@", name);
+    }
+
+    ATLFeedGenerator *other = [[ATLFeedGenerator alloc] initWithSeed:7];
+    XCTAssertTrue([other writeFeedToDirectory:directory2 error:NULL]);
+    XCTAssertNotEqualObjects([NSData dataWithContentsOfURL:[directory1 URLByAppendingPathComponent:@"trips.txt"]],
+                             [NSData dataWithContentsOfURL:[directory2 URLByAppendingPathComponent:@"trips.txt"]]);
+}
+
+- (void)testImportBenchmark
+{
+    NSArray *sizes = [self benchmarkSizes];
+    XCTAssertGreaterThan([sizes count], 0, @"ATL_BENCHMARK_ROWS contains no valid size");
+    NSMutableArray *results = [NSMutableArray array];
+    for (NSNumber *size in sizes) {
+        @autoreleasepool {
+            [results addObject:[self runBenchmarkWithNrOfRows:[size unsignedIntegerValue]]];
+        }
+    }
+    NSData *report = [NSJSONSerialization dataWithJSONObject:@{@"benchmarks": results} options:NSJSONWritingPrettyPrinted error:NULL];
+    NSLog(@"Import benchmark:\n%@", [[NSString alloc] initWithData:report encoding:NSUTF8StringEncoding]);
+
+    NSString *reportPath = [[NSProcessInfo processInfo] environment][@"ATL_BENCHMARK_REPORT"];
+    if ([reportPath length] > 0) {
+        XCTAssertTrue([report writeToFile:reportPath atomically:YES]);
+    }
+}
+
+@end
@@ -29,18 +29,49 @@
 #import "ATLServicePoint.h"
 #import "ATLServiceRule.h"
 #import "ATLSeries.h"
+#import "ATLSeriesRef.h"
+#import "ATLServiceRef.h"
 #import "ATLMissionRule.h"
 #import "ATLTimePath.h"
 #import "ATLTimePoint.h"
+#import "ATLTimePathIndex.h"
+#import "ATLTripIndex.h"
+#import "ATLRowFilter.h"
+#import "ATLZipArchive.h"
+#import "ATLCSVReader.h"
+#import "ATLStopTimesSorter.h"
 #import "ATLCalendarRule.h"
+#import "ATLFeedCalendar.h"
 
 #import "NSManagedObjectContext+FFEUtilities.h"
 
-@interface ATLImporterTests : XCTestCase
+static uint32_t checksumOfData(NSData *data)
+{
+    const uint8_t *bytes = [data bytes];
+    uint32_t crc = 0xFFFFFFFF;
+    for (NSUInteger i = 0; i < [data length]; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static void appendLittleEndian(NSMutableData *data, uint32_t value, NSUInteger length)
+{
+    for (NSUInteger i = 0; i < length; i++) {
+        uint8_t byte = (value >> (8 * i)) & 0xFF;
+        [data appendBytes:&byte length:1];
+    }
+}
+
+@interface ATLImporterTests : XCTestCase <ATLImportMetricsDelegate>
 
 @property (nonatomic, strong) ATLDataController *dataController;
 @property (nonatomic, strong) ATLScheduleImporter *importer;
 @property (nonatomic, weak) NSManagedObjectContext *managedObjectContext;
+@property (nonatomic, strong) NSMutableArray *progressPositions;
 
 @end
 
@@ -134,6 +165,641 @@
     XCTAssertEqualObjects(point1.stationCode, @"hdr", @"");
 }
 
+- (void)testCalendarWithoutFeedPeriod
+{
+    // Without feed_info.txt there is no feed period to size the service days, the calendar step fails
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"calendar_dates" withExtension:@"txt"] forStep:readCalendar];
+    XCTAssertNil(self.importer.metrics.currentStep);
+    XCTAssertEqual([self.importer.calendarRules count], 0);
+
+    [self.importer importContentsOfURL:[bundle URLForResource:@"feed_info" withExtension:@"txt"] forStep:readInfo];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"calendar_dates" withExtension:@"txt"] forStep:readCalendar];
+    XCTAssertGreaterThan([self.importer.calendarRules count], 0);
+}
+
+- (void)testPackedTimePoints
+{
+    NSArray *points = @[[[ATLTimePoint alloc] initWithArrival:600 departure:602 stationID:@"nl.ut" platform:@"5"
+                                                      options:pointOptionsCanPickUp | pointOptionsCanDropOff],
+                        [[ATLTimePoint alloc] initWithArrival:620 departure:620 stationID:@"nl.gd" platform:nil
+                                                      options:pointOptionsNone],
+                        [[ATLTimePoint alloc] initWithArrival:640 departure:641 stationID:@"nl.rtd" platform:@"5"
+                                                      options:pointOptionsCanDropOff]];
+    ATLTimePath *path = (ATLTimePath*)[self.managedObjectContext createManagedObjectOfType:@"ATLTimePath"];
+    path.timePointsData = [ATLTimePath dataForPointsArray:points];
+    XCTAssertEqual(path.nrOfPoints, 3);
+    XCTAssertEqualObjects(path.timePoints, points);
+    XCTAssertEqualObjects(path.lastPoint.stationCode, @"rtd");
+    XCTAssertTrue([path callsAtStationWithID:@"nl.gd"]);
+    XCTAssertFalse([path callsAtStationWithID:@"nl.asd"]);
+    NSArray *stationIDs = @[@"nl.gd", @"nl.rtd"];
+    XCTAssertEqualObjects([path stationIDsFromID:@"nl.gd" toID:@"nl.rtd"], stationIDs);
+    
+    ATLTimePath *oldPath = (ATLTimePath*)[self.managedObjectContext createManagedObjectOfType:@"ATLTimePath"];
+    oldPath.timePointsData = [NSKeyedArchiver archivedDataWithRootObject:points];
+    XCTAssertTrue([oldPath callsAtStationWithID:@"nl.ut"]);
+    XCTAssertTrue([oldPath migrateTimePointsData]);
+    XCTAssertEqualObjects(oldPath.timePointsData, path.timePointsData);
+    XCTAssertFalse([oldPath migrateTimePointsData]);
+}
+
+- (void)testSymbolTable
+{
+    ATLSymbolTable *table = [ATLSymbolTable sharedTable];
+    ATLSymbol symbol = [table symbolForString:@"nl.ut"];
+    XCTAssertNotEqual(symbol, NO_SYMBOL);
+    XCTAssertEqual([table symbolForBytes:"nl.ut" length:5], symbol);
+    XCTAssertEqualObjects([table stringForSymbol:symbol], @"nl.ut");
+    XCTAssertEqualObjects([table codeForSymbol:symbol], @"ut");
+    
+    ATLTimePoint *point = [ATLTimePoint new];
+    point.stopLocation = @"ut|5";
+    XCTAssertEqual(point.stationSymbol, symbol);
+    XCTAssertEqualObjects(point.platform, @"5");
+
+    // The cache gives the same symbols, and only interns keys it has not seen before
+    ATLSymbolCache *cache = [[ATLSymbolCache alloc] initWithSymbolTable:table prefix:@"nl."];
+    XCTAssertEqual([cache symbolForBytes:"ut|5" length:2], symbol);
+    XCTAssertEqual([cache symbolForBytes:"ut" length:2], symbol);
+    XCTAssertEqual(cache.count, 1);
+    for (int i = 0; i < 2000; i++) {
+        char code[16];
+        int length = snprintf(code, sizeof(code), "x%d", i);
+        XCTAssertEqual([cache symbolForBytes:code length:length], [table symbolForString:[NSString stringWithFormat:@"nl.x%d", i]]);
+    }
+    XCTAssertEqual(cache.count, 2001);
+    XCTAssertEqual([cache symbolForBytes:"ut" length:2], symbol);
+    XCTAssertEqual([cache symbolForBytes:"\xff" length:1], NO_SYMBOL);
+}
+
+- (void)testTimePathIndex
+{
+    ATLTimePoint *point1 = [[ATLTimePoint alloc] initWithArrival:600 departure:602 stationID:@"nl.ut" platform:@"5" options:pointOptionsNone];
+    ATLTimePoint *point2 = [[ATLTimePoint alloc] initWithArrival:620 departure:620 stationID:@"nl.gd" platform:@"3" options:pointOptionsNone];
+    NSData *data1 = [ATLTimePath dataForPointsArray:@[point1, point2]];
+    NSData *data2 = [ATLTimePath dataForPointsArray:@[point2, point1]];
+    
+    ATLTimePathIndex *index = [[ATLTimePathIndex alloc] initWithCapacity:1];
+    XCTAssertEqual([index entryForPointsData:data1], NSNotFound);
+    NSUInteger entry1 = [index addPointsData:data1 reference:@"path1"];
+    NSUInteger entry2 = [index addPointsData:data2 reference:@"path2"];
+    for (int i = 0; i < 100; i++) {
+        [index addPointsData:[ATLTimePath dataForPointsArray:@[[[ATLTimePoint alloc] initWithArrival:i departure:i stationID:@"nl.ut"
+                                                                                               platform:nil options:pointOptionsNone]]]
+                   reference:@(i)];
+    }
+    XCTAssertEqual([index entryForPointsData:[ATLTimePath dataForPointsArray:@[point1, point2]]], entry1);
+    XCTAssertEqualObjects([index referenceAtEntry:entry2], @"path2");
+    [index setReference:nil atEntry:entry2];
+    XCTAssertEqual([index entryForPointsData:data2], entry2);
+    XCTAssertNil([index referenceAtEntry:entry2]);
+    XCTAssertEqual(index.count, 101);
+    XCTAssertEqual(index.nrOfHits, 2);
+}
+
+- (void)testImportMetrics
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    self.importer.batchSize = 2;
+    [self.importer importContentsOfURL:[bundle URLForResource:@"feed_info" withExtension:@"txt"] forStep:readInfo];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_calendar_dates" withExtension:@"txt"] forStep:readCalendar];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_trips" withExtension:@"txt"] forStep:readTrips];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_stop_times" withExtension:@"txt"] forStep:readStopTimes];
+    
+    NSArray *steps = self.importer.metrics.steps;
+    XCTAssertEqual([steps count], 4);
+    ATLImportStepMetrics *trips = steps[2];
+    XCTAssertEqualObjects(trips.name, @"t2_trips.txt");
+    XCTAssertGreaterThanOrEqual(trips.nrOfObjectsCreated, 6);
+    XCTAssertGreaterThan(trips.nrOfSaves, 1);
+    ATLImportStepMetrics *stopTimes = steps[3];
+    XCTAssertGreaterThan(stopTimes.nrOfRows, 0);
+    XCTAssertGreaterThan(stopTimes.nrOfBytes, 0);
+    
+    NSDictionary *summary = [NSJSONSerialization JSONObjectWithData:[self.importer.metrics JSONSummary] options:0 error:NULL];
+    XCTAssertEqual([summary[@"steps"] count], 4);
+
+    // Progress of an XML import reports the position in the document
+    ATLFileImporter *fileImporter = [ATLFileImporter new];
+    fileImporter.metrics.progressInterval = 2;
+    fileImporter.metrics.delegate = self;
+    self.progressPositions = [NSMutableArray array];
+    NSURL *atlasURL = [bundle URLForResource:@"t2_data" withExtension:@"xml"];
+    [fileImporter importContentsOfURL:atlasURL intoManagedObjectContext:self.managedObjectContext];
+    XCTAssertGreaterThan([self.progressPositions count], 2);
+    XCTAssertGreaterThan([[self.progressPositions lastObject] unsignedIntegerValue], [self.progressPositions[0] unsignedIntegerValue]);
+    NSNumber *fileSize = nil;
+    [atlasURL getResourceValue:&fileSize forKey:NSURLFileSizeKey error:NULL];
+    XCTAssertLessThanOrEqual([[self.progressPositions lastObject] unsignedIntegerValue], [fileSize unsignedIntegerValue]);
+    XCTAssertEqual([[fileImporter.metrics.steps lastObject] nrOfBytes], [fileSize unsignedIntegerValue]);
+}
+
+- (void)importMetrics:(ATLImportMetrics *)metrics didUpdateStep:(ATLImportStepMetrics *)step
+{
+    [self.progressPositions addObject:@(step.nrOfBytes)];
+}
+
+- (void)testPipelinedImport
+{
+    NSURL *bundleURL = [[NSBundle bundleForClass:[self class]] bundleURL];
+    [self.importer importContentsOfDirectory:[bundleURL URLByAppendingPathComponent:@"Contents/Resources" isDirectory:YES]
+                    intoManagedObjectContext:self.managedObjectContext
+                                 withOptions:includeCalendarExceptions | pipelinedImport | parallelStopTimes];
+    
+    ATLMissionRule *trip1 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"10000|1|3047" create:NO];
+    XCTAssertEqualObjects(trip1.headsign, @"Nijmegen", @"");
+    XCTAssertEqual(trip1.weekdays, 1 << 5, @"");
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLTimePath class]] count], 2, @"");
+    XCTAssertEqual([trip1.timePath.timePoints count], 18, @"");
+    XCTAssertEqual([self.importer.metrics.steps count], 4);
+}
+
+- (void)testRowFilter
+{
+    ATLRowFilter *filter = [[ATLRowFilter alloc] initWithRules:@{ATLRowFilterExcludedAgenciesKey: @[@911],
+                                                                 ATLRowFilterCategoriesKey: @[@"IC"],
+                                                                 ATLRowFilterCategoryPrefixesKey: @[@"SP"],
+                                                                 ATLRowFilterDeniedServicesKey: @[@"42"]}];
+    ATLCSVField service = {"41", 2, NO};
+    ATLCSVField deniedService = {"42", 2, NO};
+    ATLCSVField route = {"100-SPR,100-ICE", 7, NO};
+    XCTAssertTrue([filter acceptsRoute:route service:service], @"");
+    XCTAssertFalse([filter acceptsRoute:route service:deniedService], @"");
+    route.length = 6;
+    XCTAssertFalse([filter acceptsRoute:route service:service], @"");
+    XCTAssertTrue([filter acceptsRouteID:@"100-IC"], @"");
+    XCTAssertFalse([filter acceptsRouteID:@"100-ICE"], @"");
+    XCTAssertFalse([filter acceptsRouteID:@"911-IC"], @"");
+    XCTAssertFalse([filter acceptsRouteID:@"100-ST"], @"");
+    XCTAssertFalse([filter acceptsRouteID:@"100"], @"");
+    XCTAssertTrue([filter acceptsRouteID:@"100-IC-x"], @"");
+    XCTAssertFalse([filter acceptsRouteID:@"100-ICE-x"], @"");
+    XCTAssertTrue([filter acceptsRouteID:@"100-SPR-"], @"");
+    
+    // Without registered trips every trip is accepted, e.g. for stop_times read without trips.txt
+    ATLCSVField trip = {"3047", 4, NO};
+    ATLCSVField otherTrip = {"3049", 4, NO};
+    XCTAssertTrue([filter acceptsTrip:otherTrip], @"");
+    [filter addTrip:trip];
+    XCTAssertTrue([filter acceptsTrip:trip], @"");
+    XCTAssertFalse([filter acceptsTrip:otherTrip], @"");
+    XCTAssertEqual(filter.nrOfTrips, 1);
+    [filter removeAllTrips];
+    XCTAssertEqual(filter.nrOfTrips, 0);
+    XCTAssertTrue([filter acceptsTrip:otherTrip], @"");
+}
+
+- (void)testArchiveImport
+{
+    NSURL *archiveURL = [[NSBundle bundleForClass:[self class]] URLForResource:@"gtfs" withExtension:@"zip"];
+    NSError *error = nil;
+    ATLZipArchive *archive = [[ATLZipArchive alloc] initWithContentsOfURL:archiveURL error:&error];
+    XCTAssertNotNil(archive, @"%@", error);
+    XCTAssertEqual([archive.memberNames count], 4);
+    XCTAssertEqual([archive uncompressedSizeOfMember:@"stop_times.txt"], 2456);
+    
+    // Chunks that split lines give the same records as the mapped file
+    ATLCSVReader *mappedReader = [[ATLCSVReader alloc] initWithContentsOfCSVFile:[[NSBundle bundleForClass:[self class]]
+                                                                                  pathForResource:@"stop_times" ofType:@"txt"]];
+    [mappedReader parse];
+    NSData *stopTimes = [NSData dataWithContentsOfFile:[[NSBundle bundleForClass:[self class]] pathForResource:@"stop_times" ofType:@"txt"]];
+    ATLCSVReader *streamingReader = [[ATLCSVReader alloc] initForStreaming];
+    for (NSUInteger offset = 0; offset < [stopTimes length]; offset += 7) {
+        [streamingReader appendBytes:(const char *)[stopTimes bytes] + offset length:MIN(7, [stopTimes length] - offset)];
+    }
+    [streamingReader finishStreaming];
+    XCTAssertEqual(streamingReader.nrOfRecords, mappedReader.nrOfRecords);
+    XCTAssertEqual(streamingReader.totalBytesRead, mappedReader.totalBytesRead);
+    
+    [self.importer importContentsOfArchive:archiveURL intoManagedObjectContext:self.managedObjectContext
+                               withOptions:includeCalendarExceptions];
+    ATLMissionRule *trip1 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"10000|1|3047" create:NO];
+    XCTAssertEqualObjects(trip1.headsign, @"Nijmegen", @"");
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLTimePath class]] count], 2, @"");
+    XCTAssertEqual([trip1.timePath.timePoints count], 18, @"");
+}
+
+- (void)testFailedArchiveMember
+{
+    // Corrupt the checksum of stop_times.txt in the central directory, so the member fails its verification
+    NSURL *archiveURL = [[NSBundle bundleForClass:[self class]] URLForResource:@"gtfs" withExtension:@"zip"];
+    NSMutableData *corrupted = [NSMutableData dataWithContentsOfURL:archiveURL];
+    NSData *name = [@"stop_times.txt" dataUsingEncoding:NSUTF8StringEncoding];
+    NSRange nameRange = [corrupted rangeOfData:name options:NSDataSearchBackwards range:NSMakeRange(0, [corrupted length])];
+    XCTAssertNotEqual(nameRange.location, NSNotFound);
+    NSUInteger headerOffset = nameRange.location - [@"gtfs/" length] - 46;
+    uint8_t *crc = (uint8_t *)[corrupted mutableBytes] + headerOffset + 16;
+    crc[0] ^= 0xff;
+    NSURL *corruptedURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"corrupted_gtfs.zip"]];
+    XCTAssertTrue([corrupted writeToURL:corruptedURL atomically:YES]);
+
+    [self.importer importContentsOfArchive:corruptedURL intoManagedObjectContext:self.managedObjectContext
+                               withOptions:includeCalendarExceptions];
+    XCTAssertNil(self.importer.metrics.currentStep, @"a failed member must close its step");
+    XCTAssertEqual([self.importer.metrics.steps count], 4);
+    [[NSFileManager defaultManager] removeItemAtURL:corruptedURL error:NULL];
+
+    // None of the rows of the corrupt member were imported
+    ATLMissionRule *trip = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"10000|1|3047" create:NO];
+    XCTAssertNotNil(trip);
+    XCTAssertNil(trip.timePath);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLTimePath class]] count], 0);
+
+    // The abandoned step leaves no state behind for the next import
+    [self.importer importContentsOfArchive:archiveURL intoManagedObjectContext:self.managedObjectContext
+                               withOptions:includeCalendarExceptions];
+    ATLMissionRule *trip1 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"10000|1|3047" create:NO];
+    XCTAssertEqual([trip1.timePath.timePoints count], 18, @"");
+}
+
+/**
+ stop_times.txt with its rows in reverse order, so that the rows of every trip are out of sequence
+ */
+- (NSString *)shuffledStopTimes
+{
+    NSString *path = [[NSBundle bundleForClass:[self class]] pathForResource:@"stop_times" ofType:@"txt"];
+    NSString *original = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL];
+    NSMutableArray *lines = [[original componentsSeparatedByString:@"\n"] mutableCopy];
+    [lines removeLastObject];
+    NSString *header = lines[0];
+    [lines removeObjectAtIndex:0];
+    NSArray *reversedLines = [[lines reverseObjectEnumerator] allObjects];
+    return [NSString stringWithFormat:@"%@\n%@\n", header, [reversedLines componentsJoinedByString:@"\n"]];
+}
+
+- (void)testStopTimesSorter
+{
+    NSString *path = [[NSBundle bundleForClass:[self class]] pathForResource:@"stop_times" ofType:@"txt"];
+    NSString *original = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL];
+    NSString *shuffled = [self shuffledStopTimes];
+    NSURL *shuffledURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"shuffled_stop_times.txt"]];
+    [shuffled writeToURL:shuffledURL atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+    
+    XCTAssertTrue([[[ATLStopTimesSorter alloc] initWithContentsOfURL:[NSURL fileURLWithPath:path]] isSorted]);
+    NSURL *missingURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"missing_stop_times.txt"]];
+    XCTAssertFalse([[[ATLStopTimesSorter alloc] initWithContentsOfURL:missingURL] isSorted]);
+    ATLStopTimesSorter *sorter = [[ATLStopTimesSorter alloc] initWithContentsOfURL:shuffledURL];
+    XCTAssertFalse([sorter isSorted]);
+    sorter.maxRowsPerRun = 10;
+    NSMutableData *sorted = [NSMutableData data];
+    NSError *error = nil;
+    BOOL success = [sorter enumerateSortedChunksUsingBlock:^(const void *bytes, NSUInteger length, BOOL *stop) {
+        [sorted appendBytes:bytes length:length];
+    } error:&error];
+    XCTAssertTrue(success, @"%@", error);
+    XCTAssertEqual(sorter.nrOfRuns, 6);
+    XCTAssertEqualObjects([[NSString alloc] initWithData:sorted encoding:NSUTF8StringEncoding], original);
+    
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    self.importer.options = includeCalendarExceptions | sortStopTimes;
+    [self.importer importContentsOfURL:[bundle URLForResource:@"feed_info" withExtension:@"txt"] forStep:readInfo];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"calendar_dates" withExtension:@"txt"] forStep:readCalendar];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"trips" withExtension:@"txt"] forStep:readTrips];
+    [self.importer importContentsOfURL:shuffledURL forStep:readStopTimes];
+    [[NSFileManager defaultManager] removeItemAtURL:shuffledURL error:NULL];
+    ATLMissionRule *trip1 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"10000|1|3047" create:NO];
+    XCTAssertEqual([trip1.timePath.timePoints count], 18, @"");
+
+    // A file the sorter cannot read is not taken as sorted, its step is abandoned
+    NSString *unsortable = [shuffled stringByReplacingOccurrencesOfString:@"stop_sequence" withString:@"sequence"];
+    NSURL *unsortableURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"unsortable_stop_times.txt"]];
+    [unsortable writeToURL:unsortableURL atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+    [self.importer importContentsOfURL:unsortableURL forStep:readStopTimes];
+    [[NSFileManager defaultManager] removeItemAtURL:unsortableURL error:NULL];
+    XCTAssertNil(self.importer.metrics.currentStep);
+    XCTAssertEqual([self.importer.timePaths count], 0);
+}
+
+/**
+ Writes the members without compression, so that the archive can be built without zlib
+ */
+- (NSURL *)storedArchive:(NSString *)fileName withMembers:(NSDictionary *)members
+{
+    NSMutableData *archive = [NSMutableData data];
+    NSMutableData *directory = [NSMutableData data];
+    for (NSString *name in members) {
+        NSData *contents = members[name];
+        NSData *nameData = [name dataUsingEncoding:NSUTF8StringEncoding];
+        uint32_t crc = checksumOfData(contents);
+        uint32_t offset = (uint32_t)[archive length];
+        appendLittleEndian(archive, 0x04034b50, 4);
+        appendLittleEndian(archive, 20, 2);
+        appendLittleEndian(archive, 0, 2 + 2 + 2 + 2);
+        appendLittleEndian(archive, crc, 4);
+        appendLittleEndian(archive, (uint32_t)[contents length], 4);
+        appendLittleEndian(archive, (uint32_t)[contents length], 4);
+        appendLittleEndian(archive, (uint32_t)[nameData length], 2);
+        appendLittleEndian(archive, 0, 2);
+        [archive appendData:nameData];
+        [archive appendData:contents];
+
+        appendLittleEndian(directory, 0x02014b50, 4);
+        appendLittleEndian(directory, 20, 2);
+        appendLittleEndian(directory, 20, 2);
+        appendLittleEndian(directory, 0, 2 + 2 + 2 + 2);
+        appendLittleEndian(directory, crc, 4);
+        appendLittleEndian(directory, (uint32_t)[contents length], 4);
+        appendLittleEndian(directory, (uint32_t)[contents length], 4);
+        appendLittleEndian(directory, (uint32_t)[nameData length], 2);
+        appendLittleEndian(directory, 0, 2 + 2 + 2 + 2);
+        appendLittleEndian(directory, 0, 4);
+        appendLittleEndian(directory, offset, 4);
+        [directory appendData:nameData];
+    }
+    uint32_t directoryOffset = (uint32_t)[archive length];
+    [archive appendData:directory];
+    appendLittleEndian(archive, 0x06054b50, 4);
+    appendLittleEndian(archive, 0, 2 + 2);
+    appendLittleEndian(archive, (uint32_t)[members count], 2);
+    appendLittleEndian(archive, (uint32_t)[members count], 2);
+    appendLittleEndian(archive, (uint32_t)[directory length], 4);
+    appendLittleEndian(archive, directoryOffset, 4);
+    appendLittleEndian(archive, 0, 2);
+    NSURL *url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:fileName]];
+    [archive writeToURL:url atomically:YES];
+    return url;
+}
+
+- (void)testSortedArchiveMember
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    NSMutableDictionary *members = [NSMutableDictionary dictionary];
+    for (NSString *name in @[@"feed_info", @"calendar_dates", @"trips"]) {
+        members[[name stringByAppendingPathExtension:@"txt"]] = [NSData dataWithContentsOfURL:[bundle URLForResource:name withExtension:@"txt"]];
+    }
+    members[@"stop_times.txt"] = [[self shuffledStopTimes] dataUsingEncoding:NSUTF8StringEncoding];
+    NSURL *archiveURL = [self storedArchive:@"shuffled_gtfs.zip" withMembers:members];
+    NSError *error = nil;
+    ATLZipArchive *archive = [[ATLZipArchive alloc] initWithContentsOfURL:archiveURL error:&error];
+    XCTAssertTrue([archive verifyMember:@"stop_times.txt" error:&error], @"%@", error);
+
+    // The member is sorted like a file, without sorting the stop times of every trip would be read backwards
+    [self.importer importContentsOfArchive:archiveURL intoManagedObjectContext:self.managedObjectContext
+                               withOptions:includeCalendarExceptions | sortStopTimes];
+    [[NSFileManager defaultManager] removeItemAtURL:archiveURL error:NULL];
+    ATLMissionRule *trip1 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"10000|1|3047" create:NO];
+    XCTAssertEqual([trip1.timePath.timePoints count], 18, @"");
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLTimePath class]] count], 2, @"");
+}
+
+- (void)testStopWithoutPlatform
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    NSString *stopTimes = [NSString stringWithContentsOfURL:[bundle URLForResource:@"stop_times" withExtension:@"txt"]
+                                                   encoding:NSUTF8StringEncoding error:NULL];
+    stopTimes = [stopTimes stringByTrimmingCharactersInSet:[NSCharacterSet newlineCharacterSet]];
+    NSURL *stopTimesURL = [self temporaryFeedFile:@"platformless_stop_times.txt"
+                                        withLines:@[[stopTimes stringByReplacingOccurrencesOfString:@",hdr|3," withString:@",hdr,"]]];
+    self.importer.options = includeCalendarExceptions;
+    [self.importer importContentsOfURL:[bundle URLForResource:@"feed_info" withExtension:@"txt"] forStep:readInfo];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"calendar_dates" withExtension:@"txt"] forStep:readCalendar];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"trips" withExtension:@"txt"] forStep:readTrips];
+    [self.importer importContentsOfURL:stopTimesURL forStep:readStopTimes];
+    [[NSFileManager defaultManager] removeItemAtURL:stopTimesURL error:NULL];
+    ATLMissionRule *trip1 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"10000|1|3047" create:NO];
+    XCTAssertEqual([trip1.timePath.timePoints count], 18, @"");
+    XCTAssertEqualObjects([trip1.timePath.timePoints[0] stationCode], @"hdr", @"");
+}
+
+- (void)testFrequencies
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    self.importer.options = includeCalendarExceptions;
+    [self.importer importContentsOfURL:[bundle URLForResource:@"feed_info" withExtension:@"txt"] forStep:readInfo];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_calendar_dates" withExtension:@"txt"] forStep:readCalendar];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_trips" withExtension:@"txt"] forStep:readTrips];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_stop_times" withExtension:@"txt"] forStep:readStopTimes];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_frequencies" withExtension:@"txt"] forStep:readFrequencies];
+    
+    ATLMissionRule *rule = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3049" create:NO];
+    XCTAssertTrue(rule.isPeriodic);
+    XCTAssertEqual(rule.offset, 6 * 60);
+    XCTAssertEqual(rule.headway, 30);
+    XCTAssertEqual(rule.lastOffset, 9 * 60 + 30);
+    XCTAssertEqual(rule.nrOfInstances, 8);
+    ATLMissionRule *periodRule = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3049|1" create:NO];
+    XCTAssertEqual(periodRule.offset, 16 * 60);
+    XCTAssertEqual(periodRule.lastOffset, 17 * 60 + 45);
+    XCTAssertEqual(periodRule.timePath, rule.timePath);
+    XCTAssertFalse([[self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3047" create:NO] isPeriodic]);
+    
+    NSMutableArray *offsets = [NSMutableArray array];
+    [rule enumerateOffsetsFrom:7 * 60 + 10 to:8 * 60 usingBlock:^(int16_t offset) {
+        [offsets addObject:@(offset)];
+    }];
+    XCTAssertEqualObjects(offsets, (@[@(7 * 60 + 30), @(8 * 60)]));
+    XCTAssertEqual([self.importer.metrics.steps count], 5);
+}
+
+- (void)testAtlasImportFetches
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    ATLFileImporter *fileImporter = [ATLFileImporter new];
+    [fileImporter importContentsOfURL:[bundle URLForResource:@"t2_data" withExtension:@"xml"]
+             intoManagedObjectContext:self.managedObjectContext];
+    ATLImportStepMetrics *step = [fileImporter.metrics.steps lastObject];
+    XCTAssertEqual(step.nrOfFetches, 1);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLStation class]] count], 6);
+
+    // A second import finds all entries in the prefetched identifiers, and creates no duplicates
+    [fileImporter importContentsOfURL:[bundle URLForResource:@"t2_data" withExtension:@"xml"]
+             intoManagedObjectContext:self.managedObjectContext];
+    step = [fileImporter.metrics.steps lastObject];
+    XCTAssertEqual(step.nrOfFetches, 1);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLStation class]] count], 6);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLSeries class]] count], 2);
+
+    // Fetches are counted per context, those of another context do not show up in the metrics
+    NSUInteger nrOfFetches = self.managedObjectContext.numberOfFetchRequests;
+    NSManagedObjectContext *otherContext = [ATLDataController testingInstance].managedObjectContext;
+    [otherContext allObjectsOfClass:[ATLStation class]];
+    XCTAssertEqual(otherContext.numberOfFetchRequests, 1);
+    XCTAssertEqual(self.managedObjectContext.numberOfFetchRequests, nrOfFetches);
+}
+
+- (void)testParallelAtlasImport
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    ATLFileImporter *fileImporter = [ATLFileImporter new];
+    fileImporter.parallelImport = YES;
+    [fileImporter importContentsOfURL:[bundle URLForResource:@"t2_data" withExtension:@"xml"]
+             intoManagedObjectContext:self.managedObjectContext];
+    // Every chunk prefetches the identifiers it adds, the elements themselves need no fetch requests
+    ATLImportStepMetrics *step = [fileImporter.metrics.steps lastObject];
+    XCTAssertGreaterThanOrEqual(step.nrOfFetches, 1);
+    XCTAssertLessThanOrEqual(step.nrOfFetches, [[NSProcessInfo processInfo] activeProcessorCount] * 4);
+    XCTAssertLessThan(step.nrOfFetches, step.nrOfRows);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLJunction class]] count], 2);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLStation class]] count], 6);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLSeries class]] count], 2);
+
+    // References between entries in different chunks are resolved as in a serial import
+    ATLService *service = (ATLService*)[self.managedObjectContext objectOfClass:[ATLService class] withModelID:@"ic.j" create:NO];
+    XCTAssertEqual([service.servicePoints count], 8);
+    XCTAssertEqualObjects(service.firstStation.name, @"Utrecht Centraal");
+
+    // A second parallel import finds the entries of every chunk, and creates no duplicates
+    [fileImporter importContentsOfURL:[bundle URLForResource:@"t2_data" withExtension:@"xml"]
+             intoManagedObjectContext:self.managedObjectContext];
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLJunction class]] count], 2);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLStation class]] count], 6);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLSeries class]] count], 2);
+    XCTAssertEqual([service.servicePoints count], 8);
+}
+
+- (void)testParallelImportOfMalformedDocument
+{
+    // The last chunk fails to parse after the chunks before it were applied
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    NSURL *url = [bundle URLForResource:@"t2_data" withExtension:@"xml"];
+    NSMutableString *document = [NSMutableString stringWithContentsOfURL:url encoding:NSUTF8StringEncoding error:NULL];
+    [document replaceOccurrencesOfString:@"</testdata>"
+                              withString:@"    <series id=\"nl.032\"><serviceRefs></series></serviceRefs>\n</testdata>"
+                                 options:0 range:NSMakeRange(0, [document length])];
+    NSURL *malformedURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"t2_malformed.xml"]];
+    XCTAssertTrue([document writeToURL:malformedURL atomically:YES encoding:NSUTF8StringEncoding error:NULL]);
+
+    ATLDataController *serialController = [ATLDataController testingInstance];
+    serialController.testingDate = [NSDate date];
+    [[ATLFileImporter new] importContentsOfURL:url intoManagedObjectContext:serialController.managedObjectContext];
+
+    ATLFileImporter *fileImporter = [ATLFileImporter new];
+    fileImporter.parallelImport = YES;
+    [fileImporter importContentsOfURL:malformedURL intoManagedObjectContext:self.managedObjectContext];
+    [[NSFileManager defaultManager] removeItemAtURL:malformedURL error:NULL];
+
+    // The serial import that follows does not add the children of the applied chunks a second time
+    for (Class entryClass in @[[ATLStation class], [ATLService class], [ATLServicePoint class], [ATLSeriesRef class], [ATLServiceRef class]]) {
+        XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:entryClass] count],
+                       [[serialController.managedObjectContext allObjectsOfClass:entryClass] count], @"%@", entryClass);
+    }
+    ATLService *service = (ATLService*)[self.managedObjectContext objectOfClass:[ATLService class] withModelID:@"ic.j" create:NO];
+    XCTAssertEqual([service.servicePoints count], 8);
+}
+
+- (void)testTripIndex
+{
+    ATLTripIndex *index = [ATLTripIndex new];
+    for (NSString *tripID in @[@"t1", @"t2", @"10000|1|t3"]) {
+        ATLMissionRule *missionRule = (ATLMissionRule*)[self.managedObjectContext createManagedObjectOfType:@"ATLMissionRule"];
+        missionRule.id_ = tripID;
+        [index setReference:missionRule forTripID:tripID];
+    }
+    XCTAssertTrue([self.managedObjectContext save:NULL]);
+    for (NSString *tripID in index.allTripIDs) {
+        [index setReference:[[index referenceForTripID:tripID] objectID] forTripID:tripID];
+    }
+    NSURL *url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"t2_trips.atlt"]];
+    NSError *error = nil;
+    XCTAssertTrue([index writeToURL:url error:&error], @"%@", error);
+
+    // The spilled index resolves trips without fetching
+    NSPersistentStoreCoordinator *coordinator = self.managedObjectContext.persistentStoreCoordinator;
+    ATLTripIndex *spilledIndex = [ATLTripIndex indexWithContentsOfURL:url persistentStoreCoordinator:coordinator];
+    XCTAssertNotNil(spilledIndex);
+    XCTAssertEqual(spilledIndex.count, 3);
+    XCTAssertEqualObjects(spilledIndex.allTripIDs, index.allTripIDs);
+    NSUInteger nrOfFetches = self.managedObjectContext.numberOfFetchRequests;
+    for (NSString *tripID in index.allTripIDs) {
+        XCTAssertEqualObjects([spilledIndex referenceForTripID:tripID], [index referenceForTripID:tripID]);
+    }
+    XCTAssertNil([spilledIndex referenceForTripID:@"t4"]);
+    XCTAssertEqual(self.managedObjectContext.numberOfFetchRequests, nrOfFetches);
+
+    // A truncated file is refused
+    NSData *data = [NSData dataWithContentsOfURL:url];
+    [[data subdataWithRange:NSMakeRange(0, [data length] - 5)] writeToURL:url atomically:YES];
+    XCTAssertNil([ATLTripIndex indexWithContentsOfURL:url persistentStoreCoordinator:coordinator]);
+    [[NSFileManager defaultManager] removeItemAtURL:url error:NULL];
+
+    // Unsaved references and trip_ids that do not fit an entry are refused without writing
+    ATLTripIndex *invalidIndex = [ATLTripIndex new];
+    NSManagedObject *unsavedRule = [self.managedObjectContext createManagedObjectOfType:@"ATLMissionRule"];
+    [invalidIndex setReference:unsavedRule forTripID:@"t5"];
+    XCTAssertFalse([invalidIndex writeToURL:url error:&error]);
+    XCTAssertEqual(error.code, unsavedReferenceError);
+    [self.managedObjectContext deleteObject:unsavedRule];
+    invalidIndex = [ATLTripIndex new];
+    NSString *longTripID = [@"" stringByPaddingToLength:UINT16_MAX + 1 withString:@"t" startingAtIndex:0];
+    [invalidIndex setReference:[index referenceForTripID:@"t1"] forTripID:longTripID];
+    XCTAssertFalse([invalidIndex writeToURL:url error:&error]);
+    XCTAssertEqual(error.code, oversizedEntryError);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:url.path]);
+
+    // An import through a spilled index gives the same results as one with the index in memory
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    self.importer.tripIndexURL = url;
+    [self.importer importContentsOfURL:[bundle URLForResource:@"feed_info" withExtension:@"txt"] forStep:readInfo];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_calendar_dates" withExtension:@"txt"] forStep:readCalendar];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_trips" withExtension:@"txt"] forStep:readTrips];
+    XCTAssertNotNil([ATLTripIndex indexWithContentsOfURL:url persistentStoreCoordinator:coordinator]);
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_stop_times" withExtension:@"txt"] forStep:readStopTimes];
+    XCTAssertEqual([self.importer.timePaths count], 5);
+    ATLMissionRule *mission3051 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3051" create:NO];
+    XCTAssertEqualObjects(mission3051.offsetString, @"13:00");
+    [[NSFileManager defaultManager] removeItemAtURL:url error:NULL];
+}
+
+- (void)testFeedCalendar
+{
+    // 1 march 2014 was a saturday
+    ATLFeedCalendar *calendar = [[ATLFeedCalendar alloc] initWithStartIdentifier:@"20140301" endIdentifier:@"20140331"];
+    XCTAssertEqual(calendar.nrOfDays, 31);
+    XCTAssertEqual(calendar.nrOfWeeks, 4);
+    XCTAssertEqual(calendar.nrOfWords, 1);
+    XCTAssertEqual([calendar weekdayForDay:0], 5);
+    XCTAssertEqual([calendar dayForIdentifier:@"20140301"], 0);
+    XCTAssertEqual([calendar dayForIdentifier:@"20140331"], 30);
+    XCTAssertEqual([calendar dayForIdentifier:@"20140228"], INVALID_DAY);
+    XCTAssertEqual([calendar dayForIdentifier:@"20140401"], INVALID_DAY);
+    XCTAssertEqual([calendar dayForIdentifier:@"2014031"], INVALID_DAY);
+
+    // Weekday masks
+    XCTAssertEqual([calendar daysOnWeekday:5][0], (ATLDayWord)(1 | 1 << 7 | 1 << 14 | 1 << 21 | 1 << 28));
+    XCTAssertEqual(numberOfDays([calendar daysOnWeekday:0], calendar.nrOfWords), 5);
+    XCTAssertEqual(numberOfDays([calendar daysOnWeekday:1], calendar.nrOfWords), 4);
+    NSUInteger total = 0;
+    for (int weekday = 0; weekday < 7; weekday++) {
+        total += numberOfDays([calendar daysOnWeekday:weekday], calendar.nrOfWords);
+    }
+    XCTAssertEqual(total, 31);
+
+    // Date ranges that span several words
+    ATLFeedCalendar *year = [[ATLFeedCalendar alloc] initWithStartIdentifier:@"20140101" endIdentifier:@"20141231"];
+    XCTAssertEqual(year.nrOfDays, 365);
+    XCTAssertEqual(year.nrOfWords, 6);
+    XCTAssertEqual([year dayForIdentifier:@"20141231"], 364);
+    ATLDayWord days[6] = {0};
+    addDay(days, 63);
+    addDay(days, 64);
+    addDay(days, 364);
+    XCTAssertEqual(numberOfDays(days, year.nrOfWords), 3);
+    NSSet *dates = [year datesForDays:days];
+    XCTAssertEqual([dates count], 3);
+    XCTAssertTrue([dates containsObject:[year dateForDay:64]]);
+    XCTAssertEqualObjects([year dateForDay:364], year.endDate);
+    XCTAssertNil([year dateForDay:365]);
+
+    // Monday to friday, except tuesday 11 march and with the extra saturday 8 march
+    ATLDayWord running = 0;
+    for (int weekday = 0; weekday < 5; weekday++) {
+        running |= [calendar daysOnWeekday:weekday][0];
+    }
+    ATLCalendarRule *regularRule = [[ATLCalendarRule alloc] initWithCalendar:calendar runningDays:&running];
+    XCTAssertEqual(regularRule.weekdays, 0x1f);
+    XCTAssertEqual([regularRule.runningDates count], 0);
+    XCTAssertEqual([regularRule.notRunningDates count], 0);
+    running &= ~((ATLDayWord)1 << 10);
+    addDay(&running, 7);
+    ATLCalendarRule *rule = [[ATLCalendarRule alloc] initWithCalendar:calendar runningDays:&running];
+    XCTAssertEqual(rule.weekdays, 0x1f);
+    XCTAssertEqualObjects(rule.runningDates, [NSSet setWithObject:[calendar dateForDay:7]]);
+    XCTAssertEqualObjects(rule.notRunningDates, [NSSet setWithObject:[calendar dateForDay:10]]);
+    XCTAssertNotEqual(rule.fingerprint, regularRule.fingerprint);
+    XCTAssertEqual(rule.fingerprint, [[ATLCalendarRule alloc] initWithCalendar:calendar runningDays:&running].fingerprint);
+}
+
 - (void)testMissionAggregation
 {
     NSBundle *bundle = [NSBundle bundleForClass:[self class]];
@@ -193,4 +859,210 @@
     XCTAssertEqual([rule3147zo.noStopPoints count], 2);
 }
 
+- (void)testParallelStopTimes
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    self.importer.options = parallelStopTimes;
+    [self.importer importContentsOfURL:[bundle URLForResource:@"feed_info" withExtension:@"txt"] forStep:readInfo];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_calendar_dates" withExtension:@"txt"] forStep:readCalendar];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_trips" withExtension:@"txt"] forStep:readTrips];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_stop_times" withExtension:@"txt"] forStep:readStopTimes];
+    XCTAssertEqual([self.importer.timePaths count], 5);
+    
+    // Results must be identical to the serial import in testMissionAggregation
+    ATLMissionRule *mission3047 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3047" create:NO];
+    XCTAssertEqualObjects(mission3047.offsetString, @"12:00");
+    ATLMissionRule *mission3049 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3049" create:NO];
+    XCTAssertEqualObjects(mission3049.offsetString, @"13:30");
+    XCTAssertNotEqual(mission3047.timePath, mission3049.timePath);
+    ATLMissionRule *mission3051 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3051" create:NO];
+    XCTAssertEqualObjects(mission3051.offsetString, @"13:00");
+    XCTAssertEqual(mission3047.timePath, mission3051.timePath);
+}
+
+- (void)testBatchedImport
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    self.importer.batchSize = 2;
+    [self.importer importContentsOfURL:[bundle URLForResource:@"feed_info" withExtension:@"txt"] forStep:readInfo];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_calendar_dates" withExtension:@"txt"] forStep:readCalendar];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_trips" withExtension:@"txt"] forStep:readTrips];
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLMissionRule class]] count], 6);
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_stop_times" withExtension:@"txt"] forStep:readStopTimes];
+    XCTAssertEqual([self.importer.timePaths count], 5);
+    XCTAssertFalse([self.managedObjectContext hasChanges]);
+    
+    ATLMissionRule *mission3047 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3047" create:NO];
+    ATLMissionRule *mission3051 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3051" create:NO];
+    XCTAssertEqualObjects(mission3051.offsetString, @"13:00");
+    XCTAssertEqual(mission3047.timePath, mission3051.timePath);
+}
+
+- (void)importIncrementalFeedWithTrips:(NSURL *)tripsURL stopTimes:(NSURL *)stopTimesURL frequencies:(NSURL *)frequenciesURL
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"feed_info" withExtension:@"txt"] forStep:readInfo];
+    [self.importer importContentsOfURL:[bundle URLForResource:@"t2_calendar_dates" withExtension:@"txt"] forStep:readCalendar];
+    [self.importer importContentsOfURL:tripsURL forStep:readTrips];
+    [self.importer importContentsOfURL:stopTimesURL forStep:readStopTimes];
+    [self.importer importContentsOfURL:frequenciesURL forStep:readFrequencies];
+}
+
+- (NSURL *)temporaryFeedFile:(NSString *)fileName withLines:(NSArray *)lines
+{
+    NSURL *url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:fileName]];
+    NSString *contents = [[lines componentsJoinedByString:@"\n"] stringByAppendingString:@"\n"];
+    [contents writeToURL:url atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+    return url;
+}
+
+- (void)testIncrementalImport
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    NSURL *tripsURL = [bundle URLForResource:@"t2_trips" withExtension:@"txt"];
+    NSURL *stopTimesURL = [bundle URLForResource:@"t2_stop_times" withExtension:@"txt"];
+    NSURL *fingerprintsURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"t2_fingerprints.plist"]];
+    [[NSFileManager defaultManager] removeItemAtURL:fingerprintsURL error:NULL];
+    self.importer.options = incrementalImport;
+    self.importer.fingerprintsURL = fingerprintsURL;
+    for (int run = 0; run < 2; run++) {
+        [self importIncrementalFeedWithTrips:tripsURL stopTimes:stopTimesURL frequencies:nil];
+    }
+    XCTAssertEqual([self.importer.lastImportChanges.insertedTripIDs count], 0);
+    XCTAssertEqual([self.importer.lastImportChanges.deletedTripIDs count], 0);
+    XCTAssertEqual(self.importer.lastImportChanges.nrOfUnchangedTrips, 6);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLMissionRule class]] count], 6);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLTimePath class]] count], 5);
+    ATLMissionRule *mission3047 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3047" create:NO];
+
+    // Trips 3047 and 3051 get another headsign, 3049 is removed and 3053 is added with the stop times of 3051
+    NSString *trips = [NSString stringWithContentsOfURL:tripsURL encoding:NSUTF8StringEncoding error:NULL];
+    NSMutableArray *tripLines = [NSMutableArray array];
+    for (NSString *line in [trips componentsSeparatedByString:@"\n"]) {
+        if ([line hasPrefix:@"100-IC,NS:0,3047,"]) {
+            [tripLines addObject:[line stringByReplacingOccurrencesOfString:@"Nijmegen" withString:@"Arnhem"]];
+        } else if ([line hasPrefix:@"100-IC,NS:0,3051,"]) {
+            [tripLines addObject:[line stringByReplacingOccurrencesOfString:@"Nijmegen" withString:@"Arnhem"]];
+            [tripLines addObject:[line stringByReplacingOccurrencesOfString:@"3051" withString:@"3053"]];
+        } else if ([line length] > 0 && ![line hasPrefix:@"100-IC,NS:0,3049,"]) {
+            [tripLines addObject:line];
+        }
+    }
+    NSString *stopTimes = [NSString stringWithContentsOfURL:stopTimesURL encoding:NSUTF8StringEncoding error:NULL];
+    NSMutableArray *stopTimesLines = [NSMutableArray array];
+    NSMutableArray *addedLines = [NSMutableArray array];
+    for (NSString *line in [stopTimes componentsSeparatedByString:@"\n"]) {
+        if ([line length] > 0) {
+            [stopTimesLines addObject:line];
+        }
+        if ([line hasPrefix:@"3051,"]) {
+            [addedLines addObject:[@"3053" stringByAppendingString:[line substringFromIndex:4]]];
+        }
+    }
+    [stopTimesLines addObjectsFromArray:addedLines];
+    NSURL *changedTripsURL = [self temporaryFeedFile:@"t2_changed_trips.txt" withLines:tripLines];
+    NSURL *changedStopTimesURL = [self temporaryFeedFile:@"t2_changed_stop_times.txt" withLines:stopTimesLines];
+    [self importIncrementalFeedWithTrips:changedTripsURL stopTimes:changedStopTimesURL frequencies:nil];
+    ATLScheduleImportChanges *changes = self.importer.lastImportChanges;
+    XCTAssertEqualObjects(changes.updatedTripIDs, ([NSSet setWithObjects:@"3047", @"3051", nil]));
+    XCTAssertEqualObjects(changes.deletedTripIDs, [NSSet setWithObject:@"3049"]);
+    XCTAssertEqualObjects(changes.insertedTripIDs, [NSSet setWithObject:@"3053"]);
+    XCTAssertEqual(changes.nrOfUnchangedTrips, 3);
+    XCTAssertEqual([self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3047" create:NO], mission3047);
+    // The time paths, the rules of both changed trips and the deleted trips are fetched once each
+    ATLImportStepMetrics *stopTimesStep = nil;
+    for (ATLImportStepMetrics *step in self.importer.metrics.steps) {
+        if ([step.name isEqualToString:@"t2_changed_stop_times.txt"]) {
+            stopTimesStep = step;
+        }
+    }
+    XCTAssertEqual(stopTimesStep.nrOfFetches, 3);
+    XCTAssertEqualObjects([self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3051" create:NO].headsign, @"Arnhem");
+    XCTAssertNil([self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3049" create:NO]);
+    ATLMissionRule *mission3053 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3053" create:NO];
+    XCTAssertEqual(mission3053.timePath, mission3047.timePath);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLMissionRule class]] count], 6);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLTimePath class]] count], 4);
+
+    // Without fingerprints the stored rules are matched on trip_id instead of being replaced
+    [[NSFileManager defaultManager] removeItemAtURL:fingerprintsURL error:NULL];
+    [self importIncrementalFeedWithTrips:tripsURL stopTimes:stopTimesURL frequencies:nil];
+    changes = self.importer.lastImportChanges;
+    XCTAssertEqual([changes.updatedTripIDs count], 5);
+    XCTAssertEqualObjects(changes.insertedTripIDs, [NSSet setWithObject:@"3049"]);
+    XCTAssertEqualObjects(changes.deletedTripIDs, [NSSet setWithObject:@"3053"]);
+    XCTAssertEqual([self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3047" create:NO], mission3047);
+    XCTAssertFalse(mission3047.isDeleted);
+    XCTAssertEqualObjects([self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3051" create:NO].headsign, @"Nijmegen");
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLMissionRule class]] count], 6);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLTimePath class]] count], 5);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:fingerprintsURL.path]);
+
+    [[NSFileManager defaultManager] removeItemAtURL:changedTripsURL error:NULL];
+    [[NSFileManager defaultManager] removeItemAtURL:changedStopTimesURL error:NULL];
+    [[NSFileManager defaultManager] removeItemAtURL:fingerprintsURL error:NULL];
+}
+
+- (void)testIncrementalFrequencies
+{
+    NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+    NSURL *tripsURL = [bundle URLForResource:@"t2_trips" withExtension:@"txt"];
+    NSURL *stopTimesURL = [bundle URLForResource:@"t2_stop_times" withExtension:@"txt"];
+    NSURL *frequenciesURL = [bundle URLForResource:@"t2_frequencies" withExtension:@"txt"];
+    NSURL *fingerprintsURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"t2_fingerprints.plist"]];
+    [[NSFileManager defaultManager] removeItemAtURL:fingerprintsURL error:NULL];
+    self.importer.options = incrementalImport;
+    self.importer.fingerprintsURL = fingerprintsURL;
+    [self importIncrementalFeedWithTrips:tripsURL stopTimes:stopTimesURL frequencies:frequenciesURL];
+    ATLMissionRule *periodRule = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3049|1" create:NO];
+    XCTAssertEqual(periodRule.offset, 16 * 60);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLMissionRule class]] count], 7);
+
+    // Unchanged periods leave their rules alone
+    [self importIncrementalFeedWithTrips:tripsURL stopTimes:stopTimesURL frequencies:frequenciesURL];
+    XCTAssertEqual([self.importer.lastImportChanges.updatedTripIDs count], 0);
+    XCTAssertEqual(self.importer.lastImportChanges.nrOfUnchangedTrips, 6);
+    XCTAssertEqual([self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3049|1" create:NO], periodRule);
+
+    // A removed period deletes its rule
+    NSString *frequencies = [NSString stringWithContentsOfURL:frequenciesURL encoding:NSUTF8StringEncoding error:NULL];
+    NSArray *frequencyLines = [frequencies componentsSeparatedByString:@"\n"];
+    NSURL *changedFrequenciesURL = [self temporaryFeedFile:@"t2_changed_frequencies.txt"
+                                                 withLines:[frequencyLines subarrayWithRange:NSMakeRange(0, 2)]];
+    [self importIncrementalFeedWithTrips:tripsURL stopTimes:stopTimesURL frequencies:changedFrequenciesURL];
+    XCTAssertEqualObjects(self.importer.lastImportChanges.updatedTripIDs, [NSSet setWithObject:@"3049"]);
+    XCTAssertEqual(self.importer.lastImportChanges.nrOfUnchangedTrips, 5);
+    XCTAssertNil([self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3049|1" create:NO]);
+    ATLMissionRule *mission3049 = [self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3049" create:NO];
+    XCTAssertEqual(mission3049.headway, 30);
+    XCTAssertEqual(mission3049.lastOffset, 9 * 60 + 30);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLMissionRule class]] count], 6);
+
+    // Without frequencies the trip gets back the offset of its stop times
+    [self importIncrementalFeedWithTrips:tripsURL stopTimes:stopTimesURL frequencies:nil];
+    XCTAssertEqualObjects(self.importer.lastImportChanges.updatedTripIDs, [NSSet setWithObject:@"3049"]);
+    XCTAssertFalse(mission3049.isPeriodic);
+    XCTAssertEqual(mission3049.offset, 13 * 60 + 30);
+
+    // The periods of a deleted trip are deleted with it
+    [self importIncrementalFeedWithTrips:tripsURL stopTimes:stopTimesURL frequencies:frequenciesURL];
+    XCTAssertNotNil([self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3049|1" create:NO]);
+    NSString *trips = [NSString stringWithContentsOfURL:tripsURL encoding:NSUTF8StringEncoding error:NULL];
+    NSMutableArray *tripLines = [NSMutableArray array];
+    for (NSString *line in [trips componentsSeparatedByString:@"\n"]) {
+        if ([line length] > 0 && ![line hasPrefix:@"100-IC,NS:0,3049,"]) {
+            [tripLines addObject:line];
+        }
+    }
+    NSURL *changedTripsURL = [self temporaryFeedFile:@"t2_changed_trips.txt" withLines:tripLines];
+    [self importIncrementalFeedWithTrips:changedTripsURL stopTimes:stopTimesURL frequencies:frequenciesURL];
+    XCTAssertEqualObjects(self.importer.lastImportChanges.deletedTripIDs, [NSSet setWithObject:@"3049"]);
+    XCTAssertNil([self.managedObjectContext objectOfClass:[ATLMissionRule class] withModelID:@"3049|1" create:NO]);
+    XCTAssertEqual([[self.managedObjectContext allObjectsOfClass:[ATLMissionRule class]] count], 5);
+
+    [[NSFileManager defaultManager] removeItemAtURL:changedFrequenciesURL error:NULL];
+    [[NSFileManager defaultManager] removeItemAtURL:changedTripsURL error:NULL];
+    [[NSFileManager defaultManager] removeItemAtURL:fingerprintsURL error:NULL];
+}
+
 @end
@@ -36,10 +36,54 @@
 #import "ATLPathNode.h"
 #import "ATLAlias.h"
 #import "ATLJourney.h"
+#import "ATLBoundsTree.h"
+#import "ATLStationIndex.h"
+#import "ATLNode.h"
 
 #import "NSDate+Formatters.h"
 #import "NSManagedObjectContext+FFEUtilities.h"
 
+/**
+ Projection of one coordinate by walking the segments and then the curves of the heartline,
+ as the route did before the batch kernels, kept as an independent reference for them.
+ */
+static RoutePosition scalarProjection(ATLRoute *route, CLLocationCoordinate2D coordinate, double range)
+{
+    NSUInteger count = route.nrOfNodes;
+    for (NSUInteger index = 0; index + 1 < count; index++) {
+        ATLNode *node = [route nodeAtIndex:index];
+        CLLocationCoordinate2D b = [route coordinateBAtIndex:index];
+        PolarSize linePolar = [node polarSizeBetween:b and:[route coordinateAAtIndex:index + 1]];
+        PolarSize hitPolar = [node polarSizeBetween:b and:coordinate];
+        if (hitPolar.length < linePolar.length) {
+            hitPolar.angle -= linePolar.angle;
+            CGSize delta = cartesianSizeFromPolar(hitPolar);
+            if (delta.height > -range && delta.height < range && delta.width > 0) {
+                return routePositionMake(node.km_b + (delta.width / 1000), delta.height);
+            }
+        }
+    }
+    for (NSUInteger index = 1; index + 1 < count; index++) {
+        ATLNode *node = [route nodeAtIndex:index];
+        double radius = node.radius;
+        if (radius > 0) {
+            PolarSize hitPolar = [node polarSizeBetween:[route coordinateCAtIndex:index] and:coordinate];
+            if (hitPolar.length > radius - range && hitPolar.length < radius + range) {
+                PolarSize linePolar = [node polarSizeBetween:[route coordinateBAtIndex:index - 1] and:[route coordinateAAtIndex:index]];
+                double curveAngle = rangeMinusPiPlusPi(M_PI + [route polarSizeBetweenIndex:index andIndex:index + 1].angle
+                                                       - [route polarSizeBetweenIndex:index andIndex:index - 1].angle);
+                double capAngle = rangeMinusPiPlusPi(linePolar.angle - capInCurveDirection(curveAngle));
+                double angleDif = rangeMinusPiPlusPi(hitPolar.angle - capAngle);
+                if ((curveAngle > 0 && angleDif > 0 && angleDif < curveAngle) ||
+                    (curveAngle < 0 && angleDif < 0 && angleDif > curveAngle)) {
+                    return routePositionMake(node.km_a + (fabs(angleDif) * radius / 1000), hitPolar.length - radius);
+                }
+            }
+        }
+    }
+    return INVALID_POSITION;
+}
+
 @interface ATLModelTests : XCTestCase
 
 @property (strong) ATLDataController *dataController;
@@ -74,6 +118,192 @@
     XCTAssertEqual(bounds.maxLon, 4.0);
 }
 
+- (void)testRouteGeometry
+{
+    ATLRoute *route = (ATLRoute*)[self.dataController.managedObjectContext createManagedObjectOfType:@"ATLRoute"];
+    route.heartLine = @[[[ATLNode alloc] initWithLatitude:52.00 longitude:5.00 radius:0 km_a:0 km_b:0],
+                        [[ATLNode alloc] initWithLatitude:52.01 longitude:5.00 radius:500 km_a:0 km_b:0],
+                        [[ATLNode alloc] initWithLatitude:52.01 longitude:5.02 radius:0 km_a:0 km_b:0]];
+    [route updateRoutePositioning];
+    XCTAssertEqual([route coordinateBAtIndex:0].latitude, 52.00);
+    XCTAssertEqualWithAccuracy([route lengthOfCurveAtIndex:1], 500 * M_PI_2, 1);
+    XCTAssertEqualWithAccuracy(route.end_km - [route nodeAtIndex:1].km_b, [route lengthOfSegmentAtIndex:2] / 1000, 0.001);
+
+    ATLGeoReference start = [route geoReferenceForPosition:0.001];
+    XCTAssertEqualWithAccuracy(start.coordinate.latitude, 52.00, 0.0001);
+    XCTAssertEqualWithAccuracy(start.coordinate.longitude, 5.00, 0.0001);
+
+    // A sweep along the route gives the same references as separate lookups
+    double positions[] = {0.0, 0.5, route.end_km - 0.5, route.end_km + 1};
+    ATLGeoReference references[4];
+    [route getGeoReferences:references forPositions:positions count:4];
+    for (NSUInteger i = 0; i < 4; i++) {
+        ATLGeoReference reference = [route geoReferenceForPosition:positions[i]];
+        XCTAssertEqual(references[i].coordinate.latitude, reference.coordinate.latitude);
+        XCTAssertEqual(references[i].coordinate.longitude, reference.coordinate.longitude);
+        XCTAssertEqual(references[i].heading, reference.heading);
+    }
+
+    // Projecting coordinates in a batch gives the positions of the scalar projection
+    CLLocationCoordinate2D center = [route coordinateCAtIndex:1];
+    CLLocationCoordinate2D coordinates[5] = {
+        CLLocationCoordinate2DMake(52.005, 5.0001),
+        CLLocationCoordinate2DMake(center.latitude + 500 * M_SQRT1_2 / VER_SCALE,
+                                   center.longitude - 500 * M_SQRT1_2 / horScaleForLatitude(center.latitude)),
+        CLLocationCoordinate2DMake(52.01, 5.01),
+        CLLocationCoordinate2DMake(52.5, 5.5),
+        CLLocationCoordinate2DMake(52.002, 5.0)};
+    RoutePosition projections[5];
+    [route getProjections:projections ofCoordinates:coordinates count:5 withAccuracy:100];
+    XCTAssertEqualWithAccuracy(projections[0].km, 0.005 * VER_SCALE / 1000, 0.001);
+    XCTAssertEqualWithAccuracy(projections[0].transversal, -0.0001 * horScaleForLatitude(52.0), 0.1);
+    XCTAssertEqualWithAccuracy(projections[1].km, [route nodeAtIndex:1].km_a + 0.5 * M_PI_4, 0.001);
+    XCTAssertEqualWithAccuracy(projections[1].transversal, 0, 0.1);
+    XCTAssertEqualWithAccuracy(projections[2].km, [route nodeAtIndex:1].km_b + (0.01 * horScaleForLatitude(52.01) - 500) / 1000, 0.001);
+    XCTAssertEqualWithAccuracy(projections[2].transversal, 0, 0.1);
+    XCTAssertFalse(validPosition(projections[3]));
+    XCTAssertEqualWithAccuracy(projections[4].km, 0.002 * VER_SCALE / 1000, 0.001);
+    XCTAssertEqualWithAccuracy(projections[4].transversal, 0, 0.1);
+    for (NSUInteger i = 0; i < 5; i++) {
+        RoutePosition reference = scalarProjection(route, coordinates[i], 100);
+        XCTAssertEqual(validPosition(projections[i]), validPosition(reference));
+        if (validPosition(reference)) {
+            XCTAssertEqualWithAccuracy(projections[i].km, reference.km, 0.000001);
+            XCTAssertEqualWithAccuracy(projections[i].transversal, reference.transversal, 0.001);
+        }
+        RoutePosition projection = [route projectionOfCoordinate:coordinates[i] withAccuracy:100];
+        XCTAssertEqual(projections[i].km, projection.km);
+    }
+
+    // Replacing the heartline discards the cached geometry
+    CLLocationCoordinate2D curveStart = [route coordinateAAtIndex:1];
+    route.heartLine = @[[[ATLNode alloc] initWithLatitude:52.00 longitude:5.00 radius:0 km_a:0 km_b:0],
+                        [[ATLNode alloc] initWithLatitude:52.02 longitude:5.00 radius:500 km_a:0 km_b:0],
+                        [[ATLNode alloc] initWithLatitude:52.02 longitude:5.02 radius:0 km_a:0 km_b:0]];
+    XCTAssertGreaterThan([route coordinateAAtIndex:1].latitude, curveStart.latitude);
+
+    // An index outside the heartline gives a zeroed geometry
+    XCTAssertEqual([route coordinateAAtIndex:3].latitude, 0);
+    XCTAssertEqual([route coordinateCAtIndex:NSNotFound].longitude, 0);
+    XCTAssertEqual([route angleAtIndex:-1], 0);
+}
+
+- (void)testBoundsTree
+{
+    ATLBounds bounds[1000];
+    srand48(1026);
+    for (NSUInteger i = 0; i < 1000; i++) {
+        double lon = 3.0 + 4.0 * drand48(), lat = 50.5 + 3.0 * drand48();
+        bounds[i] = (ATLBounds){lon, lat, lon + 0.2 * drand48(), lat + 0.2 * drand48()};
+    }
+    ATLBoundsTree *tree = [[ATLBoundsTree alloc] initWithBounds:bounds count:1000];
+    for (NSUInteger query = 0; query < 50; query++) {
+        double lon = 3.0 + 4.0 * drand48(), lat = 50.5 + 3.0 * drand48();
+        ATLBounds searchBounds = {lon, lat, lon + 0.1, lat + 0.1};
+        NSMutableIndexSet *expected = [NSMutableIndexSet indexSet];
+        for (NSUInteger i = 0; i < 1000; i++) {
+            if (bounds[i].minLon < searchBounds.maxLon && bounds[i].maxLon > searchBounds.minLon &&
+                bounds[i].minLat < searchBounds.maxLat && bounds[i].maxLat > searchBounds.minLat) {
+                [expected addIndex:i];
+            }
+        }
+        NSMutableIndexSet *found = [NSMutableIndexSet indexSet];
+        [tree addItemsIntersectingBounds:searchBounds toIndexSet:found];
+        XCTAssertEqualObjects(found, expected);
+    }
+}
+
+- (void)testRoutesAtCoordinate
+{
+    NSManagedObjectContext *context = self.dataController.managedObjectContext;
+    ATLRoute *route = (ATLRoute*)[context createManagedObjectOfType:@"ATLRoute"];
+    ATLSubRoute *subroute = (ATLSubRoute*)[context createManagedObjectOfType:@"ATLSubRoute"];
+    subroute.route = route;
+    subroute.minLat = 52.08;
+    subroute.maxLat = 52.10;
+    subroute.minLon = 5.10;
+    subroute.maxLon = 5.12;
+    XCTAssertEqualObjects([self.dataController routesAtCoordinate:CLLocationCoordinate2DMake(52.09, 5.11)], [NSSet setWithObject:route]);
+    XCTAssertEqual([[self.dataController routesAtCoordinate:CLLocationCoordinate2DMake(52.37, 4.90)] count], 0);
+
+    // Moving a subroute is picked up by the spatial index
+    subroute.minLat = 52.36;
+    subroute.maxLat = 52.38;
+    subroute.minLon = 4.89;
+    subroute.maxLon = 4.91;
+    XCTAssertEqual([[self.dataController routesAtCoordinate:CLLocationCoordinate2DMake(52.09, 5.11)] count], 0);
+    XCTAssertEqualObjects([self.dataController routesAtCoordinate:CLLocationCoordinate2DMake(52.37, 4.90)], [NSSet setWithObject:route]);
+}
+
+- (void)testStationIndex
+{
+    NSManagedObjectContext *context = self.dataController.managedObjectContext;
+    ATLRoute *route = (ATLRoute*)[context createManagedObjectOfType:@"ATLRoute"];
+    NSMutableArray *stations = [NSMutableArray arrayWithCapacity:300];
+    srand48(25);
+    for (int i = 0; i < 300; i++) {
+        ATLStation *station = (ATLStation*)[context createManagedObjectOfType:@"ATLStation"];
+        station.id_ = [NSString stringWithFormat:@"nl.s%d", i];
+        ATLRoutePosition *position = (ATLRoutePosition*)[context createManagedObjectOfType:@"ATLRoutePosition"];
+        position.route = route;
+        position.location = station;
+        position.coordinate = CLLocationCoordinate2DMake(51.5 + drand48() * 1.5, 4.0 + drand48() * 2.5);
+        [stations addObject:station];
+    }
+    // A station without positions has no coordinate and is not indexed
+    ATLStation *unplaced = (ATLStation*)[context createManagedObjectOfType:@"ATLStation"];
+    ATLStationIndex *index = [[ATLStationIndex alloc] initWithStations:[stations arrayByAddingObject:unplaced]];
+    XCTAssertEqual(index.count, (NSUInteger)300);
+
+    CLLocationCoordinate2D coordinates[50];
+    for (int i = 0; i < 50; i++) {
+        coordinates[i] = CLLocationCoordinate2DMake(51.3 + drand48() * 2.0, 3.8 + drand48() * 3.0);
+        CLLocationCoordinate2D coordinate = coordinates[i];
+        double horScale = horScaleForLatitude(coordinate.latitude);
+        NSArray *sorted = [stations sortedArrayUsingComparator:^NSComparisonResult(ATLStation *s1, ATLStation *s2) {
+            double d1 = hypot((s1.coordinate.longitude - coordinate.longitude) * horScale, (s1.coordinate.latitude - coordinate.latitude) * VER_SCALE);
+            double d2 = hypot((s2.coordinate.longitude - coordinate.longitude) * horScale, (s2.coordinate.latitude - coordinate.latitude) * VER_SCALE);
+            return d1 < d2 ? NSOrderedAscending : (d1 > d2 ? NSOrderedDescending : NSOrderedSame);
+        }];
+        NSMutableSet *inRange = [NSMutableSet set];
+        for (ATLStation *station in stations) {
+            double distance = hypot((station.coordinate.longitude - coordinate.longitude) * horScale,
+                                    (station.coordinate.latitude - coordinate.latitude) * VER_SCALE);
+            if (distance <= 8000) {
+                [inRange addObject:station];
+            }
+        }
+        XCTAssertEqualObjects([NSSet setWithArray:[index stationsWithinRange:8000 ofCoordinate:coordinate]], inRange);
+        XCTAssertEqualObjects([index nearestStations:5 toCoordinate:coordinate withinRange:1E9], [sorted subarrayWithRange:NSMakeRange(0, 5)]);
+    }
+
+    NSUInteger indexes[50];
+    double distances[50];
+    [index getNearestStationIndexes:indexes distances:distances forCoordinates:coordinates count:50 withinRange:5000];
+    for (int i = 0; i < 50; i++) {
+        NSArray *nearest = [index nearestStations:1 toCoordinate:coordinates[i] withinRange:5000];
+        if ([nearest count] == 0) {
+            XCTAssertEqual(indexes[i], (NSUInteger)NSNotFound);
+        } else {
+            XCTAssertEqual([index stationAtIndex:indexes[i]], nearest[0]);
+            XCTAssertTrue(distances[i] <= 5000);
+        }
+    }
+    XCTAssertEqual([self.dataController stationClosestToCoordinate:coordinates[0]], [[index nearestStations:1 toCoordinate:coordinates[0] withinRange:5000] firstObject]);
+
+    // The rebuilt index follows positions that moved or were added after the coordinate was read
+    ATLStation *moved = stations[0];
+    XCTAssertTrue(CLLocationCoordinate2DIsValid(moved.coordinate));
+    [[moved.routePositions anyObject] setCoordinate:CLLocationCoordinate2DMake(53.5, 7.5)];
+    XCTAssertFalse(CLLocationCoordinate2DIsValid(unplaced.coordinate));
+    ATLRoutePosition *position = (ATLRoutePosition*)[context createManagedObjectOfType:@"ATLRoutePosition"];
+    position.route = route;
+    position.location = unplaced;
+    position.coordinate = CLLocationCoordinate2DMake(53.6, 7.9);
+    XCTAssertEqual([self.dataController stationClosestToCoordinate:CLLocationCoordinate2DMake(53.5, 7.5)], moved);
+    XCTAssertEqual([self.dataController stationClosestToCoordinate:CLLocationCoordinate2DMake(53.6, 7.9)], unplaced);
+}
+
 - (void)testAliasSetting
 {
     XCTAssertNotNil(self.dataController.managedObjectContext, @"managedObjectContext must exist");